@@ -8,6 +8,7 @@
 */
 
 #include <string.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <sys/time.h>
@@ -25,28 +26,92 @@
 #include "tcpip_adapter.h"
 #include "esp_smartconfig.h"
 #include "lwip/err.h"
-#include "apps/sntp/sntp.h"
 #include "driver/gpio.h"
 #include "driver/adc.h"
 #include "esp_adc_cal.h"
 #include "esp_mqtt.h"
+#include "sn_ring.h"
+#include "sn_source_hw.h"
+#include "sn_source_spi.h"
+#include "sn_sampler.h"
+#include "sn_config.h"
+#include "sn_clock.h"
+#include "sn_dsp.h"
+#include "sn_calib.h"
+#include "sn_spill.h"
+#include "sn_pool.h"
+#include "sn_mqtt_pipe.h"
+#include "sn_udp.h"
+#include "sn_publisher.h"
+#include "sn_health.h"
+#include "sn_boot.h"
+#include "sn_bench.h"
 
 #define MQTT_HOST "argo"
 #define MQTT_USER "ESP32-logger"
 #define MQTT_PASS "testpass"
 #define MQTT_PORT "1833"
-#define MQTT_COMMAND_CHANNEL "ESP32-Node-Control"
-#define MQTT_BUFFER_SIZE 10
+#define MQTT_COMMAND_CHANNEL "ESP32-Node-Control"    //commands for every node; a node also listens on <channel>/<node id>
+#define MQTT_ACK_QOS 1
+#define STATS_INTERVAL_S 10           //node-health report on <channel>/<node id>/stats, 0 disables, changed with command 10
+#define MQTT_BUFFER_SIZE (SN_HEALTH_MAX_REPORT + 256)   //control connection only, sample frames go through the data pipe
 #define MQTT_COMMAND_TIMEOUT 60
 #define MQTT_TOPIC "ESP32-logger/testlogging"
+#define MQTT_DATA_WINDOW 4            //QoS 1 data frames in flight on the data pipe
+#define MQTT_DATA_KEEP_ALIVE_S 30
+#define UDP_DATA_HOST "239.255.83.78"   //multicast group (or unicast receiver) for the UDP data transport
+#define UDP_DATA_PORT "47800"
+#define UDP_DATA_HISTORY 4            //frames kept for NACK retransmission
+#define UDP_DATA_TTL 1
+#define DATA_TRANSPORT_UDP 0          //1 streams over UDP from boot instead of the MQTT data pipe
+#define COMPRESS_FRAMES 1             //lossless sn_codec coding of frame samples, 0 sends them packed
+
+#define NTP_SERVER "argo"            //local NTP server, a LAN server is needed for sub-ms sync
+#define NTP_POLL_INTERVAL_S 16
+#define WIFI_TARGETED_ATTEMPTS 2     //reconnects to the cached BSSID and channel before scanning for the SSID
+#define WIFI_SCAN_ATTEMPTS 3         //further failed attempts before falling back to SmartConfig at boot
+#define WIFI_CACHE_STATIC_IP 0       //1 reuses the last DHCP lease as a static address on the targeted reconnect
 
 #define DEFAULT_VREF    1100        //Use adc2_vref_to_gpio() to obtain a better estimate
-#define NO_OF_SAMPLES   64          //Multisampling
+#define SAMPLE_RATE_HZ 100           //initial output rate, changed with command 2
+#define PKT_LEN 10                   //initial sample sets per frame, changed with command 3
+#define SAMPLE_RING_SIZE 256         //sample sets buffered between sampler and publisher, power of two
+#define USE_SYNTHETIC_SOURCE 0       //1 streams generated waveforms instead of ADC readings (bench testing)
+#define SYNTHETIC_BASE_FREQ_HZ 1     //frequency of synthetic channel 0, channel n runs at (n+1) times this
+#define USE_SPI_ADC 0                //1 reads the external SPI ADC below instead of the built-in ADC1
+#define SPI_ADC_CHIP sn_spi_adc_ads7953()   //chip description, see main/sn_spi_adc.h
+#define SPI_ADC_HOST VSPI_HOST
+#define SPI_ADC_DMA_CHAN 2
+#define SPI_ADC_MOSI_GPIO 23
+#define SPI_ADC_MISO_GPIO 19
+#define SPI_ADC_SCLK_GPIO 18
+#define SPI_ADC_CS_GPIO 5
+#define SPI_ADC_DRDY_GPIO -1         //data-ready/BUSY pin, -1 reads on the sampler's timer (sequenced chips)
+#define SPI_ADC_CONVST_GPIO -1       //conversion start pin clocked at the sample rate, -1 when unused
+#define RUN_BENCHMARK 0              //1 sweeps channels, frame sizes and rates on the synthetic source and prints SN_BENCH lines
+#define SPILL_BACKFILL_BYTES_PER_S 8192   //drain rate of frames spilled to flash while offline, on top of live data
+#define FRAME_POOL_BUFS 8            //preallocated frame buffers shared by publisher and data pipe
+#define FRAME_BUF_SIZE (SN_MQTT_PIPE_HEADROOM + SN_PUBLISHER_MAX_FRAME_LEN)
 
-static esp_adc_cal_characteristics_t *adc_chars;
-static const adc_channel_t channel = ADC_CHANNEL_6;     //GPIO34 if ADC1, GPIO14 if ADC2
+static const adc_channel_t channel = ADC_CHANNEL_6;     //GPIO34 on ADC1
 static const adc_atten_t atten = ADC_ATTEN_DB_0;
-static const adc_unit_t unit = ADC_UNIT_1;
+
+static sn_sample_set_t sample_ring_slots[SAMPLE_RING_SIZE];
+static sn_ring_t sample_ring;
+static uint8_t frame_pool_storage[FRAME_POOL_BUFS * FRAME_BUF_SIZE];
+static sn_buf_t frame_pool_bufs[FRAME_POOL_BUFS];
+static sn_pool_t frame_pool;
+static char data_client_id[24];
+static char node_command_topic[sizeof(MQTT_COMMAND_CHANNEL) + 8];
+static char node_ack_topic[sizeof(MQTT_COMMAND_CHANNEL) + 12];
+static char node_stats_topic[sizeof(MQTT_COMMAND_CHANNEL) + 12];
+static uint32_t wifi_disconnects;
+static uint32_t mqtt_disconnects;
+static sn_boot_net_t cached_net;    //network joined last time, see sn_boot.h
+static bool have_cached_net;
+static bool wifi_ever_connected;
+static uint8_t wifi_attempts;       //failed connection attempts since the last success
+static bool smartconfig_started;
 
 /* FreeRTOS event group to signal when we are connected & ready to make a request */
 static EventGroupHandle_t wifi_event_group;
@@ -58,8 +123,7 @@ static const int CONNECTED_BIT = BIT0;
 static const int ESPTOUCH_DONE_BIT = BIT1;
 static const char *TAG = "sn";
 
-static void obtain_time(void);
-static void initialize_sntp(void);
+static void start_clock(void);
 
 void smartconfig_example_task(void * parm);
 
@@ -99,24 +163,115 @@ static void print_char_val_type(esp_adc_cal_value_t val_type)
 }
 
 
+static void start_smartconfig(void)
+{
+	if (!smartconfig_started) {
+		smartconfig_started = true;
+		xTaskCreate(smartconfig_example_task, "smartconfig_example_task", 4096, NULL, 3, NULL);
+	}
+}
+
+static void connect_cached(bool targeted)
+{
+	/* targeted: straight to the cached AP on its channel, no scan; otherwise scan for the SSID */
+	wifi_config_t wifi_config = { 0 };
+	memcpy(wifi_config.sta.ssid, cached_net.ssid, sizeof(wifi_config.sta.ssid));
+	memcpy(wifi_config.sta.password, cached_net.password, sizeof(wifi_config.sta.password));
+	if (targeted) {
+		wifi_config.sta.bssid_set = true;
+		memcpy(wifi_config.sta.bssid, cached_net.bssid, sizeof(wifi_config.sta.bssid));
+		wifi_config.sta.channel = cached_net.channel;
+	}
+	if (targeted && cached_net.static_ip) {
+		tcpip_adapter_ip_info_t ip_info = { 0 };
+		tcpip_adapter_dns_info_t dns_info = { 0 };
+		ip_info.ip.addr = cached_net.ip;
+		ip_info.netmask.addr = cached_net.netmask;
+		ip_info.gw.addr = cached_net.gateway;
+		dns_info.ip.type = IPADDR_TYPE_V4;
+		dns_info.ip.u_addr.ip4.addr = cached_net.dns;
+		tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+		tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &ip_info);
+		tcpip_adapter_set_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &dns_info);
+	} else {
+		tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+	}
+	ESP_ERROR_CHECK( esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
+	esp_wifi_connect();
+}
+
+static void remember_network(const tcpip_adapter_ip_info_t *ip_info)
+{
+	/* cache what worked for the next boot; sn_boot only writes flash when it changed */
+	wifi_config_t wifi_config;
+	wifi_ap_record_t ap_info;
+	sn_boot_net_t net = { 0 };
+	if (esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_config) != ESP_OK || esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+		return;
+	}
+	memcpy(net.ssid, wifi_config.sta.ssid, sizeof(net.ssid));
+	memcpy(net.password, wifi_config.sta.password, sizeof(net.password));
+	memcpy(net.bssid, ap_info.bssid, sizeof(net.bssid));
+	net.channel = ap_info.primary;
+#if WIFI_CACHE_STATIC_IP
+	tcpip_adapter_dns_info_t dns_info;
+	net.static_ip = true;
+	net.ip = ip_info->ip.addr;
+	net.netmask = ip_info->netmask.addr;
+	net.gateway = ip_info->gw.addr;
+	if (tcpip_adapter_get_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &dns_info) == ESP_OK) {
+		net.dns = dns_info.ip.u_addr.ip4.addr;
+	}
+#endif
+	cached_net = net;
+	have_cached_net = true;
+	sn_boot_save_net(&net);
+}
+
 static esp_err_t event_handler(void *ctx, system_event_t *event)
 {
     switch(event->event_id) {
     case SYSTEM_EVENT_STA_START:
-        xTaskCreate(smartconfig_example_task, "smartconfig_example_task", 4096, NULL, 3, NULL);
+	if (have_cached_net) {
+		connect_cached(true);
+	} else {
+		start_smartconfig();
+	}
+        break;
+    case SYSTEM_EVENT_STA_CONNECTED:
+	sn_boot_mark(SN_BOOT_WIFI_CONNECTED);
         break;
     case SYSTEM_EVENT_STA_GOT_IP:
+	sn_boot_mark(SN_BOOT_GOT_IP);
+	wifi_ever_connected = true;
+	wifi_attempts = 0;
         xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
-	// start mqtt
+	// start mqtt, and skip the retry waits of everything that was waiting for the network
 	esp_mqtt_start(MQTT_HOST, MQTT_PORT, "esp-mqtt", MQTT_USER, MQTT_PASS);
+	sn_clock_poll_now();
+	sn_mqtt_pipe_retry_now();
+	sn_udp_retry_now();
+	remember_network(&event->event_info.got_ip.ip_info);
         break;
     case SYSTEM_EVENT_STA_DISCONNECTED:
+      wifi_disconnects++;
       // stop mqtt
       esp_mqtt_stop();
+        xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
 
-      // reconnect wifi
+      // reconnect wifi: the cached AP first, then a scan for its SSID, then SmartConfig if this boot never got on
+	wifi_attempts++;
+	if (have_cached_net && !smartconfig_started && wifi_attempts == WIFI_TARGETED_ATTEMPTS) {
+		ESP_LOGW(TAG, "Cached AP not answering, scanning for %.32s", (const char *)cached_net.ssid);
+		connect_cached(false);
+		break;
+	}
+	if (!wifi_ever_connected && !smartconfig_started && wifi_attempts >= WIFI_TARGETED_ATTEMPTS + WIFI_SCAN_ATTEMPTS) {
+		ESP_LOGW(TAG, "Cached network failed, starting SmartConfig");
+		start_smartconfig();
+		break;
+	}
 	esp_wifi_connect();
-        xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
         break;
     default:
         break;
@@ -133,6 +288,8 @@ static void initialise_wifi(void)
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
 
     ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
+    //the network is cached by sn_boot, keep the driver from writing its own copy to flash on every connect
+    ESP_ERROR_CHECK( esp_wifi_set_storage(WIFI_STORAGE_RAM) );
     ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK( esp_wifi_start() );
 }
@@ -177,10 +334,13 @@ static void esp_mqtt_status_callback( esp_mqtt_status_t status)
 	/* callback for mqtt status events */
 	switch (status) {
     		case ESP_MQTT_STATUS_CONNECTED:
+      			sn_boot_mark(SN_BOOT_MQTT_CONNECTED);
       			// subscribe
       			esp_mqtt_subscribe(MQTT_COMMAND_CHANNEL, 2);
+      			esp_mqtt_subscribe(node_command_topic, 2);
       			break;
     		case ESP_MQTT_STATUS_DISCONNECTED:
+      			mqtt_disconnects++;
       			// reconnect
       			esp_mqtt_start(MQTT_HOST, MQTT_PORT, "esp-mqtt", MQTT_USER, MQTT_PASS);
 			break;
@@ -190,62 +350,187 @@ static void esp_mqtt_status_callback( esp_mqtt_status_t status)
 		
 }
 /* 
-  establish an enum for sensor node command codes:
-    0 stop sending
-    1 start sending
-    2 rate set
-    3 packet length set
+  establish an enum for sensor node command codes. Commands arrive on MQTT_COMMAND_CHANNEL (all nodes) or
+  MQTT_COMMAND_CHANNEL/<node id as 4 hex digits>; multi-byte fields are little-endian:
+    0 stop sending: [0]
+    1 start sending: [1]
+    2 rate set: [2][rate hz, 2 bytes]
+    3 packet length set: [3][sample sets per frame, 2 bytes]
+    4 disconnect
+    5 DSP set: [5][oversampling ratio][filtered channel mask, 2 bytes][calibrate 0/1]
+    6 data transport set: [6][0 MQTT, 1 UDP]
+    7 compression set: [7][0 off, 1 on]
+    8 channel mask set: [8][channel mask, 2 bytes]
+    9 full config: [9][rate, 2][channel mask, 2][pkt_len, 2][ratio][filter mask, 2][calibrate][transport][compress][run]
+    10 stats interval set: [10][seconds, 2 bytes], 0 stops the node-health report
+  Every command except disconnect and stats builds one new configuration and commits it as a whole. The node answers on
+  MQTT_COMMAND_CHANNEL/<node id>/ack with [version, 4 bytes][first sample index, 4 bytes][esp_err_t, 4 bytes]
+  once the sampler runs under it, or with the unchanged version and an error code when it was rejected.
 */
-typedef enum esp_sensor_node_command_t {ESP_SN_CMD_STOP,ESP_SN_CMD_START,ESP_SN_CMD_RATE,ESP_SN_CMD_PKT_LEN,ESP_SN_CMD_DISCONNECT} esp_sensor_node_command_t;
-/* create variables to control sensor node behavior. */
-/* TODO: figure out how to lock access to rate & pkt_len parameters so the control writing doesnt conflict with the update reading */
-static uint16_t sensor_node_rate; /* frequency for polling ADC */
-static uint16_t sensor_node_pkt_len; /* number of sample per mqtt packet during send*/
+typedef enum esp_sensor_node_command_t {ESP_SN_CMD_STOP,ESP_SN_CMD_START,ESP_SN_CMD_RATE,ESP_SN_CMD_PKT_LEN,ESP_SN_CMD_DISCONNECT,ESP_SN_CMD_DSP,ESP_SN_CMD_TRANSPORT,ESP_SN_CMD_COMPRESS,ESP_SN_CMD_CHANNELS,ESP_SN_CMD_CONFIG,ESP_SN_CMD_STATS} esp_sensor_node_command_t;
+/* expected payload length per command code, including the code itself */
+static const uint8_t command_len[] = {1, 1, 3, 3, 1, 5, 2, 2, 3, 14, 3};
+
+static uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
 
 static void esp_mqtt_message_callback(const char *topic, uint8_t *payload, size_t len)
 {
 	esp_sensor_node_command_t control_code;
-	/* To Do: update with node spcific sub-channels. For now all nodes respond the same way*/
-	if (strcmp(topic, "command")) {
-		control_code=payload[0];
-		switch (control_code){
-			case ESP_SN_CMD_STOP:
-				/* stop sending data*/
-				/* NOTE: stop function built into esp_mqtt.c disconnects network after disconnecting from broker */
-				ESP_LOGI(TAG, "Got command to stop sending data");
-				break;
-			case ESP_SN_CMD_START:
-				/* start sending data*/
-				ESP_LOGI(TAG, "Got command to start sending data");
-				break;
-			case ESP_SN_CMD_RATE:
-				/* set rate at which the ADC will be polled */
-				if (len!=sizeof(sensor_node_rate)/sizeof(payload[0])) {
-					/* note the following assumes that len only contains the number of elements in payload. If len includes the topic, or the len element itself, we need to adjust this */
-					ESP_LOGI(TAG, "Got bad sample rate packet with %d bytes",sizeof(payload[0])*len);			
-				}else{
-					memcpy(&sensor_node_rate,&payload[1],sizeof(sensor_node_rate)); /* take data from UINT8_t in payload, and convert to UINT16, or whatever sensor_node_rate is */
-					ESP_LOGI(TAG, "Got command to set sample rate to %d hz",sensor_node_rate);
-				}
-				break;
-			case ESP_SN_CMD_PKT_LEN:
-				/* set how many samples are in each packet. Sets the effective update rate */
-				if (len!=sizeof(sensor_node_rate)/sizeof(payload[0])) {
-					/* note the following assumes that len only contains the number of elements in payload. If len includes the topic, or the len element itself, we need to adjust this */
-					ESP_LOGI(TAG, "Got bad pkt_len packet with %d bytes",sizeof(payload[0])*len);			
-				}else{
-					memcpy(&sensor_node_pkt_len,&payload[1],sizeof(sensor_node_pkt_len)); /* take data from UINT8_t in payload, and convert to UINT16, or whatever sensor_node_rate is */
-					ESP_LOGI(TAG, "Got command to set packet length to %d samples",sensor_node_pkt_len);	
-				}
-				break;	
-			case ESP_SN_CMD_DISCONNECT:
-				esp_mqtt_stop();		
-			default:
-				ESP_LOGI(TAG, "Got bad control code on command channel. Received code: %d",control_code);
-				break;
+	sn_config_t config;
+
+	if (strcmp(topic, MQTT_COMMAND_CHANNEL) != 0 && strcmp(topic, node_command_topic) != 0) {
+		return;
+	}
+	if (len == 0) {
+		return;
+	}
+	control_code=payload[0];
+	if (control_code >= sizeof(command_len) || len != command_len[control_code]) {
+		ESP_LOGI(TAG, "Got bad control code on command channel. Received code: %d with %d bytes",control_code,len);
+		return;
+	}
+	/* commands edit a copy of the current configuration, which is then swapped in as a whole */
+	sn_config_edit(&config);
+	switch (control_code){
+		case ESP_SN_CMD_STOP:
+			ESP_LOGI(TAG, "Got command to stop sending data");
+			config.running = false;
+			break;
+		case ESP_SN_CMD_START:
+			ESP_LOGI(TAG, "Got command to start sending data");
+			config.running = true;
+			break;
+		case ESP_SN_CMD_RATE:
+			/* set rate at which the ADC will be polled */
+			config.rate_hz = get_le16(&payload[1]);
+			ESP_LOGI(TAG, "Got command to set sample rate to %d hz",config.rate_hz);
+			break;
+		case ESP_SN_CMD_PKT_LEN:
+			/* set how many samples are in each packet. Sets the effective update rate */
+			config.pkt_len = get_le16(&payload[1]);
+			ESP_LOGI(TAG, "Got command to set packet length to %d samples",config.pkt_len);
+			break;
+		case ESP_SN_CMD_DSP:
+			/* select oversampling ratio, which channels run through the decimation filter, and calibrated output */
+			config.dsp.ratio = payload[1] ? payload[1] : 1;
+			config.dsp.filter_mask = get_le16(&payload[2]);
+			config.dsp.calibrate = payload[4] != 0;
+			ESP_LOGI(TAG, "Got command to set oversampling to x%d on channel mask 0x%04x",config.dsp.ratio,config.dsp.filter_mask);
+			break;
+		case ESP_SN_CMD_TRANSPORT:
+			/* choose how sample frames travel; commands stay on this connection either way */
+			ESP_LOGI(TAG, "Got command to send data over %s",payload[1] ? "UDP" : "MQTT");
+			config.transport = payload[1] ? sn_transport_udp() : sn_transport_mqtt();
+			break;
+		case ESP_SN_CMD_COMPRESS:
+			/* lossless coding of the samples, applies from the next frame */
+			ESP_LOGI(TAG, "Got command to turn compression %s",payload[1] ? "on" : "off");
+			config.compress = payload[1] != 0;
+			break;
+		case ESP_SN_CMD_CHANNELS:
+			config.channel_mask = get_le16(&payload[1]);
+			ESP_LOGI(TAG, "Got command to sample channel mask 0x%04x",config.channel_mask);
+			break;
+		case ESP_SN_CMD_CONFIG:
+			config.rate_hz = get_le16(&payload[1]);
+			config.channel_mask = get_le16(&payload[3]);
+			config.pkt_len = get_le16(&payload[5]);
+			config.dsp.ratio = payload[7] ? payload[7] : 1;
+			config.dsp.filter_mask = get_le16(&payload[8]);
+			config.dsp.calibrate = payload[10] != 0;
+			config.transport = payload[11] ? sn_transport_udp() : sn_transport_mqtt();
+			config.compress = payload[12] != 0;
+			config.running = payload[13] != 0;
+			ESP_LOGI(TAG, "Got full configuration");
+			break;
+		case ESP_SN_CMD_STATS:
+			ESP_LOGI(TAG, "Got command to report node health every %d s",get_le16(&payload[1]));
+			sn_health_set_interval(get_le16(&payload[1]));
+			sn_config_cancel();
+			return;
+		case ESP_SN_CMD_DISCONNECT:
+			sn_config_cancel();
+			esp_mqtt_stop();
+			return;
+	}
+	esp_err_t err = sn_sampler_check(&config);
+	if (err == ESP_OK && config.pkt_len == 0) {
+		err = ESP_ERR_INVALID_ARG;
+	}
+	if (err != ESP_OK) {
+		/* the ack task reports the rejection with the version still in effect */
+		sn_config_cancel();
+		sn_config_get(&config);
+		sn_config_ack_t ack = { .version = config.version, .result = err, .applied = config.version,
+		                        .running = config.running };
+		sn_config_post_ack(&ack);
+		return;
+	}
+	sn_config_commit(&config);
+}
+
+static void config_ack_task(void *parm)
+{
+	/* publish config acknowledgments from here, the MQTT callback must not block on a publish */
+	sn_config_ack_t ack;
+	uint8_t payload[17];
+	while (1) {
+		if (sn_config_wait_ack(&ack, portMAX_DELAY)) {
+			put_le32(&payload[0], ack.version);
+			put_le32(&payload[4], ack.index);
+			put_le32(&payload[8], (uint32_t)ack.result);
+			put_le32(&payload[12], ack.applied);
+			payload[16] = ack.running;
+			if (!esp_mqtt_publish(node_ack_topic, payload, sizeof(payload), MQTT_ACK_QOS, false)) {
+				ESP_LOGW(TAG, "Could not acknowledge config %u", ack.version);
+			}
 		}
 	}
 }
+static bool publish_stats(const char *payload, size_t len)
+{
+	return esp_mqtt_publish(node_stats_topic, (uint8_t *)payload, len, 0, false);
+}
+
+static void add_network_stats(sn_stats_writer_t *writer)
+{
+	sn_stats_u32(writer, "wifi_disconnects", wifi_disconnects);
+	sn_stats_u32(writer, "mqtt_disconnects", mqtt_disconnects);
+	sn_boot_add_fields(writer);
+}
+
+#if USE_SPI_ADC
+static sn_source_t *spi_adc_source(void)
+{
+	sn_spi_master_config_t master_config = {
+		.host = SPI_ADC_HOST,
+		.dma_chan = SPI_ADC_DMA_CHAN,
+		.mosi_gpio = SPI_ADC_MOSI_GPIO,
+		.miso_gpio = SPI_ADC_MISO_GPIO,
+		.sclk_gpio = SPI_ADC_SCLK_GPIO,
+		.cs_gpio = SPI_ADC_CS_GPIO,
+	};
+	sn_spi_adc_config_t adc_config = {
+		.chip = SPI_ADC_CHIP,
+		.drdy_gpio = SPI_ADC_DRDY_GPIO,
+		.convst_gpio = SPI_ADC_CONVST_GPIO,
+	};
+	ESP_ERROR_CHECK( sn_spi_bus_master(&master_config, adc_config.chip, &adc_config.bus) );
+	return sn_source_spi_adc(&adc_config);
+}
+#endif
+
 void smartconfig_example_task(void * parm)
 {
 	/* copied from esp-idf smartconfig example */
@@ -265,109 +550,152 @@ void smartconfig_example_task(void * parm)
     }
 }
 
-static void obtain_time(void)
-{
-	/* largely copied from esp-idf sntp example code */
-    ESP_ERROR_CHECK( nvs_flash_init() );
-//    initialise_wifi();
-//    xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT,false, true, portMAX_DELAY);
-    initialize_sntp();
-
-    // wait for time to be set
-    time_t now = 0;
-    struct tm timeinfo = { 0 };
-    int retry = 0;
-    const int retry_count = 10;
-    while(timeinfo.tm_year < (2016 - 1900) && ++retry < retry_count) {
-        ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
-        time(&now);
-        localtime_r(&now, &timeinfo);
-    }
-
-//    ESP_ERROR_CHECK( esp_wifi_stop() );
-}
-
-static void initialize_sntp(void)
+static void start_clock(void)
 {
-    ESP_LOGI(TAG, "Initializing SNTP");
-    sntp_setoperatingmode(SNTP_OPMODE_POLL);
-    sntp_setservername(0, "pool.ntp.org");
-    sntp_init(); 
+	/* start continuous clock discipline without waiting for it: sampling starts on the provisional timeline
+	   (the saved time and drift, see sn_clock.h) and frames are flagged until the first sync */
+	sn_clock_state_t clock_state;
+	sn_clock_config_t clock_config = {
+		.server = NTP_SERVER,
+		.poll_interval_s = NTP_POLL_INTERVAL_S,
+		.restore = sn_boot_load_clock(&clock_state) == ESP_OK ? &clock_state : NULL,
+		.save = sn_boot_save_clock,
+	};
+	ESP_ERROR_CHECK( sn_clock_start(&clock_config) );
 }
 
 void app_main()
 {
+	sn_boot_mark(SN_BOOT_APP_START);
     	ESP_ERROR_CHECK( nvs_flash_init() );
-    	initialise_wifi();
-	/* TODO: implement NTP or iterative SNTP calls and spawn process here instead of a single SNTP call to set time*/
-    	time_t now;
-    	struct tm timeinfo;
-    	time(&now);
-    	localtime_r(&now, &timeinfo);
-    // Is time set? If not, tm_year will be (1970 - 1900).
-    	if (timeinfo.tm_year < (2016 - 1900)) {
-        	ESP_LOGI(TAG, "Time is not set yet. Connecting to WiFi and getting time over NTP.");
-        	obtain_time(); 
-        	// update 'now' variable with current time
-        	time(&now);
-    	}
-
-    char strftime_buf[64];
-    // Set timezone to Eastern Standard Time and print local time
+	have_cached_net = sn_boot_load_net(&cached_net) == ESP_OK;
+	if (have_cached_net) {
+		ESP_LOGI(TAG, "Reconnecting to %.32s", (const char *)cached_net.ssid);
+	} else {
+		ESP_LOGI(TAG, "No cached network, waiting for SmartConfig");
+	}
+
+    // Set timezone
 	/* TODO: figure out timezone on the fly */ 
 	setenv("TZ", "CST6CDT,M3.2.0,M11.1.0", 1);
 	tzset();
-	localtime_r(&now, &timeinfo);
-	strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
-	ESP_LOGI(TAG, "The current date/time in New York is: %s", strftime_buf);
+
+    //initial acquisition config, in place before the first command can arrive
+	uint8_t mac[6];
+	esp_efuse_mac_get_default(mac);
+	uint16_t node_id = (mac[4] << 8) | mac[5];
+	snprintf(node_command_topic, sizeof(node_command_topic), "%s/%04x", MQTT_COMMAND_CHANNEL, node_id);
+	snprintf(node_ack_topic, sizeof(node_ack_topic), "%s/%04x/ack", MQTT_COMMAND_CHANNEL, node_id);
+	snprintf(node_stats_topic, sizeof(node_stats_topic), "%s/%04x/stats", MQTT_COMMAND_CHANNEL, node_id);
+	sn_config_t initial_config = {
+		.running = true,
+		.rate_hz = SAMPLE_RATE_HZ,
+		.channel_mask = 1 << channel,
+		.dsp = { .ratio = 1 },
+		.pkt_len = PKT_LEN,
+#if DATA_TRANSPORT_UDP
+		.transport = sn_transport_udp(),
+#else
+		.transport = sn_transport_mqtt(),
+#endif
+		.compress = COMPRESS_FRAMES,
+	};
+	ESP_ERROR_CHECK( sn_config_init(&initial_config) );
+	xTaskCreate(config_ack_task, "config_ack_task", 2048, NULL, 3, NULL);
 
     //begin MQTT process
     	esp_mqtt_init(esp_mqtt_status_callback, esp_mqtt_message_callback, MQTT_BUFFER_SIZE, MQTT_COMMAND_TIMEOUT);	
+    //Wi-Fi only once MQTT is initialised, the connected event starts it; the clock needs the network stack
+	initialise_wifi();
+	start_clock();
     //Establish MQTT last will and testimate
     //esp_mqtt_lwt(const char *topic, const char *payload, int qos, bool retained);
 	/* TODO: check that the MQTT host is the correct input for "client_ID" */
     	esp_mqtt_start(MQTT_HOST, MQTT_PORT, MQTT_HOST, MQTT_USER, MQTT_PASS);
 
-    //set up ADC
+    //set up continuous sampling: sampler task on core 1, publisher on core 0
 	check_efuse();
-    	if (unit == ADC_UNIT_1) {
-        	adc1_config_width(ADC_WIDTH_BIT_12);
-        	adc1_config_channel_atten(channel, atten);
-    	} else {
-        	adc2_config_channel_atten((adc2_channel_t)channel, atten);
+	print_char_val_type(sn_calib_init(ADC_UNIT_1, atten, DEFAULT_VREF));
+	sn_ring_init(&sample_ring, sample_ring_slots, SAMPLE_RING_SIZE);
+	sn_sampler_config_t sampler_config = {
+#if USE_SYNTHETIC_SOURCE || RUN_BENCHMARK
+		.source = sn_source_synth(SYNTHETIC_BASE_FREQ_HZ),
+#elif USE_SPI_ADC
+		.source = spi_adc_source(),
+#else
+		.source = sn_source_i2s_adc(atten),
+#endif
+		.initial = &initial_config,
+		.lut = sn_calib_lut(),
+	};
+	ESP_ERROR_CHECK( sn_pool_init(&frame_pool, frame_pool_bufs, frame_pool_storage, FRAME_POOL_BUFS, FRAME_BUF_SIZE,
+	                              SN_MQTT_PIPE_HEADROOM) );
+	snprintf(data_client_id, sizeof(data_client_id), "sn-%04x-data", node_id);
+	sn_mqtt_pipe_config_t pipe_config = {
+		.host = MQTT_HOST,
+		.port = MQTT_PORT,
+		.client_id = data_client_id,
+		.username = MQTT_USER,
+		.password = MQTT_PASS,
+		.topic = MQTT_TOPIC,
+		.pool = &frame_pool,
+		.window = MQTT_DATA_WINDOW,
+		.keep_alive_s = MQTT_DATA_KEEP_ALIVE_S,
+	};
+	ESP_ERROR_CHECK( sn_mqtt_pipe_start(&pipe_config) );
+	sn_udp_config_t udp_config = {
+		.host = UDP_DATA_HOST,
+		.port = UDP_DATA_PORT,
+		.node_id = node_id,
+		.pool = &frame_pool,
+		.history = UDP_DATA_HISTORY,
+		.multicast_ttl = UDP_DATA_TTL,
+	};
+	ESP_ERROR_CHECK( sn_udp_start(&udp_config) );
+	sn_publisher_config_t publisher_config = {
+		.ring = &sample_ring,
+		.pool = &frame_pool,
+		.node_id = node_id,
+		.sample_bits = sampler_config.source->sample_bits,
+		.backfill_bytes_per_s = SPILL_BACKFILL_BYTES_PER_S,
+		.backpressure = SN_PUBLISHER_DROP_OLDEST,
+	};
+	sn_spill_flash_t spill_flash;
+	if (sn_spill_flash_partition(SN_SPILL_PARTITION_LABEL, &spill_flash) != ESP_OK ||
+	    sn_spill_init(&spill_flash) != ESP_OK) {
+		ESP_LOGW(TAG, "No spill partition, data sampled while offline will be lost");
 	}
-	uint32_t adc_reading = 0;
-
-    //begin pushing data
-	/*TODO: change while loop to timer watchdog/callback. Ditch multisampling?*/
-	int i=0;    
-	while (i<10){  
-		/* simple 10 sample stream */
-		adc_reading = 0;
-		//grab data from ADC with multisampling
-        	for (int i = 0; i < NO_OF_SAMPLES; i++) {
-            		if (unit == ADC_UNIT_1) {
-                		adc_reading += adc1_get_raw((adc1_channel_t)channel);
-            		} else {
-                		int raw;
-                		adc2_get_raw((adc2_channel_t)channel, ADC_WIDTH_BIT_12, &raw);
-                		adc_reading += raw;
-            		}
-        	}
-        	adc_reading /= NO_OF_SAMPLES;
-        	//Convert adc_reading to voltage in mV
-        	uint32_t voltage = esp_adc_cal_raw_to_voltage(adc_reading, adc_chars);
-		ESP_LOGI(TAG, "Raw: %d\tVoltage: %dmV\n", adc_reading, voltage);
-		//publish ADC data
-    		//esp_mqtt_publish(topic, data, size of data, QOS level, retain);
-    		esp_mqtt_publish(MQTT_TOPIC, voltage, 1, 2, false);
-		i++;
-		vTaskDelay(pdMS_TO_TICKS(1000));
-    	}
-    //unsubscribe
-    //bool esp_mqtt_unsubscribe(const char *topic);
-    //stop MQTT process
-    //esp_mqtt_stop();
+	ESP_ERROR_CHECK( sn_publisher_start(&publisher_config) );
+	if (sn_sampler_start(&sampler_config, &sample_ring) != ESP_OK) {
+		/* DMA scanning unavailable: fall back to polling ADC1 from the sampler timer */
+		ESP_LOGW(TAG, "Falling back to polled ADC sampling");
+		sampler_config.source = sn_source_adc(ADC_UNIT_1, atten);
+		ESP_ERROR_CHECK( sn_sampler_start(&sampler_config, &sample_ring) );
+	}
+	sn_health_config_t health_config = {
+		.node_id = node_id,
+		.interval_s = STATS_INTERVAL_S,
+		.publish = publish_stats,
+		.add_fields = add_network_stats,
+	};
+	sn_boot_mark(SN_BOOT_SAMPLING);
+	ESP_ERROR_CHECK( sn_health_start(&health_config) );
+	ESP_ERROR_CHECK( sn_boot_watch() );
+#if RUN_BENCHMARK
+	static const uint8_t bench_channels[] = { 1, 4, 8, 16 };
+	static const uint16_t bench_pkt_lens[] = { 10, 50 };
+	static const uint16_t bench_rates[] = { 100, 250, 500, 1000, 2000 };
+	sn_bench_config_t bench_config = {
+		.channels = bench_channels,
+		.channel_steps = sizeof(bench_channels),
+		.pkt_lens = bench_pkt_lens,
+		.pkt_len_steps = sizeof(bench_pkt_lens) / sizeof(bench_pkt_lens[0]),
+		.rates = bench_rates,
+		.rate_steps = sizeof(bench_rates) / sizeof(bench_rates[0]),
+		.settle_ms = 2000,
+		.measure_ms = 10000,
+		.report = publish_stats,
+	};
+	ESP_ERROR_CHECK( sn_bench_start(&bench_config) );
+#endif
 }
-
@@ -0,0 +1,198 @@
+/* On-target throughput and latency sweep.
+
+   A step counts as sustained when no set was lost anywhere between the
+   timer and the transport: no coalesced ticks, no ring overruns and no
+   frames dropped for lack of buffers. CPU per set is the run time the
+   pipeline tasks (sampler, esp_timer, publisher and both transports) used
+   during the window divided by the sets sampled; it needs
+   CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS and is reported as 0 without it.
+   Latency is the frame fill time plus the transport's handoff-to-delivery
+   histogram.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sn_config.h"
+#include "sn_sampler.h"
+#include "sn_publisher.h"
+#include "sn_mqtt_pipe.h"
+#include "sn_udp.h"
+#include "sn_stats.h"
+#include "sn_bench.h"
+
+#define SN_BENCH_CORE           0
+#define SN_BENCH_PRIORITY       2
+#define SN_BENCH_STACK_SIZE     4096
+#define SN_BENCH_MAX_TASKS      24
+#define SN_BENCH_MAX_LINE       512
+
+static const char *TAG = "sn_bench";
+
+/* tasks whose run time is charged to the pipeline */
+static const char *const s_pipeline_tasks[] = {
+    "sn_sampler", "esp_timer", "sn_publisher", "sn_mqtt_pipe", "sn_udp",
+};
+
+typedef struct {
+    sn_sampler_stats_t sampler;
+    sn_publisher_stats_t publisher;
+    sn_mqtt_pipe_stats_t pipe;
+    sn_udp_stats_t udp;
+    uint32_t run_time;          /* pipeline tasks */
+    uint32_t total_time;        /* run time clock */
+} bench_snapshot_t;
+
+static sn_bench_config_t s_config;
+static bench_snapshot_t s_before;
+static bench_snapshot_t s_after;
+static char s_line[SN_BENCH_MAX_LINE];
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+static TaskStatus_t s_tasks[SN_BENCH_MAX_TASKS];
+#endif
+
+static void take_snapshot(bench_snapshot_t *snap)
+{
+    sn_sampler_get_stats(SN_STATS_READER_BENCH, &snap->sampler);
+    sn_publisher_get_stats(SN_STATS_READER_BENCH, &snap->publisher);
+    sn_mqtt_pipe_get_stats(&snap->pipe);
+    sn_udp_get_stats(&snap->udp);
+    snap->run_time = 0;
+    snap->total_time = 0;
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+    UBaseType_t count = uxTaskGetSystemState(s_tasks, SN_BENCH_MAX_TASKS, &snap->total_time);
+    for (UBaseType_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < sizeof(s_pipeline_tasks) / sizeof(s_pipeline_tasks[0]); j++) {
+            if (strcmp(s_tasks[i].pcTaskName, s_pipeline_tasks[j]) == 0) {
+                snap->run_time += s_tasks[i].ulRunTimeCounter;
+            }
+        }
+    }
+#endif
+}
+
+static void emit(sn_stats_writer_t *w)
+{
+    size_t len = sn_stats_finish(w);
+
+    if (len == 0) {
+        ESP_LOGW(TAG, "Report line does not fit in %d bytes", SN_BENCH_MAX_LINE);
+        return;
+    }
+    printf("SN_BENCH %s\n", s_line);
+    if (s_config.report != NULL) {
+        s_config.report(s_line, len);
+    }
+}
+
+/* Apply one step and measure it. Returns true when no sample set was lost
+   in the ring or the pool and no more ticks were coalesced than allowed. */
+static bool run_step(uint8_t channels, uint16_t pkt_len, uint16_t rate_hz)
+{
+    sn_config_t config;
+    sn_stats_writer_t w;
+    sn_hist_t latency;
+
+    sn_config_edit(&config);
+    config.running = true;
+    config.channel_mask = (uint16_t)((1u << channels) - 1);
+    config.pkt_len = pkt_len;
+    config.rate_hz = rate_hz;
+    if (sn_sampler_check(&config) != ESP_OK) {
+        sn_config_cancel();
+        return false;
+    }
+    sn_config_commit(&config);
+    vTaskDelay(pdMS_TO_TICKS(s_config.settle_ms));
+    take_snapshot(&s_before);
+    vTaskDelay(pdMS_TO_TICKS(s_config.measure_ms));
+    take_snapshot(&s_after);
+
+    uint32_t sets = s_after.sampler.sample_sets - s_before.sampler.sample_sets;
+    uint32_t missed = s_after.sampler.missed_ticks - s_before.sampler.missed_ticks;
+    uint32_t lost = (s_after.sampler.ring_drops - s_before.sampler.ring_drops) +
+                    (s_after.publisher.frames_dropped - s_before.publisher.frames_dropped) * pkt_len;
+    uint32_t run_time = s_after.run_time - s_before.run_time;
+    uint32_t frame_us = (uint32_t)pkt_len * (1000000 / rate_hz);
+    bool sustained = lost == 0 && missed <= s_config.max_missed_ticks && sets > 0;
+
+    if (config.transport == sn_transport_udp()) {
+        sn_hist_delta(&latency, &s_after.udp.send_latency_us, &s_before.udp.send_latency_us);
+    } else {
+        sn_hist_delta(&latency, &s_after.pipe.ack_latency_us, &s_before.pipe.ack_latency_us);
+    }
+
+    sn_stats_begin(&w, s_line, sizeof(s_line));
+    sn_stats_str(&w, "bench", "step");
+    sn_stats_u32(&w, "channels", channels);
+    sn_stats_u32(&w, "pkt_len", pkt_len);
+    sn_stats_u32(&w, "rate_hz", rate_hz);
+    sn_stats_str(&w, "transport", config.transport->name);
+    sn_stats_u32(&w, "compress", config.compress);
+    sn_stats_u32(&w, "sets", sets);
+    sn_stats_u32(&w, "missed_ticks", missed);
+    sn_stats_u32(&w, "lost", lost);
+    sn_stats_u32(&w, "sustained", sustained);
+    /* run time is in esp_timer microseconds with CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER */
+    sn_stats_u32(&w, "cpu_ns_per_set", sets ? (uint32_t)((uint64_t)run_time * 1000 / sets) : 0);
+    sn_stats_u32(&w, "cpu_permille", s_after.total_time != s_before.total_time ?
+                 (uint32_t)((uint64_t)run_time * 1000 / (s_after.total_time - s_before.total_time)) : 0);
+    /* the marks restarted with the snapshot before the window */
+    sn_stats_u32(&w, "ring_high_water", s_after.sampler.ring_high_water);
+    sn_stats_u32(&w, "pool_low_water", s_after.publisher.pool_low_water);
+    sn_stats_u32(&w, "heap_min", heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    sn_stats_u32(&w, "latency_us_p50", frame_us + sn_hist_percentile(&latency, 50));
+    sn_stats_u32(&w, "latency_us_p99", frame_us + sn_hist_percentile(&latency, 99));
+    sn_stats_u32(&w, "latency_us_max", frame_us + latency.max);
+    emit(&w);
+    return sustained;
+}
+
+static void bench_task(void *arg)
+{
+    sn_config_t original, config;
+    sn_stats_writer_t w;
+
+    sn_config_get(&original);
+    ESP_LOGI(TAG, "Sweeping %d channel counts x %d packet lengths x %d rates", s_config.channel_steps,
+             s_config.pkt_len_steps, s_config.rate_steps);
+    for (uint8_t c = 0; c < s_config.channel_steps; c++) {
+        for (uint8_t p = 0; p < s_config.pkt_len_steps; p++) {
+            uint16_t max_rate = 0;
+            for (uint8_t r = 0; r < s_config.rate_steps; r++) {
+                if (!run_step(s_config.channels[c], s_config.pkt_lens[p], s_config.rates[r])) {
+                    break;
+                }
+                max_rate = s_config.rates[r];
+            }
+            sn_stats_begin(&w, s_line, sizeof(s_line));
+            sn_stats_str(&w, "bench", "max");
+            sn_stats_u32(&w, "channels", s_config.channels[c]);
+            sn_stats_u32(&w, "pkt_len", s_config.pkt_lens[p]);
+            sn_stats_u32(&w, "max_rate_hz", max_rate);
+            emit(&w);
+        }
+    }
+    sn_config_edit(&config);    /* commands that came in during the sweep are replaced too */
+    sn_config_commit(&original);
+    sn_stats_begin(&w, s_line, sizeof(s_line));
+    sn_stats_str(&w, "bench", "done");
+    emit(&w);
+    vTaskDelete(NULL);
+}
+
+esp_err_t sn_bench_start(const sn_bench_config_t *config)
+{
+    if (config == NULL || config->channels == NULL || config->pkt_lens == NULL || config->rates == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_config = *config;
+    if (xTaskCreatePinnedToCore(bench_task, "sn_bench", SN_BENCH_STACK_SIZE, NULL,
+                                SN_BENCH_PRIORITY, NULL, SN_BENCH_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create bench task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
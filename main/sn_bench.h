@@ -0,0 +1,43 @@
+/* On-target throughput and latency sweep.
+
+   Steps the live pipeline through every combination of channel count,
+   packet length and sample rate by committing sn_config changes, lets each
+   step settle, then measures it over a fixed window using the stage
+   counters and histograms. Rates are swept upwards per channel count and
+   packet length and stop at the first step that loses sample sets in the
+   ring or the pool, or whose sampler coalesced more timer ticks than
+   max_missed_ticks, so the last clean rate is the highest sustainable load.
+   Each step reports the two separately as "lost" and "missed_ticks". Run it with the
+   synthetic source so every channel count is available.
+
+   Every step and every summary is one JSON object on its own line, printed
+   to the console with an "SN_BENCH " prefix and optionally passed to a
+   report callback, so runs from different releases can be diffed. The
+   original configuration is restored at the end.
+*/
+
+#ifndef SN_BENCH_H
+#define SN_BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct {
+    const uint8_t *channels;    /* channel counts to try, channels 0..n-1 */
+    uint8_t channel_steps;
+    const uint16_t *pkt_lens;   /* sample sets per frame to try */
+    uint8_t pkt_len_steps;
+    const uint16_t *rates;      /* output rates to try, ascending */
+    uint8_t rate_steps;
+    uint16_t settle_ms;         /* after each change, before measuring */
+    uint16_t measure_ms;
+    uint16_t max_missed_ticks;  /* per step; 0 on the target, where a missed tick is an overrun */
+    bool (*report)(const char *line, size_t len);   /* optional, e.g. publish on the stats topic */
+} sn_bench_config_t;
+
+/* Spawn the sweep task. Sampler and publisher must be running. */
+esp_err_t sn_bench_start(const sn_bench_config_t *config);
+
+#endif /* SN_BENCH_H */
@@ -0,0 +1,175 @@
+/* Fast boot support.
+
+   Both records are blobs in the "sn_boot" NVS namespace. The network
+   record is compared with the stored copy before writing, so a normal
+   reconnect never touches flash; the clock record is only written at the
+   rate sn_clock hands it over.
+
+   Phases are marked by whichever task reaches them, the sampler on the
+   other core included. A mark claims its phase first so only one time is
+   ever written, and publishes it with a store-release after the time, so
+   a reader that sees the phase reached also sees when.
+*/
+
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "sn_boot.h"
+
+#define SN_BOOT_NAMESPACE       "sn_boot"
+#define SN_BOOT_KEY_NET         "net"
+#define SN_BOOT_KEY_CLOCK       "clock"
+#define SN_BOOT_PRIORITY        2
+#define SN_BOOT_STACK_SIZE      2048
+#define SN_BOOT_POLL_MS         100
+#define SN_BOOT_WATCH_S         120     /* give up on phases not reached by then */
+
+static const char *TAG = "sn_boot";
+
+static const char *const s_phase_names[SN_BOOT_PHASES] = {
+    "app_start", "sampling", "first_sample", "wifi_connected", "got_ip", "mqtt_connected", "first_frame",
+    "clock_synced",
+};
+
+static int64_t s_phase_us[SN_BOOT_PHASES];
+static bool s_phase_claimed[SN_BOOT_PHASES];
+static bool s_phase_reached[SN_BOOT_PHASES];       /* set after s_phase_us */
+static sn_boot_net_t s_stored_net;
+static bool s_stored_net_valid;
+
+static esp_err_t load_blob(const char *key, void *data, size_t len)
+{
+    nvs_handle handle;
+    size_t stored = len;
+    esp_err_t err = nvs_open(SN_BOOT_NAMESPACE, NVS_READONLY, &handle);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_get_blob(handle, key, data, &stored);
+    nvs_close(handle);
+    if (err == ESP_OK && stored != len) {
+        /* written by a build with a different layout */
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    return err;
+}
+
+static esp_err_t save_blob(const char *key, const void *data, size_t len)
+{
+    nvs_handle handle;
+    esp_err_t err = nvs_open(SN_BOOT_NAMESPACE, NVS_READWRITE, &handle);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(handle, key, data, len);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+esp_err_t sn_boot_load_net(sn_boot_net_t *net)
+{
+    esp_err_t err = load_blob(SN_BOOT_KEY_NET, &s_stored_net, sizeof(s_stored_net));
+
+    s_stored_net_valid = err == ESP_OK;
+    if (s_stored_net_valid) {
+        *net = s_stored_net;
+    }
+    return err;
+}
+
+esp_err_t sn_boot_save_net(const sn_boot_net_t *net)
+{
+    if (s_stored_net_valid && memcmp(net, &s_stored_net, sizeof(*net)) == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err = save_blob(SN_BOOT_KEY_NET, net, sizeof(*net));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to cache network: %d", err);
+        return err;
+    }
+    s_stored_net = *net;
+    s_stored_net_valid = true;
+    ESP_LOGI(TAG, "Cached network %.32s on channel %d", (const char *)net->ssid, net->channel);
+    return ESP_OK;
+}
+
+esp_err_t sn_boot_load_clock(sn_clock_state_t *state)
+{
+    return load_blob(SN_BOOT_KEY_CLOCK, state, sizeof(*state));
+}
+
+void sn_boot_save_clock(const sn_clock_state_t *state)
+{
+    esp_err_t err = save_blob(SN_BOOT_KEY_CLOCK, state, sizeof(*state));
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save clock state: %d", err);
+    }
+}
+
+void sn_boot_mark(sn_boot_phase_t phase)
+{
+    if (phase >= SN_BOOT_PHASES || __atomic_load_n(&s_phase_claimed[phase], __ATOMIC_RELAXED) ||
+        __atomic_exchange_n(&s_phase_claimed[phase], true, __ATOMIC_RELAXED)) {
+        return;
+    }
+    s_phase_us[phase] = esp_timer_get_time();
+    __atomic_store_n(&s_phase_reached[phase], true, __ATOMIC_RELEASE);
+}
+
+static bool reached(sn_boot_phase_t phase)
+{
+    return __atomic_load_n(&s_phase_reached[phase], __ATOMIC_ACQUIRE);
+}
+
+static void log_report(void)
+{
+    for (int i = 0; i < SN_BOOT_PHASES; i++) {
+        if (reached(i)) {
+            ESP_LOGI(TAG, "%-16s %6" PRId64 " ms", s_phase_names[i], s_phase_us[i] / 1000);
+        } else {
+            ESP_LOGI(TAG, "%-16s    not reached", s_phase_names[i]);
+        }
+    }
+}
+
+static void boot_task(void *arg)
+{
+    int64_t deadline_us = esp_timer_get_time() + SN_BOOT_WATCH_S * 1000000LL;
+
+    while (!(reached(SN_BOOT_FIRST_FRAME) && reached(SN_BOOT_CLOCK_SYNCED)) &&
+           esp_timer_get_time() < deadline_us) {
+        vTaskDelay(pdMS_TO_TICKS(SN_BOOT_POLL_MS));
+    }
+    log_report();
+    vTaskDelete(NULL);
+}
+
+esp_err_t sn_boot_watch(void)
+{
+    if (xTaskCreate(boot_task, "sn_boot", SN_BOOT_STACK_SIZE, NULL, SN_BOOT_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create boot watcher task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void sn_boot_add_fields(sn_stats_writer_t *writer)
+{
+    sn_stats_object(writer, "boot_ms");
+    for (int i = 0; i < SN_BOOT_PHASES; i++) {
+        if (reached(i)) {
+            sn_stats_u32(writer, s_phase_names[i], (uint32_t)(s_phase_us[i] / 1000));
+        }
+    }
+    sn_stats_end_object(writer);
+}
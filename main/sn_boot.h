@@ -0,0 +1,70 @@
+/* Fast boot support.
+
+   Keeps what a node needs to get back on the air quickly in NVS: the
+   network it last joined (credentials, the AP's BSSID and channel, and
+   optionally the address it was given, for a targeted reconnect without
+   scanning or DHCP) and the clock state (see sn_clock_state_t). Records are
+   only rewritten when they change.
+
+   It also times the startup phases. Phases are marked as they are reached,
+   in esp_timer microseconds since the application started, by the code
+   that reaches them: the sampler marks the first sample, the data
+   transports the first frame and the clock its first sync. A watcher task
+   logs the table once the first frame is out and the clock is synced, and
+   the table stays in the health report.
+*/
+
+#ifndef SN_BOOT_H
+#define SN_BOOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sn_clock.h"
+#include "sn_stats.h"
+
+typedef enum {
+    SN_BOOT_APP_START = 0,
+    SN_BOOT_SAMPLING,           /* sampler and publisher started */
+    SN_BOOT_FIRST_SAMPLE,       /* first sample set in the ring */
+    SN_BOOT_WIFI_CONNECTED,     /* associated with the AP */
+    SN_BOOT_GOT_IP,
+    SN_BOOT_MQTT_CONNECTED,     /* control connection up */
+    SN_BOOT_FIRST_FRAME,        /* first data frame acknowledged (MQTT) or sent (UDP) */
+    SN_BOOT_CLOCK_SYNCED,
+    SN_BOOT_PHASES,
+} sn_boot_phase_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    uint8_t bssid[6];
+    uint8_t channel;
+    bool static_ip;             /* reuse the addresses below instead of asking DHCP */
+    uint32_t ip;                /* network byte order, as in tcpip_adapter_ip_info_t */
+    uint32_t netmask;
+    uint32_t gateway;
+    uint32_t dns;
+} sn_boot_net_t;
+
+/* Read the cached network, ESP_ERR_NVS_NOT_FOUND before the first successful connection. */
+esp_err_t sn_boot_load_net(sn_boot_net_t *net);
+
+/* Store the network just joined, unless it is the one already cached. */
+esp_err_t sn_boot_save_net(const sn_boot_net_t *net);
+
+esp_err_t sn_boot_load_clock(sn_clock_state_t *state);
+
+/* Store the clock state; fits sn_clock_config_t.save. */
+void sn_boot_save_clock(const sn_clock_state_t *state);
+
+/* Record that a phase was reached; safe from any task. Later marks of the same phase are ignored. */
+void sn_boot_mark(sn_boot_phase_t phase);
+
+/* Spawn the task that logs the timing report once the first frame is out and the clock is synced. */
+esp_err_t sn_boot_watch(void);
+
+/* Add the phase times in milliseconds as a "boot_ms" object, fits sn_health_config_t.add_fields. */
+void sn_boot_add_fields(sn_stats_writer_t *writer);
+
+#endif /* SN_BOOT_H */
@@ -0,0 +1,47 @@
+/* ADC calibration table.
+
+   For the linear attenuations the table is evaluated from the characterised
+   coefficients directly, which keeps the sub-millivolt part that
+   esp_adc_cal_raw_to_voltage() rounds away. At 11 dB the driver applies its
+   own curve correction, so those entries come from the driver call.
+*/
+
+#include <stddef.h>
+#include "esp_log.h"
+#include "sn_dsp.h"
+#include "sn_calib.h"
+
+#define SN_CALIB_COEFF_A_SCALE  65536   /* esp_adc_cal coeff_a is a 16.16 fixed point slope */
+
+static const char *TAG = "sn_calib";
+
+static esp_adc_cal_characteristics_t s_chars;
+static uint32_t s_lut[SN_DSP_LUT_SIZE];
+static bool s_ready;
+
+esp_adc_cal_value_t sn_calib_init(adc_unit_t unit, adc_atten_t atten, uint32_t default_vref)
+{
+    esp_adc_cal_value_t val_type = esp_adc_cal_characterize(unit, atten, ADC_WIDTH_BIT_12, default_vref, &s_chars);
+
+    for (uint32_t raw = 0; raw < SN_DSP_LUT_SIZE; raw++) {
+        if (atten == ADC_ATTEN_DB_11) {
+            s_lut[raw] = esp_adc_cal_raw_to_voltage(raw, &s_chars) * 1000;
+        } else {
+            s_lut[raw] = (uint32_t)(((uint64_t)s_chars.coeff_a * raw * 1000 + SN_CALIB_COEFF_A_SCALE / 2)
+                                    / SN_CALIB_COEFF_A_SCALE) + s_chars.coeff_b * 1000;
+        }
+    }
+    s_ready = true;
+    ESP_LOGI(TAG, "Calibration table built: code 0 = %u uV, code 4095 = %u uV", s_lut[0], s_lut[SN_DSP_LUT_SIZE - 1]);
+    return val_type;
+}
+
+const uint32_t *sn_calib_lut(void)
+{
+    return s_ready ? s_lut : NULL;
+}
+
+const esp_adc_cal_characteristics_t *sn_calib_chars(void)
+{
+    return s_ready ? &s_chars : NULL;
+}
@@ -0,0 +1,24 @@
+/* ADC calibration table.
+
+   Characterises the ADC once through esp_adc_cal and expands the result into
+   a raw 12-bit code to microvolt table, so converting a sample is an array
+   index instead of a call to esp_adc_cal_raw_to_voltage().
+*/
+
+#ifndef SN_CALIB_H
+#define SN_CALIB_H
+
+#include <stdint.h>
+#include "driver/adc.h"
+#include "esp_adc_cal.h"
+
+/* Characterise the ADC at 12 bits and build the table. Returns which calibration source was used. */
+esp_adc_cal_value_t sn_calib_init(adc_unit_t unit, adc_atten_t atten, uint32_t default_vref);
+
+/* The SN_DSP_LUT_SIZE entry table, or NULL before sn_calib_init(). */
+const uint32_t *sn_calib_lut(void);
+
+/* Characteristics the table was built from, or NULL before sn_calib_init(). */
+const esp_adc_cal_characteristics_t *sn_calib_chars(void);
+
+#endif /* SN_CALIB_H */
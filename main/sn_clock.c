@@ -0,0 +1,474 @@
+/* Disciplined clock service.
+
+   The timebase is a straight line through an anchor point:
+
+     now = base_utc + elapsed + (elapsed * rate_frac >> 32),  elapsed = local - base_local
+
+   where rate_frac is the combined frequency and slew correction in units of
+   2^-32. The discipline task is the only writer and publishes new anchors
+   under a sequence counter, so readers on either core never take a lock.
+   The status it reports is updated under a second one (see sn_stats.h).
+
+   Each poll yields an offset/delay pair. The last SN_CLOCK_FILTER_LEN pairs
+   are kept and the one with the smallest delay is trusted, as in the NTP
+   clock filter. A frequency-locked loop folds each new offset into the drift
+   estimate, and the remaining offset is slewed out over one poll interval.
+
+   A restored state seeds the provisional timebase and the drift estimate,
+   so the loop starts from the last frequency it settled on rather than
+   zero.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "sn_boot.h"
+#include "sn_clock.h"
+#include "sn_stats.h"
+
+#define SN_CLOCK_PRIORITY       3
+#define SN_CLOCK_STACK_SIZE     4096
+#define SN_CLOCK_FILTER_LEN     8
+#define SN_CLOCK_FREQ_GAIN      4           /* fraction 1/N of each frequency error folded into the estimate */
+#define SN_CLOCK_UNSYNCED_POLL_MS 2000
+#define SN_CLOCK_REPLY_TIMEOUT_MS 1000
+#define SN_NTP_PORT             123
+#define SN_NTP_PACKET_LEN       48
+#define SN_NTP_UNIX_OFFSET      2208988800ULL   /* seconds from 1900 to 1970 */
+
+static const char *TAG = "sn_clock";
+
+static const int SYNCED_BIT = BIT0;
+
+typedef struct {
+    int64_t base_local;
+    int64_t base_utc;
+    int64_t rate_frac;
+    bool provisional;           /* not yet stepped onto the server's time */
+} timebase_t;
+
+typedef struct {
+    int64_t local_us;           /* when the sample was taken */
+    int64_t offset_us;
+    int64_t delay_us;
+} clock_sample_t;
+
+static timebase_t s_timebase = { .provisional = true };
+static uint32_t s_timebase_seq;
+
+static sn_clock_config_t s_config;
+static EventGroupHandle_t s_events;
+static TaskHandle_t s_task;
+static sn_clock_status_t s_status;
+static uint32_t s_status_seq;           /* odd while the task updates s_status */
+static clock_sample_t s_filter[SN_CLOCK_FILTER_LEN];
+static uint8_t s_filter_count;
+static uint8_t s_filter_next;
+static int64_t s_last_used_local;
+static int64_t s_freq_ppb;
+static int64_t s_slew_end_us;           /* esp_timer time the current slew runs out, 0 when not slewing */
+static int64_t s_last_save_us;
+
+static void status_begin(void)
+{
+    sn_stats_write_begin(&s_status_seq);
+}
+
+static void status_end(void)
+{
+    sn_stats_write_end(&s_status_seq);
+}
+
+static int64_t timebase_apply(const timebase_t *tb, int64_t local_us)
+{
+    int64_t elapsed = local_us - tb->base_local;
+    return tb->base_utc + elapsed + ((elapsed * tb->rate_frac) >> 32);
+}
+
+static void timebase_read(timebase_t *tb)
+{
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&s_timebase_seq, __ATOMIC_ACQUIRE);
+        *tb = s_timebase;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&s_timebase_seq, __ATOMIC_RELAXED));
+}
+
+static void timebase_write(const timebase_t *tb)
+{
+    __atomic_store_n(&s_timebase_seq, s_timebase_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s_timebase = *tb;
+    __atomic_store_n(&s_timebase_seq, s_timebase_seq + 1, __ATOMIC_RELEASE);
+}
+
+int64_t sn_clock_convert(int64_t local_us, bool *provisional)
+{
+    timebase_t tb;
+    timebase_read(&tb);
+    *provisional = tb.provisional;
+    return timebase_apply(&tb, local_us);
+}
+
+int64_t sn_clock_from_local(int64_t local_us)
+{
+    bool provisional;
+    return sn_clock_convert(local_us, &provisional);
+}
+
+int64_t sn_clock_now_us(void)
+{
+    return sn_clock_from_local(esp_timer_get_time());
+}
+
+static uint32_t isqrt(uint64_t v)
+{
+    uint64_t root = 0;
+    for (uint64_t bit = 1ULL << 62; bit != 0; bit >>= 2) {
+        if (v >= root + bit) {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return (uint32_t)root;
+}
+
+static int64_t clamp(int64_t v, int64_t limit)
+{
+    return v > limit ? limit : (v < -limit ? -limit : v);
+}
+
+/* Re-anchor the timebase at local_us, optionally stepping it, with a new rate correction. */
+static void set_timebase(int64_t local_us, int64_t step_us, int64_t rate_ppb)
+{
+    timebase_t tb = s_timebase;     /* only this task writes, so no seqlock needed to read */
+    timebase_t next = {
+        .base_local = local_us,
+        .base_utc = timebase_apply(&tb, local_us) + step_us,
+        .rate_frac = rate_ppb * 4294967296LL / 1000000000,
+        .provisional = false,
+    };
+    timebase_write(&next);
+}
+
+/* Start the provisional timeline from the system time kept across a soft reset, or the saved time. */
+static void restore_timebase(const sn_clock_state_t *state)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t system_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+    s_freq_ppb = clamp(state->drift_ppb, SN_CLOCK_MAX_SLEW_PPB);
+    status_begin();
+    s_status.drift_ppb = (int32_t)s_freq_ppb;
+    status_end();
+    timebase_t tb = {
+        .base_local = esp_timer_get_time(),
+        .base_utc = system_us > state->utc_us ? system_us : state->utc_us,
+        .rate_frac = s_freq_ppb * 4294967296LL / 1000000000,
+        .provisional = true,
+    };
+    timebase_write(&tb);
+}
+
+static void save_state(void)
+{
+    sn_clock_state_t state = {
+        .utc_us = sn_clock_now_us(),
+        .drift_ppb = (int32_t)s_freq_ppb,
+    };
+
+    s_last_save_us = esp_timer_get_time();
+    s_config.save(&state);
+}
+
+static void ntp_put_timestamp(uint8_t *p, int64_t unix_us)
+{
+    uint32_t sec = (uint32_t)(unix_us / 1000000 + SN_NTP_UNIX_OFFSET);
+    uint32_t frac = (uint32_t)(((uint64_t)(unix_us % 1000000) << 32) / 1000000);
+    for (int i = 0; i < 4; i++) {
+        p[i] = sec >> (24 - 8 * i);
+        p[4 + i] = frac >> (24 - 8 * i);
+    }
+}
+
+static int64_t ntp_get_timestamp(const uint8_t *p)
+{
+    uint32_t sec = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    uint32_t frac = ((uint32_t)p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+    return ((int64_t)sec - (int64_t)SN_NTP_UNIX_OFFSET) * 1000000 + (((uint64_t)frac * 1000000) >> 32);
+}
+
+static int ntp_open(struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *res = NULL;
+    char port[6];
+
+    snprintf(port, sizeof(port), "%u", s_config.port != 0 ? s_config.port : SN_NTP_PORT);
+    if (getaddrinfo(s_config.server, port, &hints, &res) != 0 || res == NULL) {
+        ESP_LOGW(TAG, "Could not resolve NTP server %s", s_config.server);
+        return -1;
+    }
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        return -1;
+    }
+    struct timeval tv = {
+        .tv_sec = SN_CLOCK_REPLY_TIMEOUT_MS / 1000,
+        .tv_usec = (SN_CLOCK_REPLY_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return sock;
+}
+
+/* One client/server exchange. Fills sample on success. */
+static bool ntp_query(int sock, const struct sockaddr_storage *addr, socklen_t addr_len, clock_sample_t *sample)
+{
+    uint8_t pkt[SN_NTP_PACKET_LEN] = { 0 };
+    uint8_t origin[8];
+
+    pkt[0] = (0 << 6) | (4 << 3) | 3;   /* no leap warning, version 4, client mode */
+    int64_t t1 = sn_clock_now_us();
+    ntp_put_timestamp(&pkt[40], t1);
+    memcpy(origin, &pkt[40], sizeof(origin));
+
+    if (sendto(sock, pkt, sizeof(pkt), 0, (const struct sockaddr *)addr, addr_len) != sizeof(pkt)) {
+        return false;
+    }
+    for (;;) {
+        int len = recv(sock, pkt, sizeof(pkt), 0);
+        int64_t local_us = esp_timer_get_time();
+        int64_t t4 = sn_clock_from_local(local_us);
+        if (len < 0) {
+            return false;
+        }
+        /* ignore stale replies to earlier, timed out requests */
+        if (len < SN_NTP_PACKET_LEN || memcmp(&pkt[24], origin, sizeof(origin)) != 0) {
+            continue;
+        }
+        if ((pkt[0] & 0x07) != 4 || pkt[1] == 0 || (pkt[0] >> 6) == 3) {
+            ESP_LOGW(TAG, "NTP server not usable (mode %d, stratum %d)", pkt[0] & 0x07, pkt[1]);
+            return false;
+        }
+        int64_t t2 = ntp_get_timestamp(&pkt[32]);
+        int64_t t3 = ntp_get_timestamp(&pkt[40]);
+        sample->local_us = local_us;
+        sample->offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+        sample->delay_us = (t4 - t1) - (t3 - t2);
+        return sample->delay_us >= 0;
+    }
+}
+
+/* Back to the frequency estimate alone, at the end of a slew's poll interval or when a poll brings no
+   new sample, so a correction is never applied for longer than it was computed for. */
+static void end_slew(void)
+{
+    if (s_slew_end_us != 0) {
+        set_timebase(esp_timer_get_time(), 0, s_freq_ppb);
+        s_slew_end_us = 0;
+    }
+}
+
+static void discipline(const clock_sample_t *sample)
+{
+    s_filter[s_filter_next] = *sample;
+    s_filter_next = (s_filter_next + 1) % SN_CLOCK_FILTER_LEN;
+    if (s_filter_count < SN_CLOCK_FILTER_LEN) {
+        s_filter_count++;
+    }
+
+    const clock_sample_t *best = &s_filter[0];
+    for (int i = 1; i < s_filter_count; i++) {
+        if (s_filter[i].delay_us < best->delay_us) {
+            best = &s_filter[i];
+        }
+    }
+    uint64_t spread = 0;
+    for (int i = 0; i < s_filter_count; i++) {
+        int64_t d = s_filter[i].offset_us - best->offset_us;
+        spread += d * d;
+    }
+    status_begin();
+    s_status.jitter_us = isqrt(spread / s_filter_count);
+    status_end();
+
+    /* like ntpd, never use a sample twice or one older than the last used */
+    if (best->local_us <= s_last_used_local) {
+        end_slew();
+        return;
+    }
+    int64_t interval_us = best->local_us - s_last_used_local;
+    int64_t offset_us = best->offset_us;
+    status_begin();
+    s_status.offset_us = offset_us;
+    s_status.delay_us = (uint32_t)best->delay_us;
+    status_end();
+    s_last_used_local = best->local_us;
+
+    if (!s_status.synced || offset_us > SN_CLOCK_STEP_THRESHOLD_US || offset_us < -SN_CLOCK_STEP_THRESHOLD_US) {
+        ESP_LOGI(TAG, "Stepping clock by %" PRId64 " us", offset_us);
+        if (!s_status.synced) {
+            status_begin();
+            s_status.first_step_us = offset_us;
+            status_end();
+        }
+        set_timebase(esp_timer_get_time(), offset_us, s_freq_ppb);
+        s_slew_end_us = 0;
+        /* older samples were measured against the unstepped clock */
+        s_filter_count = 0;
+        s_filter_next = 0;
+
+        int64_t now_us = sn_clock_now_us();
+        struct timeval tv = {
+            .tv_sec = now_us / 1000000,
+            .tv_usec = now_us % 1000000,
+        };
+        settimeofday(&tv, NULL);
+        if (!s_status.synced) {
+            sn_boot_mark(SN_BOOT_CLOCK_SYNCED);
+        }
+        status_begin();
+        s_status.synced = true;
+        status_end();
+        xEventGroupSetBits(s_events, SYNCED_BIT);
+        return;
+    }
+
+    int64_t freq_error_ppb = offset_us * 1000000000 / interval_us;
+    s_freq_ppb = clamp(s_freq_ppb + freq_error_ppb / SN_CLOCK_FREQ_GAIN, SN_CLOCK_MAX_SLEW_PPB);
+    int64_t slew_ppb = clamp(offset_us * 1000000000 / ((int64_t)s_config.poll_interval_s * 1000000),
+                             SN_CLOCK_MAX_SLEW_PPB);
+    int64_t now_us = esp_timer_get_time();
+    set_timebase(now_us, 0, clamp(s_freq_ppb + slew_ppb, SN_CLOCK_MAX_SLEW_PPB));
+    s_slew_end_us = now_us + (int64_t)s_config.poll_interval_s * 1000000;
+    status_begin();
+    s_status.drift_ppb = (int32_t)s_freq_ppb;
+    status_end();
+    ESP_LOGI(TAG, "offset %" PRId64 " us, delay %u us, jitter %u us, drift %d ppb",
+             offset_us, s_status.delay_us, s_status.jitter_us, s_status.drift_ppb);
+    if (s_config.save != NULL &&
+        (s_last_save_us == 0 || esp_timer_get_time() - s_last_save_us >= SN_CLOCK_SAVE_INTERVAL_S * 1000000LL)) {
+        save_state();
+    }
+}
+
+/* Sleep until the next poll is due, ending a slew on the way when it runs out first. A notification
+   from sn_clock_poll_now() cuts the wait short. */
+static void wait_for_poll(void)
+{
+    uint32_t interval_ms = s_status.synced ? s_config.poll_interval_s * 1000 : SN_CLOCK_UNSYNCED_POLL_MS;
+    int64_t poll_us = esp_timer_get_time() + (int64_t)interval_ms * 1000;
+
+    for (;;) {
+        int64_t now_us = esp_timer_get_time();
+        int64_t until_us = s_slew_end_us != 0 && s_slew_end_us < poll_us ? s_slew_end_us : poll_us;
+        if (until_us > now_us) {
+            uint32_t wait_ms = (uint32_t)((until_us - now_us + 999) / 1000);
+            if (ulTaskNotifyTake(pdTRUE, (wait_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS) > 0) {
+                return;
+            }
+        }
+        now_us = esp_timer_get_time();
+        if (s_slew_end_us != 0 && now_us >= s_slew_end_us) {
+            end_slew();
+        }
+        if (now_us >= poll_us) {
+            return;
+        }
+    }
+}
+
+static void clock_task(void *arg)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = 0;
+    int sock = -1;
+
+    for (;;) {
+        if (sock < 0) {
+            sock = ntp_open(&addr, &addr_len);
+        }
+        if (sock >= 0) {
+            clock_sample_t sample;
+            status_begin();
+            s_status.polls++;
+            status_end();
+            if (ntp_query(sock, &addr, addr_len, &sample)) {
+                discipline(&sample);
+            } else {
+                status_begin();
+                s_status.failures++;
+                status_end();
+                end_slew();
+                close(sock);
+                sock = -1;
+            }
+        } else {
+            end_slew();
+        }
+        wait_for_poll();
+    }
+}
+
+esp_err_t sn_clock_start(const sn_clock_config_t *config)
+{
+    if (config == NULL || config->server == NULL || config->poll_interval_s == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_config = *config;
+    s_events = xEventGroupCreate();
+    if (s_events == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (config->restore != NULL) {
+        restore_timebase(config->restore);
+        ESP_LOGI(TAG, "Provisional time %" PRId64 " us, drift %d ppb", sn_clock_now_us(), s_status.drift_ppb);
+    }
+    if (xTaskCreate(clock_task, "sn_clock", SN_CLOCK_STACK_SIZE, NULL, SN_CLOCK_PRIORITY, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create clock task");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Disciplining clock against %s every %d s", config->server, config->poll_interval_s);
+    return ESP_OK;
+}
+
+bool sn_clock_wait_synced(uint32_t timeout_ms)
+{
+    return xEventGroupWaitBits(s_events, SYNCED_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms)) & SYNCED_BIT;
+}
+
+void sn_clock_poll_now(void)
+{
+    if (s_task != NULL) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+void sn_clock_get_status(sn_clock_status_t *status)
+{
+    uint32_t seq;
+
+    do {
+        seq = sn_stats_read_begin(&s_status_seq);
+        *status = s_status;
+    } while (sn_stats_read_retry(&s_status_seq, seq));
+}
@@ -0,0 +1,80 @@
+/* Disciplined clock service.
+
+   Polls an NTP server continuously, filters the offset/delay samples, and
+   estimates the frequency error of the local oscillator. Corrections are
+   slewed into a timebase derived from esp_timer instead of stepping it, so
+   timestamps stay monotonic and evenly spaced between polls. A slew lasts
+   one poll interval, after which the timebase runs at the frequency
+   estimate alone until the next sample is used. Only the first sync (or an
+   offset above SN_CLOCK_STEP_THRESHOLD_US) steps the clock.
+
+   sn_clock_now_us() is lock-free and cheap enough for the sampler hot path.
+
+   Until the first sync the clock runs on a provisional timeline: the
+   system time if it survived a soft reset, otherwise the last saved time,
+   advanced at the saved drift (boot relative when nothing was saved).
+   Timestamps taken meanwhile are flagged by sn_clock_convert(), and the
+   step applied at the first sync is reported so they can be corrected
+   afterwards. The state is handed to a save callback once the first
+   correction after sync is in, and then every SN_CLOCK_SAVE_INTERVAL_S.
+*/
+
+#ifndef SN_CLOCK_H
+#define SN_CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define SN_CLOCK_STEP_THRESHOLD_US  128000      /* offsets above this are stepped, as ntpd does */
+#define SN_CLOCK_MAX_SLEW_PPB       500000      /* largest correction applied to the clock rate */
+#define SN_CLOCK_SAVE_INTERVAL_S    3600
+
+/* What is kept across reboots. */
+typedef struct {
+    int64_t utc_us;             /* disciplined time when saved */
+    int32_t drift_ppb;          /* frequency error estimate of the local oscillator */
+} sn_clock_state_t;
+
+typedef struct {
+    const char *server;         /* NTP server host name or dotted address, ideally on the local network */
+    uint16_t port;              /* UDP port of the server, 0 for the standard 123 */
+    uint16_t poll_interval_s;   /* seconds between polls once synchronised */
+    const sn_clock_state_t *restore;                /* last saved state, may be NULL */
+    void (*save)(const sn_clock_state_t *state);    /* persist the state, may be NULL */
+} sn_clock_config_t;
+
+typedef struct {
+    bool synced;                /* at least one valid sample has set the clock */
+    int64_t offset_us;          /* offset of the selected sample, server minus local */
+    uint32_t delay_us;          /* round trip delay of the selected sample */
+    uint32_t jitter_us;         /* RMS spread of the recent offsets around the selected one */
+    int32_t drift_ppb;          /* estimated frequency error of the local oscillator */
+    uint32_t polls;             /* requests sent */
+    uint32_t failures;          /* requests that timed out or returned a bad reply */
+    int64_t first_step_us;      /* step at the first sync, add it to provisional timestamps */
+} sn_clock_status_t;
+
+/* Spawn the clock discipline task. */
+esp_err_t sn_clock_start(const sn_clock_config_t *config);
+
+/* Block until the first sync or timeout. Returns true when synced. */
+bool sn_clock_wait_synced(uint32_t timeout_ms);
+
+/* Poll the server now instead of after the current wait, e.g. when the network just came up. */
+void sn_clock_poll_now(void);
+
+/* Convert an esp_timer_get_time() reading to disciplined microseconds since the Unix epoch.
+   Before the first sync this is on the provisional timeline. */
+int64_t sn_clock_from_local(int64_t local_us);
+
+/* sn_clock_from_local() that also tells whether the result is provisional. */
+int64_t sn_clock_convert(int64_t local_us, bool *provisional);
+
+/* Disciplined microseconds since the Unix epoch. */
+int64_t sn_clock_now_us(void);
+
+/* Snapshot the discipline state for reporting. Safe from any task. */
+void sn_clock_get_status(sn_clock_status_t *status);
+
+#endif /* SN_CLOCK_H */
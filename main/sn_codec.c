@@ -0,0 +1,188 @@
+/* Lossless sample codec for sample frames. */
+
+#include <string.h>
+#include "sn_codec.h"
+
+#define SN_CODEC_COST_SHIFT     4       /* predictor costs decay by 1/16 per sample */
+#define SN_CODEC_RESET          64      /* halve the Rice statistics after this many samples */
+#define SN_CODEC_INITIAL_SUM    32
+
+typedef struct {
+    const uint8_t *in;
+    const uint8_t *end;
+    uint32_t acc;
+    uint8_t bits;
+} bit_reader_t;
+
+static void channel_init(sn_codec_channel_t *ch)
+{
+    memset(ch, 0, sizeof(*ch));
+    ch->abs_sum = SN_CODEC_INITIAL_SUM;
+    ch->count = 1;
+}
+
+static int32_t clamp16(int32_t v)
+{
+    return v < 0 ? 0 : v > UINT16_MAX ? UINT16_MAX : v;
+}
+
+static int32_t predict(const sn_codec_channel_t *ch)
+{
+    if (ch->cost[1] < ch->cost[0]) {
+        return clamp16(2 * ch->prev[0] - ch->prev[1]);
+    }
+    return ch->prev[0];
+}
+
+static uint8_t rice_k(const sn_codec_channel_t *ch)
+{
+    uint8_t k = 0;
+    while ((ch->count << k) < ch->abs_sum && k < SN_CODEC_RAW_BITS) {
+        k++;
+    }
+    return k;
+}
+
+static uint32_t abs_diff(int32_t a, int32_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+/* Fold a sample into the predictor costs, Rice statistics and history. */
+static void update(sn_codec_channel_t *ch, int32_t x, uint32_t abs_residual)
+{
+    uint32_t e0 = abs_diff(x, ch->prev[0]);
+    uint32_t e1 = abs_diff(x, clamp16(2 * ch->prev[0] - ch->prev[1]));
+
+    ch->cost[0] += e0 - (ch->cost[0] >> SN_CODEC_COST_SHIFT);
+    ch->cost[1] += e1 - (ch->cost[1] >> SN_CODEC_COST_SHIFT);
+    ch->abs_sum += abs_residual;
+    if (++ch->count >= SN_CODEC_RESET) {
+        ch->abs_sum >>= 1;
+        ch->count >>= 1;
+    }
+    ch->prev[1] = ch->prev[0];
+    ch->prev[0] = x;
+}
+
+/* Append n <= 24 bits. */
+static uint8_t *put_bits(sn_codec_t *codec, uint8_t *out, uint32_t value, uint8_t n)
+{
+    codec->acc |= value << codec->bits;
+    codec->bits += n;
+    while (codec->bits >= 8) {
+        *out++ = (uint8_t)codec->acc;
+        codec->acc >>= 8;
+        codec->bits -= 8;
+    }
+    return out;
+}
+
+void sn_codec_init(sn_codec_t *codec, uint8_t channel_count)
+{
+    codec->channel_count = channel_count;
+    codec->acc = 0;
+    codec->bits = 0;
+    for (uint8_t i = 0; i < channel_count; i++) {
+        channel_init(&codec->ch[i]);
+    }
+}
+
+uint8_t *sn_codec_encode_set(sn_codec_t *codec, const uint16_t *samples, uint8_t *out)
+{
+    for (uint8_t i = 0; i < codec->channel_count; i++) {
+        sn_codec_channel_t *ch = &codec->ch[i];
+        int32_t x = samples[i];
+        int32_t e = x - predict(ch);
+        uint32_t u = e >= 0 ? (uint32_t)e << 1 : ((uint32_t)-e << 1) - 1;
+        uint8_t k = rice_k(ch);
+        uint32_t q = u >> k;
+
+        if (q < SN_CODEC_RICE_LIMIT) {
+            out = put_bits(codec, out, (1u << q) - 1, q + 1);   /* q ones and a zero */
+            if (k > 0) {
+                out = put_bits(codec, out, u & ((1u << k) - 1), k);
+            }
+        } else {
+            out = put_bits(codec, out, (1u << SN_CODEC_RICE_LIMIT) - 1, SN_CODEC_RICE_LIMIT);
+            out = put_bits(codec, out, u, SN_CODEC_RAW_BITS);
+        }
+        update(ch, x, e >= 0 ? e : -e);
+    }
+    return out;
+}
+
+uint8_t *sn_codec_flush(sn_codec_t *codec, uint8_t *out)
+{
+    if (codec->bits) {
+        *out++ = (uint8_t)codec->acc;
+        codec->acc = 0;
+        codec->bits = 0;
+    }
+    return out;
+}
+
+/* Read n <= 24 bits. */
+static bool get_bits(bit_reader_t *r, uint8_t n, uint32_t *value)
+{
+    while (r->bits < n) {
+        if (r->in == r->end) {
+            return false;
+        }
+        r->acc |= (uint32_t)*r->in++ << r->bits;
+        r->bits += 8;
+    }
+    *value = r->acc & ((1u << n) - 1);
+    r->acc >>= n;
+    r->bits -= n;
+    return true;
+}
+
+bool sn_codec_decode(const uint8_t *in, size_t len, uint8_t channel_count, uint32_t set_count, uint16_t *out)
+{
+    sn_codec_channel_t state[SN_MAX_CHANNELS];
+    bit_reader_t r = { .in = in, .end = in + len };
+
+    if (channel_count > SN_MAX_CHANNELS) {
+        return false;
+    }
+    for (uint8_t i = 0; i < channel_count; i++) {
+        channel_init(&state[i]);
+    }
+    for (uint32_t n = 0; n < set_count; n++) {
+        for (uint8_t i = 0; i < channel_count; i++) {
+            sn_codec_channel_t *ch = &state[i];
+            uint8_t k = rice_k(ch);
+            uint32_t q = 0, bit, u;
+
+            while (q < SN_CODEC_RICE_LIMIT) {
+                if (!get_bits(&r, 1, &bit)) {
+                    return false;
+                }
+                if (!bit) {
+                    break;
+                }
+                q++;
+            }
+            if (q == SN_CODEC_RICE_LIMIT) {
+                if (!get_bits(&r, SN_CODEC_RAW_BITS, &u)) {
+                    return false;
+                }
+            } else {
+                uint32_t low = 0;
+                if (k > 0 && !get_bits(&r, k, &low)) {
+                    return false;
+                }
+                u = (q << k) | low;
+            }
+            int32_t e = (u & 1) ? -(int32_t)((u + 1) >> 1) : (int32_t)(u >> 1);
+            int32_t x = predict(ch) + e;
+            if (x < 0 || x > UINT16_MAX) {
+                return false;
+            }
+            update(ch, x, e >= 0 ? e : -e);
+            *out++ = (uint16_t)x;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+/* Lossless sample codec for sample frames.
+
+   Every channel is predicted from its own history and the residuals are
+   Rice coded, one sample set at a time, so a frame can be encoded while it
+   is being filled. Per channel the codec runs two fixed predictors, delta
+   (x[n-1]) and second order linear (2x[n-1] - x[n-2]), and uses whichever
+   has had the smaller decayed absolute error so far; the decoder tracks
+   the same costs, so no side information is sent. The Rice parameter k
+   adapts from a running mean of the residual magnitudes as in JPEG-LS.
+   Quotients of SN_CODEC_RICE_LIMIT or more escape to the raw residual.
+
+   Bits are packed LSB first. State is reset at the start of every frame so
+   each frame decodes on its own. Everything is integer arithmetic with a
+   few words of state per channel, and like sn_frame this file has no
+   ESP-IDF dependencies so the server side can reuse it.
+*/
+
+#ifndef SN_CODEC_H
+#define SN_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sn_sample.h"
+
+#define SN_CODEC_RICE_LIMIT     16      /* unary quotients from here on escape to raw */
+#define SN_CODEC_RAW_BITS       17      /* zigzag residual of two 16-bit values */
+#define SN_CODEC_MAX_SAMPLE_BITS (SN_CODEC_RICE_LIMIT + SN_CODEC_RAW_BITS)
+
+typedef struct {
+    int32_t prev[2];            /* x[n-1], x[n-2] */
+    uint32_t cost[2];           /* decayed absolute error of the delta and linear predictors */
+    uint32_t abs_sum;           /* running sum of |residual| for the Rice parameter */
+    uint32_t count;
+} sn_codec_channel_t;
+
+typedef struct {
+    sn_codec_channel_t ch[SN_MAX_CHANNELS];
+    uint8_t channel_count;
+    uint8_t bits;               /* bits pending in acc */
+    uint32_t acc;
+} sn_codec_t;
+
+/* Upper bound on the encoded size of one sample set. */
+static inline size_t sn_codec_max_set_len(uint8_t channel_count)
+{
+    return ((size_t)channel_count * SN_CODEC_MAX_SAMPLE_BITS + 7) / 8;
+}
+
+/* Reset the prediction state for a new frame. */
+void sn_codec_init(sn_codec_t *codec, uint8_t channel_count);
+
+/* Encode one set of channel_count samples at out; returns the new end of output.
+   Up to 7 bits stay pending in the codec until the next set or sn_codec_flush(). */
+uint8_t *sn_codec_encode_set(sn_codec_t *codec, const uint16_t *samples, uint8_t *out);
+
+/* Write out the pending bits, zero padded; returns the new end of output. */
+uint8_t *sn_codec_flush(sn_codec_t *codec, uint8_t *out);
+
+/* Decode set_count sets of channel_count channels into out.
+   Returns false when the input runs out or is malformed. */
+bool sn_codec_decode(const uint8_t *in, size_t len, uint8_t channel_count, uint32_t set_count, uint16_t *out);
+
+#endif /* SN_CODEC_H */
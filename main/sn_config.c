@@ -0,0 +1,120 @@
+/* Versioned acquisition configuration.
+
+   The triple buffer per consumer holds three slots: back is owned by the
+   committer, front by the consumer, and middle is handed between them by
+   atomic exchange, with SN_CONFIG_FRESH marking a slot the consumer has not
+   taken yet. The back slots and s_latest belong to whichever task holds
+   s_lock.
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "sn_config.h"
+
+#define SN_CONFIG_FRESH         0x04
+#define SN_CONFIG_ACK_QUEUE_LEN 8
+
+typedef struct {
+    sn_config_t slots[3];
+    uint8_t back;               /* committer owned */
+    uint8_t front;              /* consumer owned */
+    uint8_t middle;             /* slot index | SN_CONFIG_FRESH, only ever exchanged atomically */
+} config_box_t;
+
+static const char *TAG = "sn_config";
+
+static config_box_t s_boxes[SN_CONFIG_CONSUMERS];
+static sn_config_t s_latest;    /* committer owned */
+static SemaphoreHandle_t s_lock;        /* held from sn_config_edit() to the commit */
+static QueueHandle_t s_acks;
+
+static void box_publish(config_box_t *box, const sn_config_t *config)
+{
+    box->slots[box->back] = *config;
+    uint8_t prev = __atomic_exchange_n(&box->middle, box->back | SN_CONFIG_FRESH, __ATOMIC_ACQ_REL);
+    box->back = prev & ~SN_CONFIG_FRESH;
+}
+
+esp_err_t sn_config_init(const sn_config_t *initial)
+{
+    if (initial == NULL || initial->transport == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_acks = xQueueCreate(SN_CONFIG_ACK_QUEUE_LEN, sizeof(sn_config_ack_t));
+    s_lock = xSemaphoreCreateMutex();
+    if (s_acks == NULL || s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < SN_CONFIG_CONSUMERS; i++) {
+        s_boxes[i].front = 0;
+        s_boxes[i].middle = 1;
+        s_boxes[i].back = 2;
+    }
+    sn_config_t config = *initial;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_latest.version = 0;
+    sn_config_commit(&config);
+    return ESP_OK;
+}
+
+void sn_config_get(sn_config_t *config)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *config = s_latest;
+    xSemaphoreGive(s_lock);
+}
+
+void sn_config_edit(sn_config_t *config)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *config = s_latest;
+}
+
+void sn_config_cancel(void)
+{
+    xSemaphoreGive(s_lock);
+}
+
+void sn_config_commit(sn_config_t *config)
+{
+    config->version = s_latest.version + 1;
+    s_latest = *config;
+    for (int i = 0; i < SN_CONFIG_CONSUMERS; i++) {
+        box_publish(&s_boxes[i], config);
+    }
+    xSemaphoreGive(s_lock);
+    ESP_LOGI(TAG, "Config %u: %s, %d hz on 0x%04x, oversampling x%d, %d sets per frame over %s%s",
+             config->version, config->running ? "running" : "stopped", config->rate_hz, config->channel_mask,
+             config->dsp.ratio, config->pkt_len, config->transport->name, config->compress ? ", compressed" : "");
+}
+
+const sn_config_t *sn_config_adopt(sn_config_consumer_t consumer)
+{
+    config_box_t *box = &s_boxes[consumer];
+
+    if (!sn_config_pending(consumer)) {
+        return NULL;
+    }
+    uint8_t prev = __atomic_exchange_n(&box->middle, box->front, __ATOMIC_ACQ_REL);
+    box->front = prev & ~SN_CONFIG_FRESH;
+    return &box->slots[box->front];
+}
+
+bool sn_config_pending(sn_config_consumer_t consumer)
+{
+    return (__atomic_load_n(&s_boxes[consumer].middle, __ATOMIC_RELAXED) & SN_CONFIG_FRESH) != 0;
+}
+
+void sn_config_post_ack(const sn_config_ack_t *ack)
+{
+    if (s_acks != NULL) {
+        xQueueSend(s_acks, ack, 0);
+    }
+}
+
+bool sn_config_wait_ack(sn_config_ack_t *ack, TickType_t wait)
+{
+    return xQueueReceive(s_acks, ack, wait) == pdTRUE;
+}
@@ -0,0 +1,92 @@
+/* Versioned acquisition configuration.
+
+   Everything the command channel can change lives in one sn_config_t. A
+   committer (the command handler, or the benchmark sweep) copies the latest
+   configuration with sn_config_edit(), edits the copy and commits it; the
+   commit stamps a new version and hands the whole object to the sampler and
+   the publisher at once, so a command that touches several settings never
+   shows up half applied. A mutex is held from the edit to the commit, so
+   committers on different tasks take turns and none works from a copy
+   another has replaced meanwhile.
+
+   Each consumer has its own triple buffer: the committer fills a spare slot
+   and swaps it in with one atomic exchange, and the consumer takes the
+   newest slot with another when it reaches a boundary of its own. Neither
+   side waits for the other, and a consumer that misses versions simply
+   skips to the latest. The sampler adopts between source reads and stamps
+   the version into every sample set; the publisher closes its frame when
+   that stamp changes and adopts once a frame opens on a set carrying the
+   new version, so no frame mixes sample sets taken under two
+   configurations or goes out under settings newer than its sets.
+
+   Once the sampler has adopted a version it posts an acknowledgment with
+   the index of the first sample set taken under it. A version the source
+   rejects is acknowledged with the error and the version sampling carries
+   on under: the previous one, or none if that could not be restored either.
+*/
+
+#ifndef SN_CONFIG_H
+#define SN_CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "sn_dsp.h"
+#include "sn_transport.h"
+
+typedef enum {
+    SN_CONFIG_SAMPLER,
+    SN_CONFIG_PUBLISHER,
+    SN_CONFIG_CONSUMERS,
+} sn_config_consumer_t;
+
+typedef struct {
+    uint32_t version;           /* assigned by sn_config_commit() */
+    bool running;               /* sampling on, cleared by the stop command */
+    uint16_t rate_hz;           /* output sample sets per second */
+    uint16_t channel_mask;      /* bit n enables channel n of the source */
+    sn_dsp_config_t dsp;        /* oversampling, filtering and calibration */
+    uint16_t pkt_len;           /* sample sets per frame */
+    const sn_transport_t *transport;    /* data transport for frames */
+    bool compress;              /* code frame samples with sn_codec */
+} sn_config_t;
+
+typedef struct {
+    uint32_t version;           /* configuration the acknowledgment is about */
+    uint32_t index;             /* first sample set taken under it */
+    esp_err_t result;           /* ESP_OK once applied, otherwise why it was rejected */
+    uint32_t applied;           /* version in effect afterwards, the previous one after a rejection */
+    bool running;               /* sampling afterwards; false when a rejection left nothing to restore */
+} sn_config_ack_t;
+
+/* Publish the initial configuration as version 1. Call once before starting the consumers. */
+esp_err_t sn_config_init(const sn_config_t *initial);
+
+/* Copy of the latest committed configuration. Safe from any task. */
+void sn_config_get(sn_config_t *config);
+
+/* Take the committer lock and copy the latest configuration to edit. Follow with
+   sn_config_commit() or sn_config_cancel() on the same task. */
+void sn_config_edit(sn_config_t *config);
+
+/* Stamp config with the next version, hand it to every consumer and release the committer lock. */
+void sn_config_commit(sn_config_t *config);
+
+/* Release the committer lock without committing. */
+void sn_config_cancel(void);
+
+/* Newest configuration for a consumer if one arrived since its last call, otherwise NULL.
+   The object stays valid until the consumer's next call. */
+const sn_config_t *sn_config_adopt(sn_config_consumer_t consumer);
+
+/* True when a configuration is waiting for the consumer. */
+bool sn_config_pending(sn_config_consumer_t consumer);
+
+/* Queue an acknowledgment for the command channel; dropped when the queue is full. Never blocks. */
+void sn_config_post_ack(const sn_config_ack_t *ack);
+
+/* Wait for the next acknowledgment. */
+bool sn_config_wait_ack(sn_config_ack_t *ack, TickType_t wait);
+
+#endif /* SN_CONFIG_H */
@@ -0,0 +1,131 @@
+/* Oversampling/decimation and calibration stage.
+
+   CIC decimator, N = 3 stages, differential delay 1: the integrators run at
+   the input rate and the combs once per window of ratio inputs. The gain is
+   ratio^3, a power of two, so normalisation is a single shift. Integrator
+   and comb state is unsigned and wraps modulo 2^32; the comb differences
+   still come out exact as long as the output itself fits, hence
+   in_bits + 3 * log2(ratio) <= 31, and the output is only converted once
+   the combs are done.
+*/
+
+#include <string.h>
+#include "sn_dsp.h"
+
+static uint8_t log2_ratio(uint8_t ratio)
+{
+    uint8_t l = 0;
+    while ((1u << l) < ratio) {
+        l++;
+    }
+    return l;
+}
+
+bool sn_dsp_active(const sn_dsp_config_t *config)
+{
+    return config->ratio > 1 || config->calibrate;
+}
+
+bool sn_dsp_check(const sn_dsp_config_t *config, uint8_t in_bits, const uint32_t *lut)
+{
+    uint8_t l = log2_ratio(config->ratio);
+
+    if (config->ratio == 0 || config->ratio > SN_DSP_MAX_RATIO || (1u << l) != config->ratio ||
+        in_bits > 16 || in_bits + SN_DSP_CIC_STAGES * l > 31) {
+        return false;
+    }
+    /* the table is indexed by 12-bit codes */
+    return !config->calibrate || (lut != NULL && in_bits == 12);
+}
+
+bool sn_dsp_init(sn_dsp_t *dsp, const sn_dsp_config_t *config, uint16_t channel_mask, uint8_t in_bits,
+                 const uint32_t *lut)
+{
+    if (!sn_dsp_check(config, in_bits, lut)) {
+        return false;
+    }
+    uint8_t l = log2_ratio(config->ratio);
+
+    memset(dsp, 0, sizeof(*dsp));
+    dsp->config = *config;
+    dsp->lut = lut;
+    dsp->in_bits = in_bits;
+    dsp->shift = SN_DSP_CIC_STAGES * l - (16 - in_bits);
+    for (int ch = 0; ch < SN_MAX_CHANNELS; ch++) {
+        if (channel_mask & (1 << ch)) {
+            dsp->filtered[dsp->channel_count++] = (config->filter_mask & (1 << ch)) != 0;
+        }
+    }
+    return true;
+}
+
+static uint16_t cic_output(sn_dsp_t *dsp, int ch)
+{
+    uint32_t *comb = dsp->comb[ch];
+    uint32_t y = dsp->integ[ch][SN_DSP_CIC_STAGES - 1];
+
+    for (int k = 0; k < SN_DSP_CIC_STAGES; k++) {
+        uint32_t prev = comb[k];
+        comb[k] = y;
+        y -= prev;
+    }
+    y = dsp->shift >= 0 ? y >> dsp->shift : y << -dsp->shift;
+    return y > UINT16_MAX ? UINT16_MAX : (uint16_t)y;
+}
+
+/* 16-bit scaled code to 100 uV units: interpolate the 12-bit table on the 4 fractional bits. */
+static uint16_t calibrate(const uint32_t *lut, uint16_t v)
+{
+    uint32_t idx = v >> 4;
+    uint32_t frac = v & 0x0f;
+    uint32_t uv = lut[idx];
+
+    if (idx + 1 < SN_DSP_LUT_SIZE) {
+        uv += (int32_t)((lut[idx + 1] - lut[idx]) * frac) >> 4;
+    }
+    /* multiply by 2^32 / 100 rather than divide */
+    return (uint16_t)(((uint64_t)uv * 42949673u) >> 32);
+}
+
+void sn_dsp_process(sn_dsp_t *dsp, const sn_sample_block_t *in, sn_sample_block_t *out)
+{
+    const uint16_t *samples = in->samples;
+    uint16_t *dst = dsp->out;
+    uint8_t up = 16 - dsp->in_bits;
+    uint32_t count = 0;
+    int64_t first_us = 0;
+
+    for (uint32_t k = 0; k < in->count; k++, samples += dsp->channel_count) {
+        if (dsp->phase == 0) {
+            dsp->window_us = in->timestamp_us + (int64_t)k * in->period_us;
+        }
+        for (int ch = 0; ch < dsp->channel_count; ch++) {
+            if (!dsp->filtered[ch]) {
+                continue;
+            }
+            uint32_t *integ = dsp->integ[ch];
+            integ[0] += samples[ch];
+            integ[1] += integ[0];
+            integ[2] += integ[1];
+        }
+        if (++dsp->phase < dsp->config.ratio) {
+            continue;
+        }
+        dsp->phase = 0;
+
+        if (count == 0) {
+            first_us = dsp->window_us;
+        }
+        for (int ch = 0; ch < dsp->channel_count; ch++) {
+            uint16_t v = dsp->filtered[ch] ? cic_output(dsp, ch) : (uint16_t)(samples[ch] << up);
+            *dst++ = dsp->config.calibrate ? calibrate(dsp->lut, v) : v;
+        }
+        count++;
+    }
+
+    out->samples = dsp->out;
+    out->count = count;
+    out->timestamp_us = first_us;
+    out->period_us = in->period_us * dsp->config.ratio;
+    out->format = dsp->config.calibrate ? SN_SAMPLE_FORMAT_CAL_100UV : SN_SAMPLE_FORMAT_SCALED16;
+}
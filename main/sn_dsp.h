@@ -0,0 +1,59 @@
+/* Oversampling/decimation and calibration stage between the source and the ring.
+
+   The source runs at ratio times the output rate. Channels in filter_mask go
+   through a three stage CIC decimator in 32-bit fixed point; the others are
+   simply subsampled. Outputs are scaled to 16 bits full scale, so averaging
+   gains are kept as extra resolution, and can optionally be converted to
+   calibrated voltage through a 4096-entry table built once at startup.
+
+   Everything works on whole blocks and has no ESP-IDF dependencies.
+*/
+
+#ifndef SN_DSP_H
+#define SN_DSP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sn_sample.h"
+
+#define SN_DSP_MAX_RATIO    64
+#define SN_DSP_CIC_STAGES   3
+#define SN_DSP_BLOCK_SETS   64      /* largest input block accepted per call */
+#define SN_DSP_LUT_SIZE     4096    /* entries in the raw 12-bit code to microvolt table */
+
+typedef struct {
+    uint8_t ratio;              /* oversampling ratio, a power of two up to SN_DSP_MAX_RATIO; 1 disables decimation */
+    uint16_t filter_mask;       /* channels run through the CIC decimator; the rest are subsampled */
+    bool calibrate;             /* output calibrated voltage in 100 uV units instead of scaled codes */
+} sn_dsp_config_t;
+
+typedef struct {
+    sn_dsp_config_t config;
+    const uint32_t *lut;        /* SN_DSP_LUT_SIZE entries, raw code to microvolts */
+    uint8_t channel_count;
+    uint8_t in_bits;
+    int8_t shift;               /* right shift normalising CIC output to 16 bits, negative shifts left */
+    uint8_t phase;              /* inputs consumed in the current decimation window */
+    bool filtered[SN_MAX_CHANNELS];
+    uint32_t integ[SN_MAX_CHANNELS][SN_DSP_CIC_STAGES];    /* wrap modulo 2^32 */
+    uint32_t comb[SN_MAX_CHANNELS][SN_DSP_CIC_STAGES];
+    int64_t window_us;          /* timestamp of the first input of the current window */
+    uint16_t out[SN_DSP_BLOCK_SETS * SN_MAX_CHANNELS];
+} sn_dsp_t;
+
+/* True when the configuration changes the samples at all. */
+bool sn_dsp_active(const sn_dsp_config_t *config);
+
+/* True when sn_dsp_init() would accept the configuration for this input resolution and table. */
+bool sn_dsp_check(const sn_dsp_config_t *config, uint8_t in_bits, const uint32_t *lut);
+
+/* Reset filter state for a channel mask and input resolution. lut may be NULL when
+   calibrate is off. Returns false for an unsupported ratio, resolution or missing table. */
+bool sn_dsp_init(sn_dsp_t *dsp, const sn_dsp_config_t *config, uint16_t channel_mask, uint8_t in_bits,
+                 const uint32_t *lut);
+
+/* Consume a block of at most SN_DSP_BLOCK_SETS input sets and describe the decimated output,
+   which stays valid until the next call. out->count may be zero. */
+void sn_dsp_process(sn_dsp_t *dsp, const sn_sample_block_t *in, sn_sample_block_t *out);
+
+#endif /* SN_DSP_H */
@@ -0,0 +1,201 @@
+/* Batched binary sample-frame format used for MQTT payloads. */
+
+#include <string.h>
+#include "sn_frame.h"
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, (uint16_t)v);
+    put_le16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return get_le16(p) | ((uint32_t)get_le16(p + 2) << 16);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+static void write_header(uint8_t *buf, const sn_frame_header_t *hdr)
+{
+    buf[0] = hdr->version;
+    buf[1] = hdr->flags;
+    put_le16(&buf[2], hdr->node_id);
+    put_le32(&buf[4], hdr->seq);
+    put_le64(&buf[8], (uint64_t)hdr->t0_us);
+    put_le32(&buf[16], hdr->period_us);
+    put_le16(&buf[20], hdr->channel_mask);
+    put_le16(&buf[22], hdr->sample_count);
+}
+
+uint8_t sn_frame_channel_count(uint16_t channel_mask)
+{
+    uint8_t count = 0;
+    while (channel_mask) {
+        channel_mask &= channel_mask - 1;
+        count++;
+    }
+    return count;
+}
+
+static size_t payload_len(uint32_t values, uint8_t flags)
+{
+    if (flags & SN_FRAME_FLAG_COMPRESSED) {
+        return values * 2;
+    }
+    if (flags & SN_FRAME_FLAG_PACKED12) {
+        return (values * 12 + 7) / 8;
+    }
+    return values * 2;
+}
+
+size_t sn_frame_len(uint16_t channel_mask, uint16_t sample_count, uint8_t flags)
+{
+    return SN_FRAME_HEADER_LEN + payload_len((uint32_t)sample_count * sn_frame_channel_count(channel_mask), flags);
+}
+
+void sn_frame_writer_begin(sn_frame_writer_t *writer, uint8_t *buf, size_t cap, const sn_frame_header_t *hdr)
+{
+    writer->buf = buf;
+    writer->cap = cap;
+    writer->len = SN_FRAME_HEADER_LEN;
+    writer->hdr = *hdr;
+    writer->hdr.version = SN_FRAME_VERSION;
+    writer->hdr.sample_count = 0;
+    writer->channel_count = sn_frame_channel_count(hdr->channel_mask);
+    writer->acc = 0;
+    writer->acc_bits = 0;
+    if (hdr->flags & SN_FRAME_FLAG_COMPRESSED) {
+        writer->hdr.flags &= ~SN_FRAME_FLAG_PACKED12;
+        sn_codec_init(&writer->codec, writer->channel_count);
+    }
+}
+
+bool sn_frame_writer_add(sn_frame_writer_t *writer, const uint16_t *samples)
+{
+    if (writer->hdr.flags & SN_FRAME_FLAG_COMPRESSED) {
+        /* reserve the worst case and the final flush byte so a set never has to be backed out */
+        if (writer->hdr.sample_count == UINT16_MAX ||
+            writer->len + sn_codec_max_set_len(writer->channel_count) + 1 > writer->cap) {
+            return false;
+        }
+        writer->len = sn_codec_encode_set(&writer->codec, samples, writer->buf + writer->len) - writer->buf;
+        writer->hdr.sample_count++;
+        return true;
+    }
+    if (writer->hdr.sample_count == UINT16_MAX ||
+        sn_frame_len(writer->hdr.channel_mask, writer->hdr.sample_count + 1, writer->hdr.flags) > writer->cap) {
+        return false;
+    }
+
+    uint8_t *out = writer->buf + writer->len;
+    if (writer->hdr.flags & SN_FRAME_FLAG_PACKED12) {
+        uint32_t acc = writer->acc;
+        uint8_t bits = writer->acc_bits;
+        for (int i = 0; i < writer->channel_count; i++) {
+            acc |= (uint32_t)(samples[i] & 0x0fff) << bits;
+            bits += 12;
+            while (bits >= 8) {
+                *out++ = (uint8_t)acc;
+                acc >>= 8;
+                bits -= 8;
+            }
+        }
+        writer->acc = acc;
+        writer->acc_bits = bits;
+    } else {
+        for (int i = 0; i < writer->channel_count; i++) {
+            put_le16(out, samples[i]);
+            out += 2;
+        }
+    }
+    writer->len = out - writer->buf;
+    writer->hdr.sample_count++;
+    return true;
+}
+
+size_t sn_frame_writer_finish(sn_frame_writer_t *writer)
+{
+    if (writer->hdr.flags & SN_FRAME_FLAG_COMPRESSED) {
+        writer->len = sn_codec_flush(&writer->codec, writer->buf + writer->len) - writer->buf;
+    } else if (writer->acc_bits) {
+        writer->buf[writer->len++] = (uint8_t)writer->acc;
+        writer->acc = 0;
+        writer->acc_bits = 0;
+    }
+    write_header(writer->buf, &writer->hdr);
+    return writer->len;
+}
+
+bool sn_frame_decode_header(const uint8_t *buf, size_t len, sn_frame_header_t *hdr)
+{
+    if (len < SN_FRAME_HEADER_LEN || buf[0] != SN_FRAME_VERSION) {
+        return false;
+    }
+    hdr->version = buf[0];
+    hdr->flags = buf[1];
+    hdr->node_id = get_le16(&buf[2]);
+    hdr->seq = get_le32(&buf[4]);
+    hdr->t0_us = (int64_t)get_le64(&buf[8]);
+    hdr->period_us = get_le32(&buf[16]);
+    hdr->channel_mask = get_le16(&buf[20]);
+    hdr->sample_count = get_le16(&buf[22]);
+    return true;
+}
+
+bool sn_frame_decode_samples(const uint8_t *buf, size_t len, const sn_frame_header_t *hdr,
+                             uint16_t *out, size_t out_count)
+{
+    uint8_t channel_count = sn_frame_channel_count(hdr->channel_mask);
+    size_t count = (size_t)hdr->sample_count * channel_count;
+
+    if (hdr->flags & SN_FRAME_FLAG_COMPRESSED) {
+        return out_count >= count && len >= SN_FRAME_HEADER_LEN &&
+               sn_codec_decode(buf + SN_FRAME_HEADER_LEN, len - SN_FRAME_HEADER_LEN, channel_count,
+                               hdr->sample_count, out);
+    }
+    if (out_count < count || len < sn_frame_len(hdr->channel_mask, hdr->sample_count, hdr->flags)) {
+        return false;
+    }
+
+    const uint8_t *in = buf + SN_FRAME_HEADER_LEN;
+    if (hdr->flags & SN_FRAME_FLAG_PACKED12) {
+        uint32_t acc = 0;
+        uint8_t bits = 0;
+        for (size_t i = 0; i < count; i++) {
+            while (bits < 12) {
+                acc |= (uint32_t)*in++ << bits;
+                bits += 8;
+            }
+            out[i] = acc & 0x0fff;
+            acc >>= 12;
+            bits -= 12;
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = get_le16(in);
+            in += 2;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,98 @@
+/* Batched binary sample-frame format used for MQTT payloads.
+
+   A frame is a fixed 24 byte little-endian header followed by sample_count
+   sample sets, channel-interleaved in ascending channel order:
+
+     offset  size  field
+          0     1  version        SN_FRAME_VERSION
+          1     1  flags          SN_FRAME_FLAG_*
+          2     2  node_id
+          4     4  seq            frame counter per node, wraps
+          8     8  t0_us          timestamp of the first sample set
+         16     4  period_us      nominal spacing of the sample sets
+         20     2  channel_mask   bit n set when channel n is present
+         22     2  sample_count   number of sample sets in the frame
+
+   With SN_FRAME_FLAG_PACKED12 the samples form a little-endian bit stream of
+   12-bit values (two samples per three bytes, the last byte zero padded);
+   otherwise every sample is a little-endian uint16. Without SN_FRAME_FLAG_SCALED16
+   or SN_FRAME_FLAG_CAL_100UV the samples are raw ADC codes. With
+   SN_FRAME_FLAG_COMPRESSED the samples are an sn_codec bit stream instead and
+   the frame length varies with the signal; sn_frame_len() then gives the
+   uncompressed 16-bit size.
+
+   Sample sets within a frame are contiguous: the encoder starts a new frame
+   whenever the sampler skipped an index or changed its channels or period,
+   so set k of a frame was taken at t0_us + k * period_us. Frames sampled
+   before the node's clock first synchronised carry SN_FRAME_FLAG_PROVISIONAL;
+   adding the first_step_us the node reports in its health report puts them
+   on the synchronised timeline.
+
+   This file has no ESP-IDF dependencies so the server side can reuse it.
+*/
+
+#ifndef SN_FRAME_H
+#define SN_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sn_codec.h"
+
+#define SN_FRAME_VERSION        1
+#define SN_FRAME_HEADER_LEN     24
+
+#define SN_FRAME_FLAG_PACKED12  0x01    /* samples are packed 12-bit values */
+#define SN_FRAME_FLAG_SCALED16  0x02    /* samples are oversampled ADC codes scaled to 16 bits full scale */
+#define SN_FRAME_FLAG_CAL_100UV 0x04    /* samples are calibrated input voltage in units of 100 uV */
+#define SN_FRAME_FLAG_BACKFILL  0x08    /* frame was held on the node while offline and is delivered late */
+#define SN_FRAME_FLAG_COMPRESSED 0x10   /* samples are losslessly coded by sn_codec, see sn_codec.h */
+#define SN_FRAME_FLAG_PROVISIONAL 0x20  /* t0_us was taken before the first clock sync, see sn_clock.h */
+
+typedef struct {
+    uint8_t version;
+    uint8_t flags;
+    uint16_t node_id;
+    uint32_t seq;
+    int64_t t0_us;
+    uint32_t period_us;
+    uint16_t channel_mask;
+    uint16_t sample_count;
+} sn_frame_header_t;
+
+/* Incremental encoder that writes sample sets straight into the output buffer. */
+typedef struct {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    sn_frame_header_t hdr;
+    uint8_t channel_count;
+    uint8_t acc_bits;           /* bits pending in acc when packing 12-bit samples */
+    uint32_t acc;
+    sn_codec_t codec;           /* prediction state when compressing */
+} sn_frame_writer_t;
+
+/* Number of channels set in a channel mask. */
+uint8_t sn_frame_channel_count(uint16_t channel_mask);
+
+/* Total encoded size of a frame with the given shape. */
+size_t sn_frame_len(uint16_t channel_mask, uint16_t sample_count, uint8_t flags);
+
+/* Start a frame in buf. hdr->sample_count is ignored and counted by the writer. */
+void sn_frame_writer_begin(sn_frame_writer_t *writer, uint8_t *buf, size_t cap, const sn_frame_header_t *hdr);
+
+/* Append one sample set of channel_count values. Returns false when it would not fit. */
+bool sn_frame_writer_add(sn_frame_writer_t *writer, const uint16_t *samples);
+
+/* Flush pending bits, write the final header and return the frame length in bytes. */
+size_t sn_frame_writer_finish(sn_frame_writer_t *writer);
+
+/* Parse and validate a header. Returns false on a short buffer or unknown version. */
+bool sn_frame_decode_header(const uint8_t *buf, size_t len, sn_frame_header_t *hdr);
+
+/* Unpack all samples of a frame into out (sample_count * channel_count values, interleaved).
+   Returns false when the buffer is truncated or out is too small. */
+bool sn_frame_decode_samples(const uint8_t *buf, size_t len, const sn_frame_header_t *hdr,
+                             uint16_t *out, size_t out_count);
+
+#endif /* SN_FRAME_H */
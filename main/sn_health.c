@@ -0,0 +1,348 @@
+/* Periodic node-health report.
+
+   Everything is read through the stages' get_stats snapshots, so the
+   reporter never touches their state; the previous snapshot of each
+   histogram and each task's run time counter is kept to report the last
+   interval only.
+
+   The report is written section by section. A section that does not fit
+   is rolled back together with the baselines it moved, so the report still
+   goes out without it, says how many sections it left out, and the next
+   report covers that section over both intervals. The extremes a stage
+   restarts when read (ring and pool marks, interval min and max) cannot be
+   put back, so those a left-out section took are kept here and folded
+   into the next report's.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sn_sampler.h"
+#include "sn_publisher.h"
+#include "sn_mqtt_pipe.h"
+#include "sn_udp.h"
+#include "sn_spill.h"
+#include "sn_clock.h"
+#include "sn_health.h"
+
+#define SN_HEALTH_CORE          0
+#define SN_HEALTH_PRIORITY      2
+#define SN_HEALTH_STACK_SIZE    4096
+#define SN_HEALTH_IDLE_MS       1000
+#define SN_HEALTH_MAX_TASKS     24
+#define SN_HEALTH_TASK_KEY_LEN  24
+#define SN_HEALTH_TAIL_LEN      24      /* ,"truncated":n} kept free until the end */
+
+static const char *TAG = "sn_health";
+
+static sn_health_config_t s_config;
+static volatile uint16_t s_interval_s;
+static char s_report[SN_HEALTH_MAX_REPORT];
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+static TaskStatus_t s_tasks[SN_HEALTH_MAX_TASKS];
+#endif
+
+/* everything as of the previous report, owned by the task */
+typedef struct {
+    sn_hist_t jitter;
+    sn_hist_t read;
+    sn_hist_t encode;
+    sn_hist_t ack_latency;
+    sn_hist_t send_latency;
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+    struct {
+        UBaseType_t number;
+        uint32_t run_time;
+    } tasks[SN_HEALTH_MAX_TASKS];
+    UBaseType_t task_count;
+    uint32_t total;
+#endif
+} health_baseline_t;
+
+static health_baseline_t s_prev;
+static health_baseline_t s_saved;       /* s_prev before the section being written */
+
+/* extremes taken for a section that was left out, to fold into the next report's */
+typedef struct {
+    uint32_t ring_high_water;
+    uint32_t min_interval_us;
+    uint32_t max_interval_us;           /* 0 when no interval was measured */
+    uint8_t pool_low_water;             /* UINT8_MAX when none was taken */
+} health_marks_t;
+
+static health_marks_t s_carry = { .pool_low_water = UINT8_MAX };
+static health_marks_t s_taken;          /* s_carry with the marks the section being written took */
+
+/* Replace prev with now and write the histogram of what was added in between. */
+static void interval_hist(sn_stats_writer_t *w, const char *key, const sn_hist_t *now, sn_hist_t *prev)
+{
+    sn_hist_t delta;
+
+    sn_hist_delta(&delta, now, prev);
+    sn_stats_hist(w, key, &delta);
+    *prev = *now;
+}
+
+static void add_sampler(sn_stats_writer_t *w)
+{
+    sn_sampler_stats_t now;
+
+    sn_sampler_get_stats(SN_STATS_READER_HEALTH, &now);
+    if (s_carry.ring_high_water > now.ring_high_water) {
+        now.ring_high_water = s_carry.ring_high_water;
+    }
+    if (s_carry.max_interval_us != 0) {
+        if (now.max_interval_us == 0 || s_carry.min_interval_us < now.min_interval_us) {
+            now.min_interval_us = s_carry.min_interval_us;
+        }
+        if (s_carry.max_interval_us > now.max_interval_us) {
+            now.max_interval_us = s_carry.max_interval_us;
+        }
+    }
+    s_carry.ring_high_water = 0;
+    s_carry.max_interval_us = 0;
+    s_taken.ring_high_water = now.ring_high_water;
+    s_taken.min_interval_us = now.min_interval_us;
+    s_taken.max_interval_us = now.max_interval_us;
+
+    sn_stats_object(w, "sampler");
+    sn_stats_u32(w, "sets", now.sample_sets);
+    sn_stats_u32(w, "missed_ticks", now.missed_ticks);
+    sn_stats_u32(w, "ring_drops", now.ring_drops);
+    sn_stats_u32(w, "read_errors", now.read_errors);
+    sn_stats_u32(w, "ring_high_water", now.ring_high_water);
+    /* extremes since the previous report, 0 when no interval was measured */
+    sn_stats_u32(w, "interval_min_us", now.max_interval_us ? now.min_interval_us : 0);
+    sn_stats_u32(w, "interval_max_us", now.max_interval_us);
+    interval_hist(w, "jitter_ns", &now.jitter_ns, &s_prev.jitter);
+    interval_hist(w, "read_ns", &now.read_ns, &s_prev.read);
+    sn_stats_end_object(w);
+}
+
+static void add_publisher(sn_stats_writer_t *w)
+{
+    sn_publisher_stats_t now;
+
+    sn_publisher_get_stats(SN_STATS_READER_HEALTH, &now);
+    if (s_carry.pool_low_water < now.pool_low_water) {
+        now.pool_low_water = s_carry.pool_low_water;
+    }
+    s_carry.pool_low_water = UINT8_MAX;
+    s_taken.pool_low_water = now.pool_low_water;
+
+    sn_stats_object(w, "publisher");
+    sn_stats_u32(w, "frames", now.frames);
+    sn_stats_u32(w, "dropped", now.frames_dropped);
+    sn_stats_u32(w, "spilled", now.frames_spilled);
+    sn_stats_u32(w, "backfilled", now.frames_backfilled);
+    sn_stats_u32(w, "pool_waits", now.pool_waits);
+    sn_stats_u32(w, "pool_low_water", now.pool_low_water);
+    interval_hist(w, "encode_ns", &now.encode_ns, &s_prev.encode);
+    sn_stats_end_object(w);
+}
+
+static void add_mqtt(sn_stats_writer_t *w)
+{
+    sn_mqtt_pipe_stats_t pipe;
+
+    sn_mqtt_pipe_get_stats(&pipe);
+    sn_stats_object(w, "mqtt");
+    sn_stats_u32(w, "published", pipe.published);
+    sn_stats_u32(w, "acked", pipe.acked);
+    sn_stats_u32(w, "resent", pipe.resent);
+    sn_stats_u32(w, "reclaimed", pipe.reclaimed);
+    sn_stats_u32(w, "reconnects", pipe.reconnects);
+    sn_stats_u32(w, "max_inflight", pipe.max_inflight);
+    sn_stats_u64(w, "bytes", pipe.bytes);
+    interval_hist(w, "ack_latency_us", &pipe.ack_latency_us, &s_prev.ack_latency);
+    sn_stats_end_object(w);
+}
+
+static void add_udp(sn_stats_writer_t *w)
+{
+    sn_udp_stats_t udp;
+
+    sn_udp_get_stats(&udp);
+    sn_stats_object(w, "udp");
+    sn_stats_u32(w, "sent", udp.sent);
+    sn_stats_u32(w, "retransmitted", udp.retransmitted);
+    sn_stats_u32(w, "nacks", udp.nacks);
+    sn_stats_u32(w, "gone", udp.gone);
+    sn_stats_u32(w, "send_errors", udp.send_errors);
+    sn_stats_u64(w, "bytes", udp.bytes);
+    interval_hist(w, "send_latency_us", &udp.send_latency_us, &s_prev.send_latency);
+    sn_stats_end_object(w);
+}
+
+static void add_spill_and_clock(sn_stats_writer_t *w)
+{
+    sn_clock_status_t clock;
+
+    if (sn_spill_ready()) {
+        sn_spill_stats_t spill;
+        sn_spill_get_stats(&spill);
+        sn_stats_object(w, "spill");
+        sn_stats_u32(w, "written", spill.records_written);
+        sn_stats_u32(w, "drained", spill.records_drained);
+        sn_stats_u32(w, "dropped", spill.records_dropped);
+        sn_stats_u32(w, "corrupt", spill.records_corrupt);
+        sn_stats_u32(w, "pending", spill.records_pending);
+        sn_stats_end_object(w);
+    }
+    sn_clock_get_status(&clock);
+    sn_stats_object(w, "clock");
+    sn_stats_u32(w, "synced", clock.synced);
+    sn_stats_i64(w, "offset_us", clock.offset_us);
+    sn_stats_u32(w, "delay_us", clock.delay_us);
+    sn_stats_i64(w, "drift_ppb", clock.drift_ppb);
+    sn_stats_u32(w, "failures", clock.failures);
+    sn_stats_i64(w, "first_step_us", clock.first_step_us);
+    sn_stats_end_object(w);
+}
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+/* Task names are not unique: both idle tasks are called IDLE. Idle tasks get their core appended, any
+   other repeated name #n after the one created first. */
+static void task_key(char *key, UBaseType_t i, UBaseType_t count)
+{
+    int twins = 0;
+
+    for (int cpu = 0; cpu < portNUM_PROCESSORS; cpu++) {
+        if (s_tasks[i].xHandle == xTaskGetIdleTaskHandleForCPU(cpu)) {
+            snprintf(key, SN_HEALTH_TASK_KEY_LEN, "%s%d", s_tasks[i].pcTaskName, cpu);
+            return;
+        }
+    }
+    for (UBaseType_t j = 0; j < count; j++) {
+        twins += s_tasks[j].xTaskNumber < s_tasks[i].xTaskNumber &&
+                 strcmp(s_tasks[j].pcTaskName, s_tasks[i].pcTaskName) == 0;
+    }
+    snprintf(key, SN_HEALTH_TASK_KEY_LEN, twins ? "%s#%d" : "%s", s_tasks[i].pcTaskName, twins);
+}
+
+/* Share of one core each task used over the last interval, in permille. */
+static void add_tasks(sn_stats_writer_t *w)
+{
+    uint32_t total;
+    UBaseType_t count = uxTaskGetSystemState(s_tasks, SN_HEALTH_MAX_TASKS, &total);
+    uint32_t elapsed = total - s_prev.total;
+    char key[SN_HEALTH_TASK_KEY_LEN];
+
+    sn_stats_object(w, "cpu_permille");
+    for (UBaseType_t i = 0; i < count && elapsed > 0; i++) {
+        uint32_t prev = 0;
+        for (UBaseType_t j = 0; j < s_prev.task_count; j++) {
+            if (s_prev.tasks[j].number == s_tasks[i].xTaskNumber) {
+                prev = s_prev.tasks[j].run_time;
+                break;
+            }
+        }
+        task_key(key, i, count);
+        sn_stats_u32(w, key, (uint32_t)((uint64_t)(s_tasks[i].ulRunTimeCounter - prev) * 1000 / elapsed));
+    }
+    sn_stats_end_object(w);
+    for (UBaseType_t i = 0; i < count; i++) {
+        s_prev.tasks[i].number = s_tasks[i].xTaskNumber;
+        s_prev.tasks[i].run_time = s_tasks[i].ulRunTimeCounter;
+    }
+    s_prev.task_count = count;
+    s_prev.total = total;
+}
+#endif
+
+/* Write one section, or nothing and keep the baselines and the marks it took when it does not fit. */
+static bool add_section(sn_stats_writer_t *w, void (*add)(sn_stats_writer_t *w))
+{
+    sn_stats_mark_t mark = sn_stats_mark(w);
+
+    s_saved = s_prev;
+    s_taken = s_carry;
+    add(w);
+    if (!w->truncated) {
+        return true;
+    }
+    sn_stats_rewind(w, &mark);
+    s_prev = s_saved;
+    s_carry = s_taken;
+    return false;
+}
+
+/* Returns the length, 0 when not even the header fits; *dropped counts the sections left out. */
+static size_t build_report(uint32_t *dropped)
+{
+    sn_stats_writer_t w;
+    char node[5];
+
+    snprintf(node, sizeof(node), "%04x", s_config.node_id);
+    sn_stats_begin(&w, s_report, sizeof(s_report) - SN_HEALTH_TAIL_LEN);
+    sn_stats_str(&w, "node", node);
+    sn_stats_u64(&w, "uptime_ms", esp_timer_get_time() / 1000);
+    sn_stats_u32(&w, "heap_free", heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    sn_stats_u32(&w, "heap_min", heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    sn_stats_u32(&w, "heap_largest", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    /* most important first, the per-task figures are the largest and go last */
+    *dropped = 0;
+    *dropped += !add_section(&w, add_sampler);
+    *dropped += !add_section(&w, add_publisher);
+    *dropped += !add_section(&w, add_mqtt);
+    *dropped += !add_section(&w, add_udp);
+    *dropped += !add_section(&w, add_spill_and_clock);
+    if (s_config.add_fields != NULL) {
+        *dropped += !add_section(&w, s_config.add_fields);
+    }
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+    *dropped += !add_section(&w, add_tasks);
+#endif
+    w.cap = sizeof(s_report);
+    if (*dropped > 0) {
+        sn_stats_u32(&w, "truncated", *dropped);
+    }
+    return sn_stats_finish(&w);
+}
+
+static void health_task(void *arg)
+{
+    for (;;) {
+        uint16_t interval_s = s_interval_s;
+        vTaskDelay(interval_s ? interval_s * configTICK_RATE_HZ : pdMS_TO_TICKS(SN_HEALTH_IDLE_MS));
+        if (interval_s == 0) {
+            continue;
+        }
+        uint32_t dropped;
+        size_t len = build_report(&dropped);
+        if (len == 0) {
+            ESP_LOGW(TAG, "Report does not fit in %d bytes", SN_HEALTH_MAX_REPORT);
+            continue;
+        }
+        if (dropped > 0) {
+            ESP_LOGW(TAG, "Left %u sections out of the report to fit in %d bytes", dropped,
+                     SN_HEALTH_MAX_REPORT);
+        }
+        s_config.publish(s_report, len);
+    }
+}
+
+esp_err_t sn_health_start(const sn_health_config_t *config)
+{
+    if (config == NULL || config->publish == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_config = *config;
+    s_interval_s = config->interval_s;
+    if (xTaskCreatePinnedToCore(health_task, "sn_health", SN_HEALTH_STACK_SIZE, NULL,
+                                SN_HEALTH_PRIORITY, NULL, SN_HEALTH_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create health task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void sn_health_set_interval(uint16_t interval_s)
+{
+    s_interval_s = interval_s;
+}
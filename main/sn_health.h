@@ -0,0 +1,37 @@
+/* Periodic node-health report.
+
+   A low priority task on core 0 collects the counters and histograms of
+   every pipeline stage, free heap, the clock discipline state and per-task
+   CPU usage, formats them as one compact JSON object and hands it to a
+   publish callback every interval_s seconds. Histograms, CPU figures and
+   high-water marks cover the last interval; counters are totals since boot. Per-task CPU
+   needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS and is left out without it.
+   A section that would overflow SN_HEALTH_MAX_REPORT is left out of that
+   report and "truncated" gives the number left out.
+*/
+
+#ifndef SN_HEALTH_H
+#define SN_HEALTH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sn_stats.h"
+
+#define SN_HEALTH_MAX_REPORT    3072
+
+typedef struct {
+    uint16_t node_id;
+    uint16_t interval_s;        /* 0 keeps the task idle until set */
+    bool (*publish)(const char *payload, size_t len);
+    void (*add_fields)(sn_stats_writer_t *writer);  /* optional application counters, may be NULL */
+} sn_health_config_t;
+
+/* Spawn the reporting task. */
+esp_err_t sn_health_start(const sn_health_config_t *config);
+
+/* Change the report interval, 0 to stop reporting. Takes effect after the current wait. */
+void sn_health_set_interval(uint16_t interval_s);
+
+#endif /* SN_HEALTH_H */
@@ -0,0 +1,467 @@
+/* Pipelined MQTT data connection.
+
+   A minimal MQTT 3.1.1 client: CONNECT, QoS 1 PUBLISH, PUBACK and PINGREQ,
+   nothing else, since the pipe never subscribes. One task owns the socket.
+   While the window has room it waits on the queue of filled buffers, so a
+   new frame goes out as soon as it is handed over, and picks up PUBACKs in
+   between; with the window full it waits on the socket instead.
+
+   The task is the only writer of s_stats and updates it under s_stats_seq
+   (see sn_stats.h). Reclaims run on the publisher task, so their count is
+   kept apart and added atomically.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "sn_transport.h"
+#include "sn_boot.h"
+#include "sn_mqtt_pipe.h"
+
+#define SN_MQTT_PIPE_CORE       0
+#define SN_MQTT_PIPE_PRIORITY   5
+#define SN_MQTT_PIPE_STACK_SIZE 4096
+#define SN_MQTT_PIPE_POLL_MS    10
+#define SN_MQTT_PIPE_RETRY_MS   1000
+#define SN_MQTT_PIPE_RX_TIMEOUT_MS 5000
+#define SN_MQTT_PIPE_MAX_STRING 64      /* client id, username and password */
+
+#define MQTT_CONNECT            0x10
+#define MQTT_CONNACK            0x20
+#define MQTT_PUBLISH            0x30
+#define MQTT_PUBACK             0x40
+#define MQTT_PINGREQ            0xc0
+#define MQTT_FLAG_DUP           0x08
+#define MQTT_FLAG_QOS1          0x02
+#define MQTT_CONNECT_CLEAN      0x02
+#define MQTT_CONNECT_PASSWORD   0x40
+#define MQTT_CONNECT_USERNAME   0x80
+
+static const char *TAG = "sn_mqtt_pipe";
+
+static sn_mqtt_pipe_config_t s_config;
+static size_t s_topic_len;
+static QueueHandle_t s_ready;
+static sn_buf_t *s_inflight[SN_MQTT_PIPE_MAX_WINDOW];  /* in send order */
+static uint8_t s_inflight_count;
+static int s_sock = -1;
+static volatile bool s_connected;
+static TaskHandle_t s_task;
+static uint16_t s_next_id;
+static int64_t s_last_tx_us;
+static int64_t s_last_rx_us;
+static sn_mqtt_pipe_stats_t s_stats;
+static uint32_t s_stats_seq;            /* odd while the task updates s_stats */
+static uint32_t s_reclaimed;            /* written by the publisher task */
+
+static void stats_begin(void)
+{
+    sn_stats_write_begin(&s_stats_seq);
+}
+
+static void stats_end(void)
+{
+    sn_stats_write_end(&s_stats_seq);
+}
+
+static size_t varint_len(uint32_t value)
+{
+    return value < 128 ? 1 : value < 16384 ? 2 : value < 2097152 ? 3 : 4;
+}
+
+static size_t put_varint(uint8_t *p, uint32_t value)
+{
+    size_t n = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        p[n++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return n;
+}
+
+static size_t put_string(uint8_t *p, const char *s)
+{
+    size_t len = strlen(s);
+    p[0] = len >> 8;
+    p[1] = len & 0xff;
+    memcpy(p + 2, s, len);
+    return len + 2;
+}
+
+static bool send_all(const uint8_t *p, size_t len)
+{
+    while (len > 0) {
+        int n = send(s_sock, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+        stats_begin();
+        s_stats.bytes += n;
+        stats_end();
+    }
+    s_last_tx_us = esp_timer_get_time();
+    return true;
+}
+
+static bool recv_all(uint8_t *p, size_t len)
+{
+    while (len > 0) {
+        int n = recv(s_sock, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void drop_connection(void)
+{
+    if (s_sock >= 0) {
+        ESP_LOGW(TAG, "Connection lost with %d frames in flight", s_inflight_count);
+        close(s_sock);
+        s_sock = -1;
+    }
+    s_connected = false;
+}
+
+static bool connect_broker(void)
+{
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res;
+
+    if (getaddrinfo(s_config.host, s_config.port, &hints, &res) != 0 || res == NULL) {
+        return false;
+    }
+    s_sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (s_sock < 0) {
+        freeaddrinfo(res);
+        return false;
+    }
+    int err = connect(s_sock, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (err != 0) {
+        drop_connection();
+        return false;
+    }
+    int one = 1;
+    setsockopt(s_sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv = {
+        .tv_sec = SN_MQTT_PIPE_RX_TIMEOUT_MS / 1000,
+        .tv_usec = (SN_MQTT_PIPE_RX_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(s_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    uint8_t pkt[5 + 10 + 3 * (2 + SN_MQTT_PIPE_MAX_STRING)];
+    uint8_t flags = MQTT_CONNECT_CLEAN;
+    uint32_t remaining = 10 + 2 + strlen(s_config.client_id);
+    if (s_config.username != NULL) {
+        flags |= MQTT_CONNECT_USERNAME;
+        remaining += 2 + strlen(s_config.username);
+    }
+    if (s_config.password != NULL) {
+        flags |= MQTT_CONNECT_PASSWORD;
+        remaining += 2 + strlen(s_config.password);
+    }
+    uint8_t *p = pkt;
+    *p++ = MQTT_CONNECT;
+    p += put_varint(p, remaining);
+    p += put_string(p, "MQTT");
+    *p++ = 4;                   /* protocol level 3.1.1 */
+    *p++ = flags;
+    *p++ = s_config.keep_alive_s >> 8;
+    *p++ = s_config.keep_alive_s & 0xff;
+    p += put_string(p, s_config.client_id);
+    if (s_config.username != NULL) {
+        p += put_string(p, s_config.username);
+    }
+    if (s_config.password != NULL) {
+        p += put_string(p, s_config.password);
+    }
+
+    uint8_t connack[4];
+    if (!send_all(pkt, p - pkt) || !recv_all(connack, sizeof(connack)) ||
+        connack[0] != MQTT_CONNACK || connack[1] != 2 || connack[3] != 0) {
+        ESP_LOGW(TAG, "Broker %s refused the data connection", s_config.host);
+        drop_connection();
+        return false;
+    }
+    s_last_rx_us = esp_timer_get_time();
+    return true;
+}
+
+/* Write the PUBLISH header into the headroom in front of the frame. */
+static void frame_publish(sn_buf_t *buf)
+{
+    uint32_t remaining = 2 + s_topic_len + 2 + buf->len;
+    uint8_t *p = buf->data - (1 + varint_len(remaining) + 2 + s_topic_len + 2);
+
+    if (++s_next_id == 0) {
+        s_next_id = 1;
+    }
+    buf->packet = p;
+    buf->packet_id = s_next_id;
+    *p++ = MQTT_PUBLISH | MQTT_FLAG_QOS1;
+    p += put_varint(p, remaining);
+    *p++ = s_topic_len >> 8;
+    *p++ = s_topic_len & 0xff;
+    memcpy(p, s_config.topic, s_topic_len);
+    p += s_topic_len;
+    *p++ = buf->packet_id >> 8;
+    *p++ = buf->packet_id & 0xff;
+}
+
+static bool send_publish(sn_buf_t *buf)
+{
+    stats_begin();
+    s_stats.published++;
+    stats_end();
+    return send_all(buf->packet, buf->data + buf->len - buf->packet);
+}
+
+static bool resend_inflight(void)
+{
+    for (uint8_t i = 0; i < s_inflight_count; i++) {
+        s_inflight[i]->packet[0] |= MQTT_FLAG_DUP;
+        stats_begin();
+        s_stats.resent++;
+        stats_end();
+        if (!send_publish(s_inflight[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void handle_puback(uint16_t packet_id)
+{
+    for (uint8_t i = 0; i < s_inflight_count; i++) {
+        if (s_inflight[i]->packet_id == packet_id) {
+            stats_begin();
+            sn_hist_add(&s_stats.ack_latency_us, esp_timer_get_time() - s_inflight[i]->queued_us);
+            s_stats.acked++;
+            stats_end();
+            sn_boot_mark(SN_BOOT_FIRST_FRAME);
+            sn_pool_release(s_config.pool, s_inflight[i]);
+            s_inflight_count--;
+            memmove(&s_inflight[i], &s_inflight[i + 1], (s_inflight_count - i) * sizeof(s_inflight[0]));
+            return;
+        }
+    }
+}
+
+static bool read_packet(void)
+{
+    uint8_t type, byte, body[4];
+    uint32_t remaining = 0;
+    int shift = 0;
+
+    if (!recv_all(&type, 1)) {
+        return false;
+    }
+    do {
+        if (shift > 21 || !recv_all(&byte, 1)) {
+            return false;
+        }
+        remaining |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    size_t keep = remaining < sizeof(body) ? remaining : sizeof(body);
+    if (!recv_all(body, keep)) {
+        return false;
+    }
+    for (uint32_t left = remaining - keep; left > 0; ) {
+        uint8_t discard[32];
+        size_t n = left < sizeof(discard) ? left : sizeof(discard);
+        if (!recv_all(discard, n)) {
+            return false;
+        }
+        left -= n;
+    }
+    s_last_rx_us = esp_timer_get_time();
+    if ((type & 0xf0) == MQTT_PUBACK && remaining >= 2) {
+        handle_puback((body[0] << 8) | body[1]);
+    }
+    return true;
+}
+
+/* Handle everything the broker sent, waiting up to wait_ms for the first packet. */
+static bool poll_input(uint32_t wait_ms)
+{
+    for (;;) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(s_sock, &rfds);
+        struct timeval tv = {
+            .tv_sec = wait_ms / 1000,
+            .tv_usec = (wait_ms % 1000) * 1000,
+        };
+        int n = select(s_sock + 1, &rfds, NULL, NULL, &tv);
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        if (!read_packet()) {
+            return false;
+        }
+        wait_ms = 0;
+    }
+}
+
+static bool keep_alive(void)
+{
+    static const uint8_t pingreq[2] = { MQTT_PINGREQ, 0 };
+    int64_t now_us = esp_timer_get_time();
+    int64_t interval_us = (int64_t)s_config.keep_alive_s * 1000000;
+
+    if (interval_us == 0) {
+        return true;
+    }
+    if (now_us - s_last_rx_us > interval_us + interval_us / 2) {
+        ESP_LOGW(TAG, "Broker stopped answering");
+        return false;
+    }
+    if (now_us - s_last_tx_us > interval_us / 2) {
+        return send_all(pingreq, sizeof(pingreq));
+    }
+    return true;
+}
+
+static void pipe_task(void *arg)
+{
+    for (;;) {
+        if (s_sock < 0) {
+            if (!connect_broker()) {
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SN_MQTT_PIPE_RETRY_MS));
+                continue;
+            }
+            if (!resend_inflight()) {
+                drop_connection();
+                continue;
+            }
+            stats_begin();
+            s_stats.reconnects++;
+            stats_end();
+            s_connected = true;
+            ESP_LOGI(TAG, "Data connection to %s up, window %d", s_config.host, s_config.window);
+        }
+
+        uint32_t wait_ms = SN_MQTT_PIPE_POLL_MS;
+        if (s_inflight_count < s_config.window) {
+            sn_buf_t *buf;
+            if (xQueueReceive(s_ready, &buf, pdMS_TO_TICKS(SN_MQTT_PIPE_POLL_MS)) == pdTRUE) {
+                frame_publish(buf);
+                s_inflight[s_inflight_count++] = buf;
+                if (s_inflight_count > s_stats.max_inflight) {
+                    stats_begin();
+                    s_stats.max_inflight = s_inflight_count;
+                    stats_end();
+                }
+                if (!send_publish(buf)) {
+                    drop_connection();
+                    continue;
+                }
+            }
+            wait_ms = 0;
+        }
+        if (!poll_input(wait_ms) || !keep_alive()) {
+            drop_connection();
+        }
+    }
+}
+
+esp_err_t sn_mqtt_pipe_start(const sn_mqtt_pipe_config_t *config)
+{
+    if (config == NULL || config->host == NULL || config->port == NULL || config->client_id == NULL ||
+        config->topic == NULL || config->pool == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(config->topic) > SN_MQTT_PIPE_MAX_TOPIC || config->pool->headroom < SN_MQTT_PIPE_HEADROOM ||
+        strlen(config->client_id) > SN_MQTT_PIPE_MAX_STRING ||
+        (config->username != NULL && strlen(config->username) > SN_MQTT_PIPE_MAX_STRING) ||
+        (config->password != NULL && strlen(config->password) > SN_MQTT_PIPE_MAX_STRING)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    /* the publisher needs a buffer for the frame it fills and one for backfill */
+    if (config->window == 0 || config->window > SN_MQTT_PIPE_MAX_WINDOW || config->window + 2 > config->pool->count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_config = *config;
+    s_topic_len = strlen(config->topic);
+    s_ready = xQueueCreate(config->pool->count, sizeof(sn_buf_t *));
+    if (s_ready == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(pipe_task, "sn_mqtt_pipe", SN_MQTT_PIPE_STACK_SIZE, NULL,
+                                SN_MQTT_PIPE_PRIORITY, &s_task, SN_MQTT_PIPE_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create pipe task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void sn_mqtt_pipe_retry_now(void)
+{
+    if (s_task != NULL) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+bool sn_mqtt_pipe_connected(void)
+{
+    return s_connected;
+}
+
+esp_err_t sn_mqtt_pipe_send(sn_buf_t *buf)
+{
+    return xQueueSend(s_ready, &buf, 0) == pdTRUE ? ESP_OK : ESP_FAIL;
+}
+
+sn_buf_t *sn_mqtt_pipe_reclaim(void)
+{
+    sn_buf_t *buf;
+
+    if (xQueueReceive(s_ready, &buf, 0) != pdTRUE) {
+        return NULL;
+    }
+    __atomic_fetch_add(&s_reclaimed, 1, __ATOMIC_RELAXED);
+    buf->packet = NULL;         /* len and data stay: the caller may spill or resend the frame */
+    return buf;
+}
+
+void sn_mqtt_pipe_get_stats(sn_mqtt_pipe_stats_t *stats)
+{
+    uint32_t seq;
+
+    do {
+        seq = sn_stats_read_begin(&s_stats_seq);
+        *stats = s_stats;
+    } while (sn_stats_read_retry(&s_stats_seq, seq));
+    stats->reclaimed = __atomic_load_n(&s_reclaimed, __ATOMIC_RELAXED);
+}
+
+const sn_transport_t *sn_transport_mqtt(void)
+{
+    static const sn_transport_t transport = {
+        .name = "mqtt",
+        .max_frame = SIZE_MAX,
+        .connected = sn_mqtt_pipe_connected,
+        .send = sn_mqtt_pipe_send,
+        .reclaim = sn_mqtt_pipe_reclaim,
+    };
+    return &transport;
+}
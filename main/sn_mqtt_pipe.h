@@ -0,0 +1,68 @@
+/* Pipelined MQTT data connection.
+
+   esp_mqtt waits for the PUBACK of every QoS 1 publish before returning, so
+   at most one data frame can be on the wire at a time. The pipe keeps its
+   own broker connection for sample data only and keeps up to window QoS 1
+   publishes in flight: the PUBLISH header is written into the headroom in
+   front of each pooled frame and header and frame go out in a single send,
+   and the buffer goes back to the pool when its PUBACK arrives. Frames
+   still in flight when the connection drops are sent again with DUP set
+   after reconnecting. Commands and subscriptions stay on esp_mqtt.
+*/
+
+#ifndef SN_MQTT_PIPE_H
+#define SN_MQTT_PIPE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sn_pool.h"
+#include "sn_stats.h"
+
+#define SN_MQTT_PIPE_MAX_TOPIC  96
+#define SN_MQTT_PIPE_MAX_WINDOW 16
+/* Pool headroom needed for the PUBLISH header: type, remaining length, topic and packet id. */
+#define SN_MQTT_PIPE_HEADROOM   (1 + 4 + 2 + SN_MQTT_PIPE_MAX_TOPIC + 2)
+
+typedef struct {
+    const char *host;
+    const char *port;
+    const char *client_id;      /* must differ from the esp_mqtt control connection */
+    const char *username;
+    const char *password;
+    const char *topic;          /* every frame is published here */
+    sn_pool_t *pool;            /* buffers are returned here once acknowledged */
+    uint8_t window;             /* QoS 1 publishes in flight, at most pool count - 2 */
+    uint16_t keep_alive_s;
+} sn_mqtt_pipe_config_t;
+
+typedef struct {
+    uint32_t published;         /* PUBLISH packets sent, including resends */
+    uint32_t acked;
+    uint32_t resent;            /* in-flight frames sent again after a reconnect */
+    uint32_t reclaimed;         /* queued frames taken back by the publisher */
+    uint32_t reconnects;
+    uint64_t bytes;             /* bytes sent on the connection */
+    uint8_t max_inflight;
+    sn_hist_t ack_latency_us;   /* from handoff by the publisher to PUBACK */
+} sn_mqtt_pipe_stats_t;
+
+/* Spawn the pipe task; it connects, and reconnects, on its own. */
+esp_err_t sn_mqtt_pipe_start(const sn_mqtt_pipe_config_t *config);
+
+/* Skip the wait before the next connection attempt, e.g. when the station just got an address. */
+void sn_mqtt_pipe_retry_now(void);
+
+/* True while the broker connection is up. */
+bool sn_mqtt_pipe_connected(void);
+
+/* Queue a filled buffer for publishing; on success the pipe owns it until it returns to the pool,
+   on failure the caller keeps it. */
+esp_err_t sn_mqtt_pipe_send(sn_buf_t *buf);
+
+/* Take back the oldest queued buffer that has not been sent yet, frame intact, or NULL. */
+sn_buf_t *sn_mqtt_pipe_reclaim(void);
+
+void sn_mqtt_pipe_get_stats(sn_mqtt_pipe_stats_t *stats);
+
+#endif /* SN_MQTT_PIPE_H */
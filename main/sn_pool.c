@@ -0,0 +1,50 @@
+/* Fixed pool of preallocated frame buffers. */
+
+#include "sn_pool.h"
+
+esp_err_t sn_pool_init(sn_pool_t *pool, sn_buf_t *bufs, uint8_t *storage, uint8_t count, size_t buf_size,
+                       size_t headroom)
+{
+    if (pool == NULL || bufs == NULL || storage == NULL || count == 0 || buf_size <= headroom) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pool->free = xQueueCreate(count, sizeof(sn_buf_t *));
+    if (pool->free == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    pool->bufs = bufs;
+    pool->count = count;
+    pool->headroom = headroom;
+    for (uint8_t i = 0; i < count; i++) {
+        sn_buf_t *buf = &bufs[i];
+        buf->data = storage + (size_t)i * buf_size + headroom;
+        buf->cap = buf_size - headroom;
+        buf->len = 0;
+        buf->packet = NULL;
+        buf->packet_id = 0;
+        xQueueSend(pool->free, &buf, 0);
+    }
+    return ESP_OK;
+}
+
+sn_buf_t *sn_pool_acquire(sn_pool_t *pool, TickType_t wait)
+{
+    sn_buf_t *buf;
+
+    if (xQueueReceive(pool->free, &buf, wait) != pdTRUE) {
+        return NULL;
+    }
+    buf->len = 0;
+    buf->packet = NULL;
+    return buf;
+}
+
+void sn_pool_release(sn_pool_t *pool, sn_buf_t *buf)
+{
+    xQueueSend(pool->free, &buf, 0);
+}
+
+uint8_t sn_pool_available(const sn_pool_t *pool)
+{
+    return uxQueueMessagesWaiting(pool->free);
+}
@@ -0,0 +1,50 @@
+/* Fixed pool of preallocated frame buffers.
+
+   Every buffer reserves headroom in front of its payload so a transport can
+   write its packet header in place and send header and frame with a single
+   write, without copying the frame. Buffers move between the free list, the
+   publisher filling one, the transport queue and the in-flight window, and
+   come back to the free list once the transport is done with them. The pool
+   never allocates after init; storage is owned by the caller, as for the
+   sample ring.
+*/
+
+#ifndef SN_POOL_H
+#define SN_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_err.h"
+
+typedef struct {
+    uint8_t *data;              /* frame payload, preceded by the pool's headroom */
+    size_t cap;                 /* payload capacity */
+    size_t len;                 /* payload length */
+    uint8_t *packet;            /* start of the transport header in front of data, set by the transport */
+    uint16_t packet_id;         /* transport use while the buffer is queued or in flight */
+    int64_t queued_us;          /* esp_timer time the frame was handed to a transport */
+} sn_buf_t;
+
+typedef struct {
+    QueueHandle_t free;         /* free buffers, as sn_buf_t pointers */
+    sn_buf_t *bufs;
+    uint8_t count;
+    size_t headroom;
+} sn_pool_t;
+
+/* Carve storage (count * buf_size bytes) into count buffers of buf_size - headroom payload bytes. */
+esp_err_t sn_pool_init(sn_pool_t *pool, sn_buf_t *bufs, uint8_t *storage, uint8_t count, size_t buf_size,
+                       size_t headroom);
+
+/* Take a free buffer, waiting up to wait ticks. Returns NULL when none became free. */
+sn_buf_t *sn_pool_acquire(sn_pool_t *pool, TickType_t wait);
+
+/* Return a buffer to the free list. */
+void sn_pool_release(sn_pool_t *pool, sn_buf_t *buf);
+
+/* Number of buffers currently free. */
+uint8_t sn_pool_available(const sn_pool_t *pool);
+
+#endif /* SN_POOL_H */
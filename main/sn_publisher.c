@@ -0,0 +1,388 @@
+/* Publisher task: drains the sample ring into pooled frames for a data transport.
+
+   Sample sets are encoded straight from the ring into a pool buffer, which
+   goes to the transport as is once the frame is closed. A frame is closed when it
+   holds pkt_len sets, when the next set does not continue it (skipped index,
+   new channel mask, period, sample format or config version), or when it is
+   full. Packet length, compression and transport come from sn_config. A new
+   configuration is taken from sn_config as soon as it arrives but only
+   applied when a frame opens on a set stamped with its version, so sets
+   still in the ring from before the change go out under the settings they
+   were taken with. One that stops sampling is applied once the ring runs
+   dry, since no set will carry it; a staged configuration also closes an
+   open frame then, so stopping does not strand a partial frame.
+
+   With the spill log ready, frames are capped at its record size so any of
+   them can be spilled, and the ring is drained even while disconnected.
+   Backfill sends at most one spilled frame per pass, only while at least two
+   buffers are free so live frames never wait on it, and paces them with a
+   byte budget that refills at backfill_bytes_per_s, up to one record. A
+   spilled frame is marked drained once the transport has it, which then
+   owns its delivery.
+
+   The task is the only writer of the counters and updates them under
+   s_stats_seq (see sn_stats.h). The pool low-water mark is kept once per stats
+   reader. The reader swaps its mark for SN_PUBLISHER_NO_MARK, and the task
+   only ever lowers it to a free count it has just seen, so neither side loses
+   the other's update.
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sn_frame.h"
+#include "sn_spill.h"
+#include "sn_config.h"
+#include "sn_publisher.h"
+
+#define SN_PUBLISHER_CORE       0
+#define SN_PUBLISHER_PRIORITY   4
+#define SN_PUBLISHER_STACK_SIZE 4096
+#define SN_PUBLISHER_IDLE_MS    10
+#define SN_PUBLISHER_NO_MARK    UINT8_MAX       /* no frame started since the reader's last call */
+
+static const char *TAG = "sn_publisher";
+
+static sn_publisher_config_t s_config;
+static sn_publisher_stats_t s_stats;
+static uint32_t s_stats_seq;            /* odd while the task updates s_stats */
+static uint8_t s_pool_low[SN_STATS_READERS];    /* fewest free buffers since each reader's last call */
+
+/* settings in effect, owned by the task */
+static const sn_transport_t *s_transport;
+static uint16_t s_pkt_len;
+static bool s_compress;
+static sn_config_t s_staged;            /* taken from sn_config, waiting for its first sample set */
+static bool s_staged_valid;
+
+static sn_buf_t *s_buf;                 /* frame being filled */
+static sn_frame_writer_t s_writer;
+static bool s_frame_open;
+static uint32_t s_next_index;
+static uint32_t s_seq;
+static uint8_t s_frame_format;
+static uint16_t s_frame_version;
+static size_t s_frame_cap;
+
+static int64_t s_backfill_due_us;
+
+static void stats_begin(void)
+{
+    sn_stats_write_begin(&s_stats_seq);
+}
+
+static void stats_end(void)
+{
+    sn_stats_write_end(&s_stats_seq);
+}
+
+/* Move frames still queued on the old transport to the new one, oldest first, and let the old one go. */
+static void switch_transport(const sn_transport_t *next)
+{
+    sn_buf_t *buf;
+
+    while ((buf = s_transport->reclaim()) != NULL) {
+        if (next->send(buf) != ESP_OK) {
+            sn_pool_release(s_config.pool, buf);
+            stats_begin();
+            s_stats.frames_dropped++;
+            stats_end();
+        }
+    }
+    if (s_transport->detach != NULL) {
+        s_transport->detach();
+    }
+    ESP_LOGI(TAG, "Data transport %s -> %s", s_transport->name, next->name);
+    s_transport = next;
+}
+
+/* Keep the newest configuration until the sample sets it governs come up. */
+static void stage_config(void)
+{
+    const sn_config_t *config = sn_config_adopt(SN_CONFIG_PUBLISHER);
+
+    if (config != NULL) {
+        s_staged = *config;
+        s_staged_valid = true;
+    }
+}
+
+/* Take over the publishing side of the staged configuration; only called between frames. */
+static void apply_config(void)
+{
+    s_pkt_len = s_staged.pkt_len ? s_staged.pkt_len : 1;
+    s_compress = s_staged.compress;
+    if (s_transport == NULL) {
+        s_transport = s_staged.transport;
+    } else if (s_staged.transport != s_transport) {
+        switch_transport(s_staged.transport);
+    }
+    s_staged_valid = false;
+}
+
+/* Apply a staged configuration if set, the first set of the next frame, was taken under it or a later one.
+   With the ring dry (set NULL) only a configuration that stops sampling applies. */
+static void adopt_config(const sn_sample_set_t *set)
+{
+    stage_config();
+    if (!s_staged_valid) {
+        return;
+    }
+    /* sets carry the low 16 bits of the version */
+    if (set != NULL ? (int16_t)(set->config_version - (uint16_t)s_staged.version) >= 0 : !s_staged.running) {
+        apply_config();
+    }
+}
+
+static bool offline_spill(void)
+{
+    return sn_spill_ready() && !s_transport->connected();
+}
+
+static void spill_buf(sn_buf_t *buf)
+{
+    /* the backfill flag lives in the header byte, set it without re-encoding */
+    buf->data[1] |= SN_FRAME_FLAG_BACKFILL;
+    esp_err_t err = sn_spill_write(buf->data, buf->len);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Spilling a frame failed: %d", err);
+        return;
+    }
+    stats_begin();
+    s_stats.frames_spilled++;
+    stats_end();
+}
+
+/* Get a buffer for the next frame, applying the backpressure policy when the pool is empty. */
+static sn_buf_t *acquire_buf(void)
+{
+    uint8_t available = sn_pool_available(s_config.pool);
+    sn_buf_t *buf = sn_pool_acquire(s_config.pool, 0);
+
+    for (int r = 0; r < SN_STATS_READERS; r++) {
+        if (available < __atomic_load_n(&s_pool_low[r], __ATOMIC_RELAXED)) {
+            __atomic_store_n(&s_pool_low[r], available, __ATOMIC_RELAXED);
+        }
+    }
+    if (buf != NULL) {
+        return buf;
+    }
+    stats_begin();
+    s_stats.pool_waits++;
+    stats_end();
+    for (;;) {
+        bool offline = offline_spill();
+        if (offline || s_config.backpressure == SN_PUBLISHER_DROP_OLDEST) {
+            buf = s_transport->reclaim();
+            if (buf != NULL) {
+                /* offline, a queued frame is kept in the spill log rather than dropped */
+                if (offline) {
+                    spill_buf(buf);
+                } else {
+                    stats_begin();
+                    s_stats.frames_dropped++;
+                    stats_end();
+                }
+                return buf;
+            }
+        }
+        buf = sn_pool_acquire(s_config.pool, pdMS_TO_TICKS(SN_PUBLISHER_IDLE_MS));
+        if (buf != NULL) {
+            return buf;
+        }
+    }
+}
+
+static void publish_frame(void)
+{
+    s_buf->len = sn_frame_writer_finish(&s_writer);
+    s_buf->queued_us = esp_timer_get_time();
+    if (offline_spill()) {
+        spill_buf(s_buf);
+        sn_pool_release(s_config.pool, s_buf);
+    } else if (s_transport->send(s_buf) == ESP_OK) {
+        stats_begin();
+        s_stats.frames++;
+        stats_end();
+    } else {
+        sn_pool_release(s_config.pool, s_buf);
+        stats_begin();
+        s_stats.frames_dropped++;
+        stats_end();
+    }
+    s_buf = NULL;
+    s_frame_open = false;
+}
+
+/* Hand the oldest spilled frame to the pipe if the drain budget allows. Returns true when one went out. */
+static bool backfill(void)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    if (!s_transport->connected() || s_config.backfill_bytes_per_s == 0 || now_us < s_backfill_due_us ||
+        sn_pool_available(s_config.pool) < 2) {
+        return false;
+    }
+    sn_buf_t *buf = sn_pool_acquire(s_config.pool, 0);
+    if (buf == NULL) {
+        return false;
+    }
+    size_t len = sn_spill_peek(buf->data, buf->cap);
+    if (len == 0) {
+        sn_pool_release(s_config.pool, buf);
+        return false;
+    }
+    buf->len = len;
+    buf->queued_us = now_us;
+    if (s_transport->send(buf) != ESP_OK) {
+        /* the record stays pending and is tried again on a later pass */
+        sn_pool_release(s_config.pool, buf);
+        return false;
+    }
+    sn_spill_consume();
+    stats_begin();
+    s_stats.frames_backfilled++;
+    stats_end();
+
+    /* an idle budget saves up at most one record's worth */
+    int64_t earliest_us = now_us - (int64_t)sn_spill_max_record() * 1000000 / s_config.backfill_bytes_per_s;
+    if (s_backfill_due_us < earliest_us) {
+        s_backfill_due_us = earliest_us;
+    }
+    s_backfill_due_us += (int64_t)len * 1000000 / s_config.backfill_bytes_per_s;
+    return true;
+}
+
+static uint8_t frame_flags(uint8_t format)
+{
+    uint8_t coding = s_compress ? SN_FRAME_FLAG_COMPRESSED : 0;
+
+    switch (format) {
+        case SN_SAMPLE_FORMAT_SCALED16:
+            return SN_FRAME_FLAG_SCALED16 | coding;
+        case SN_SAMPLE_FORMAT_CAL_100UV:
+            return SN_FRAME_FLAG_CAL_100UV | coding;
+        default:
+            if (s_compress) {
+                return SN_FRAME_FLAG_COMPRESSED;
+            }
+            return s_config.sample_bits <= 12 ? SN_FRAME_FLAG_PACKED12 : 0;
+    }
+}
+
+static void open_frame(const sn_sample_set_t *set)
+{
+    adopt_config(set);
+
+    sn_frame_header_t hdr = {
+        .flags = frame_flags(set->format) | (set->provisional ? SN_FRAME_FLAG_PROVISIONAL : 0),
+        .node_id = s_config.node_id,
+        .seq = s_seq++,
+        .t0_us = set->timestamp_us,
+        .period_us = set->period_us,
+        .channel_mask = set->channel_mask,
+    };
+    size_t cap = s_frame_cap < s_transport->max_frame ? s_frame_cap : s_transport->max_frame;
+    s_buf = acquire_buf();
+    sn_frame_writer_begin(&s_writer, s_buf->data, s_buf->cap < cap ? s_buf->cap : cap, &hdr);
+    s_frame_format = set->format;
+    s_frame_version = set->config_version;
+    s_frame_open = true;
+}
+
+static void publisher_task(void *arg)
+{
+    s_frame_cap = SN_PUBLISHER_MAX_FRAME_LEN;
+    if (sn_spill_ready() && sn_spill_max_record() < s_frame_cap) {
+        s_frame_cap = sn_spill_max_record();
+    }
+
+    for (;;) {
+        stage_config();
+        const sn_sample_set_t *set = s_transport->connected() || sn_spill_ready() ? sn_ring_front(s_config.ring) : NULL;
+        if (set == NULL) {
+            if (s_frame_open && s_staged_valid) {
+                publish_frame();
+            }
+            if (!s_frame_open) {
+                adopt_config(NULL);
+            }
+            if (!sn_spill_ready() || !backfill()) {
+                vTaskDelay(pdMS_TO_TICKS(SN_PUBLISHER_IDLE_MS));
+            }
+            continue;
+        }
+
+        if (s_frame_open && (set->index != s_next_index ||
+                             set->channel_mask != s_writer.hdr.channel_mask ||
+                             set->period_us != s_writer.hdr.period_us ||
+                             set->format != s_frame_format ||
+                             set->config_version != s_frame_version ||
+                             set->provisional != !!(s_writer.hdr.flags & SN_FRAME_FLAG_PROVISIONAL))) {
+            publish_frame();
+        }
+        if (!s_frame_open) {
+            open_frame(set);
+        }
+        uint32_t start = sn_stats_cycles();
+        if (!sn_frame_writer_add(&s_writer, set->samples)) {
+            publish_frame();
+            open_frame(set);
+            start = sn_stats_cycles();
+            sn_frame_writer_add(&s_writer, set->samples);
+        }
+        stats_begin();
+        sn_hist_add(&s_stats.encode_ns, sn_stats_elapsed_ns(start));
+        stats_end();
+        s_next_index = set->index + 1;
+        sn_ring_pop(s_config.ring);
+
+        if (s_writer.hdr.sample_count >= s_pkt_len) {
+            publish_frame();
+            if (sn_spill_ready()) {
+                backfill();
+            }
+        }
+    }
+}
+
+esp_err_t sn_publisher_start(const sn_publisher_config_t *config)
+{
+    if (config == NULL || config->ring == NULL || config->pool == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_config = *config;
+    for (int r = 0; r < SN_STATS_READERS; r++) {
+        s_pool_low[r] = SN_PUBLISHER_NO_MARK;
+    }
+    stage_config();
+    if (s_staged_valid) {
+        apply_config();
+    }
+    if (s_transport == NULL) {
+        ESP_LOGE(TAG, "No configuration, call sn_config_init() first");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xTaskCreatePinnedToCore(publisher_task, "sn_publisher", SN_PUBLISHER_STACK_SIZE, NULL,
+                                SN_PUBLISHER_PRIORITY, NULL, SN_PUBLISHER_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create publisher task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void sn_publisher_get_stats(sn_stats_reader_t reader, sn_publisher_stats_t *stats)
+{
+    uint32_t seq;
+
+    do {
+        seq = sn_stats_read_begin(&s_stats_seq);
+        *stats = s_stats;
+    } while (sn_stats_read_retry(&s_stats_seq, seq));
+    stats->pool_low_water = __atomic_exchange_n(&s_pool_low[reader], SN_PUBLISHER_NO_MARK, __ATOMIC_RELAXED);
+    if (stats->pool_low_water == SN_PUBLISHER_NO_MARK) {
+        /* no frame started in the window, the pool stood where it is now */
+        stats->pool_low_water = s_config.pool != NULL ? sn_pool_available(s_config.pool) : 0;
+    }
+}
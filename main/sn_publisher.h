@@ -0,0 +1,70 @@
+/* Publisher task: drains the sample ring into pooled frames for a data transport.
+
+   Runs on core 0 next to the Wi-Fi and MQTT tasks so network stalls never
+   reach the sampler on core 1; when the publisher falls behind the ring
+   overruns and the sampler counts the drops. Sample sets are batched into
+   sn_frame payloads of up to pkt_len sets each, encoded in place in a
+   buffer from the frame pool and handed to the current sn_transport_t
+   without copying. Frames are capped at the transport's max_frame. Packet
+   length, compression and transport follow sn_config and change only at
+   frame boundaries. With compression on the samples are coded by sn_codec
+   as they are added, so a frame still holds pkt_len sets but takes fewer
+   bytes on the wire and in the spill log.
+
+   When every buffer is queued or in flight the backpressure policy applies:
+   SN_PUBLISHER_DROP_OLDEST takes back the oldest frame not yet sent, while
+   SN_PUBLISHER_BLOCK waits for the transport to free one and lets the ring absorb
+   the stall. Frames already on the wire are never dropped.
+
+   Once sn_spill_init() has succeeded, frames finished while the transport is down
+   go to the spill log instead, together with frames still queued, and after
+   reconnecting the log is drained at backfill_bytes_per_s between live
+   frames. Live data always goes first, so its latency does not grow with the
+   backlog. Spilled frames carry SN_FRAME_FLAG_BACKFILL.
+*/
+
+#ifndef SN_PUBLISHER_H
+#define SN_PUBLISHER_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sn_ring.h"
+#include "sn_pool.h"
+#include "sn_transport.h"
+#include "sn_stats.h"
+
+/* Largest frame the publisher will build; frame pool buffers hold this plus transport headroom. */
+#define SN_PUBLISHER_MAX_FRAME_LEN  4096
+
+typedef enum {
+    SN_PUBLISHER_DROP_OLDEST,   /* reuse the oldest frame that has not been sent yet */
+    SN_PUBLISHER_BLOCK,         /* wait for a buffer to come back from the pipe */
+} sn_publisher_backpressure_t;
+
+typedef struct {
+    sn_ring_t *ring;            /* ring filled by the sampler */
+    sn_pool_t *pool;            /* frame buffers, shared with the transports */
+    uint16_t node_id;           /* written into every frame header */
+    uint8_t sample_bits;        /* source resolution; raw samples of 12 bits or less are packed */
+    uint32_t backfill_bytes_per_s;  /* spill log drain rate after reconnecting */
+    sn_publisher_backpressure_t backpressure;
+} sn_publisher_config_t;
+
+typedef struct {
+    uint32_t frames;            /* live frames handed to the transport */
+    uint32_t frames_dropped;    /* frames discarded by SN_PUBLISHER_DROP_OLDEST or refused by the transport */
+    uint32_t frames_spilled;    /* frames written to the spill log */
+    uint32_t frames_backfilled; /* spilled frames handed to the transport again */
+    uint32_t pool_waits;        /* times a frame had to wait for a buffer */
+    uint8_t pool_low_water;     /* fewest free buffers seen when starting a frame, since the reader's last call */
+    sn_hist_t encode_ns;        /* time to add one sample set to a frame */
+} sn_publisher_stats_t;
+
+/* Take the current sn_config and spawn the publisher task. */
+esp_err_t sn_publisher_start(const sn_publisher_config_t *config);
+
+/* Snapshot of the publisher counters. The pool low-water mark covers the time since the same reader's
+   previous call and restarts with it. */
+void sn_publisher_get_stats(sn_stats_reader_t reader, sn_publisher_stats_t *stats);
+
+#endif /* SN_PUBLISHER_H */
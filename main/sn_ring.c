@@ -0,0 +1,72 @@
+/* Single-producer/single-consumer lock-free ring of sample sets.
+
+   Uses the GCC __atomic builtins so the same code runs on both ESP32 cores and
+   on a host; on Xtensa the acquire/release orderings emit the needed memw.
+*/
+
+#include <stddef.h>
+#include "sn_ring.h"
+
+bool sn_ring_init(sn_ring_t *ring, sn_sample_set_t *slots, uint32_t size)
+{
+    if (ring == NULL || slots == NULL || size == 0 || (size & (size - 1)) != 0) {
+        return false;
+    }
+    ring->slots = slots;
+    ring->size = size;
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    ring->high_water = 0;
+    return true;
+}
+
+sn_sample_set_t *sn_ring_claim(sn_ring_t *ring)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t used = head - tail;
+
+    if (used >= ring->size) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    if (used + 1 > ring->high_water) {
+        ring->high_water = used + 1;
+    }
+    return &ring->slots[head & ring->mask];
+}
+
+void sn_ring_commit(sn_ring_t *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+const sn_sample_set_t *sn_ring_front(sn_ring_t *ring)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        return NULL;
+    }
+    return &ring->slots[tail & ring->mask];
+}
+
+void sn_ring_pop(sn_ring_t *ring)
+{
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t sn_ring_count(const sn_ring_t *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+uint32_t sn_ring_dropped(const sn_ring_t *ring)
+{
+    return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
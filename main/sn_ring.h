@@ -0,0 +1,46 @@
+/* Single-producer/single-consumer lock-free ring of sample sets.
+
+   The sampler task is the only writer of head and the publisher task the only
+   writer of tail, so neither side ever takes a lock or allocates. Slots are
+   claimed and filled in place, then made visible with a release store.
+*/
+
+#ifndef SN_RING_H
+#define SN_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sn_sample.h"
+
+typedef struct {
+    sn_sample_set_t *slots;     /* caller-owned storage, size entries */
+    uint32_t size;              /* power of two */
+    uint32_t mask;
+    uint32_t head;              /* next slot to write, producer owned */
+    uint32_t tail;              /* next slot to read, consumer owned */
+    uint32_t dropped;           /* sample sets discarded because the ring was full, producer owned */
+    uint32_t high_water;        /* deepest fill level seen by the producer */
+} sn_ring_t;
+
+/* Attach storage to a ring. size must be a power of two. Returns false on a bad size. */
+bool sn_ring_init(sn_ring_t *ring, sn_sample_set_t *slots, uint32_t size);
+
+/* Producer: get the next free slot, or NULL (and count a drop) when the ring is full. */
+sn_sample_set_t *sn_ring_claim(sn_ring_t *ring);
+
+/* Producer: make the slot returned by the last sn_ring_claim() visible to the consumer. */
+void sn_ring_commit(sn_ring_t *ring);
+
+/* Consumer: oldest unread slot, or NULL when the ring is empty. */
+const sn_sample_set_t *sn_ring_front(sn_ring_t *ring);
+
+/* Consumer: release the slot returned by sn_ring_front(). */
+void sn_ring_pop(sn_ring_t *ring);
+
+/* Number of committed, unread slots. Safe to call from either side. */
+uint32_t sn_ring_count(const sn_ring_t *ring);
+
+/* Sample sets dropped on overrun since init. Safe to call from either side. */
+uint32_t sn_ring_dropped(const sn_ring_t *ring);
+
+#endif /* SN_RING_H */
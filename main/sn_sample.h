@@ -0,0 +1,44 @@
+/* Sample types shared by the acquisition and publishing stages of the sensor node.
+
+   Kept free of ESP-IDF includes so the pipeline data structures can also be
+   compiled on a host machine.
+*/
+
+#ifndef SN_SAMPLE_H
+#define SN_SAMPLE_H
+
+#include <stdint.h>
+
+/* Upper bound on channels in a sample set. ADC1 only exposes 8, the planned SPI ADC board 16. */
+#define SN_MAX_CHANNELS 16
+
+/* Units of the values in a sample set. */
+typedef enum {
+    SN_SAMPLE_FORMAT_RAW = 0,           /* ADC codes at the source resolution */
+    SN_SAMPLE_FORMAT_SCALED16,          /* oversampled ADC codes scaled to 16 bits full scale */
+    SN_SAMPLE_FORMAT_CAL_100UV,         /* calibrated input voltage in units of 100 uV */
+} sn_sample_format_t;
+
+/* One timestamped reading of every enabled channel. */
+typedef struct {
+    int64_t timestamp_us;               /* disciplined time (sn_clock) at which the scan started */
+    uint32_t index;                     /* running sample-set counter since sampling started */
+    uint32_t period_us;                 /* nominal sample period in effect for this set */
+    uint16_t channel_mask;              /* bit n set when channel n is present in samples[] */
+    uint8_t channel_count;              /* number of valid entries in samples[] */
+    uint8_t format;                     /* sn_sample_format_t of samples[] */
+    uint16_t config_version;            /* low bits of the sn_config version the set was taken under */
+    uint8_t provisional;                /* timestamp_us is on the clock's provisional timeline, see sn_clock.h */
+    uint16_t samples[SN_MAX_CHANNELS];  /* readings, packed in ascending channel order */
+} sn_sample_set_t;
+
+/* A block of channel-interleaved sample sets, owned by whoever produced it and valid until its next call. */
+typedef struct {
+    const uint16_t *samples;    /* count * channel_count values, channel-interleaved */
+    uint32_t count;             /* sample sets in the block */
+    int64_t timestamp_us;       /* esp_timer time of the first set; 0 lets the sampler stamp polled reads */
+    uint32_t period_us;         /* spacing of the sets in the block */
+    uint8_t format;             /* sn_sample_format_t of samples */
+} sn_sample_block_t;
+
+#endif /* SN_SAMPLE_H */
@@ -0,0 +1,423 @@
+/* Continuous sampler.
+
+   For polled sources the esp_timer callback only notifies the sampler task;
+   the scan itself runs on core 1 so Wi-Fi and MQTT work on core 0 cannot
+   delay it. A notification count above one means ticks were coalesced while
+   a scan was still running. Self-paced sources are read in blocks and every
+   set is stamped from the block's first timestamp and period. Source
+   timestamps are esp_timer readings, converted once per block to the
+   disciplined clock.
+
+   New configurations are picked up by the task between reads, so the
+   source, the filter state and the polling timer are only ever touched from
+   core 1. The source is only stopped and reconfigured when the rate,
+   channels, oversampling or running state change; other versions just
+   change the stamp. Settings the source rejects are replaced by the
+   previous ones, and sampling stops if those fail too. While stopped the
+   task checks for a new one every SN_SAMPLER_IDLE_MS.
+
+   The task is the only writer of the counters and updates them under
+   s_stats_seq (see sn_stats.h); readers on the other core copy until no
+   update overlapped the copy. Interval extremes are kept once per reader; a reader restarts
+   its window by posting the sequence its copy was taken at, and the task
+   resets the window before the next interval goes in, carrying over the
+   last one if it arrived after the copy. The ring high-water mark needs no
+   such care: the reader swaps its mark for 0, and the task only ever
+   raises it to a fill level it has just seen.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sn_clock.h"
+#include "sn_boot.h"
+#include "sn_sampler.h"
+
+#define SN_SAMPLER_CORE         1
+#define SN_SAMPLER_PRIORITY     (configMAX_PRIORITIES - 2)
+#define SN_SAMPLER_STACK_SIZE   4096
+#define SN_SAMPLER_BLOCK_SETS   SN_DSP_BLOCK_SETS   /* sets requested per read from a self-paced source */
+#define SN_SAMPLER_READ_TIMEOUT_MS 100
+#define SN_SAMPLER_IDLE_MS      100
+
+static const char *TAG = "sn_sampler";
+
+static sn_ring_t *s_ring;
+static sn_source_t *s_source;
+static const uint32_t *s_lut;
+static TaskHandle_t s_task;
+static esp_timer_handle_t s_timer;
+static uint32_t s_index;
+static sn_sampler_stats_t s_stats;
+static uint32_t s_stats_seq;            /* odd while the task updates s_stats or s_windows */
+
+typedef struct {
+    uint32_t min_interval_us;
+    uint32_t max_interval_us;
+} sampler_window_t;
+
+static sampler_window_t s_windows[SN_STATS_READERS];     /* written by the task only */
+static uint32_t s_taken[SN_STATS_READERS];    /* 1 + s_stats_seq of the reader's last copy, 0 once reset */
+static uint32_t s_last_interval_us;             /* 0 after a restart */
+static uint32_t s_last_interval_seq;            /* s_stats_seq before the update that added it */
+static uint32_t s_ring_high[SN_STATS_READERS];  /* deepest fill since each reader's last call */
+
+/* settings in effect, owned by the task */
+static uint32_t s_period_us;
+static uint32_t s_tick_us;              /* nominal polling interval */
+static sn_config_t s_applied;           /* configuration in effect */
+static uint16_t s_version;
+static bool s_running;
+static bool s_source_started;
+static bool s_restart_interval;
+static sn_dsp_t s_dsp;
+static bool s_dsp_active;
+
+static void sampler_timer_cb(void *arg)
+{
+    xTaskNotifyGive(s_task);
+}
+
+static void stats_begin(void)
+{
+    sn_stats_write_begin(&s_stats_seq);
+}
+
+static void stats_end(void)
+{
+    sn_stats_write_end(&s_stats_seq);
+}
+
+static void window_reset(sampler_window_t *window)
+{
+    window->min_interval_us = UINT32_MAX;
+    window->max_interval_us = 0;
+}
+
+static void window_add(sampler_window_t *window, uint32_t interval_us)
+{
+    if (interval_us < window->min_interval_us) {
+        window->min_interval_us = interval_us;
+    }
+    if (interval_us > window->max_interval_us) {
+        window->max_interval_us = interval_us;
+    }
+}
+
+/* Record a scan interval in every reader's window, restarting those a reader has taken; call between
+   stats_begin() and stats_end(). */
+static void add_interval(uint32_t interval_us)
+{
+    uint32_t seq = s_stats_seq - 1;     /* the even value readers saw before this update */
+
+    for (int r = 0; r < SN_STATS_READERS; r++) {
+        uint32_t taken = __atomic_exchange_n(&s_taken[r], 0, __ATOMIC_ACQUIRE);
+        if (taken != 0) {
+            window_reset(&s_windows[r]);
+            /* a copy at seq holds every update that began before it */
+            if (s_last_interval_us != 0 && (int32_t)(s_last_interval_seq - (taken - 1)) >= 0) {
+                window_add(&s_windows[r], s_last_interval_us);
+            }
+        }
+        window_add(&s_windows[r], interval_us);
+    }
+    s_last_interval_us = interval_us;
+    s_last_interval_seq = seq;
+}
+
+static void push_block(const sn_sample_block_t *block)
+{
+    uint8_t channel_count = __builtin_popcount(s_source->channel_mask);
+    const uint16_t *samples = block->samples;
+    bool provisional;
+    int64_t t0_us = sn_clock_convert(block->timestamp_us, &provisional);
+
+    uint32_t pushed = 0;
+
+    for (uint32_t k = 0; k < block->count; k++, samples += channel_count) {
+        /* the index advances even when the ring is full so gaps show up downstream */
+        uint32_t index = s_index++;
+        sn_sample_set_t *set = sn_ring_claim(s_ring);
+        if (set == NULL) {
+            continue;
+        }
+        set->timestamp_us = t0_us + (int64_t)k * block->period_us;
+        set->index = index;
+        set->period_us = s_period_us;
+        set->channel_mask = s_source->channel_mask;
+        set->channel_count = channel_count;
+        set->format = block->format;
+        set->config_version = s_version;
+        set->provisional = provisional;
+        memcpy(set->samples, samples, channel_count * sizeof(uint16_t));
+        sn_ring_commit(s_ring);
+        pushed++;
+    }
+    if (pushed > 0 && s_stats.sample_sets == 0) {
+        sn_boot_mark(SN_BOOT_FIRST_SAMPLE);
+    }
+    stats_begin();
+    s_stats.sample_sets += pushed;
+    stats_end();
+
+    uint32_t used = sn_ring_count(s_ring);
+    for (int r = 0; r < SN_STATS_READERS; r++) {
+        if (used > __atomic_load_n(&s_ring_high[r], __ATOMIC_RELAXED)) {
+            __atomic_store_n(&s_ring_high[r], used, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void process_block(const sn_sample_block_t *block)
+{
+    if (s_dsp_active) {
+        sn_sample_block_t out;
+        sn_dsp_process(&s_dsp, block, &out);
+        push_block(&out);
+    } else {
+        push_block(block);
+    }
+}
+
+static uint32_t source_rate(const sn_config_t *config)
+{
+    return (uint32_t)config->rate_hz * config->dsp.ratio;
+}
+
+static bool same_acquisition(const sn_config_t *a, const sn_config_t *b)
+{
+    return a->rate_hz == b->rate_hz && a->channel_mask == b->channel_mask && a->dsp.ratio == b->dsp.ratio &&
+           a->dsp.filter_mask == b->dsp.filter_mask && a->dsp.calibrate == b->dsp.calibrate;
+}
+
+/* Switch to a new configuration between two reads and acknowledge it. */
+static void apply_config(const sn_config_t *config)
+{
+    bool reconfigure = !same_acquisition(config, &s_applied);
+    sn_config_ack_t ack = {
+        .version = config->version,
+        .index = s_index,
+        .result = ESP_OK,
+    };
+
+    if (reconfigure || config->running != s_running) {
+        if (s_source_started) {
+            sn_source_stop(s_source);
+            s_source_started = false;
+        }
+        if (!s_source->self_paced) {
+            esp_timer_stop(s_timer); /* fails harmlessly when the timer is not running */
+        }
+        if (reconfigure) {
+            ack.result = sn_source_configure(s_source, config->channel_mask, source_rate(config));
+        }
+        if (ack.result != ESP_OK) {
+            ESP_LOGE(TAG, "Source %s rejected 0x%04x at %d hz, keeping version %u", s_source->ops->name,
+                     config->channel_mask, source_rate(config), s_applied.version);
+            config = &s_applied;
+            if (sn_source_configure(s_source, config->channel_mask, source_rate(config)) != ESP_OK) {
+                ESP_LOGE(TAG, "Source %s failed to restore version %u, sampling stopped", s_source->ops->name,
+                         config->version);
+                s_applied.running = false;
+            }
+        }
+        s_dsp_active = sn_dsp_active(&config->dsp) &&
+                       sn_dsp_init(&s_dsp, &config->dsp, s_source->channel_mask, s_source->sample_bits, s_lut);
+        s_period_us = 1000000 / config->rate_hz;
+        s_tick_us = 1000000 / source_rate(config);
+        s_running = config->running;
+
+        /* self-paced sources are restarted by the read loop */
+        if (s_running && !s_source->self_paced) {
+            s_restart_interval = true;
+            esp_timer_start_periodic(s_timer, s_tick_us);
+        }
+    }
+    s_applied = *config;
+    s_version = (uint16_t)config->version;
+    ack.applied = config->version;
+    ack.running = s_running;
+    sn_config_post_ack(&ack);
+}
+
+static void sample_polled(void)
+{
+    static int64_t last_us;
+    sn_sample_block_t block;
+    uint32_t ticks = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SN_SAMPLER_IDLE_MS));
+    int64_t now_us = esp_timer_get_time();
+
+    if (ticks == 0 || !s_running) {
+        return;
+    }
+    stats_begin();
+    if (ticks > 1) {
+        s_stats.missed_ticks += ticks - 1;
+    }
+    if (s_restart_interval) {
+        s_restart_interval = false;
+        s_last_interval_us = 0;
+    } else {
+        uint32_t interval_us = (uint32_t)(now_us - last_us);
+        add_interval(interval_us);
+        uint32_t jitter_us = interval_us > s_tick_us ? interval_us - s_tick_us : s_tick_us - interval_us;
+        sn_hist_add(&s_stats.jitter_ns, jitter_us * 1000);
+    }
+    stats_end();
+    last_us = now_us;
+
+    uint32_t start = sn_stats_cycles();
+    esp_err_t err = sn_source_read_block(s_source, 1, &block, 0);
+    stats_begin();
+    sn_hist_add(&s_stats.read_ns, sn_stats_elapsed_ns(start));
+    s_stats.read_errors += err != ESP_OK;
+    stats_end();
+    if (err != ESP_OK) {
+        return;
+    }
+    if (block.timestamp_us == 0) {
+        block.timestamp_us = now_us;
+    }
+    process_block(&block);
+}
+
+static void sample_self_paced(void)
+{
+    sn_sample_block_t block;
+
+    if (!s_running) {
+        vTaskDelay(pdMS_TO_TICKS(SN_SAMPLER_IDLE_MS));
+        return;
+    }
+    if (!s_source_started) {
+        if (sn_source_start(s_source) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to start source %s", s_source->ops->name);
+            vTaskDelay(pdMS_TO_TICKS(SN_SAMPLER_IDLE_MS));
+            return;
+        }
+        s_source_started = true;
+    }
+    if (sn_source_read_block(s_source, SN_SAMPLER_BLOCK_SETS, &block, SN_SAMPLER_READ_TIMEOUT_MS) != ESP_OK) {
+        stats_begin();
+        s_stats.read_errors++;
+        stats_end();
+        return;
+    }
+    process_block(&block);
+}
+
+static void sampler_task(void *arg)
+{
+    for (;;) {
+        const sn_config_t *config = sn_config_adopt(SN_CONFIG_SAMPLER);
+        if (config != NULL) {
+            apply_config(config);
+        }
+        if (s_source->self_paced) {
+            sample_self_paced();
+        } else {
+            sample_polled();
+        }
+    }
+}
+
+esp_err_t sn_sampler_check(const sn_config_t *config)
+{
+    uint32_t source_rate = (uint32_t)config->rate_hz * config->dsp.ratio;
+
+    if (s_source == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (config->rate_hz == 0 || config->rate_hz > SN_SAMPLER_MAX_RATE_HZ || config->dsp.ratio == 0 ||
+        source_rate > SN_SAMPLER_MAX_SOURCE_RATE_HZ) {
+        ESP_LOGE(TAG, "Rejecting sample rate of %d hz with oversampling x%d", config->rate_hz, config->dsp.ratio);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->channel_mask == 0 || (config->channel_mask & ~s_source->supported_mask) != 0) {
+        ESP_LOGE(TAG, "Rejecting channel mask 0x%04x, %s scans 0x%04x", config->channel_mask, s_source->ops->name,
+                 s_source->supported_mask);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (sn_dsp_active(&config->dsp) && !sn_dsp_check(&config->dsp, s_source->sample_bits, s_lut)) {
+        ESP_LOGE(TAG, "Rejecting oversampling x%d%s", config->dsp.ratio, config->dsp.calibrate ? " with calibration" : "");
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t sn_sampler_start(const sn_sampler_config_t *config, sn_ring_t *ring)
+{
+    if (config == NULL || config->source == NULL || config->initial == NULL || ring == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_task != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const sn_config_t *initial = config->initial;
+    s_source = config->source;
+    s_lut = config->lut;
+    esp_err_t err = sn_sampler_check(initial);
+    if (err == ESP_OK) {
+        err = sn_source_open(s_source);
+    }
+    if (err == ESP_OK) {
+        err = sn_source_configure(s_source, initial->channel_mask, source_rate(initial));
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set up source %s: %d", s_source->ops->name, err);
+        return err;
+    }
+    s_ring = ring;
+    /* configured but stopped: adopting the initial version only has to start it */
+    s_applied = *initial;
+    s_applied.running = false;
+    memset(&s_stats, 0, sizeof(s_stats));
+    for (int r = 0; r < SN_STATS_READERS; r++) {
+        window_reset(&s_windows[r]);
+    }
+
+    if (!s_source->self_paced && s_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = sampler_timer_cb,
+            .name = "sn_sampler",
+        };
+        err = esp_timer_create(&timer_args, &s_timer);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    /* the task adopts the current configuration, and starts the source or the timer, before its first read */
+    BaseType_t ret = xTaskCreatePinnedToCore(sampler_task, "sn_sampler", SN_SAMPLER_STACK_SIZE, NULL,
+                                             SN_SAMPLER_PRIORITY, &s_task, SN_SAMPLER_CORE);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create sampler task");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Starting %s source on channel mask 0x%04x at %d hz, oversampling x%d", s_source->ops->name,
+             initial->channel_mask, initial->rate_hz, initial->dsp.ratio);
+    return ESP_OK;
+}
+
+void sn_sampler_get_stats(sn_stats_reader_t reader, sn_sampler_stats_t *stats)
+{
+    uint32_t seq;
+
+    do {
+        seq = sn_stats_read_begin(&s_stats_seq);
+        *stats = s_stats;
+        stats->min_interval_us = s_windows[reader].min_interval_us;
+        stats->max_interval_us = s_windows[reader].max_interval_us;
+    } while (sn_stats_read_retry(&s_stats_seq, seq));
+    __atomic_store_n(&s_taken[reader], seq + 1, __ATOMIC_RELEASE);
+
+    if (s_source != NULL) {
+        stats->missed_ticks += s_source->missed;
+    }
+    if (s_ring != NULL) {
+        stats->ring_drops = sn_ring_dropped(s_ring);
+    }
+    stats->ring_high_water = __atomic_exchange_n(&s_ring_high[reader], 0, __ATOMIC_RELAXED);
+}
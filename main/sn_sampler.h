@@ -0,0 +1,61 @@
+/* Continuous sampler.
+
+   Runs a high priority task pinned to core 1 that reads blocks from an
+   sn_source_t and pushes one timestamped sample set per scan into an
+   sn_ring_t. Polled sources are paced by an esp_timer firing at the
+   configured rate; self-paced (DMA) sources are read as fast as they deliver.
+   With oversampling the source runs at ratio times the output rate and every
+   block passes through the sn_dsp decimator before reaching the ring.
+   Nothing on this path allocates or blocks on the network.
+
+   Rate, channels, oversampling and start/stop come from sn_config: the task
+   adopts a new configuration between two reads, stamps its version into
+   every sample set and acknowledges it with the first index taken under it.
+*/
+
+#ifndef SN_SAMPLER_H
+#define SN_SAMPLER_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sn_ring.h"
+#include "sn_source.h"
+#include "sn_dsp.h"
+#include "sn_config.h"
+#include "sn_stats.h"
+
+#define SN_SAMPLER_MAX_RATE_HZ          2000
+#define SN_SAMPLER_MAX_SOURCE_RATE_HZ   32000   /* output rate times oversampling ratio */
+
+typedef struct {
+    sn_source_t *source;        /* backend the samples are read from */
+    const sn_config_t *initial; /* settings the source is checked against at start; the task then follows sn_config */
+    const uint32_t *lut;        /* calibration table for dsp.calibrate, see sn_calib_lut() */
+} sn_sampler_config_t;
+
+typedef struct {
+    uint32_t sample_sets;       /* sample sets written to the ring */
+    uint32_t missed_ticks;      /* timer ticks that fired while the previous scan was still running, and
+                                   conversions a self-paced source dropped */
+    uint32_t ring_drops;        /* sample sets lost because the publisher fell behind */
+    uint32_t read_errors;       /* failed source reads */
+    uint32_t min_interval_us;   /* shortest gap between consecutive polled scans since the reader's last call */
+    uint32_t max_interval_us;   /* longest gap between consecutive polled scans since the reader's last call */
+    uint32_t ring_high_water;   /* deepest ring fill level since the reader's last call */
+    sn_hist_t jitter_ns;        /* distance of each polled scan interval from the nominal one */
+    sn_hist_t read_ns;          /* duration of each polled source read */
+} sn_sampler_stats_t;
+
+/* Open and configure the source and spawn the sampler task, which starts sampling once it
+   adopts a running configuration. */
+esp_err_t sn_sampler_start(const sn_sampler_config_t *config, sn_ring_t *ring);
+
+/* Check the sampling side of a configuration against the source before it is committed. */
+esp_err_t sn_sampler_check(const sn_config_t *config);
+
+/* Consistent snapshot of the sampler counters, safe from any core. The interval extremes and the ring
+   high-water mark cover the time since the same reader's previous call and restart with it; other
+   readers' windows are not touched. */
+void sn_sampler_get_stats(sn_stats_reader_t reader, sn_sampler_stats_t *stats);
+
+#endif /* SN_SAMPLER_H */
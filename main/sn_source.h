@@ -0,0 +1,79 @@
+/* Pluggable sample sources.
+
+   A source turns a channel mask and a rate into blocks of channel-interleaved
+   raw samples. Polled sources do one scan per read and are paced by the
+   sampler's timer; self-paced sources (DMA-driven) are clocked by hardware
+   and block in read until a buffer is complete. A self-paced source that
+   has to drop conversions because it was not read in time counts them in
+   missed.
+
+   Backends are singletons returned by their factory function, so creating a
+   source never allocates. This header and the synthetic source have no
+   ESP-IDF dependencies besides esp_err.h, so they also build on a host; the
+   SPI ADC source is declared in sn_source_spi.h, and the factories that need
+   driver types are in sn_source_hw.h.
+*/
+
+#ifndef SN_SOURCE_H
+#define SN_SOURCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sn_sample.h"
+
+typedef struct sn_source sn_source_t;
+
+typedef struct {
+    const char *name;
+    esp_err_t (*open)(sn_source_t *src);
+    esp_err_t (*configure)(sn_source_t *src, uint16_t channel_mask, uint32_t rate_hz);
+    esp_err_t (*start)(sn_source_t *src);
+    esp_err_t (*read_block)(sn_source_t *src, uint32_t max_sets, sn_sample_block_t *block, uint32_t timeout_ms);
+    esp_err_t (*stop)(sn_source_t *src);
+} sn_source_ops_t;
+
+struct sn_source {
+    const sn_source_ops_t *ops;
+    bool self_paced;            /* true when the hardware clocks the samples */
+    uint8_t sample_bits;        /* resolution of the raw samples */
+    uint16_t supported_mask;    /* channels this backend can scan */
+    uint16_t channel_mask;      /* channels currently configured */
+    uint32_t rate_hz;           /* sample sets per second currently configured */
+    volatile uint32_t missed;   /* conversions lost before they could be read */
+};
+
+/* Deterministic waveforms (sine, triangle, square, ramp by channel) for benchmarks and bench-top runs.
+   base_freq_hz is the frequency of channel 0; channel n runs at (n + 1) * base_freq_hz. */
+sn_source_t *sn_source_synth(uint32_t base_freq_hz);
+
+static inline esp_err_t sn_source_open(sn_source_t *src)
+{
+    return src->ops->open ? src->ops->open(src) : ESP_OK;
+}
+
+static inline esp_err_t sn_source_configure(sn_source_t *src, uint16_t channel_mask, uint32_t rate_hz)
+{
+    if (channel_mask == 0 || (channel_mask & ~src->supported_mask) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return src->ops->configure(src, channel_mask, rate_hz);
+}
+
+static inline esp_err_t sn_source_start(sn_source_t *src)
+{
+    return src->ops->start ? src->ops->start(src) : ESP_OK;
+}
+
+static inline esp_err_t sn_source_read_block(sn_source_t *src, uint32_t max_sets, sn_sample_block_t *block,
+                                             uint32_t timeout_ms)
+{
+    return src->ops->read_block(src, max_sets, block, timeout_ms);
+}
+
+static inline esp_err_t sn_source_stop(sn_source_t *src)
+{
+    return src->ops->stop ? src->ops->stop(src) : ESP_OK;
+}
+
+#endif /* SN_SOURCE_H */
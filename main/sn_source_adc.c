@@ -0,0 +1,94 @@
+/* Polled ADC backend: the original adc1_get_raw/adc2_get_raw path.
+
+   Each read is one blocking driver call per channel, paced by the sampler's
+   timer. ADC2 is shared with the Wi-Fi driver, so adc2_get_raw can time out
+   while Wi-Fi is active; such samples are reported as 0.
+*/
+
+#include "esp_log.h"
+#include "sn_source_hw.h"
+
+#define SN_SOURCE_ADC_MAX_CHANNELS 10
+
+static const char *TAG = "sn_source_adc";
+
+typedef struct {
+    sn_source_t base;
+    adc_unit_t unit;
+    adc_atten_t atten;
+    uint8_t channel_count;
+    uint8_t channels[SN_SOURCE_ADC_MAX_CHANNELS];
+    uint16_t samples[SN_SOURCE_ADC_MAX_CHANNELS];
+} adc_source_t;
+
+static adc_source_t s_source;
+
+static esp_err_t adc_configure(sn_source_t *src, uint16_t channel_mask, uint32_t rate_hz)
+{
+    adc_source_t *adc = (adc_source_t *)src;
+    esp_err_t err;
+
+    if (adc->unit == ADC_UNIT_1) {
+        err = adc1_config_width(ADC_WIDTH_BIT_12);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    adc->channel_count = 0;
+    for (int ch = 0; ch < SN_SOURCE_ADC_MAX_CHANNELS; ch++) {
+        if (!(channel_mask & (1 << ch))) {
+            continue;
+        }
+        if (adc->unit == ADC_UNIT_1) {
+            err = adc1_config_channel_atten((adc1_channel_t)ch, adc->atten);
+        } else {
+            err = adc2_config_channel_atten((adc2_channel_t)ch, adc->atten);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to configure ADC%d channel %d", adc->unit, ch);
+            return err;
+        }
+        adc->channels[adc->channel_count++] = ch;
+    }
+    src->channel_mask = channel_mask;
+    src->rate_hz = rate_hz;
+    return ESP_OK;
+}
+
+static esp_err_t adc_read_block(sn_source_t *src, uint32_t max_sets, sn_sample_block_t *block, uint32_t timeout_ms)
+{
+    adc_source_t *adc = (adc_source_t *)src;
+
+    for (int i = 0; i < adc->channel_count; i++) {
+        if (adc->unit == ADC_UNIT_1) {
+            adc->samples[i] = (uint16_t)adc1_get_raw((adc1_channel_t)adc->channels[i]);
+        } else {
+            int raw = 0;
+            adc2_get_raw((adc2_channel_t)adc->channels[i], ADC_WIDTH_BIT_12, &raw);
+            adc->samples[i] = (uint16_t)raw;
+        }
+    }
+    block->samples = adc->samples;
+    block->format = SN_SAMPLE_FORMAT_RAW;
+    block->count = 1;
+    block->timestamp_us = 0;
+    block->period_us = 0;
+    return ESP_OK;
+}
+
+static const sn_source_ops_t s_adc_ops = {
+    .name = "adc",
+    .configure = adc_configure,
+    .read_block = adc_read_block,
+};
+
+sn_source_t *sn_source_adc(adc_unit_t unit, adc_atten_t atten)
+{
+    s_source.base.ops = &s_adc_ops;
+    s_source.base.self_paced = false;
+    s_source.base.sample_bits = 12;
+    s_source.base.supported_mask = unit == ADC_UNIT_1 ? (1 << ADC1_CHANNEL_MAX) - 1 : (1 << ADC2_CHANNEL_MAX) - 1;
+    s_source.unit = unit;
+    s_source.atten = atten;
+    return &s_source.base;
+}
@@ -0,0 +1,36 @@
+/* Sample sources and bus bindings that depend on ESP-IDF drivers.
+
+   Kept apart from sn_source.h so the source interface, the synthetic
+   source and the SPI source build without the driver headers.
+*/
+
+#ifndef SN_SOURCE_HW_H
+#define SN_SOURCE_HW_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/adc.h"
+#include "driver/spi_master.h"
+#include "sn_source.h"
+#include "sn_spi_adc.h"
+
+typedef struct {
+    spi_host_device_t host;     /* HSPI_HOST or VSPI_HOST */
+    int dma_chan;               /* 1 or 2 */
+    int mosi_gpio;
+    int miso_gpio;
+    int sclk_gpio;
+    int cs_gpio;
+    uint32_t sclk_hz;           /* 0 runs at the chip's maximum */
+} sn_spi_master_config_t;
+
+/* Polled adc1_get_raw/adc2_get_raw backend: one blocking driver call per channel per read. */
+sn_source_t *sn_source_adc(adc_unit_t unit, adc_atten_t atten);
+
+/* I2S built-in ADC mode with DMA, scanning up to 8 ADC1 channels back to back. */
+sn_source_t *sn_source_i2s_adc(adc_atten_t atten);
+
+/* Initialise an spi_master bus with one device for chip and bind it as an sn_spi_bus_t. */
+esp_err_t sn_spi_bus_master(const sn_spi_master_config_t *config, const sn_spi_adc_chip_t *chip, sn_spi_bus_t *bus);
+
+#endif /* SN_SOURCE_HW_H */
@@ -0,0 +1,286 @@
+/* I2S built-in ADC backend.
+
+   The I2S0 peripheral drives the SAR ADC1 controller and streams conversions
+   into DMA buffers, so scanning costs no CPU per sample. The driver only sets
+   up a single channel, so the ADC1 pattern table is rewritten afterwards to
+   scan every enabled channel in turn.
+
+   Each 16-bit word from the DMA carries its channel number in the top four
+   bits and the conversion in the low twelve. The I2S peripheral swaps the
+   two halves of each 32-bit word, so with an odd channel count a pair
+   straddles two scans. Each pair is swapped back as it is read, and every
+   word goes straight to its place in the block handed to the sampler, by
+   its position in the scan. A word whose channel is not the one expected at
+   its position (a DMA buffer dropped while the reader was late) rewinds the
+   set being assembled, counted as missed, and assembly restarts at the next
+   scan. Words read past the last set of a block stay in raw for the next.
+
+   Sets are stamped from the stream, not from when a read returns, since
+   i2s_read returns at once while DMA buffers are queued: word w after the
+   anchor was converted w / channel_count periods after it. The anchor is
+   taken when the DMA starts. A miss loses an unknown number of words, so a
+   block ends at one and the stream is anchored again at the next scan, by
+   the time the read holding it returned less the words read after it, and
+   never before where the old anchor would put it.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "driver/i2s.h"
+#include "soc/syscon_struct.h"
+#include "sn_source_hw.h"
+
+#define SN_I2S_PORT             I2S_NUM_0
+#define SN_I2S_DMA_BUF_COUNT    4
+#define SN_I2S_DMA_BUF_LEN      256     /* samples per DMA buffer */
+#define SN_I2S_READ_WORDS       (SN_I2S_DMA_BUF_LEN * 2)
+
+static const char *TAG = "sn_source_i2s";
+
+typedef struct {
+    sn_source_t base;
+    adc_atten_t atten;
+    bool installed;
+    uint8_t channel_count;
+    uint8_t sequence[ADC1_CHANNEL_MAX]; /* enabled channels in scan order */
+    uint8_t pending_count;              /* words of the set being assembled, already in place in sets */
+    bool resync;                        /* skipping words until the next scan starts */
+    uint32_t last_count;                /* sets in the previous block, the partial set follows them */
+    int64_t anchor_us;                  /* when word 0 of the stream was converted */
+    uint64_t words;                     /* words taken from raw since the anchor */
+    uint64_t set_word;                  /* first word of the set being assembled */
+    uint64_t block_word;                /* first word of the block's first set */
+    bool reanchor;                      /* a miss broke the stream, anchor again at the next scan */
+    int64_t read_us;                    /* when the words in raw were read */
+    uint16_t raw_pos;                   /* next word of raw to place */
+    uint16_t raw_len;
+    uint16_t raw[SN_I2S_READ_WORDS];    /* as read from the DMA, pairs swapped */
+    uint16_t sets[SN_I2S_READ_WORDS];
+} i2s_source_t;
+
+static i2s_source_t s_source;
+
+static void set_scan_pattern(i2s_source_t *i2s, uint16_t channel_mask)
+{
+    uint32_t tab[4] = { 0 };
+    int n = 0;
+
+    for (int ch = 0; ch < ADC1_CHANNEL_MAX; ch++) {
+        if (channel_mask & (1 << ch)) {
+            /* pattern entry: channel[7:4] width[3:2] atten[1:0], four entries per register, MSB first */
+            uint32_t entry = (ch << 4) | (ADC_WIDTH_BIT_12 << 2) | i2s->atten;
+            tab[n / 4] |= entry << (24 - 8 * (n % 4));
+            n++;
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        SYSCON.saradc_sar1_patt_tab[i] = tab[i];
+    }
+    SYSCON.saradc_ctrl.sar1_patt_len = n - 1;
+}
+
+static esp_err_t i2s_adc_configure(sn_source_t *src, uint16_t channel_mask, uint32_t rate_hz)
+{
+    i2s_source_t *i2s = (i2s_source_t *)src;
+    int first = __builtin_ctz(channel_mask);
+
+    if (i2s->installed) {
+        i2s_adc_disable(SN_I2S_PORT);
+        i2s_driver_uninstall(SN_I2S_PORT);
+        i2s->installed = false;
+    }
+
+    i2s->channel_count = 0;
+    for (int ch = 0; ch < ADC1_CHANNEL_MAX; ch++) {
+        if (channel_mask & (1 << ch)) {
+            adc1_config_channel_atten((adc1_channel_t)ch, i2s->atten);
+            i2s->sequence[i2s->channel_count++] = ch;
+        }
+    }
+
+    const i2s_config_t i2s_config = {
+        .mode = I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN,
+        .sample_rate = rate_hz * i2s->channel_count,
+        .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+        .channel_format = I2S_CHANNEL_FMT_ONLY_RIGHT,
+        .communication_format = I2S_COMM_FORMAT_I2S_MSB,
+        .intr_alloc_flags = 0,
+        .dma_buf_count = SN_I2S_DMA_BUF_COUNT,
+        .dma_buf_len = SN_I2S_DMA_BUF_LEN,
+        .use_apll = false,
+    };
+    esp_err_t err = i2s_driver_install(SN_I2S_PORT, &i2s_config, 0, NULL);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to install I2S driver: %d", err);
+        return err;
+    }
+    i2s->installed = true;
+    i2s_stop(SN_I2S_PORT);
+    err = i2s_set_adc_mode(ADC_UNIT_1, (adc1_channel_t)first);
+    if (err != ESP_OK) {
+        return err;
+    }
+    set_scan_pattern(i2s, channel_mask);
+
+    i2s->pending_count = 0;
+    i2s->resync = false;
+    i2s->last_count = 0;
+    i2s->raw_pos = i2s->raw_len = 0;
+    src->channel_mask = channel_mask;
+    src->rate_hz = rate_hz;
+    ESP_LOGI(TAG, "Scanning %d ADC1 channels (mask 0x%02x) at %d hz", i2s->channel_count, channel_mask, rate_hz);
+    return ESP_OK;
+}
+
+static esp_err_t i2s_adc_start(sn_source_t *src)
+{
+    i2s_source_t *i2s = (i2s_source_t *)src;
+    esp_err_t err = i2s_adc_enable(SN_I2S_PORT);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = i2s_start(SN_I2S_PORT);
+    i2s->anchor_us = esp_timer_get_time();
+    i2s->words = 0;
+    i2s->reanchor = false;
+    i2s->pending_count = 0;
+    i2s->resync = false;
+    i2s->raw_pos = i2s->raw_len = 0;
+    return err;
+}
+
+/* When word w after the anchor was converted. */
+static int64_t word_us(const i2s_source_t *i2s, uint64_t w)
+{
+    return i2s->anchor_us + (int64_t)(w * 1000000 / ((uint64_t)i2s->channel_count * i2s->base.rate_hz));
+}
+
+/* Anchor the stream at the word about to be taken from raw, the first of a scan. */
+static void anchor_here(i2s_source_t *i2s)
+{
+    uint64_t after = i2s->raw_len - i2s->raw_pos;
+    int64_t read_us = i2s->read_us - (int64_t)(after * 1000000 / ((uint64_t)i2s->channel_count * i2s->base.rate_hz));
+    int64_t kept_us = word_us(i2s, i2s->words);
+
+    i2s->anchor_us = read_us > kept_us ? read_us : kept_us;
+    i2s->words = 0;
+    i2s->reanchor = false;
+}
+
+/* Place the next word of raw at its position in set count of the block. Returns 1 when it completes the
+   set, 0 otherwise, and -1, leaving the word in raw, when it breaks the scan behind sets already in the block. */
+static int place_word(i2s_source_t *i2s, uint32_t count)
+{
+    uint16_t word = i2s->raw[i2s->raw_pos ^ 1];
+    uint8_t ch = word >> 12;
+
+    if (ch != i2s->sequence[i2s->pending_count]) {
+        if (count > 0) {
+            return -1;
+        }
+        if (i2s->pending_count > 0 || !i2s->resync) {
+            i2s->base.missed++;
+            i2s->reanchor = true;
+        }
+        i2s->pending_count = 0;
+        i2s->resync = ch != i2s->sequence[0];
+    } else {
+        i2s->resync = false;
+    }
+    if (!i2s->resync && i2s->pending_count == 0) {
+        if (i2s->reanchor) {
+            anchor_here(i2s);
+        }
+        i2s->set_word = i2s->words;
+    }
+    i2s->raw_pos++;
+    i2s->words++;
+    if (i2s->resync) {
+        return 0;
+    }
+    i2s->sets[count * i2s->channel_count + i2s->pending_count++] = word & 0x0fff;
+    if (i2s->pending_count < i2s->channel_count) {
+        return 0;
+    }
+    i2s->pending_count = 0;
+    if (count == 0) {
+        i2s->block_word = i2s->set_word;
+    }
+    return 1;
+}
+
+static esp_err_t i2s_adc_read_block(sn_source_t *src, uint32_t max_sets, sn_sample_block_t *block, uint32_t timeout_ms)
+{
+    i2s_source_t *i2s = (i2s_source_t *)src;
+    uint8_t n = i2s->channel_count;
+    uint32_t count = 0;
+    bool read = false;
+
+    if (max_sets > SN_I2S_READ_WORDS / n) {
+        max_sets = SN_I2S_READ_WORDS / n;
+    }
+    if (i2s->pending_count > 0 && i2s->last_count > 0) {
+        /* a set left incomplete when the last read came up short moves to the front */
+        memmove(i2s->sets, i2s->sets + i2s->last_count * n, i2s->pending_count * sizeof(uint16_t));
+    }
+    while (count < max_sets) {
+        if (i2s->raw_pos == i2s->raw_len) {
+            if (read) {
+                break;
+            }
+            /* whole 32-bit words, so every pair read can be swapped back */
+            size_t words = ((max_sets - count) * n - i2s->pending_count + 1) & ~1u;
+            size_t bytes_read = 0;
+            esp_err_t err = i2s_read(SN_I2S_PORT, i2s->raw, words * sizeof(uint16_t), &bytes_read,
+                                     pdMS_TO_TICKS(timeout_ms));
+            if (err != ESP_OK) {
+                return err;
+            }
+            read = true;
+            i2s->read_us = esp_timer_get_time();
+            i2s->raw_pos = 0;
+            i2s->raw_len = bytes_read / sizeof(uint32_t) * 2;
+            continue;
+        }
+        int placed = place_word(i2s, count);
+        if (placed < 0) {
+            break;
+        }
+        count += placed;
+    }
+    i2s->last_count = count;
+
+    uint32_t period_us = 1000000 / src->rate_hz;
+    block->samples = i2s->sets;
+    block->format = SN_SAMPLE_FORMAT_RAW;
+    block->count = count;
+    block->period_us = period_us;
+    block->timestamp_us = word_us(i2s, i2s->block_word);
+    return count ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t i2s_adc_stop(sn_source_t *src)
+{
+    i2s_adc_disable(SN_I2S_PORT);
+    return i2s_stop(SN_I2S_PORT);
+}
+
+static const sn_source_ops_t s_i2s_ops = {
+    .name = "i2s_adc",
+    .configure = i2s_adc_configure,
+    .start = i2s_adc_start,
+    .read_block = i2s_adc_read_block,
+    .stop = i2s_adc_stop,
+};
+
+sn_source_t *sn_source_i2s_adc(adc_atten_t atten)
+{
+    s_source.base.ops = &s_i2s_ops;
+    s_source.base.self_paced = true;
+    s_source.base.sample_bits = 12;
+    s_source.base.supported_mask = (1 << ADC1_CHANNEL_MAX) - 1;
+    s_source.atten = atten;
+    return &s_source.base;
+}
@@ -0,0 +1,432 @@
+/* External SPI ADC backend.
+
+   Every frame of a sample set is built once per configuration: command
+   words are written into DMA-capable tx buffers and the transfer
+   descriptors point at fixed slices of a DMA-capable rx area. Reading a set
+   queues all of its frames at once, so the SPI peripheral runs them back to
+   back from DMA without CPU work in between, then collects them in order
+   and decodes the results.
+
+   Self-paced (with a data-ready pin), the falling edge is timestamped in
+   the GPIO interrupt and posted through a one-deep queue; an edge that
+   finds the previous one unread means that conversion was overwritten and
+   counts as missed. Sets are gathered into a block while edges keep
+   arriving and are stamped on the block's period. A block ends early at an
+   edge that would leave some set more than half a period after its stamp
+   or move the stamps back past the previous block: a late, early or
+   bunched edge, or edges drifting off the period. So every set was taken
+   within half a period after its stamp, and stamps always increase.
+   Without a data-ready pin the sampler's timer paces the reads and the set
+   is stamped when its first frame completes.
+
+   CONVST is driven by LEDC so the conversion clock comes from hardware.
+
+   The bus hands transfers back in the order they were queued, so every
+   queued transfer has to be collected before the next set is queued. When
+   a wait fails the rest of the set is collected right away, and whatever
+   is still owed after that is collected before the next set or rebuild;
+   otherwise each later set would decode the results of the one before.
+   The spi_master binding is in sn_spi_master.c.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "sn_source_spi.h"
+
+#define SN_SPI_ADC_BLOCK_SETS       32
+#define SN_SPI_ADC_BUF_BYTES        128     /* SN_SPI_ADC_MAX_XFERS 4-byte words, or one SN_SPI_ADC_MAX_FRAME */
+#define SN_SPI_ADC_XFER_TIMEOUT_MS  20
+#define SN_SPI_ADC_LEDC_MODE        LEDC_HIGH_SPEED_MODE
+#define SN_SPI_ADC_LEDC_TIMER       LEDC_TIMER_0
+#define SN_SPI_ADC_LEDC_CHANNEL     LEDC_CHANNEL_0
+#define SN_SPI_ADC_LEDC_MAX_BITS    14
+
+static const char *TAG = "sn_source_spi";
+
+typedef struct {
+    sn_source_t base;
+    sn_spi_adc_config_t config;
+    bool opened;
+    volatile bool armed;                /* data-ready edges are posted */
+    QueueHandle_t ready;                /* esp_timer time of the latest unread data-ready edge */
+    uint8_t channel_count;
+    uint8_t sequence[SN_MAX_CHANNELS];  /* enabled channels in ascending order */
+    uint8_t xfer_count;
+    uint8_t pending;                    /* transfers queued and not yet collected */
+    esp_err_t error;                    /* error that ended the last block early, returned by the next read */
+    sn_spi_xfer_t xfers[SN_SPI_ADC_MAX_XFERS];
+    bool carry;                         /* a set read after a gap, first of the next block */
+    int64_t carry_us;
+    int64_t last_slot_us;               /* stamp of the last set of the previous block */
+    uint16_t carry_set[SN_MAX_CHANNELS];
+    uint16_t sets[SN_SPI_ADC_BLOCK_SETS * SN_MAX_CHANNELS];
+} spi_adc_t;
+
+static spi_adc_t s_source;
+static DMA_ATTR uint8_t s_tx[SN_SPI_ADC_BUF_BYTES];
+static DMA_ATTR uint8_t s_rx[SN_SPI_ADC_BUF_BYTES];
+
+static void IRAM_ATTR drdy_isr(void *arg)
+{
+    spi_adc_t *adc = arg;
+    int64_t now_us = esp_timer_get_time();
+    BaseType_t woken = pdFALSE;
+
+    if (!adc->armed) {
+        return;
+    }
+    if (uxQueueMessagesWaitingFromISR(adc->ready) > 0) {
+        adc->base.missed++;
+    }
+    xQueueOverwriteFromISR(adc->ready, &now_us, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static esp_err_t spi_adc_open(sn_source_t *src)
+{
+    spi_adc_t *adc = (spi_adc_t *)src;
+
+    if (adc->opened || adc->config.drdy_gpio < 0) {
+        adc->opened = true;
+        return ESP_OK;
+    }
+    adc->ready = xQueueCreate(1, sizeof(int64_t));
+    if (adc->ready == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    const gpio_config_t io_config = {
+        .pin_bit_mask = 1ULL << adc->config.drdy_gpio,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    esp_err_t err = gpio_config(&io_config);
+    if (err == ESP_OK) {
+        err = gpio_install_isr_service(0);
+        if (err == ESP_ERR_INVALID_STATE) {
+            err = ESP_OK;       /* already installed by someone else */
+        }
+    }
+    if (err == ESP_OK) {
+        err = gpio_isr_handler_add(adc->config.drdy_gpio, drdy_isr, adc);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set up data-ready interrupt on GPIO %d: %d", adc->config.drdy_gpio, err);
+        return err;
+    }
+    adc->opened = true;
+    return ESP_OK;
+}
+
+/* Collect every transfer still queued on the bus. */
+static esp_err_t drain(spi_adc_t *adc)
+{
+    sn_spi_bus_t *bus = &adc->config.bus;
+    sn_spi_xfer_t *done;
+
+    while (adc->pending > 0) {
+        esp_err_t err = bus->ops->wait(bus->ctx, &done, SN_SPI_ADC_XFER_TIMEOUT_MS);
+        if (err != ESP_OK) {
+            return err;
+        }
+        adc->pending--;
+    }
+    return ESP_OK;
+}
+
+static void build_xfers(spi_adc_t *adc)
+{
+    const sn_spi_adc_chip_t *chip = adc->config.chip;
+    uint8_t bytes = chip->word_bits / 8;
+    uint16_t len = chip->simultaneous ? (chip->header_words + chip->channels) * bytes : bytes;
+    size_t offset = 0;
+
+    adc->xfer_count = chip->simultaneous ? 1 : adc->channel_count + chip->pipeline;
+    memset(s_tx, 0, sizeof(s_tx));
+    for (uint8_t f = 0; f < adc->xfer_count; f++) {
+        sn_spi_xfer_t *xfer = &adc->xfers[f];
+        xfer->tx = s_tx + offset;
+        xfer->rx = s_rx + offset;
+        xfer->len = len;
+        if (chip->command != NULL) {
+            /* flush frames select the first channel again, their conversions are never read */
+            sn_spi_adc_put_word(s_tx + offset, bytes, chip->command(adc->sequence[f % adc->channel_count]));
+        }
+        offset += (len + 3) & ~3;
+    }
+}
+
+static esp_err_t set_convst_clock(spi_adc_t *adc, uint32_t rate_hz)
+{
+    uint8_t bits = SN_SPI_ADC_LEDC_MAX_BITS;
+
+    /* finest duty resolution the 80 MHz clock allows at this rate */
+    while (bits > 1 && ((uint64_t)rate_hz << bits) > APB_CLK_FREQ) {
+        bits--;
+    }
+    const ledc_timer_config_t timer_config = {
+        .speed_mode = SN_SPI_ADC_LEDC_MODE,
+        .duty_resolution = (ledc_timer_bit_t)bits,
+        .timer_num = SN_SPI_ADC_LEDC_TIMER,
+        .freq_hz = rate_hz,
+    };
+    const ledc_channel_config_t channel_config = {
+        .gpio_num = adc->config.convst_gpio,
+        .speed_mode = SN_SPI_ADC_LEDC_MODE,
+        .channel = SN_SPI_ADC_LEDC_CHANNEL,
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = SN_SPI_ADC_LEDC_TIMER,
+        .duty = 1 << (bits - 1),
+    };
+    esp_err_t err = ledc_timer_config(&timer_config);
+    if (err == ESP_OK) {
+        err = ledc_channel_config(&channel_config);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to clock CONVST at %d hz: %d", rate_hz, err);
+        return err;
+    }
+    return ledc_timer_pause(SN_SPI_ADC_LEDC_MODE, SN_SPI_ADC_LEDC_TIMER);
+}
+
+static esp_err_t spi_adc_configure(sn_source_t *src, uint16_t channel_mask, uint32_t rate_hz)
+{
+    spi_adc_t *adc = (spi_adc_t *)src;
+    const sn_spi_adc_chip_t *chip = adc->config.chip;
+    uint8_t channel_count = __builtin_popcount(channel_mask);
+    uint32_t frames = chip->simultaneous ? 1 : channel_count + chip->pipeline;
+
+    if ((uint64_t)rate_hz * frames > chip->max_frame_rate_hz) {
+        ESP_LOGE(TAG, "%d channels at %d hz need %d frames/s, %s manages %d", channel_count, rate_hz,
+                 rate_hz * frames, chip->name, chip->max_frame_rate_hz);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* the bus may still hold transfers that point at the old descriptors */
+    esp_err_t err = drain(adc);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%d transfers still queued: %d", adc->pending, err);
+        return err;
+    }
+
+    adc->channel_count = 0;
+    for (uint8_t ch = 0; ch < chip->channels; ch++) {
+        if (channel_mask & (1 << ch)) {
+            adc->sequence[adc->channel_count++] = ch;
+        }
+    }
+    build_xfers(adc);
+    sn_spi_bus_t *bus = &adc->config.bus;
+    if (bus->ops->prepare != NULL) {
+        err = bus->ops->prepare(bus->ctx, adc->xfers, adc->xfer_count);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    if (adc->config.convst_gpio >= 0) {
+        err = set_convst_clock(adc, rate_hz);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    src->channel_mask = channel_mask;
+    src->rate_hz = rate_hz;
+    ESP_LOGI(TAG, "Reading %d %s channels (mask 0x%04x) at %d hz in %d frames per set", channel_count, chip->name,
+             channel_mask, rate_hz, adc->xfer_count);
+    return ESP_OK;
+}
+
+static esp_err_t spi_adc_start(sn_source_t *src)
+{
+    spi_adc_t *adc = (spi_adc_t *)src;
+
+    adc->carry = false;
+    adc->last_slot_us = 0;
+    adc->error = ESP_OK;
+    if (adc->ready != NULL) {
+        xQueueReset(adc->ready);
+        adc->armed = true;
+    }
+    if (adc->config.convst_gpio >= 0) {
+        return ledc_timer_resume(SN_SPI_ADC_LEDC_MODE, SN_SPI_ADC_LEDC_TIMER);
+    }
+    return ESP_OK;
+}
+
+/* Run every frame of one set and decode it into out. stamp_us is when the first frame completed. */
+static esp_err_t transfer_set(spi_adc_t *adc, uint16_t *out, int64_t *stamp_us)
+{
+    const sn_spi_adc_chip_t *chip = adc->config.chip;
+    sn_spi_bus_t *bus = &adc->config.bus;
+    uint8_t bytes = chip->word_bits / 8;
+    esp_err_t err = drain(adc);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (uint8_t i = 0; i < adc->xfer_count && err == ESP_OK; i++) {
+        err = bus->ops->queue(bus->ctx, &adc->xfers[i]);
+        if (err == ESP_OK) {
+            adc->pending++;
+        }
+    }
+    esp_err_t wait_err = drain(adc);
+    if (wait_err != ESP_OK) {
+        /* give the rest of the set one more timeout, so the next set starts in step if it can */
+        drain(adc);
+        return wait_err;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (uint8_t i = 0; i < adc->channel_count; i++) {
+        uint8_t ch = adc->sequence[i];
+        const uint8_t *word = chip->simultaneous ? adc->xfers[0].rx + (chip->header_words + ch) * bytes
+                                                 : adc->xfers[i + chip->pipeline].rx;
+        int32_t sample = chip->result(sn_spi_adc_get_word(word, bytes), ch);
+        if (sample < 0) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        out[i] = (uint16_t)sample;
+    }
+    *stamp_us = adc->xfers[0].done_us;
+    return ESP_OK;
+}
+
+/* Whether the edge of set count fits the block stamped *first_us, whose edges are at most *late_us after their
+   slots. An early edge moves the block's grid back to it, as long as the grid stays after the previous block's last
+   slot; every edge in the block must stay within half a period after its slot. Updates both on success. */
+static bool on_grid(spi_adc_t *adc, uint32_t count, uint32_t period_us, int64_t edge_us, int64_t *first_us,
+                    int64_t *late_us)
+{
+    int64_t offset = edge_us - (*first_us + (int64_t)count * period_us);
+    int64_t shift = offset < 0 ? offset : 0;
+    int64_t late = *late_us - shift > offset - shift ? *late_us - shift : offset - shift;
+
+    if (late > period_us / 2 || *first_us + shift <= adc->last_slot_us) {
+        return false;
+    }
+    *first_us += shift;
+    *late_us = late;
+    return true;
+}
+
+/* Gather sets while edges keep coming. A transfer error ends the block: it is returned when no set was read,
+   and kept for the next read otherwise. */
+static esp_err_t read_edges(spi_adc_t *adc, uint32_t max_sets, uint32_t period_us, uint32_t timeout_ms,
+                            uint32_t *sets, int64_t *first_us)
+{
+    size_t set_bytes = adc->channel_count * sizeof(uint16_t);
+    uint32_t count = 0;
+    int64_t late_us = 0;
+    int64_t edge_us;
+
+    if (adc->carry) {
+        memcpy(adc->sets, adc->carry_set, set_bytes);
+        *first_us = adc->carry_us;
+        adc->carry = false;
+        count = 1;
+    }
+    /* block for the first edge, then keep collecting while they come at the sample rate */
+    while (count < max_sets &&
+           xQueueReceive(adc->ready, &edge_us, count ? 1 : pdMS_TO_TICKS(timeout_ms)) == pdTRUE) {
+        uint16_t *out = adc->sets + count * adc->channel_count;
+        int64_t done_us;
+        esp_err_t err = transfer_set(adc, out, &done_us);
+        if (err != ESP_OK) {
+            if (count == 0) {
+                return err;
+            }
+            adc->error = err;
+            break;
+        }
+        if (count == 0) {
+            *first_us = edge_us;
+        } else if (!on_grid(adc, count, period_us, edge_us, first_us, &late_us)) {
+            memcpy(adc->carry_set, out, set_bytes);
+            adc->carry_us = edge_us;
+            adc->carry = true;
+            break;
+        }
+        count++;
+    }
+    if (count > 0) {
+        adc->last_slot_us = *first_us + (int64_t)(count - 1) * period_us;
+    }
+    *sets = count;
+    return count ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t spi_adc_read_block(sn_source_t *src, uint32_t max_sets, sn_sample_block_t *block, uint32_t timeout_ms)
+{
+    spi_adc_t *adc = (spi_adc_t *)src;
+    uint32_t period_us = 1000000 / src->rate_hz;
+    int64_t first_us = 0;
+    uint32_t count = 1;
+    esp_err_t err;
+
+    if (max_sets > SN_SPI_ADC_BLOCK_SETS) {
+        max_sets = SN_SPI_ADC_BLOCK_SETS;
+    }
+    if (adc->error != ESP_OK) {
+        err = adc->error;
+        adc->error = ESP_OK;
+        return err;
+    }
+    if (src->self_paced) {
+        err = read_edges(adc, max_sets, period_us, timeout_ms, &count, &first_us);
+    } else {
+        err = transfer_set(adc, adc->sets, &first_us);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    block->samples = adc->sets;
+    block->format = SN_SAMPLE_FORMAT_RAW;
+    block->count = count;
+    block->period_us = period_us;
+    block->timestamp_us = first_us;
+    return ESP_OK;
+}
+
+static esp_err_t spi_adc_stop(sn_source_t *src)
+{
+    spi_adc_t *adc = (spi_adc_t *)src;
+
+    adc->armed = false;
+    if (adc->config.convst_gpio >= 0) {
+        return ledc_timer_pause(SN_SPI_ADC_LEDC_MODE, SN_SPI_ADC_LEDC_TIMER);
+    }
+    return ESP_OK;
+}
+
+static const sn_source_ops_t s_spi_adc_ops = {
+    .name = "spi_adc",
+    .open = spi_adc_open,
+    .configure = spi_adc_configure,
+    .start = spi_adc_start,
+    .read_block = spi_adc_read_block,
+    .stop = spi_adc_stop,
+};
+
+sn_source_t *sn_source_spi_adc(const sn_spi_adc_config_t *config)
+{
+    s_source.base.ops = &s_spi_adc_ops;
+    s_source.base.self_paced = config->drdy_gpio >= 0;
+    s_source.base.sample_bits = config->chip->sample_bits;
+    s_source.base.supported_mask = (uint16_t)((1u << config->chip->channels) - 1);
+    s_source.config = *config;
+    return &s_source.base;
+}
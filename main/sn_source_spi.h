@@ -0,0 +1,26 @@
+/* External SPI ADC source.
+
+   Kept apart from sn_source.h so the source interface and the other
+   sources do not depend on the SPI chip descriptions. Like them it has no
+   ESP-IDF dependencies besides esp_err.h, so it also builds on a host.
+*/
+
+#ifndef SN_SOURCE_SPI_H
+#define SN_SOURCE_SPI_H
+
+#include "sn_source.h"
+#include "sn_spi_adc.h"
+
+typedef struct {
+    const sn_spi_adc_chip_t *chip;
+    sn_spi_bus_t bus;           /* see sn_spi_bus_master() and sn_spi_mock_init() */
+    int drdy_gpio;              /* data-ready (BUSY) output, falling edge; -1 reads on the sampler's timer */
+    int convst_gpio;            /* conversion start input, clocked by LEDC at the sample rate; -1 when unused */
+} sn_spi_adc_config_t;
+
+/* External SPI ADC read with queued DMA transfers. With drdy_gpio the source is self-paced: the data-ready
+   edge stamps each set and starts its transfer. Without it sets are read on the sampler's timer, which suits
+   sequenced chips whose conversions are started by the transfer itself. Simultaneous chips need drdy_gpio. */
+sn_source_t *sn_source_spi_adc(const sn_spi_adc_config_t *config);
+
+#endif /* SN_SOURCE_SPI_H */
@@ -0,0 +1,124 @@
+/* Synthetic sample source.
+
+   Produces deterministic 12-bit waveforms computed from the running sample
+   index, so a given rate and channel mask always yields the same stream.
+   Channel n runs at (n + 1) * base_freq_hz and cycles through sine, triangle,
+   square and ramp shapes by n % 4. It is polled like the ADC backend and
+   needs no hardware, so the pipeline can be run on a bare board or a host.
+*/
+
+#include <math.h>
+#include "sn_source.h"
+
+#define SN_SYNTH_BLOCK_SETS     64
+#define SN_SYNTH_TABLE_BITS     8
+#define SN_SYNTH_MID            2048
+#define SN_SYNTH_AMPLITUDE      2000
+
+typedef struct {
+    sn_source_t base;
+    uint32_t base_freq_hz;
+    uint32_t index;
+    uint8_t channel_count;
+    uint8_t shape[SN_MAX_CHANNELS];
+    uint32_t phase_step[SN_MAX_CHANNELS];   /* per-sample phase increment, full turn = 2^32 */
+    int16_t sine[1 << SN_SYNTH_TABLE_BITS];
+    uint16_t samples[SN_SYNTH_BLOCK_SETS * SN_MAX_CHANNELS];
+} synth_source_t;
+
+static synth_source_t s_source;
+
+static esp_err_t synth_open(sn_source_t *src)
+{
+    synth_source_t *synth = (synth_source_t *)src;
+
+    for (int i = 0; i < (1 << SN_SYNTH_TABLE_BITS); i++) {
+        synth->sine[i] = (int16_t)lrintf(SN_SYNTH_AMPLITUDE * sinf(2.0f * (float)M_PI * i / (1 << SN_SYNTH_TABLE_BITS)));
+    }
+    return ESP_OK;
+}
+
+static esp_err_t synth_configure(sn_source_t *src, uint16_t channel_mask, uint32_t rate_hz)
+{
+    synth_source_t *synth = (synth_source_t *)src;
+
+    if (rate_hz == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    synth->channel_count = 0;
+    for (int ch = 0; ch < SN_MAX_CHANNELS; ch++) {
+        if (channel_mask & (1 << ch)) {
+            uint64_t freq = (uint64_t)(ch + 1) * synth->base_freq_hz;
+            synth->shape[synth->channel_count] = ch % 4;
+            synth->phase_step[synth->channel_count] = (uint32_t)((freq << 32) / rate_hz);
+            synth->channel_count++;
+        }
+    }
+    synth->index = 0;
+    src->channel_mask = channel_mask;
+    src->rate_hz = rate_hz;
+    return ESP_OK;
+}
+
+static uint16_t synth_value(const synth_source_t *synth, uint8_t shape, uint32_t phase)
+{
+    int32_t v;
+
+    switch (shape) {
+        case 0:
+            v = synth->sine[phase >> (32 - SN_SYNTH_TABLE_BITS)];
+            break;
+        case 1:
+            /* triangle: fold the top 17 bits of phase around the midpoint */
+            v = (int32_t)(phase >> 15) - 65536;
+            v = (v < 0 ? -v : v) - 32768;
+            v = v * SN_SYNTH_AMPLITUDE / 32768;
+            break;
+        case 2:
+            v = phase < 0x80000000u ? SN_SYNTH_AMPLITUDE : -SN_SYNTH_AMPLITUDE;
+            break;
+        default:
+            v = (int32_t)((phase >> 16) * (2 * SN_SYNTH_AMPLITUDE) >> 16) - SN_SYNTH_AMPLITUDE;
+            break;
+    }
+    return (uint16_t)(SN_SYNTH_MID + v);
+}
+
+static esp_err_t synth_read_block(sn_source_t *src, uint32_t max_sets, sn_sample_block_t *block, uint32_t timeout_ms)
+{
+    synth_source_t *synth = (synth_source_t *)src;
+    uint16_t *out = synth->samples;
+
+    if (max_sets > SN_SYNTH_BLOCK_SETS) {
+        max_sets = SN_SYNTH_BLOCK_SETS;
+    }
+    for (uint32_t k = 0; k < max_sets; k++) {
+        uint32_t index = synth->index++;
+        for (int i = 0; i < synth->channel_count; i++) {
+            *out++ = synth_value(synth, synth->shape[i], index * synth->phase_step[i]);
+        }
+    }
+    block->samples = synth->samples;
+    block->format = SN_SAMPLE_FORMAT_RAW;
+    block->count = max_sets;
+    block->timestamp_us = 0;
+    block->period_us = 1000000 / src->rate_hz;
+    return ESP_OK;
+}
+
+static const sn_source_ops_t s_synth_ops = {
+    .name = "synth",
+    .open = synth_open,
+    .configure = synth_configure,
+    .read_block = synth_read_block,
+};
+
+sn_source_t *sn_source_synth(uint32_t base_freq_hz)
+{
+    s_source.base.ops = &s_synth_ops;
+    s_source.base.self_paced = false;
+    s_source.base.sample_bits = 12;
+    s_source.base.supported_mask = 0xffff;
+    s_source.base_freq_hz = base_freq_hz;
+    return &s_source.base;
+}
@@ -0,0 +1,179 @@
+/* External SPI ADC chip descriptions and the mock bus.
+
+   The mock completes every frame as soon as it is queued: it decodes the
+   command word with selects(), keeps the channels selected by the last
+   frames to model the pipeline delay, and fills rx with response() words
+   for the scripted samples. Completion times are on a virtual clock that
+   advances by each frame's length at sclk_hz, so runs are repeatable.
+*/
+
+#include <string.h>
+#include "sn_spi_adc.h"
+
+/* ADS7953 manual mode: DI[15:12] = 0001, DI[11] programs DI[10:7] as the next channel, DI[6] = 0 is the
+   2.5 V range. DO[15:12] echo the channel the result belongs to. */
+#define ADS7953_MANUAL          0x1000
+#define ADS7953_PROGRAM         0x0800
+#define ADS7953_CHANNEL_SHIFT   7
+
+static uint32_t ads7953_command(uint8_t channel)
+{
+    return ADS7953_MANUAL | ADS7953_PROGRAM | (channel << ADS7953_CHANNEL_SHIFT);
+}
+
+static int32_t ads7953_result(uint32_t word, uint8_t channel)
+{
+    return (word >> 12) == channel ? (int32_t)(word & 0x0fff) : -1;
+}
+
+static int ads7953_selects(uint32_t command)
+{
+    if ((command & 0xf800) != (ADS7953_MANUAL | ADS7953_PROGRAM)) {
+        return -1;
+    }
+    return (command >> ADS7953_CHANNEL_SHIFT) & 0x0f;
+}
+
+static uint32_t ads7953_response(uint8_t channel, uint16_t sample)
+{
+    return ((uint32_t)channel << 12) | (sample & 0x0fff);
+}
+
+static const sn_spi_adc_chip_t s_ads7953 = {
+    .name = "ads7953",
+    .channels = 16,
+    .sample_bits = 12,
+    .word_bits = 16,
+    .simultaneous = false,
+    .pipeline = 2,
+    .spi_mode = 0,
+    .max_sclk_hz = 20000000,
+    .max_frame_rate_hz = 1000000,
+    .command = ads7953_command,
+    .result = ads7953_result,
+    .selects = ads7953_selects,
+    .response = ads7953_response,
+};
+
+/* AD7606 serial mode on DOUTA: eight two's complement words, V1 first. */
+static int32_t ad7606_result(uint32_t word, uint8_t channel)
+{
+    return (int32_t)((word ^ 0x8000) & 0xffff);
+}
+
+static uint32_t ad7606_response(uint8_t channel, uint16_t sample)
+{
+    return sample ^ 0x8000;
+}
+
+static const sn_spi_adc_chip_t s_ad7606 = {
+    .name = "ad7606",
+    .channels = 8,
+    .sample_bits = 16,
+    .word_bits = 16,
+    .simultaneous = true,
+    .header_words = 0,
+    .spi_mode = 2,
+    .max_sclk_hz = 20000000,
+    .max_frame_rate_hz = 200000,
+    .result = ad7606_result,
+    .response = ad7606_response,
+};
+
+const sn_spi_adc_chip_t *sn_spi_adc_ads7953(void)
+{
+    return &s_ads7953;
+}
+
+const sn_spi_adc_chip_t *sn_spi_adc_ad7606(void)
+{
+    return &s_ad7606;
+}
+
+static uint16_t mock_convert(sn_spi_mock_t *mock, uint8_t channel)
+{
+    uint32_t row = mock->conversions[channel]++ % mock->script_sets;
+
+    return mock->script[row * mock->chip->channels + channel];
+}
+
+static void mock_frame(sn_spi_mock_t *mock, sn_spi_xfer_t *xfer)
+{
+    const sn_spi_adc_chip_t *chip = mock->chip;
+    uint8_t bytes = chip->word_bits / 8;
+
+    memset(xfer->rx, 0, xfer->len);
+    if (chip->simultaneous) {
+        uint8_t *p = xfer->rx + chip->header_words * bytes;
+        for (uint8_t ch = 0; ch < chip->channels && p + bytes <= xfer->rx + xfer->len; ch++, p += bytes) {
+            sn_spi_adc_put_word(p, bytes, chip->response(ch, mock_convert(mock, ch)));
+        }
+        return;
+    }
+
+    int selected = chip->selects(sn_spi_adc_get_word(xfer->tx, bytes));
+    int converted = chip->pipeline ? mock->selected[chip->pipeline - 1] : selected;
+    if (converted >= 0) {
+        sn_spi_adc_put_word(xfer->rx, bytes, chip->response(converted, mock_convert(mock, converted)));
+    }
+    if (chip->pipeline) {
+        /* a frame that selects nothing keeps the previous channel */
+        memmove(&mock->selected[1], &mock->selected[0], chip->pipeline - 1);
+        if (selected >= 0) {
+            mock->selected[0] = selected;
+        }
+    }
+}
+
+static esp_err_t mock_queue(void *ctx, sn_spi_xfer_t *xfer)
+{
+    sn_spi_mock_t *mock = ctx;
+
+    if (mock->done_count == SN_SPI_ADC_MAX_XFERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    mock_frame(mock, xfer);
+    mock->clock_us += ((uint64_t)xfer->len * 8 * 1000000 + mock->sclk_hz - 1) / mock->sclk_hz;
+    xfer->done_us = mock->clock_us;
+    mock->frames++;
+    mock->done[(mock->done_head + mock->done_count++) % SN_SPI_ADC_MAX_XFERS] = xfer;
+    return ESP_OK;
+}
+
+static esp_err_t mock_wait(void *ctx, sn_spi_xfer_t **xfer, uint32_t timeout_ms)
+{
+    sn_spi_mock_t *mock = ctx;
+
+    if (mock->done_count == 0) {
+        return ESP_ERR_TIMEOUT;
+    }
+    if (mock->fail_count > 0 && mock->fail_after == 0) {
+        mock->fail_count--;
+        return mock->fail_err;
+    }
+    if (mock->fail_after > 0) {
+        mock->fail_after--;
+    }
+    *xfer = mock->done[mock->done_head];
+    mock->done_head = (mock->done_head + 1) % SN_SPI_ADC_MAX_XFERS;
+    mock->done_count--;
+    return ESP_OK;
+}
+
+static const sn_spi_bus_ops_t s_mock_ops = {
+    .queue = mock_queue,
+    .wait = mock_wait,
+};
+
+void sn_spi_mock_init(sn_spi_mock_t *mock, const sn_spi_adc_chip_t *chip, const uint16_t *script,
+                      uint32_t script_sets, uint32_t sclk_hz, sn_spi_bus_t *bus)
+{
+    memset(mock, 0, sizeof(*mock));
+    mock->chip = chip;
+    mock->script = script;
+    mock->script_sets = script_sets;
+    mock->sclk_hz = sclk_hz;
+    memset(mock->selected, 0xff, sizeof(mock->selected));
+    bus->ops = &s_mock_ops;
+    bus->ctx = mock;
+}
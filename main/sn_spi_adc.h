@@ -0,0 +1,125 @@
+/* External SPI ADC chips and the bus they are read over.
+
+   sn_spi_adc_chip_t describes a converter as a sequence of SPI frames (one
+   chip select assertion each):
+
+   - Sequenced chips (multiplexed SAR converters) take one frame per
+     channel: the command word of frame n selects a channel, and its result
+     comes back in frame n + pipeline. A set of n channels is n + pipeline
+     frames; the trailing frames only flush the pipeline.
+   - Simultaneous chips convert every input at once and return all of them
+     in one frame after data ready: header_words status words, then one
+     word per chip input in input order.
+
+   Words are word_bits wide and big-endian on the wire. command() and
+   result() translate between words and channels/samples; selects() and
+   response() are their inverses and are only used by the mock bus, which
+   replays scripted conversions the way the chip would return them, with
+   the same sequencing and pipeline delay.
+
+   sn_spi_bus_t queues pre-built transfers and hands them back in order as
+   they complete; the spi_master binding is in sn_spi_master.c (see
+   sn_source_hw.h). This file has no ESP-IDF dependencies besides esp_err.h, so
+   the chip descriptions, the mock and the SPI source also build on a host.
+*/
+
+#ifndef SN_SPI_ADC_H
+#define SN_SPI_ADC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sn_sample.h"
+
+#define SN_SPI_ADC_MAX_PIPELINE     3
+#define SN_SPI_ADC_MAX_XFERS        (SN_MAX_CHANNELS + SN_SPI_ADC_MAX_PIPELINE)    /* frames per sample set */
+#define SN_SPI_ADC_MAX_FRAME        ((SN_MAX_CHANNELS + 2) * 4)                     /* bytes in one frame */
+
+typedef struct {
+    const char *name;
+    uint8_t channels;           /* inputs on the chip */
+    uint8_t sample_bits;        /* resolution of the samples result() returns, at most 16 */
+    uint8_t word_bits;          /* bits per word on the bus: 8, 16, 24 or 32 */
+    bool simultaneous;          /* one frame returns every input; otherwise one frame per channel */
+    uint8_t header_words;       /* simultaneous: words before the first result */
+    uint8_t pipeline;           /* sequenced: frames between selecting a channel and reading its result */
+    uint8_t spi_mode;
+    uint32_t max_sclk_hz;
+    uint32_t max_frame_rate_hz; /* frames per second the converter keeps up with */
+    uint32_t (*command)(uint8_t channel);                   /* word selecting channel; NULL sends zeros */
+    int32_t (*result)(uint32_t word, uint8_t channel);      /* sample as unsigned, < 0 when the word is not for channel */
+    int (*selects)(uint32_t command);                       /* channel a command selects, < 0 for none */
+    uint32_t (*response)(uint8_t channel, uint16_t sample); /* word carrying a sample of channel */
+} sn_spi_adc_chip_t;
+
+/* One pre-built frame. Buffers are DMA capable and stay valid while the transfer is queued. */
+typedef struct {
+    const uint8_t *tx;
+    uint8_t *rx;
+    uint16_t len;               /* bytes */
+    int64_t done_us;            /* esp_timer time at which the frame completed, set by the bus */
+} sn_spi_xfer_t;
+
+typedef struct {
+    /* Called whenever the transfers are rebuilt, before any of them is queued. May be NULL. */
+    esp_err_t (*prepare)(void *ctx, sn_spi_xfer_t *xfers, size_t count);
+    esp_err_t (*queue)(void *ctx, sn_spi_xfer_t *xfer);
+    /* Wait for the oldest queued transfer to complete. On failure it stays queued and a later wait returns it. */
+    esp_err_t (*wait)(void *ctx, sn_spi_xfer_t **xfer, uint32_t timeout_ms);
+} sn_spi_bus_ops_t;
+
+typedef struct {
+    const sn_spi_bus_ops_t *ops;
+    void *ctx;
+} sn_spi_bus_t;
+
+/* Mock bus state. Each conversion of channel ch returns the next row of the script for ch:
+   script[(conversion % script_sets) * chip->channels + ch]. After fail_after more waits have
+   returned a transfer, the next fail_count waits return fail_err and leave it queued. */
+typedef struct {
+    const sn_spi_adc_chip_t *chip;
+    const uint16_t *script;
+    uint32_t script_sets;
+    uint32_t sclk_hz;
+    int64_t clock_us;           /* virtual time, advanced by every frame's transfer time */
+    uint32_t frames;            /* frames transferred */
+    uint32_t conversions[SN_MAX_CHANNELS];
+    int8_t selected[SN_SPI_ADC_MAX_PIPELINE];   /* channels selected by the last frames, newest first */
+    sn_spi_xfer_t *done[SN_SPI_ADC_MAX_XFERS];
+    uint8_t done_head;
+    uint8_t done_count;
+    uint32_t fail_after;
+    uint32_t fail_count;
+    esp_err_t fail_err;
+} sn_spi_mock_t;
+
+/* TI ADS7953: 16 channels, 12 bits, 1 MSPS, manual channel selection, result two frames later. */
+const sn_spi_adc_chip_t *sn_spi_adc_ads7953(void);
+
+/* Analog Devices AD7606: 8 simultaneously sampled channels, 16 bits, started by CONVST, data ready on BUSY. */
+const sn_spi_adc_chip_t *sn_spi_adc_ad7606(void);
+
+/* Bind a mock bus that answers like chip with the scripted samples. */
+void sn_spi_mock_init(sn_spi_mock_t *mock, const sn_spi_adc_chip_t *chip, const uint16_t *script,
+                      uint32_t script_sets, uint32_t sclk_hz, sn_spi_bus_t *bus);
+
+static inline uint32_t sn_spi_adc_get_word(const uint8_t *p, uint8_t bytes)
+{
+    uint32_t word = 0;
+
+    for (uint8_t i = 0; i < bytes; i++) {
+        word = (word << 8) | p[i];
+    }
+    return word;
+}
+
+static inline void sn_spi_adc_put_word(uint8_t *p, uint8_t bytes, uint32_t word)
+{
+    for (uint8_t i = bytes; i > 0; i--) {
+        p[i - 1] = (uint8_t)word;
+        word >>= 8;
+    }
+}
+
+#endif /* SN_SPI_ADC_H */
@@ -0,0 +1,94 @@
+/* spi_master binding for sn_spi_bus_t: one device, a transaction per pre-built transfer.
+
+   The device queue holds a whole sample set, so queueing never waits, and
+   post_cb stamps each transfer as it completes.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sn_source_hw.h"
+
+static const char *TAG = "sn_spi_master";
+
+static spi_device_handle_t s_device;
+static spi_transaction_t s_trans[SN_SPI_ADC_MAX_XFERS];
+static sn_spi_xfer_t *s_xfer_base;
+
+static void IRAM_ATTR master_post_cb(spi_transaction_t *trans)
+{
+    ((sn_spi_xfer_t *)trans->user)->done_us = esp_timer_get_time();
+}
+
+static esp_err_t master_prepare(void *ctx, sn_spi_xfer_t *xfers, size_t count)
+{
+    memset(s_trans, 0, sizeof(s_trans));
+    for (size_t i = 0; i < count; i++) {
+        s_trans[i].length = xfers[i].len * 8;
+        s_trans[i].tx_buffer = xfers[i].tx;
+        s_trans[i].rx_buffer = xfers[i].rx;
+        s_trans[i].user = &xfers[i];
+    }
+    s_xfer_base = xfers;
+    return ESP_OK;
+}
+
+static esp_err_t master_queue(void *ctx, sn_spi_xfer_t *xfer)
+{
+    return spi_device_queue_trans(s_device, &s_trans[xfer - s_xfer_base], 0);
+}
+
+static esp_err_t master_wait(void *ctx, sn_spi_xfer_t **xfer, uint32_t timeout_ms)
+{
+    spi_transaction_t *trans;
+    esp_err_t err = spi_device_get_trans_result(s_device, &trans, pdMS_TO_TICKS(timeout_ms));
+
+    if (err == ESP_OK) {
+        *xfer = trans->user;
+    }
+    return err;
+}
+
+static const sn_spi_bus_ops_t s_master_ops = {
+    .prepare = master_prepare,
+    .queue = master_queue,
+    .wait = master_wait,
+};
+
+esp_err_t sn_spi_bus_master(const sn_spi_master_config_t *config, const sn_spi_adc_chip_t *chip, sn_spi_bus_t *bus)
+{
+    uint32_t sclk_hz = config->sclk_hz && config->sclk_hz < chip->max_sclk_hz ? config->sclk_hz : chip->max_sclk_hz;
+
+    if (s_device != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const spi_bus_config_t bus_config = {
+        .mosi_io_num = config->mosi_gpio,
+        .miso_io_num = config->miso_gpio,
+        .sclk_io_num = config->sclk_gpio,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        .max_transfer_sz = SN_SPI_ADC_MAX_FRAME,
+    };
+    const spi_device_interface_config_t device_config = {
+        .mode = chip->spi_mode,
+        .clock_speed_hz = sclk_hz,
+        .spics_io_num = config->cs_gpio,
+        .queue_size = SN_SPI_ADC_MAX_XFERS,
+        .post_cb = master_post_cb,
+    };
+    esp_err_t err = spi_bus_initialize(config->host, &bus_config, config->dma_chan);
+    if (err == ESP_OK) {
+        err = spi_bus_add_device(config->host, &device_config, &s_device);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set up SPI host %d for %s: %d", config->host, chip->name, err);
+        return err;
+    }
+    bus->ops = &s_master_ops;
+    bus->ctx = NULL;
+    ESP_LOGI(TAG, "%s on SPI host %d at %d hz", chip->name, config->host, sclk_hz);
+    return ESP_OK;
+}
@@ -0,0 +1,398 @@
+/* Store-and-forward spill log.
+
+   The live part of the log is s_count sectors ending at s_head; the reader
+   always sits in the oldest of them (the tail) and retires it once every
+   record in it has been drained and the writer has moved on. A record
+   header is programmed before its payload, so a reset mid-write leaves a
+   record whose check fails and is skipped rather than a hole the writer
+   would later program over.
+
+   Only the publisher task calls in once the log is up, so s_stats has a
+   single writer and is updated under s_stats_seq (see sn_stats.h).
+*/
+
+#include <string.h>
+#include "esp_log.h"
+#include "sn_stats.h"
+#include "sn_spill.h"
+
+#define SN_SPILL_MAGIC          0x50534e53  /* "SNSP" */
+#define SN_SPILL_RETIRED        0x00000000
+#define SN_SPILL_ERASED_LEN     0xffff
+#define SN_SPILL_STATE_PENDING  0xff
+#define SN_SPILL_STATE_DRAINED  0x00
+
+static const char *TAG = "sn_spill";
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+} spill_sector_hdr_t;
+
+typedef struct {
+    uint16_t len;
+    uint16_t check;
+    uint8_t state;
+    uint8_t reserved[3];
+} spill_record_hdr_t;
+
+static sn_spill_flash_t s_flash;
+static uint32_t s_sectors;
+static bool s_ready;
+static uint32_t s_head;                 /* sector being written, or the last one used while the log is empty */
+static uint32_t s_count;                /* live sectors ending at s_head */
+static uint32_t s_next_seq;
+static size_t s_write_off;              /* next record offset in the head sector */
+static size_t s_read_off;               /* next record offset in the tail sector */
+static size_t s_peek_off;               /* record handed out by the last peek */
+static size_t s_peek_len;
+static sn_spill_stats_t s_stats;
+static uint32_t s_stats_seq;            /* odd while a writer updates s_stats */
+
+static void stats_begin(void)
+{
+    sn_stats_write_begin(&s_stats_seq);
+}
+
+static void stats_end(void)
+{
+    sn_stats_write_end(&s_stats_seq);
+}
+
+static size_t record_size(size_t len)
+{
+    return sizeof(spill_record_hdr_t) + ((len + 3) & ~(size_t)3);
+}
+
+/* Fletcher-16 over the payload. */
+static uint16_t record_check(const uint8_t *data, size_t len)
+{
+    uint32_t a = 0, b = 0;
+
+    while (len > 0) {
+        size_t n = len < 360 ? len : 360;  /* keeps a and b well inside 32 bits between reductions */
+        len -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 255;
+        b %= 255;
+    }
+    return (uint16_t)((b << 8) | a);
+}
+
+static uint32_t tail_sector(void)
+{
+    return (s_head + s_sectors + 1 - s_count) % s_sectors;
+}
+
+static size_t sector_offset(uint32_t sector)
+{
+    return (size_t)sector * s_flash.sector_size;
+}
+
+static esp_err_t flash_read(size_t offset, void *buf, size_t len)
+{
+    return s_flash.ops->read(s_flash.ctx, offset, buf, len);
+}
+
+static esp_err_t flash_write(size_t offset, const void *buf, size_t len)
+{
+    esp_err_t err = s_flash.ops->write(s_flash.ctx, offset, buf, len);
+    if (err == ESP_OK) {
+        stats_begin();
+        s_stats.flash_bytes += len;
+        stats_end();
+    }
+    return err;
+}
+
+/* Walk the records of a sector. Returns the number still pending and sets *end
+   to the offset after the last record, or to the sector size when the sector
+   holds a record whose header is unreadable so nothing more is appended. */
+static uint32_t scan_sector(uint32_t sector, size_t *end)
+{
+    size_t off = sizeof(spill_sector_hdr_t);
+    uint32_t pending = 0;
+
+    while (off + sizeof(spill_record_hdr_t) <= s_flash.sector_size) {
+        spill_record_hdr_t hdr;
+        if (flash_read(sector_offset(sector) + off, &hdr, sizeof(hdr)) != ESP_OK) {
+            off = s_flash.sector_size;
+            break;
+        }
+        if (hdr.len == SN_SPILL_ERASED_LEN) {
+            break;
+        }
+        if (hdr.len == 0 || off + record_size(hdr.len) > s_flash.sector_size) {
+            off = s_flash.sector_size;
+            break;
+        }
+        if (hdr.state != SN_SPILL_STATE_DRAINED) {
+            pending++;
+        }
+        off += record_size(hdr.len);
+    }
+    *end = off;
+    return pending;
+}
+
+/* Clear the state byte of the record at offset. */
+static esp_err_t mark_drained(size_t offset)
+{
+    static const uint8_t drained = SN_SPILL_STATE_DRAINED;
+
+    return flash_write(offset + offsetof(spill_record_hdr_t, state), &drained, sizeof(drained));
+}
+
+/* Mark the tail sector as free by clearing its magic; seq stays so init can still order it. */
+static void retire_tail(void)
+{
+    static const uint32_t retired = SN_SPILL_RETIRED;
+    size_t base = sector_offset(tail_sector());
+
+    if (s_peek_len != 0 && s_peek_off >= base && s_peek_off < base + s_flash.sector_size) {
+        s_peek_len = 0;         /* the peeked record is gone, consuming it is a no-op */
+    }
+    flash_write(base, &retired, sizeof(retired));
+    s_count--;
+    s_read_off = sizeof(spill_sector_hdr_t);
+}
+
+static esp_err_t open_sector(void)
+{
+    uint32_t next = (s_head + 1) % s_sectors;
+
+    if (s_count == s_sectors) {
+        size_t end;
+        uint32_t lost = scan_sector(tail_sector(), &end);
+        stats_begin();
+        s_stats.records_dropped += lost;
+        s_stats.records_pending -= lost;
+        stats_end();
+        if (lost > 0) {
+            ESP_LOGW(TAG, "Log full, dropping %u records", lost);
+        }
+        retire_tail();
+    }
+
+    esp_err_t err = s_flash.ops->erase(s_flash.ctx, sector_offset(next), s_flash.sector_size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    stats_begin();
+    s_stats.sector_erases++;
+    stats_end();
+    spill_sector_hdr_t hdr = {
+        .magic = SN_SPILL_MAGIC,
+        .seq = s_next_seq,
+    };
+    err = flash_write(sector_offset(next), &hdr, sizeof(hdr));
+    if (err != ESP_OK) {
+        return err;
+    }
+    s_next_seq++;
+    if (s_count == 0) {
+        s_read_off = sizeof(spill_sector_hdr_t);
+    }
+    s_head = next;
+    s_count++;
+    s_write_off = sizeof(spill_sector_hdr_t);
+    return ESP_OK;
+}
+
+esp_err_t sn_spill_init(const sn_spill_flash_t *flash)
+{
+    if (flash == NULL || flash->ops == NULL || flash->sector_size < 256 ||
+        flash->size < 2 * flash->sector_size || flash->size % flash->sector_size != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_flash = *flash;
+    s_sectors = flash->size / flash->sector_size;
+    stats_begin();
+    memset(&s_stats, 0, sizeof(s_stats));
+    stats_end();
+    s_count = 0;
+    s_head = s_sectors - 1;
+    s_next_seq = 0;
+    s_peek_len = 0;
+
+    /* the highest seq, live or retired, is where the writer stopped; live sectors run back from there */
+    bool any = false;
+    uint32_t live_min = 0;
+    for (uint32_t sector = 0; sector < s_sectors; sector++) {
+        spill_sector_hdr_t hdr;
+        esp_err_t err = flash_read(sector_offset(sector), &hdr, sizeof(hdr));
+        if (err != ESP_OK) {
+            return err;
+        }
+        if ((hdr.magic != SN_SPILL_MAGIC && hdr.magic != SN_SPILL_RETIRED) || hdr.seq == UINT32_MAX) {
+            continue;
+        }
+        if (!any || (int32_t)(hdr.seq - (s_next_seq - 1)) > 0) {
+            s_head = sector;
+            s_next_seq = hdr.seq + 1;
+        }
+        if (hdr.magic == SN_SPILL_MAGIC && (s_count == 0 || (int32_t)(hdr.seq - live_min) < 0)) {
+            live_min = hdr.seq;
+        }
+        if (hdr.magic == SN_SPILL_MAGIC) {
+            s_count++;
+        }
+        any = true;
+    }
+    if (s_count > 0) {
+        spill_sector_hdr_t hdr;
+        flash_read(sector_offset(s_head), &hdr, sizeof(hdr));
+        uint32_t span = s_next_seq - live_min;
+        if (hdr.magic != SN_SPILL_MAGIC || span != s_count) {
+            /* live sectors are not one contiguous run ending at the head; keep the run that does */
+            ESP_LOGW(TAG, "Log is inconsistent, keeping only the newest run of sectors");
+            uint32_t run = 0;
+            while (run < s_count) {
+                flash_read(sector_offset((s_head + s_sectors - run) % s_sectors), &hdr, sizeof(hdr));
+                if (hdr.magic != SN_SPILL_MAGIC || hdr.seq != s_next_seq - 1 - run) {
+                    break;
+                }
+                run++;
+            }
+            s_count = run;
+        }
+    }
+
+    s_read_off = sizeof(spill_sector_hdr_t);
+    s_write_off = s_flash.sector_size;      /* forces a fresh sector unless the head has room */
+    for (uint32_t k = 0; k < s_count; k++) {
+        uint32_t sector = (tail_sector() + k) % s_sectors;
+        size_t end;
+        stats_begin();
+        s_stats.records_pending += scan_sector(sector, &end);
+        stats_end();
+        if (sector == s_head) {
+            s_write_off = end;
+        }
+    }
+    s_ready = true;
+    ESP_LOGI(TAG, "%u sectors of %zu bytes, %u live, %u records pending", s_sectors, s_flash.sector_size,
+             s_count, s_stats.records_pending);
+    return ESP_OK;
+}
+
+bool sn_spill_ready(void)
+{
+    return s_ready;
+}
+
+size_t sn_spill_max_record(void)
+{
+    if (!s_ready) {
+        return 0;
+    }
+    size_t max = s_flash.sector_size - sizeof(spill_sector_hdr_t) - sizeof(spill_record_hdr_t);
+    return max < SN_SPILL_ERASED_LEN ? max : SN_SPILL_ERASED_LEN - 1;
+}
+
+esp_err_t sn_spill_write(const uint8_t *data, size_t len)
+{
+    if (!s_ready) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len == 0 || len > sn_spill_max_record()) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (s_count == 0 || s_write_off + record_size(len) > s_flash.sector_size) {
+        esp_err_t err = open_sector();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    spill_record_hdr_t hdr = {
+        .len = len,
+        .check = record_check(data, len),
+        .state = SN_SPILL_STATE_PENDING,
+        .reserved = { 0xff, 0xff, 0xff },
+    };
+    size_t off = sector_offset(s_head) + s_write_off;
+    esp_err_t err = flash_write(off, &hdr, sizeof(hdr));
+    s_write_off += record_size(len);     /* a failed write still consumes the space */
+    if (err == ESP_OK) {
+        err = flash_write(off + sizeof(hdr), data, len);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    stats_begin();
+    s_stats.records_written++;
+    s_stats.records_pending++;
+    s_stats.payload_bytes += len;
+    stats_end();
+    return ESP_OK;
+}
+
+size_t sn_spill_peek(uint8_t *buf, size_t cap)
+{
+    s_peek_len = 0;
+    while (s_ready && s_count > 0) {
+        size_t base = sector_offset(tail_sector());
+        size_t end = s_count == 1 ? s_write_off : s_flash.sector_size;
+        spill_record_hdr_t hdr;
+
+        if (s_read_off + sizeof(hdr) > end ||
+            flash_read(base + s_read_off, &hdr, sizeof(hdr)) != ESP_OK ||
+            hdr.len == SN_SPILL_ERASED_LEN || hdr.len == 0 ||
+            s_read_off + record_size(hdr.len) > end) {
+            if (s_count == 1) {
+                return 0;       /* caught up with the writer */
+            }
+            retire_tail();
+            continue;
+        }
+        size_t off = s_read_off;
+        s_read_off += record_size(hdr.len);
+        if (hdr.state == SN_SPILL_STATE_DRAINED) {
+            continue;
+        }
+        if (hdr.len > cap || flash_read(base + off + sizeof(hdr), buf, hdr.len) != ESP_OK ||
+            record_check(buf, hdr.len) != hdr.check) {
+            /* mark it drained so neither a later wrap nor a reset counts it as pending again */
+            mark_drained(base + off);
+            stats_begin();
+            s_stats.records_corrupt++;
+            s_stats.records_pending--;
+            stats_end();
+            continue;
+        }
+        s_read_off = off;       /* stays pending until consumed */
+        s_peek_off = base + off;
+        s_peek_len = hdr.len;
+        return hdr.len;
+    }
+    return 0;
+}
+
+esp_err_t sn_spill_consume(void)
+{
+    if (s_peek_len == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = mark_drained(s_peek_off);
+    s_read_off += record_size(s_peek_len);
+    s_peek_len = 0;
+    stats_begin();
+    s_stats.records_drained++;
+    s_stats.records_pending--;
+    stats_end();
+    return err;
+}
+
+void sn_spill_get_stats(sn_spill_stats_t *stats)
+{
+    uint32_t seq;
+
+    do {
+        seq = sn_stats_read_begin(&s_stats_seq);
+        *stats = s_stats;
+    } while (sn_stats_read_retry(&s_stats_seq, seq));
+}
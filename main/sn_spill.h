@@ -0,0 +1,81 @@
+/* Store-and-forward spill log.
+
+   While the broker is unreachable the publisher appends finished frames to a
+   circular log on flash and drains it again after reconnecting. The log is a
+   ring of erase sectors written strictly in order and each sector is erased
+   only when the writer reaches it again, so wear is spread evenly across the
+   whole partition without a separate wear-levelling layer. When the log is
+   full the oldest sector is dropped to make room.
+
+   Sector layout: an 8 byte header {magic, seq} followed by records, each an
+   8 byte header {len, check, state} and the payload padded to 4 bytes. The
+   seq of every opened sector is one higher than the last, which lets
+   sn_spill_init() find both ends of the log after a reset. Records are
+   marked drained and sectors retired by clearing bits in place, so nothing
+   is erased until a sector is reused.
+
+   Flash is reached through sn_spill_flash_t: sn_spill_flash_partition()
+   binds a data partition, and any other storage (a RAM or file image on a
+   host) can be plugged in the same way. The log is not thread safe; only
+   the publisher task uses it.
+*/
+
+#ifndef SN_SPILL_H
+#define SN_SPILL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define SN_SPILL_PARTITION_LABEL "spill"
+
+typedef struct {
+    esp_err_t (*read)(void *ctx, size_t offset, void *buf, size_t len);
+    esp_err_t (*write)(void *ctx, size_t offset, const void *buf, size_t len);
+    esp_err_t (*erase)(void *ctx, size_t offset, size_t len);
+} sn_spill_flash_ops_t;
+
+typedef struct {
+    const sn_spill_flash_ops_t *ops;
+    void *ctx;
+    size_t size;                /* bytes, a multiple of sector_size */
+    size_t sector_size;         /* erase unit */
+} sn_spill_flash_t;
+
+typedef struct {
+    uint32_t records_written;
+    uint32_t records_drained;
+    uint32_t records_dropped;   /* pending records lost when the log wrapped */
+    uint32_t records_corrupt;   /* records that failed their check, e.g. cut short by a reset */
+    uint32_t records_pending;   /* written and not yet drained */
+    uint32_t sector_erases;
+    uint64_t payload_bytes;     /* frame bytes appended */
+    uint64_t flash_bytes;       /* bytes programmed including headers and state updates */
+} sn_spill_stats_t;
+
+/* Bind the data partition with the given label. */
+esp_err_t sn_spill_flash_partition(const char *label, sn_spill_flash_t *flash);
+
+/* Attach the log to flash and recover its head, tail and pending count. */
+esp_err_t sn_spill_init(const sn_spill_flash_t *flash);
+
+/* True once sn_spill_init() succeeded. */
+bool sn_spill_ready(void);
+
+/* Largest record the log accepts. */
+size_t sn_spill_max_record(void);
+
+/* Append one record, dropping the oldest sector when the log is full. */
+esp_err_t sn_spill_write(const uint8_t *data, size_t len);
+
+/* Copy the oldest pending record into buf and return its length, 0 when the log is empty.
+   The record stays pending until sn_spill_consume(). */
+size_t sn_spill_peek(uint8_t *buf, size_t cap);
+
+/* Mark the record returned by the last sn_spill_peek() as drained. */
+esp_err_t sn_spill_consume(void);
+
+void sn_spill_get_stats(sn_spill_stats_t *stats);
+
+#endif /* SN_SPILL_H */
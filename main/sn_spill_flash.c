@@ -0,0 +1,44 @@
+/* Spill log backend on a flash data partition.
+
+   Writes and erases go through the SPI flash driver, which suspends the
+   caches on both cores while it runs; the I2S source keeps sampling into
+   DMA buffers meanwhile, a polled source may record missed ticks.
+*/
+
+#include "esp_partition.h"
+#include "sn_spill.h"
+
+static esp_err_t partition_read(void *ctx, size_t offset, void *buf, size_t len)
+{
+    return esp_partition_read(ctx, offset, buf, len);
+}
+
+static esp_err_t partition_write(void *ctx, size_t offset, const void *buf, size_t len)
+{
+    return esp_partition_write(ctx, offset, buf, len);
+}
+
+static esp_err_t partition_erase(void *ctx, size_t offset, size_t len)
+{
+    return esp_partition_erase_range(ctx, offset, len);
+}
+
+static const sn_spill_flash_ops_t s_partition_ops = {
+    .read = partition_read,
+    .write = partition_write,
+    .erase = partition_erase,
+};
+
+esp_err_t sn_spill_flash_partition(const char *label, sn_spill_flash_t *flash)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+
+    if (part == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    flash->ops = &s_partition_ops;
+    flash->ctx = (void *)part;
+    flash->size = part->size - part->size % SPI_FLASH_SEC_SIZE;
+    flash->sector_size = SPI_FLASH_SEC_SIZE;
+    return ESP_OK;
+}
@@ -0,0 +1,156 @@
+/* Low-overhead counters for the hot paths. */
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "sn_stats.h"
+
+void sn_hist_delta(sn_hist_t *delta, const sn_hist_t *now, const sn_hist_t *prev)
+{
+    delta->count = now->count - prev->count;
+    delta->sum = now->sum - prev->sum;
+    delta->max = now->max;
+    for (int i = 0; i < SN_HIST_BUCKETS; i++) {
+        delta->buckets[i] = now->buckets[i] - prev->buckets[i];
+    }
+}
+
+uint32_t sn_hist_percentile(const sn_hist_t *hist, uint8_t percent)
+{
+    uint64_t target = ((uint64_t)hist->count * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+    for (int i = 0; i < SN_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            uint32_t edge = i == SN_HIST_BUCKETS - 1 ? UINT32_MAX : (2u << i) - 1;
+            /* no value above max was recorded, whatever the bucket spans */
+            return edge < hist->max ? edge : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+static void append(sn_stats_writer_t *writer, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(sn_stats_writer_t *writer, const char *fmt, ...)
+{
+    va_list args;
+    size_t room = writer->len < writer->cap ? writer->cap - writer->len : 0;
+
+    va_start(args, fmt);
+    int n = vsnprintf(writer->buf + writer->len, room, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= room) {
+        writer->truncated = true;
+        writer->len = writer->cap;
+        return;
+    }
+    writer->len += n;
+}
+
+static void key(sn_stats_writer_t *writer, const char *name)
+{
+    append(writer, "%s\"%s\":", writer->comma ? "," : "", name);
+    writer->comma = true;
+}
+
+void sn_stats_begin(sn_stats_writer_t *writer, char *buf, size_t cap)
+{
+    writer->buf = buf;
+    writer->cap = cap;
+    writer->len = 0;
+    writer->comma = false;
+    writer->truncated = false;
+    append(writer, "{");
+}
+
+void sn_stats_object(sn_stats_writer_t *writer, const char *name)
+{
+    key(writer, name);
+    append(writer, "{");
+    writer->comma = false;
+}
+
+void sn_stats_end_object(sn_stats_writer_t *writer)
+{
+    append(writer, "}");
+    writer->comma = true;
+}
+
+void sn_stats_u32(sn_stats_writer_t *writer, const char *name, uint32_t value)
+{
+    key(writer, name);
+    append(writer, "%" PRIu32, value);
+}
+
+void sn_stats_u64(sn_stats_writer_t *writer, const char *name, uint64_t value)
+{
+    key(writer, name);
+    append(writer, "%" PRIu64, value);
+}
+
+void sn_stats_i64(sn_stats_writer_t *writer, const char *name, int64_t value)
+{
+    key(writer, name);
+    append(writer, "%" PRId64, value);
+}
+
+void sn_stats_str(sn_stats_writer_t *writer, const char *name, const char *value)
+{
+    key(writer, name);
+    append(writer, "\"%s\"", value);
+}
+
+void sn_stats_hist(sn_stats_writer_t *writer, const char *name, const sn_hist_t *hist)
+{
+    int first = 0, last = SN_HIST_BUCKETS - 1;
+
+    sn_stats_object(writer, name);
+    sn_stats_u32(writer, "n", hist->count);
+    sn_stats_u64(writer, "mean", hist->count ? hist->sum / hist->count : 0);
+    sn_stats_u32(writer, "max", hist->max);
+    sn_stats_u32(writer, "p50", sn_hist_percentile(hist, 50));
+    sn_stats_u32(writer, "p90", sn_hist_percentile(hist, 90));
+    sn_stats_u32(writer, "p99", sn_hist_percentile(hist, 99));
+    while (first < last && hist->buckets[first] == 0) {
+        first++;
+    }
+    while (last > first && hist->buckets[last] == 0) {
+        last--;
+    }
+    /* buckets[k] of the report is bucket first + k, values in [2^(first+k), 2^(first+k+1)) */
+    sn_stats_u32(writer, "first", first);
+    key(writer, "buckets");
+    for (int i = first; i <= last; i++) {
+        append(writer, "%s%" PRIu32, i == first ? "[" : ",", hist->buckets[i]);
+    }
+    append(writer, "]");
+    sn_stats_end_object(writer);
+}
+
+sn_stats_mark_t sn_stats_mark(const sn_stats_writer_t *writer)
+{
+    return (sn_stats_mark_t) { .len = writer->len, .comma = writer->comma };
+}
+
+void sn_stats_rewind(sn_stats_writer_t *writer, const sn_stats_mark_t *mark)
+{
+    if (mark->len >= writer->cap) {
+        return;     /* taken after the report had already overflowed */
+    }
+    writer->len = mark->len;
+    writer->comma = mark->comma;
+    writer->truncated = false;
+    writer->buf[writer->len] = '\0';
+}
+
+size_t sn_stats_finish(sn_stats_writer_t *writer)
+{
+    append(writer, "}");
+    return writer->truncated ? 0 : writer->len;
+}
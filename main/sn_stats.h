@@ -0,0 +1,164 @@
+/* Low-overhead counters for the hot paths.
+
+   sn_hist_t is a fixed histogram with one bucket per power of two: bucket
+   0 holds 0 and 1, bucket n holds values in [2^n, 2^(n+1)). Adding a value
+   is a count-leading-zeros and three increments, so the sampler can record
+   every scan; at 2 kHz the timing and bookkeeping add up to well under a
+   microsecond per set. Histograms only ever grow, and the reporter turns
+   two snapshots into per-interval figures with sn_hist_delta().
+
+   Each stage's counters and histograms have a single writer, the task that
+   owns them, and are read from other tasks on either core. The writer
+   wraps every update in sn_stats_write_begin()/sn_stats_write_end(), which
+   make a sequence count odd for the duration; a reader copies between
+   sn_stats_read_begin() and sn_stats_read_retry() and copies again until
+   no update overlapped, so it never sees a torn 64-bit sum or a count that
+   disagrees with its histogram. Writers run above the readers' priority,
+   so a reader on the writer's core never spins on an update it preempted.
+
+   Durations are taken with the CPU cycle counter, which is per core on the
+   ESP32, so start and end must be read on the same core; the sampler and
+   publisher are pinned. sn_stats_writer_t formats a compact JSON report.
+
+   Like sn_frame this file has no ESP-IDF dependencies; on other hosts the
+   cycle counter is a nanosecond clock, so the same stats can be read in
+   simulation.
+*/
+
+#ifndef SN_STATS_H
+#define SN_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__XTENSA__)
+#include "xtensa/hal.h"
+#include "sdkconfig.h"
+#define SN_STATS_CYCLES_PER_US  CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+#else
+#include <time.h>
+#define SN_STATS_CYCLES_PER_US  1000
+#endif
+
+#define SN_HIST_BUCKETS         32
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[SN_HIST_BUCKETS];
+} sn_hist_t;
+
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;
+    bool comma;                 /* a member was written at this nesting level */
+    bool truncated;
+} sn_stats_writer_t;
+
+/* Position in a report to roll back to, see sn_stats_rewind(). */
+typedef struct {
+    size_t len;
+    bool comma;
+} sn_stats_mark_t;
+
+/* Tasks that read the stage counters. Extremes such as high-water marks are kept once per reader and
+   restart when that reader takes them, so each sees the window since its own previous call. */
+typedef enum {
+    SN_STATS_READER_HEALTH,
+    SN_STATS_READER_BENCH,
+    SN_STATS_READERS,
+} sn_stats_reader_t;
+
+static inline void sn_stats_write_begin(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void sn_stats_write_end(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Sequence to copy at, once no update is in progress. */
+static inline uint32_t sn_stats_read_begin(const uint32_t *seq)
+{
+    uint32_t start;
+
+    while ((start = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1) {
+    }
+    return start;
+}
+
+/* True when an update overlapped the copy taken since sn_stats_read_begin() returned start. */
+static inline bool sn_stats_read_retry(const uint32_t *seq, uint32_t start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+/* Free-running cycle counter of the calling core, wraps every few seconds. */
+static inline uint32_t sn_stats_cycles(void)
+{
+#if defined(__XTENSA__)
+    return xthal_get_ccount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+/* Nanoseconds elapsed since start, a value of sn_stats_cycles() on this core. */
+static inline uint32_t sn_stats_elapsed_ns(uint32_t start)
+{
+    return (uint32_t)((uint64_t)(sn_stats_cycles() - start) * 1000 / SN_STATS_CYCLES_PER_US);
+}
+
+static inline void sn_hist_add(sn_hist_t *hist, uint32_t value)
+{
+    uint8_t bucket = value > 1 ? 31 - __builtin_clz(value) : 0;
+
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->sum += value;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+/* Counts added between two snapshots of the same histogram; max is the all-time max of now. */
+void sn_hist_delta(sn_hist_t *delta, const sn_hist_t *now, const sn_hist_t *prev);
+
+/* Upper edge of the bucket holding the given percentile, at most max; 0 when empty. */
+uint32_t sn_hist_percentile(const sn_hist_t *hist, uint8_t percent);
+
+/* Start a JSON object in buf. */
+void sn_stats_begin(sn_stats_writer_t *writer, char *buf, size_t cap);
+
+/* Open and close a nested object. */
+void sn_stats_object(sn_stats_writer_t *writer, const char *key);
+void sn_stats_end_object(sn_stats_writer_t *writer);
+
+void sn_stats_u32(sn_stats_writer_t *writer, const char *key, uint32_t value);
+void sn_stats_u64(sn_stats_writer_t *writer, const char *key, uint64_t value);
+void sn_stats_i64(sn_stats_writer_t *writer, const char *key, int64_t value);
+void sn_stats_str(sn_stats_writer_t *writer, const char *key, const char *value);
+
+/* Count, mean, max, p50/p90/p99 and the non-empty bucket range of a histogram. */
+void sn_stats_hist(sn_stats_writer_t *writer, const char *key, const sn_hist_t *hist);
+
+/* Remember the current position, taken between members. */
+sn_stats_mark_t sn_stats_mark(const sn_stats_writer_t *writer);
+
+/* Drop everything written since mark, including a truncation, so the caller can leave out a section that
+   did not fit and carry on with the rest. */
+void sn_stats_rewind(sn_stats_writer_t *writer, const sn_stats_mark_t *mark);
+
+/* Close the object. Returns the length, or 0 when it did not fit in the buffer. */
+size_t sn_stats_finish(sn_stats_writer_t *writer);
+
+#endif /* SN_STATS_H */
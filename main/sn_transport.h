@@ -0,0 +1,38 @@
+/* Data transports.
+
+   A transport takes filled frame buffers from the publisher and owns them
+   until it returns them to the frame pool, after delivery or once they fall
+   out of its retransmit history, which it gives up when the publisher
+   switches away from it. A buffer that send() refuses stays with
+   the caller, which releases, spills or retries it. Commands and
+   configuration always stay on the esp_mqtt control connection; only
+   sample frames go through here.
+
+   Backends are singletons returned by their factory function, started once
+   from app_main. The publisher can switch between them at runtime.
+*/
+
+#ifndef SN_TRANSPORT_H
+#define SN_TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sn_pool.h"
+
+typedef struct {
+    const char *name;
+    size_t max_frame;                   /* largest frame that goes out as one packet */
+    bool (*connected)(void);            /* false while frames cannot be delivered */
+    esp_err_t (*send)(sn_buf_t *buf);   /* queue a filled buffer; the transport owns it once this returns ESP_OK */
+    sn_buf_t *(*reclaim)(void);         /* take back the oldest queued buffer not sent yet, or NULL */
+    void (*detach)(void);               /* switched away from: free the retransmit history; may be NULL */
+} sn_transport_t;
+
+/* Pipelined QoS 1 MQTT connection, see sn_mqtt_pipe.h. */
+const sn_transport_t *sn_transport_mqtt(void);
+
+/* UDP unicast or multicast with NACK based retransmission, see sn_udp.h. */
+const sn_transport_t *sn_transport_udp(void);
+
+#endif /* SN_TRANSPORT_H */
@@ -0,0 +1,349 @@
+/* UDP data transport with NACK based retransmission.
+
+   One task owns the socket: it sends queued frames, answers NACKs between
+   frames and keeps the heartbeat going. Sent frames stay in their pool
+   buffers in a history indexed by seq modulo its length, so a resend is a
+   header flag and another sendto. A failed sendto (no route while Wi-Fi is
+   down) marks the transport disconnected so the publisher spills; a
+   heartbeat probe once a second brings it back. A detach only raises
+   s_release; the task frees the history itself, since it alone touches it.
+
+   The task is the only writer of s_stats and updates it under s_stats_seq
+   (see sn_stats.h). Reclaims run on the publisher task, so their count is
+   kept apart and added atomically.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "sn_transport.h"
+#include "sn_boot.h"
+#include "sn_udp.h"
+
+#define SN_UDP_CORE             0
+#define SN_UDP_PRIORITY         5
+#define SN_UDP_STACK_SIZE       4096
+#define SN_UDP_POLL_MS          10
+#define SN_UDP_RETRY_MS         1000
+#define SN_UDP_HEARTBEAT_MS     1000
+#define SN_UDP_HEARTBEAT_LINGER_MS 10000    /* heartbeats stop and the history is freed this long after the last frame */
+
+static const char *TAG = "sn_udp";
+
+static sn_udp_config_t s_config;
+static QueueHandle_t s_ready;
+static int s_sock = -1;
+static struct sockaddr_in s_dest;
+static volatile bool s_connected;
+static TaskHandle_t s_task;
+static uint32_t s_next_seq;
+static sn_buf_t *s_history[SN_UDP_MAX_HISTORY];    /* frame with seq s lives at s % history */
+static uint32_t s_history_count;
+static bool s_release;                  /* set by detach, history to be freed by the task */
+static int64_t s_last_tx_us;
+static int64_t s_last_data_us;
+static sn_udp_stats_t s_stats;
+static uint32_t s_stats_seq;            /* odd while the task updates s_stats */
+static uint32_t s_reclaimed;            /* written by the publisher task */
+
+static void stats_begin(void)
+{
+    sn_stats_write_begin(&s_stats_seq);
+}
+
+static void stats_end(void)
+{
+    sn_stats_write_end(&s_stats_seq);
+}
+
+static void put_header(uint8_t *p, uint8_t type, uint32_t seq)
+{
+    p[0] = SN_UDP_VERSION;
+    p[1] = type;
+    p[2] = s_config.node_id & 0xff;
+    p[3] = s_config.node_id >> 8;
+    p[4] = seq & 0xff;
+    p[5] = (seq >> 8) & 0xff;
+    p[6] = (seq >> 16) & 0xff;
+    p[7] = seq >> 24;
+}
+
+static bool send_datagram(const uint8_t *p, size_t len)
+{
+    if (sendto(s_sock, p, len, 0, (const struct sockaddr *)&s_dest, sizeof(s_dest)) != (int)len) {
+        stats_begin();
+        s_stats.send_errors++;
+        stats_end();
+        if (s_connected) {
+            ESP_LOGW(TAG, "Send to %s failed, holding frames", s_config.host);
+        }
+        s_connected = false;
+        return false;
+    }
+    stats_begin();
+    s_stats.bytes += len;
+    stats_end();
+    s_last_tx_us = esp_timer_get_time();
+    s_connected = true;
+    return true;
+}
+
+static void send_control(uint8_t type, uint32_t seq, uint16_t count)
+{
+    uint8_t pkt[SN_UDP_NACK_LEN];
+
+    put_header(pkt, type, seq);
+    pkt[8] = count & 0xff;
+    pkt[9] = count >> 8;
+    send_datagram(pkt, type == SN_UDP_TYPE_HEARTBEAT ? SN_UDP_HEADER_LEN : SN_UDP_NACK_LEN);
+}
+
+static bool open_socket(void)
+{
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *res;
+
+    if (getaddrinfo(s_config.host, s_config.port, &hints, &res) != 0 || res == NULL) {
+        return false;
+    }
+    memcpy(&s_dest, res->ai_addr, sizeof(s_dest));
+    freeaddrinfo(res);
+    s_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s_sock < 0) {
+        return false;
+    }
+    if (IN_MULTICAST(ntohl(s_dest.sin_addr.s_addr))) {
+        uint8_t ttl = s_config.multicast_ttl ? s_config.multicast_ttl : 1;
+        setsockopt(s_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    }
+    s_connected = true;
+    ESP_LOGI(TAG, "Streaming to %s:%s, history %d", s_config.host, s_config.port, s_config.history);
+    return true;
+}
+
+static void send_frame(sn_buf_t *buf)
+{
+    uint32_t seq = s_next_seq++;
+    uint32_t slot = seq % s_config.history;
+
+    if (s_history[slot] != NULL) {
+        sn_pool_release(s_config.pool, s_history[slot]);
+    }
+    s_history[slot] = buf;
+    if (s_history_count < s_config.history) {
+        s_history_count++;
+    }
+    buf->packet = buf->data - SN_UDP_HEADER_LEN;
+    put_header(buf->packet, SN_UDP_TYPE_DATA, seq);
+    s_last_data_us = esp_timer_get_time();
+    stats_begin();
+    sn_hist_add(&s_stats.send_latency_us, s_last_data_us - buf->queued_us);
+    stats_end();
+    /* a frame that fails to go out stays in the history and can still be NACKed */
+    if (send_datagram(buf->packet, buf->len + SN_UDP_HEADER_LEN)) {
+        stats_begin();
+        s_stats.sent++;
+        stats_end();
+        sn_boot_mark(SN_BOOT_FIRST_FRAME);
+    }
+}
+
+static void handle_nack(uint32_t first, uint16_t count)
+{
+    uint32_t gone_first = 0;
+    uint16_t gone_count = 0;
+
+    stats_begin();
+    s_stats.nacks++;
+    stats_end();
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t seq = first + i;
+        uint32_t age = s_next_seq - seq;
+        if (age == 0 || age > INT32_MAX) {
+            break;              /* not sent yet */
+        }
+        if (age > s_history_count) {
+            if (gone_count++ == 0) {
+                gone_first = seq;
+            }
+            continue;
+        }
+        sn_buf_t *buf = s_history[seq % s_config.history];
+        buf->packet[1] = SN_UDP_TYPE_DATA | SN_UDP_FLAG_RETRANSMIT;
+        if (send_datagram(buf->packet, buf->len + SN_UDP_HEADER_LEN)) {
+            stats_begin();
+            s_stats.retransmitted++;
+            stats_end();
+        }
+    }
+    if (gone_count > 0) {
+        stats_begin();
+        s_stats.gone += gone_count;
+        stats_end();
+        send_control(SN_UDP_TYPE_GONE, gone_first, gone_count);
+    }
+}
+
+static void poll_nacks(void)
+{
+    uint8_t pkt[SN_UDP_NACK_LEN];
+    int len;
+
+    while ((len = recvfrom(s_sock, pkt, sizeof(pkt), MSG_DONTWAIT, NULL, NULL)) >= SN_UDP_NACK_LEN) {
+        uint16_t node_id = pkt[2] | (pkt[3] << 8);
+        if (pkt[0] != SN_UDP_VERSION || (pkt[1] & SN_UDP_TYPE_MASK) != SN_UDP_TYPE_NACK ||
+            node_id != s_config.node_id) {
+            continue;
+        }
+        uint32_t seq = pkt[4] | (pkt[5] << 8) | (pkt[6] << 16) | ((uint32_t)pkt[7] << 24);
+        handle_nack(seq, pkt[8] | (pkt[9] << 8));
+    }
+}
+
+/* Hand the history back to the pool; NACKs for it are answered with GONE from then on. */
+static void release_history(void)
+{
+    for (uint32_t i = 0; s_history_count > 0 && i < s_config.history; i++) {
+        if (s_history[i] != NULL) {
+            sn_pool_release(s_config.pool, s_history[i]);
+            s_history[i] = NULL;
+        }
+    }
+    s_history_count = 0;
+}
+
+/* Keep receivers informed of the next seq while idle; once idle for good, release the history. */
+static void heartbeat(void)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    if (s_next_seq == 0 || now_us - s_last_tx_us < SN_UDP_HEARTBEAT_MS * 1000LL) {
+        return;
+    }
+    if (now_us - s_last_data_us > SN_UDP_HEARTBEAT_LINGER_MS * 1000LL) {
+        release_history();
+        return;
+    }
+    send_control(SN_UDP_TYPE_HEARTBEAT, s_next_seq, 0);
+}
+
+static void udp_task(void *arg)
+{
+    for (;;) {
+        if (s_sock < 0 && !open_socket()) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SN_UDP_RETRY_MS));
+            continue;
+        }
+        if (__atomic_exchange_n(&s_release, false, __ATOMIC_RELAXED)) {
+            release_history();
+        }
+        if (!s_connected) {
+            /* leave queued frames to the publisher, which spills them while we are down */
+            if (esp_timer_get_time() - s_last_tx_us >= SN_UDP_RETRY_MS * 1000LL) {
+                send_control(SN_UDP_TYPE_HEARTBEAT, s_next_seq, 0);
+                s_last_tx_us = esp_timer_get_time();
+            }
+            vTaskDelay(pdMS_TO_TICKS(SN_UDP_POLL_MS));
+            continue;
+        }
+
+        sn_buf_t *buf;
+        if (xQueueReceive(s_ready, &buf, pdMS_TO_TICKS(SN_UDP_POLL_MS)) == pdTRUE) {
+            send_frame(buf);
+        }
+        poll_nacks();
+        heartbeat();
+    }
+}
+
+esp_err_t sn_udp_start(const sn_udp_config_t *config)
+{
+    if (config == NULL || config->host == NULL || config->port == NULL || config->pool == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* the publisher needs a buffer for the frame it fills and one for backfill */
+    if (config->history == 0 || config->history > SN_UDP_MAX_HISTORY || config->history + 2 > config->pool->count ||
+        config->pool->headroom < SN_UDP_HEADER_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_config = *config;
+    s_ready = xQueueCreate(config->pool->count, sizeof(sn_buf_t *));
+    if (s_ready == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(udp_task, "sn_udp", SN_UDP_STACK_SIZE, NULL,
+                                SN_UDP_PRIORITY, &s_task, SN_UDP_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create UDP task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void sn_udp_retry_now(void)
+{
+    /* the next poll probes the receiver again */
+    s_last_tx_us = 0;
+    if (s_task != NULL) {
+        xTaskNotifyGive(s_task);
+    }
+}
+
+static bool udp_connected(void)
+{
+    return s_connected;
+}
+
+static esp_err_t udp_send(sn_buf_t *buf)
+{
+    /* switched back before the task got to a detach: keep the history */
+    __atomic_store_n(&s_release, false, __ATOMIC_RELAXED);
+    return xQueueSend(s_ready, &buf, 0) == pdTRUE ? ESP_OK : ESP_FAIL;
+}
+
+static sn_buf_t *udp_reclaim(void)
+{
+    sn_buf_t *buf;
+
+    if (xQueueReceive(s_ready, &buf, 0) != pdTRUE) {
+        return NULL;
+    }
+    __atomic_fetch_add(&s_reclaimed, 1, __ATOMIC_RELAXED);
+    buf->packet = NULL;         /* len and data stay: the caller may spill or resend the frame */
+    return buf;
+}
+
+static void udp_detach(void)
+{
+    __atomic_store_n(&s_release, true, __ATOMIC_RELAXED);
+}
+
+void sn_udp_get_stats(sn_udp_stats_t *stats)
+{
+    uint32_t seq;
+
+    do {
+        seq = sn_stats_read_begin(&s_stats_seq);
+        *stats = s_stats;
+    } while (sn_stats_read_retry(&s_stats_seq, seq));
+    stats->reclaimed = __atomic_load_n(&s_reclaimed, __ATOMIC_RELAXED);
+}
+
+const sn_transport_t *sn_transport_udp(void)
+{
+    static const sn_transport_t transport = {
+        .name = "udp",
+        .max_frame = SN_UDP_MAX_DATAGRAM - SN_UDP_HEADER_LEN,
+        .connected = udp_connected,
+        .send = udp_send,
+        .reclaim = udp_reclaim,
+        .detach = udp_detach,
+    };
+    return &transport;
+}
@@ -0,0 +1,78 @@
+/* UDP data transport with NACK based retransmission.
+
+   Each frame goes out as one datagram to a unicast or multicast address,
+   prefixed by an 8 byte little-endian header written into the pool
+   headroom:
+
+     offset  size  field
+          0     1  version        SN_UDP_VERSION
+          1     1  type           SN_UDP_TYPE_*, SN_UDP_FLAG_RETRANSMIT on resends
+          2     2  node_id
+          4     4  seq            datagram counter, consecutive over DATA packets
+
+   NACK and GONE add a uint16 count at offset 8 and cover seq .. seq+count-1.
+   A lost datagram never holds up the ones behind it. The last history
+   frames stay in their pool buffers; a receiver that sees a gap sends NACK
+   to the address the data came from and gets them again, or GONE for those
+   that already left the history. While idle after sending, the node sends
+   a HEARTBEAT carrying the next seq once a second so a receiver also
+   notices loss at the end of a burst. Once the publisher switches to
+   another transport the history goes back to the pool straight away; the
+   heartbeats carry on and later NACKs get GONE.
+
+   Datagrams are capped at one Ethernet MTU so loss costs one frame rather
+   than a fragment train; only backfilled frames from the spill log can be
+   longer and rely on IP fragmentation.
+*/
+
+#ifndef SN_UDP_H
+#define SN_UDP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sn_pool.h"
+#include "sn_stats.h"
+
+#define SN_UDP_VERSION          1
+#define SN_UDP_HEADER_LEN       8
+#define SN_UDP_NACK_LEN         10
+#define SN_UDP_MAX_DATAGRAM     1472    /* 1500 byte MTU less IP and UDP headers */
+#define SN_UDP_MAX_HISTORY      16
+
+#define SN_UDP_TYPE_DATA        0
+#define SN_UDP_TYPE_HEARTBEAT   1       /* seq is the next DATA seq */
+#define SN_UDP_TYPE_NACK        2       /* receiver to node: please resend seq .. seq+count-1 */
+#define SN_UDP_TYPE_GONE        3       /* node to receiver: seq .. seq+count-1 cannot be resent */
+#define SN_UDP_TYPE_MASK        0x7f
+#define SN_UDP_FLAG_RETRANSMIT  0x80
+
+typedef struct {
+    const char *host;           /* receiver, or a multicast group */
+    const char *port;
+    uint16_t node_id;
+    sn_pool_t *pool;            /* buffers are returned here once they leave the history */
+    uint8_t history;            /* sent frames kept for retransmission, at most pool count - 2 */
+    uint8_t multicast_ttl;
+} sn_udp_config_t;
+
+typedef struct {
+    uint32_t sent;              /* DATA datagrams, first transmissions */
+    uint32_t retransmitted;
+    uint32_t nacks;             /* NACK packets received */
+    uint32_t gone;              /* sequences NACKed after leaving the history */
+    uint32_t send_errors;
+    uint32_t reclaimed;         /* queued frames taken back by the publisher */
+    uint64_t bytes;
+    sn_hist_t send_latency_us;  /* from handoff by the publisher to the first send */
+} sn_udp_stats_t;
+
+/* Open the socket and spawn the sender task. */
+esp_err_t sn_udp_start(const sn_udp_config_t *config);
+
+/* Skip the wait before the next socket or heartbeat attempt, e.g. when the station just got an address. */
+void sn_udp_retry_now(void);
+
+void sn_udp_get_stats(sn_udp_stats_t *stats);
+
+#endif /* SN_UDP_H */
@@ -0,0 +1,192 @@
+/* GPIO, LEDC, ADC and I2S driver stand-ins, see driver/gpio.h, driver/ledc.h
+   and driver/i2s.h. */
+
+#include <stddef.h>
+#include "driver/adc.h"
+#include "driver/gpio.h"
+#include "driver/i2s.h"
+#include "driver/ledc.h"
+#include "soc/syscon_struct.h"
+#include "esp_timer.h"
+
+static uint64_t s_intr_mask;
+static gpio_isr_t s_handlers[GPIO_PIN_COUNT];
+static void *s_args[GPIO_PIN_COUNT];
+
+uint32_t sn_host_ledc_freq_hz;
+bool sn_host_ledc_running;
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    if (config->pin_bit_mask == 0 || config->pin_bit_mask >> GPIO_PIN_COUNT != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->intr_type != GPIO_INTR_DISABLE) {
+        s_intr_mask |= config->pin_bit_mask;
+    } else {
+        s_intr_mask &= ~config->pin_bit_mask;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    static bool installed;
+
+    if (installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    installed = true;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t isr_handler, void *args)
+{
+    if (gpio < 0 || gpio >= GPIO_PIN_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_args[gpio] = args;
+    __atomic_store_n(&s_handlers[gpio], isr_handler, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio)
+{
+    if (gpio < 0 || gpio >= GPIO_PIN_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    __atomic_store_n(&s_handlers[gpio], NULL, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+void sn_host_gpio_edge(gpio_num_t gpio)
+{
+    gpio_isr_t handler = __atomic_load_n(&s_handlers[gpio], __ATOMIC_ACQUIRE);
+
+    if (handler != NULL && (s_intr_mask & (1ULL << gpio)) != 0) {
+        handler(s_args[gpio]);
+    }
+}
+
+void sn_host_gpio_edge_at(gpio_num_t gpio, int64_t time_us)
+{
+    sn_host_timer_now_us = time_us;
+    sn_host_gpio_edge(gpio);
+    sn_host_timer_now_us = 0;
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *config)
+{
+    if (config->freq_hz == 0 || ((uint64_t)config->freq_hz << config->duty_resolution) > APB_CLK_FREQ) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->timer_num == LEDC_TIMER_0) {
+        sn_host_ledc_freq_hz = config->freq_hz;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *config)
+{
+    return config->gpio_num >= 0 && config->gpio_num < GPIO_PIN_COUNT ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t ledc_timer_pause(ledc_mode_t speed_mode, uint32_t timer_sel)
+{
+    if (timer_sel == LEDC_TIMER_0) {
+        sn_host_ledc_running = false;
+    }
+    return ESP_OK;
+}
+
+esp_err_t ledc_timer_resume(ledc_mode_t speed_mode, uint32_t timer_sel)
+{
+    if (timer_sel == LEDC_TIMER_0) {
+        sn_host_ledc_running = true;
+    }
+    return ESP_OK;
+}
+
+syscon_dev_t SYSCON;
+uint32_t sn_host_i2s_drop;
+static bool s_i2s_installed;
+static uint32_t s_i2s_words;    /* words delivered since the driver was installed */
+
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten)
+{
+    return channel >= 0 && channel < ADC1_CHANNEL_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queue_size, void *queue)
+{
+    if (s_i2s_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_i2s_installed = true;
+    s_i2s_words = 0;
+    return ESP_OK;
+}
+
+esp_err_t i2s_driver_uninstall(i2s_port_t port)
+{
+    s_i2s_installed = false;
+    return ESP_OK;
+}
+
+esp_err_t i2s_set_adc_mode(adc_unit_t unit, adc1_channel_t channel)
+{
+    return unit == ADC_UNIT_1 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2s_adc_enable(i2s_port_t port)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2s_adc_disable(i2s_port_t port)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2s_start(i2s_port_t port)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2s_stop(i2s_port_t port)
+{
+    return ESP_OK;
+}
+
+uint16_t sn_host_i2s_conversion(uint32_t scan, uint8_t channel)
+{
+    return (uint16_t)(((scan * 8 + channel + 1) * 2654435761u) >> 20);
+}
+
+/* Word w of the stream before the DMA swap: channel and conversion from the pattern table. */
+static uint16_t i2s_word(uint32_t w)
+{
+    uint32_t len = SYSCON.saradc_ctrl.sar1_patt_len + 1;
+    uint32_t n = w % len;
+    uint8_t ch = (uint8_t)(SYSCON.saradc_sar1_patt_tab[n / 4] >> (24 - 8 * (n % 4) + 4)) & 0x0f;
+
+    return (uint16_t)(ch << 12) | sn_host_i2s_conversion(w / len, ch);
+}
+
+esp_err_t i2s_read(i2s_port_t port, void *dest, size_t size, size_t *bytes_read, TickType_t ticks_to_wait)
+{
+    uint16_t *out = dest;
+    size_t words = size / sizeof(uint32_t) * 2;
+
+    if (!s_i2s_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_i2s_words += sn_host_i2s_drop & ~1u;
+    sn_host_i2s_drop = 0;
+    for (size_t i = 0; i < words; i += 2, s_i2s_words += 2) {
+        out[i] = i2s_word(s_i2s_words + 1);
+        out[i + 1] = i2s_word(s_i2s_words);
+    }
+    *bytes_read = words * sizeof(uint16_t);
+    return ESP_OK;
+}
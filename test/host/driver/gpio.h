@@ -0,0 +1,58 @@
+/* Host stand-in for the GPIO driver: pins are only remembered, and a test
+   raises an edge with sn_host_gpio_edge(), which runs the pin's handler on
+   the calling thread the way the interrupt would, or with
+   sn_host_gpio_edge_at() at an explicit esp_timer time. */
+
+#ifndef DRIVER_GPIO_H
+#define DRIVER_GPIO_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define GPIO_PIN_COUNT  40
+
+typedef int gpio_num_t;
+typedef void (*gpio_isr_t)(void *arg);
+
+typedef enum {
+    GPIO_MODE_INPUT = 1,
+    GPIO_MODE_OUTPUT = 2,
+} gpio_mode_t;
+
+typedef enum {
+    GPIO_PULLUP_DISABLE,
+    GPIO_PULLUP_ENABLE,
+} gpio_pullup_t;
+
+typedef enum {
+    GPIO_PULLDOWN_DISABLE,
+    GPIO_PULLDOWN_ENABLE,
+} gpio_pulldown_t;
+
+typedef enum {
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+    GPIO_INTR_ANYEDGE,
+} gpio_int_type_t;
+
+typedef struct {
+    uint64_t pin_bit_mask;
+    gpio_mode_t mode;
+    gpio_pullup_t pull_up_en;
+    gpio_pulldown_t pull_down_en;
+    gpio_int_type_t intr_type;
+} gpio_config_t;
+
+esp_err_t gpio_config(const gpio_config_t *config);
+esp_err_t gpio_install_isr_service(int intr_alloc_flags);
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t isr_handler, void *args);
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio);
+
+/* Run the handler of gpio, if its interrupt is configured. */
+void sn_host_gpio_edge(gpio_num_t gpio);
+
+/* The same, with esp_timer_get_time() reading time_us in the handler. */
+void sn_host_gpio_edge_at(gpio_num_t gpio, int64_t time_us);
+
+#endif /* DRIVER_GPIO_H */
@@ -0,0 +1,73 @@
+/* Host stand-in for the I2S driver in built-in ADC mode: i2s_read returns
+   conversions of the channels in the SYSCON pattern table, scanned in
+   order, as 16-bit words with the channel in the top four bits and with
+   the two halves of every 32-bit word swapped, as the DMA delivers them.
+   The conversion of a channel in scan n is sn_host_i2s_conversion(n, ch).
+   Setting sn_host_i2s_drop skips that many words (rounded down to whole
+   32-bit words) before the next read, as when a DMA buffer is overwritten. */
+
+#ifndef DRIVER_I2S_H
+#define DRIVER_I2S_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "driver/adc.h"
+
+typedef enum {
+    I2S_NUM_0,
+    I2S_NUM_1,
+} i2s_port_t;
+
+typedef enum {
+    I2S_MODE_MASTER = 1,
+    I2S_MODE_SLAVE = 2,
+    I2S_MODE_TX = 4,
+    I2S_MODE_RX = 8,
+    I2S_MODE_DAC_BUILT_IN = 16,
+    I2S_MODE_ADC_BUILT_IN = 32,
+} i2s_mode_t;
+
+typedef enum {
+    I2S_BITS_PER_SAMPLE_16BIT = 16,
+} i2s_bits_per_sample_t;
+
+typedef enum {
+    I2S_CHANNEL_FMT_RIGHT_LEFT,
+    I2S_CHANNEL_FMT_ALL_RIGHT,
+    I2S_CHANNEL_FMT_ALL_LEFT,
+    I2S_CHANNEL_FMT_ONLY_RIGHT,
+    I2S_CHANNEL_FMT_ONLY_LEFT,
+} i2s_channel_fmt_t;
+
+typedef enum {
+    I2S_COMM_FORMAT_I2S = 1,
+    I2S_COMM_FORMAT_I2S_MSB = 2,
+} i2s_comm_format_t;
+
+typedef struct {
+    int mode;
+    int sample_rate;
+    i2s_bits_per_sample_t bits_per_sample;
+    i2s_channel_fmt_t channel_format;
+    i2s_comm_format_t communication_format;
+    int intr_alloc_flags;
+    int dma_buf_count;
+    int dma_buf_len;
+    int use_apll;
+} i2s_config_t;
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queue_size, void *queue);
+esp_err_t i2s_driver_uninstall(i2s_port_t port);
+esp_err_t i2s_set_adc_mode(adc_unit_t unit, adc1_channel_t channel);
+esp_err_t i2s_adc_enable(i2s_port_t port);
+esp_err_t i2s_adc_disable(i2s_port_t port);
+esp_err_t i2s_start(i2s_port_t port);
+esp_err_t i2s_stop(i2s_port_t port);
+esp_err_t i2s_read(i2s_port_t port, void *dest, size_t size, size_t *bytes_read, TickType_t ticks_to_wait);
+
+uint16_t sn_host_i2s_conversion(uint32_t scan, uint8_t channel);
+extern uint32_t sn_host_i2s_drop;
+
+#endif /* DRIVER_I2S_H */
@@ -0,0 +1,62 @@
+/* Host stand-in for the LEDC driver: the configured frequency and whether
+   the timer runs are remembered for the tests to inspect; no pin toggles. */
+
+#ifndef DRIVER_LEDC_H
+#define DRIVER_LEDC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define APB_CLK_FREQ    80000000
+
+typedef enum {
+    LEDC_HIGH_SPEED_MODE,
+    LEDC_LOW_SPEED_MODE,
+} ledc_mode_t;
+
+typedef enum {
+    LEDC_TIMER_0,
+    LEDC_TIMER_1,
+    LEDC_TIMER_2,
+    LEDC_TIMER_3,
+} ledc_timer_t;
+
+typedef enum {
+    LEDC_CHANNEL_0,
+    LEDC_CHANNEL_1,
+} ledc_channel_t;
+
+typedef enum {
+    LEDC_INTR_DISABLE,
+    LEDC_INTR_FADE_END,
+} ledc_intr_type_t;
+
+typedef int ledc_timer_bit_t;
+
+typedef struct {
+    ledc_mode_t speed_mode;
+    ledc_timer_bit_t duty_resolution;
+    ledc_timer_t timer_num;
+    uint32_t freq_hz;
+} ledc_timer_config_t;
+
+typedef struct {
+    int gpio_num;
+    ledc_mode_t speed_mode;
+    ledc_channel_t channel;
+    ledc_intr_type_t intr_type;
+    ledc_timer_t timer_sel;
+    uint32_t duty;
+} ledc_channel_config_t;
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *config);
+esp_err_t ledc_channel_config(const ledc_channel_config_t *config);
+esp_err_t ledc_timer_pause(ledc_mode_t speed_mode, uint32_t timer_sel);
+esp_err_t ledc_timer_resume(ledc_mode_t speed_mode, uint32_t timer_sel);
+
+/* Frequency of timer 0 and whether it runs. */
+extern uint32_t sn_host_ledc_freq_hz;
+extern bool sn_host_ledc_running;
+
+#endif /* DRIVER_LEDC_H */
@@ -0,0 +1,13 @@
+/* Host stand-in for the spi_master driver: the types sn_source_hw.h names.
+   The bus itself is the mock in sn_spi_adc.h. */
+
+#ifndef DRIVER_SPI_MASTER_H
+#define DRIVER_SPI_MASTER_H
+
+typedef enum {
+    SPI_HOST,
+    HSPI_HOST,
+    VSPI_HOST,
+} spi_host_device_t;
+
+#endif /* DRIVER_SPI_MASTER_H */
@@ -0,0 +1,12 @@
+/* Host stand-in for esp_attr: placement attributes have no meaning off target. */
+
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define DMA_ATTR
+
+#endif /* ESP_ATTR_H */
@@ -0,0 +1,32 @@
+/* Host stand-in for the ESP-IDF error codes used by the sn_* modules. */
+
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef int32_t esp_err_t;
+
+#define ESP_OK                      0
+#define ESP_FAIL                    -1
+#define ESP_ERR_NO_MEM              0x101
+#define ESP_ERR_INVALID_ARG         0x102
+#define ESP_ERR_INVALID_STATE       0x103
+#define ESP_ERR_INVALID_SIZE        0x104
+#define ESP_ERR_NOT_FOUND           0x105
+#define ESP_ERR_NOT_SUPPORTED       0x106
+#define ESP_ERR_TIMEOUT             0x107
+#define ESP_ERR_INVALID_RESPONSE    0x108
+#define ESP_ERR_INVALID_CRC         0x109
+#define ESP_ERR_INVALID_VERSION     0x10A
+#define ESP_ERR_NVS_NOT_FOUND       0x1102
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE 0x1105
+#define ESP_ERR_NVS_INVALID_HANDLE  0x1107
+#define ESP_ERR_NVS_INVALID_LENGTH  0x110c
+
+#define ESP_ERROR_CHECK(x) do { if ((x) != ESP_OK) abort(); } while (0)
+
+const char *esp_err_to_name(esp_err_t code);
+
+#endif /* ESP_ERR_H */
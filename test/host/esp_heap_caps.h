@@ -0,0 +1,15 @@
+/* Host stand-in for the heap capability queries, reporting fixed figures. */
+
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+#endif /* ESP_HEAP_CAPS_H */
@@ -0,0 +1,30 @@
+/* Host stand-in for esp_log: lines go to stderr, filtered by sn_host_log_level
+   (SN_LOG=0..4 in the environment, warnings and errors by default). */
+
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdio.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+} esp_log_level_t;
+
+extern int sn_host_log_level;
+
+#define SN_HOST_LOG(level, letter, tag, format, ...) do {                        \
+        if (sn_host_log_level >= (level)) {                                     \
+            fprintf(stderr, letter " %s: " format "\n", tag, ##__VA_ARGS__);    \
+        }                                                                       \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) SN_HOST_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) SN_HOST_LOG(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) SN_HOST_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) SN_HOST_LOG(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+
+#endif /* ESP_LOG_H */
@@ -0,0 +1,142 @@
+/* esp_timer on the host: one dispatcher task runs the callbacks in deadline
+   order, and a periodic timer that falls behind fires back to back until it
+   has caught up, as esp_timer does. */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    int64_t alarm_us;           /* next expiry, 0 when stopped */
+    uint64_t period_us;         /* 0 for one-shot */
+    struct esp_timer *next;
+};
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond;
+static struct esp_timer *s_timers;
+static bool s_started;
+
+__thread int64_t sn_host_timer_now_us;
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+
+    if (sn_host_timer_now_us != 0) {
+        return sn_host_timer_now_us;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct esp_timer *earliest(void)
+{
+    struct esp_timer *first = NULL;
+
+    for (struct esp_timer *t = s_timers; t != NULL; t = t->next) {
+        if (t->alarm_us != 0 && (first == NULL || t->alarm_us < first->alarm_us)) {
+            first = t;
+        }
+    }
+    return first;
+}
+
+static void timer_task(void *arg)
+{
+    pthread_mutex_lock(&s_lock);
+    for (;;) {
+        struct esp_timer *t = earliest();
+        if (t == NULL) {
+            pthread_cond_wait(&s_cond, &s_lock);
+            continue;
+        }
+        int64_t now_us = esp_timer_get_time();
+        if (t->alarm_us > now_us) {
+            struct timespec until = {
+                .tv_sec = t->alarm_us / 1000000,
+                .tv_nsec = (t->alarm_us % 1000000) * 1000,
+            };
+            pthread_cond_timedwait(&s_cond, &s_lock, &until);
+            continue;
+        }
+        t->alarm_us = t->period_us ? t->alarm_us + (int64_t)t->period_us : 0;
+        esp_timer_cb_t callback = t->args.callback;
+        void *cb_arg = t->args.arg;
+        pthread_mutex_unlock(&s_lock);
+        callback(cb_arg);
+        pthread_mutex_lock(&s_lock);
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    struct esp_timer *t = calloc(1, sizeof(*t));
+
+    if (create_args == NULL || create_args->callback == NULL || out_handle == NULL) {
+        free(t);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (t == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    t->args = *create_args;
+    pthread_mutex_lock(&s_lock);
+    if (!s_started) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&s_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        xTaskCreate(timer_task, "esp_timer", 4096, NULL, configMAX_PRIORITIES - 1, NULL);
+        s_started = true;
+    }
+    t->next = s_timers;
+    s_timers = t;
+    pthread_mutex_unlock(&s_lock);
+    *out_handle = t;
+    return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&s_lock);
+    if (timer->alarm_us != 0) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        timer->alarm_us = esp_timer_get_time() + (int64_t)timeout_us;
+        timer->period_us = period_us;
+        pthread_cond_broadcast(&s_cond);
+    }
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&s_lock);
+    if (timer->alarm_us == 0) {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    timer->alarm_us = 0;
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
@@ -0,0 +1,606 @@
+/* FreeRTOS on POSIX threads, enough of it for the sn_* modules.
+
+   Every task is a detached thread with its own notification counter. Waits
+   are condition variables on CLOCK_MONOTONIC with the tick converted back to
+   milliseconds, so a timeout of n ticks lasts n * 10 ms as on the target.
+   Run time statistics come from the per-thread CPU clocks; the two idle
+   tasks are given whatever is left of two cores.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+
+#define SN_HOST_MAX_TASKS   32
+
+struct sn_host_task {
+    pthread_t thread;
+    char name[16];
+    UBaseType_t number;
+    UBaseType_t priority;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+    clockid_t cpu_clock;
+    bool started;
+    bool deleted;
+};
+
+struct sn_host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t *items;
+};
+
+struct sn_host_mutex {
+    pthread_mutex_t lock;
+};
+
+struct sn_host_events {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+static pthread_mutex_t s_tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sn_host_task *s_tasks[SN_HOST_MAX_TASKS];
+static UBaseType_t s_task_count;
+static UBaseType_t s_next_number = 1;
+static struct sn_host_task s_idle[portNUM_PROCESSORS] = {
+    { .name = "IDLE", .number = 1000 },
+    { .name = "IDLE", .number = 1001 },
+};
+static pthread_mutex_t s_critical;
+static pthread_once_t s_critical_once = PTHREAD_ONCE_INIT;
+static __thread struct sn_host_task *t_self;
+
+static void init_cond(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Absolute CLOCK_MONOTONIC deadline ticks from now. */
+static struct timespec deadline(TickType_t ticks)
+{
+    struct timespec ts;
+    uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+/* Wait on cond until pred() holds or the ticks run out; lock is held on entry and exit. */
+static bool wait_until(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks,
+                       bool (*pred)(void *ctx), void *ctx)
+{
+    struct timespec until = deadline(ticks);
+
+    while (!pred(ctx)) {
+        if (ticks == 0) {
+            return false;
+        }
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(cond, lock);
+        } else if (pthread_cond_timedwait(cond, lock, &until) != 0) {
+            return pred(ctx);
+        }
+    }
+    return true;
+}
+
+static struct sn_host_task *register_task(const char *name, UBaseType_t priority)
+{
+    struct sn_host_task *task = calloc(1, sizeof(*task));
+
+    if (task == NULL) {
+        return NULL;
+    }
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    task->priority = priority;
+    pthread_mutex_init(&task->lock, NULL);
+    init_cond(&task->cond);
+    pthread_mutex_lock(&s_tasks_lock);
+    if (s_task_count == SN_HOST_MAX_TASKS) {
+        pthread_mutex_unlock(&s_tasks_lock);
+        free(task);
+        return NULL;
+    }
+    task->number = s_next_number++;
+    s_tasks[s_task_count++] = task;
+    pthread_mutex_unlock(&s_tasks_lock);
+    return task;
+}
+
+/* The thread calling in, registered as a task on first use (the test's main thread). */
+static struct sn_host_task *self(void)
+{
+    if (t_self == NULL) {
+        t_self = register_task("main", 1);
+        t_self->thread = pthread_self();
+        pthread_getcpuclockid(t_self->thread, &t_self->cpu_clock);
+        t_self->started = true;
+    }
+    return t_self;
+}
+
+static void *task_main(void *arg)
+{
+    struct sn_host_task *task = arg;
+
+    t_self = task;
+    pthread_getcpuclockid(pthread_self(), &task->cpu_clock);
+    __atomic_store_n(&task->started, true, __ATOMIC_RELEASE);
+    task->fn(task->arg);
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id)
+{
+    struct sn_host_task *task = register_task(name, priority);
+    pthread_attr_t attr;
+
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    if (handle != NULL) {
+        *handle = task;
+    }
+    /* host frames are larger than Xtensa ones, so give every task a roomy stack */
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, (stack_depth < 16384 ? 16384 : stack_depth) * 4);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&task->thread, &attr, task_main, task);
+    pthread_attr_destroy(&attr);
+    return err == 0 ? pdPASS : pdFAIL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task != NULL && task != t_self) {
+        fprintf(stderr, "vTaskDelete of another task is not supported on the host\n");
+        abort();
+    }
+    task = self();
+    pthread_mutex_lock(&s_tasks_lock);
+    task->deleted = true;
+    pthread_mutex_unlock(&s_tasks_lock);
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec until = deadline(ticks);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) != 0) {
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / (portTICK_PERIOD_MS * 1000));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return self();
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t cpu)
+{
+    return cpu < portNUM_PROCESSORS ? &s_idle[cpu] : NULL;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_broadcast(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+    if (woken != NULL) {
+        *woken = pdTRUE;
+    }
+}
+
+static bool notified(void *ctx)
+{
+    return ((struct sn_host_task *)ctx)->notify > 0;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    struct sn_host_task *task = self();
+    uint32_t value = 0;
+
+    pthread_mutex_lock(&task->lock);
+    if (wait_until(&task->cond, &task->lock, ticks, notified, task)) {
+        value = task->notify;
+        task->notify = clear ? 0 : task->notify - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    UBaseType_t count = portNUM_PROCESSORS;
+
+    pthread_mutex_lock(&s_tasks_lock);
+    for (UBaseType_t i = 0; i < s_task_count; i++) {
+        count += !s_tasks[i]->deleted;
+    }
+    pthread_mutex_unlock(&s_tasks_lock);
+    return count;
+}
+
+static uint32_t cpu_us(clockid_t clock)
+{
+    struct timespec ts;
+
+    if (clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return (uint32_t)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t max, uint32_t *total_run_time)
+{
+    UBaseType_t count = 0;
+    uint32_t total = (uint32_t)esp_timer_get_time();
+    uint64_t busy = 0;
+
+    pthread_mutex_lock(&s_tasks_lock);
+    for (UBaseType_t i = 0; i < s_task_count && count + portNUM_PROCESSORS < max; i++) {
+        struct sn_host_task *task = s_tasks[i];
+        if (task->deleted || !__atomic_load_n(&task->started, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        status[count] = (TaskStatus_t) {
+            .xHandle = task,
+            .pcTaskName = task->name,
+            .xTaskNumber = task->number,
+            .eCurrentState = eBlocked,
+            .uxCurrentPriority = task->priority,
+            .uxBasePriority = task->priority,
+            .ulRunTimeCounter = cpu_us(task->cpu_clock),
+        };
+        busy += status[count].ulRunTimeCounter;
+        count++;
+    }
+    pthread_mutex_unlock(&s_tasks_lock);
+    if (count + portNUM_PROCESSORS > max) {
+        return 0;   /* as on the target, a short array gets nothing */
+    }
+    uint64_t capacity = (uint64_t)total * portNUM_PROCESSORS;
+    uint32_t idle = busy < capacity ? (uint32_t)((capacity - busy) / portNUM_PROCESSORS) : 0;
+    for (int cpu = 0; cpu < portNUM_PROCESSORS; cpu++) {
+        status[count++] = (TaskStatus_t) {
+            .xHandle = &s_idle[cpu],
+            .pcTaskName = s_idle[cpu].name,
+            .xTaskNumber = s_idle[cpu].number,
+            .eCurrentState = eReady,
+            .ulRunTimeCounter = idle,
+        };
+    }
+    if (total_run_time != NULL) {
+        *total_run_time = total;
+    }
+    return count;
+}
+
+static void init_critical(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&s_critical, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void sn_host_critical_enter(void)
+{
+    pthread_once(&s_critical_once, init_critical);
+    pthread_mutex_lock(&s_critical);
+}
+
+void sn_host_critical_exit(void)
+{
+    pthread_mutex_unlock(&s_critical);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct sn_host_queue *queue = calloc(1, sizeof(*queue));
+
+    if (queue == NULL || length == 0) {
+        free(queue);
+        return NULL;
+    }
+    queue->items = calloc(length, item_size ? item_size : 1);
+    if (queue->items == NULL) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->lock, NULL);
+    init_cond(&queue->cond);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->cond);
+    free(queue->items);
+    free(queue);
+}
+
+static bool has_space(void *ctx)
+{
+    struct sn_host_queue *queue = ctx;
+    return queue->count < queue->length;
+}
+
+static bool has_item(void *ctx)
+{
+    return ((struct sn_host_queue *)ctx)->count > 0;
+}
+
+static BaseType_t queue_put(QueueHandle_t queue, const void *item, TickType_t ticks, bool front)
+{
+    pthread_mutex_lock(&queue->lock);
+    if (!wait_until(&queue->cond, &queue->lock, ticks, has_space, queue)) {
+        pthread_mutex_unlock(&queue->lock);
+        return pdFAIL;
+    }
+    UBaseType_t slot;
+    if (front) {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        slot = queue->head;
+    } else {
+        slot = (queue->head + queue->count) % queue->length;
+    }
+    memcpy(queue->items + slot * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return queue_put(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return queue_put(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    return queue_put(queue, item, ticks, true);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+    return queue_put(queue, item, 0, false);
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item)
+{
+    pthread_mutex_lock(&queue->lock);
+    memcpy(queue->items + queue->head * queue->item_size, item, queue->item_size);
+    queue->count = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueOverwriteFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+    return xQueueOverwrite(queue, item);
+}
+
+static BaseType_t queue_get(QueueHandle_t queue, void *item, TickType_t ticks, bool remove)
+{
+    pthread_mutex_lock(&queue->lock);
+    if (!wait_until(&queue->cond, &queue->lock, ticks, has_item, queue)) {
+        pthread_mutex_unlock(&queue->lock);
+        return pdFAIL;
+    }
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    if (remove) {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    return queue_get(queue, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    return queue_get(queue, item, ticks, false);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->count = 0;
+    queue->head = 0;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t queue)
+{
+    return uxQueueMessagesWaiting(queue);
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    return queue->length - uxQueueMessagesWaiting(queue);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    struct sn_host_mutex *mutex = calloc(1, sizeof(*mutex));
+
+    if (mutex != NULL) {
+        pthread_mutex_init(&mutex->lock, NULL);
+    }
+    return mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return pthread_mutex_lock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+    }
+    if (ticks == 0) {
+        return pthread_mutex_trylock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+    }
+    /* pthread_mutex_timedlock only takes CLOCK_REALTIME deadlines */
+    struct timespec until;
+    uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ms / 1000;
+    until.tv_nsec += (ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    return pthread_mutex_timedlock(&mutex->lock, &until) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    return pthread_mutex_unlock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t mutex)
+{
+    pthread_mutex_destroy(&mutex->lock);
+    free(mutex);
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct sn_host_events *group = calloc(1, sizeof(*group));
+
+    if (group != NULL) {
+        pthread_mutex_init(&group->lock, NULL);
+        init_cond(&group->cond);
+    }
+    return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    EventBits_t now = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+    return now;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t before = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t bits = group->bits;
+    pthread_mutex_unlock(&group->lock);
+    return bits;
+}
+
+typedef struct {
+    struct sn_host_events *group;
+    EventBits_t bits;
+    bool all;
+} bits_wait_t;
+
+static bool bits_set(void *ctx)
+{
+    bits_wait_t *wait = ctx;
+    EventBits_t got = wait->group->bits & wait->bits;
+    return wait->all ? got == wait->bits : got != 0;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all,
+                                TickType_t ticks)
+{
+    bits_wait_t wait = { .group = group, .bits = bits, .all = all };
+
+    pthread_mutex_lock(&group->lock);
+    bool met = wait_until(&group->cond, &group->lock, ticks, bits_set, &wait);
+    EventBits_t now = group->bits;
+    if (met && clear) {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&group->lock);
+    return now;
+}
@@ -0,0 +1,56 @@
+/* Host stand-in for the FreeRTOS kernel, implemented on POSIX threads in
+   freertos.c. Each task is a thread; priorities and core affinity are
+   recorded but not enforced, ticks are 10 ms as in sdkconfig. Critical
+   sections take one process-wide recursive lock. */
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+#define portMAX_DELAY           ((TickType_t)0xffffffff)
+#define configTICK_RATE_HZ      100
+#define configMAX_PRIORITIES    25
+#define configUSE_TRACE_FACILITY        1
+#define configGENERATE_RUN_TIME_STATS   1
+#define portNUM_PROCESSORS      2
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define tskNO_AFFINITY          0x7fffffff
+
+#define BIT0    0x01
+#define BIT1    0x02
+#define BIT2    0x04
+#define BIT3    0x08
+#define BIT4    0x10
+#define BIT5    0x20
+#define BIT6    0x40
+#define BIT7    0x80
+
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { 0 }
+
+void sn_host_critical_enter(void);
+void sn_host_critical_exit(void);
+
+#define portENTER_CRITICAL(mux)         sn_host_critical_enter()
+#define portEXIT_CRITICAL(mux)          sn_host_critical_exit()
+#define portENTER_CRITICAL_ISR(mux)     sn_host_critical_enter()
+#define portEXIT_CRITICAL_ISR(mux)      sn_host_critical_exit()
+#define portYIELD_FROM_ISR()
+#define xPortGetCoreID()                0
+
+#endif /* FREERTOS_H */
@@ -0,0 +1,18 @@
+/* Host stand-in for FreeRTOS event groups. */
+
+#ifndef FREERTOS_EVENT_GROUPS_H
+#define FREERTOS_EVENT_GROUPS_H
+
+#include "FreeRTOS.h"
+
+typedef struct sn_host_events *EventGroupHandle_t;
+typedef uint32_t EventBits_t;
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all,
+                                TickType_t ticks);
+
+#endif /* FREERTOS_EVENT_GROUPS_H */
@@ -0,0 +1,25 @@
+/* Host stand-in for FreeRTOS queues. The FromISR variants never block. */
+
+#ifndef FREERTOS_QUEUE_H
+#define FREERTOS_QUEUE_H
+
+#include "FreeRTOS.h"
+
+typedef struct sn_host_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken);
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item);
+BaseType_t xQueueOverwriteFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+#endif /* FREERTOS_QUEUE_H */
@@ -0,0 +1,15 @@
+/* Host stand-in for FreeRTOS mutexes. */
+
+#ifndef FREERTOS_SEMPHR_H
+#define FREERTOS_SEMPHR_H
+
+#include "queue.h"
+
+typedef struct sn_host_mutex *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex);
+void vSemaphoreDelete(SemaphoreHandle_t mutex);
+
+#endif /* FREERTOS_SEMPHR_H */
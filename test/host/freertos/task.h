@@ -0,0 +1,45 @@
+/* Host stand-in for the FreeRTOS task API. */
+
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef struct sn_host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+typedef enum {
+    eRunning,
+    eReady,
+    eBlocked,
+    eSuspended,
+    eDeleted,
+} eTaskState;
+
+typedef struct {
+    TaskHandle_t xHandle;
+    const char *pcTaskName;
+    UBaseType_t xTaskNumber;
+    eTaskState eCurrentState;
+    UBaseType_t uxCurrentPriority;
+    UBaseType_t uxBasePriority;
+    uint32_t ulRunTimeCounter;
+    uint32_t usStackHighWaterMark;
+} TaskStatus_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id);
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t cpu);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *status, UBaseType_t max, uint32_t *total_run_time);
+
+#endif /* FREERTOS_TASK_H */
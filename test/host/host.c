@@ -0,0 +1,81 @@
+/* Odds and ends of ESP-IDF the sn_* modules use: log level, error names,
+   heap figures, and a private wall clock.
+
+   settimeofday and gettimeofday are wrapped at link time (see the Makefile)
+   so a module stepping the clock moves an offset kept here instead of the
+   machine's time. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+int sn_host_log_level = ESP_LOG_WARN;
+
+static int64_t s_wall_offset_us;
+
+__attribute__((constructor)) static void host_init(void)
+{
+    const char *level = getenv("SN_LOG");
+    if (level != NULL) {
+        sn_host_log_level = atoi(level);
+    }
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return 180 * 1024;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return 160 * 1024;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return 110 * 1024;
+}
+
+int __real_gettimeofday(struct timeval *tv, void *tz);
+
+int __wrap_gettimeofday(struct timeval *tv, void *tz)
+{
+    struct timeval now;
+    __real_gettimeofday(&now, NULL);
+    int64_t us = (int64_t)now.tv_sec * 1000000 + now.tv_usec + __atomic_load_n(&s_wall_offset_us, __ATOMIC_RELAXED);
+    tv->tv_sec = us / 1000000;
+    tv->tv_usec = us % 1000000;
+    return 0;
+}
+
+int __wrap_settimeofday(const struct timeval *tv, const void *tz)
+{
+    struct timeval now;
+    __real_gettimeofday(&now, NULL);
+    int64_t offset = ((int64_t)tv->tv_sec - now.tv_sec) * 1000000 + (tv->tv_usec - now.tv_usec);
+    __atomic_store_n(&s_wall_offset_us, offset, __ATOMIC_RELAXED);
+    return 0;
+}
@@ -0,0 +1,8 @@
+/* Host stand-in for lwip/netdb.h. */
+
+#ifndef LWIP_NETDB_H
+#define LWIP_NETDB_H
+
+#include <netdb.h>
+
+#endif /* LWIP_NETDB_H */
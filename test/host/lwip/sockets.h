@@ -0,0 +1,16 @@
+/* Host stand-in for lwip/sockets.h: the BSD socket API of the host. */
+
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#endif /* LWIP_SOCKETS_H */
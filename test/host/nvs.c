@@ -0,0 +1,131 @@
+/* NVS stand-in, see nvs.h. A handle is its namespace's index plus one,
+   with the top bit set when it was opened for writing. */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include "nvs.h"
+
+#define NVS_NAMESPACES  4
+#define NVS_ENTRIES     16
+#define NVS_NAME_LEN    16
+#define NVS_BLOB_LEN    256
+#define NVS_WRITABLE    0x80000000u
+
+typedef struct {
+    char key[NVS_NAME_LEN];
+    size_t len;
+    uint8_t data[NVS_BLOB_LEN];
+} nvs_entry_t;
+
+typedef struct {
+    char name[NVS_NAME_LEN];
+    nvs_entry_t entries[NVS_ENTRIES];
+} nvs_namespace_t;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static nvs_namespace_t s_namespaces[NVS_NAMESPACES];
+
+volatile uint32_t sn_host_nvs_writes;
+
+static nvs_namespace_t *space_of(nvs_handle handle)
+{
+    uint32_t index = (handle & ~NVS_WRITABLE) - 1;
+
+    return index < NVS_NAMESPACES && s_namespaces[index].name[0] != '\0' ? &s_namespaces[index] : NULL;
+}
+
+static nvs_entry_t *entry_of(nvs_namespace_t *space, const char *key, bool create)
+{
+    for (int i = 0; i < NVS_ENTRIES; i++) {
+        if (strcmp(space->entries[i].key, key) == 0) {
+            return &space->entries[i];
+        }
+    }
+    for (int i = 0; create && i < NVS_ENTRIES; i++) {
+        if (space->entries[i].key[0] == '\0') {
+            strncpy(space->entries[i].key, key, NVS_NAME_LEN - 1);
+            return &space->entries[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle)
+{
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+
+    if (strlen(name) >= NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    for (uint32_t i = 0; i < NVS_NAMESPACES; i++) {
+        nvs_namespace_t *space = &s_namespaces[i];
+        if (strcmp(space->name, name) == 0 || (open_mode == NVS_READWRITE && space->name[0] == '\0')) {
+            strcpy(space->name, name);
+            *out_handle = (i + 1) | (open_mode == NVS_READWRITE ? NVS_WRITABLE : 0);
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&s_lock);
+    nvs_namespace_t *space = space_of(handle);
+    nvs_entry_t *entry = space != NULL ? entry_of(space, key, false) : NULL;
+    if (space == NULL) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (entry == NULL) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (out_value != NULL && *length < entry->len) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        if (out_value != NULL) {
+            memcpy(out_value, entry->data, entry->len);
+        }
+        *length = entry->len;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length)
+{
+    esp_err_t err = ESP_OK;
+
+    if ((handle & NVS_WRITABLE) == 0) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (length > NVS_BLOB_LEN || strlen(key) >= NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    nvs_namespace_t *space = space_of(handle);
+    nvs_entry_t *entry = space != NULL ? entry_of(space, key, true) : NULL;
+    if (space == NULL) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (entry == NULL) {
+        err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    } else {
+        memcpy(entry->data, value, length);
+        entry->len = length;
+        sn_host_nvs_writes++;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    return space_of(handle) != NULL ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+void nvs_close(nvs_handle handle)
+{
+}
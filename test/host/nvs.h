@@ -0,0 +1,28 @@
+/* Host stand-in for NVS: blobs kept in memory for the life of the process,
+   so a test can store records, then "boot" and read them back. Blob writes
+   are counted to show when flash would have been written. */
+
+#ifndef NVS_H
+#define NVS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_commit(nvs_handle handle);
+void nvs_close(nvs_handle handle);
+
+/* Blobs set so far, whether or not their value changed. */
+extern volatile uint32_t sn_host_nvs_writes;
+
+#endif /* NVS_H */
@@ -0,0 +1,18 @@
+/* Host stand-in for the SYSCON registers: the ADC1 scan pattern table,
+   which the I2S stand-in scans. */
+
+#ifndef SOC_SYSCON_STRUCT_H
+#define SOC_SYSCON_STRUCT_H
+
+#include <stdint.h>
+
+typedef volatile struct {
+    struct {
+        uint32_t sar1_patt_len : 4;
+    } saradc_ctrl;
+    uint32_t saradc_sar1_patt_tab[4];
+} syscon_dev_t;
+
+extern syscon_dev_t SYSCON;
+
+#endif /* SOC_SYSCON_STRUCT_H */
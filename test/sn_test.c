@@ -0,0 +1,81 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sn_test.h"
+
+int sn_test_failures;
+bool sn_test_bench;
+
+static uint32_t s_seed = 0x9e3779b9;
+
+void sn_test_init(int argc, char **argv)
+{
+    const char *seed = getenv("SN_SEED");
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            sn_test_bench = true;
+        }
+    }
+    if (seed != NULL && strtoul(seed, NULL, 0) != 0) {
+        s_seed = strtoul(seed, NULL, 0);
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+}
+
+void sn_test_note(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+void sn_test_metric(const char *test, const char *name, double value, const char *unit)
+{
+    printf("%s: %s: %.6g %s\n", test, name, value, unit);
+}
+
+double sn_test_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+uint32_t sn_test_rand(void)
+{
+    s_seed ^= s_seed << 13;
+    s_seed ^= s_seed >> 17;
+    s_seed ^= s_seed << 5;
+    return s_seed;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double sn_test_percentile(double *values, size_t count, double percentile)
+{
+    if (count == 0) {
+        return 0;
+    }
+    qsort(values, count, sizeof(double), compare_double);
+    size_t rank = (size_t)(percentile / 100 * (count - 1) + 0.5);
+    return values[rank < count ? rank : count - 1];
+}
+
+int sn_test_done(const char *name)
+{
+    if (sn_test_failures != 0) {
+        printf("%s: FAILED (%d checks)\n", name, sn_test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
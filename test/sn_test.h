@@ -0,0 +1,48 @@
+/* Minimal check and report helpers shared by the host tests.
+
+   A failed SN_CHECK prints the location and carries on, so one run shows
+   every broken expectation; sn_test_done() turns the count into the exit
+   status. Figures go to stdout as "name: value unit" lines, and with
+   --bench on the command line tests run their longer measurement passes.
+*/
+
+#ifndef SN_TEST_H
+#define SN_TEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+extern int sn_test_failures;
+extern bool sn_test_bench;
+
+#define SN_CHECK(cond, ...) do {                                                    \
+        if (!(cond)) {                                                              \
+            sn_test_failures++;                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s", __FILE__, __LINE__, #cond);  \
+            sn_test_note(" " __VA_ARGS__);                                          \
+        }                                                                           \
+    } while (0)
+
+/* Parse the command line. Call first in main(). */
+void sn_test_init(int argc, char **argv);
+
+/* printf-style continuation of a failure line on stderr. */
+void sn_test_note(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/* Print one measured figure. */
+void sn_test_metric(const char *test, const char *name, double value, const char *unit);
+
+/* Monotonic seconds. */
+double sn_test_seconds(void);
+
+/* Deterministic pseudo-random numbers (xorshift32), seeded by sn_test_init() or SN_SEED. */
+uint32_t sn_test_rand(void);
+
+/* Sort values in place and return the given percentile (0..100). */
+double sn_test_percentile(double *values, size_t count, double percentile);
+
+/* Print a summary and return the exit status for main(). */
+int sn_test_done(const char *name);
+
+#endif /* SN_TEST_H */
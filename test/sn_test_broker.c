@@ -0,0 +1,233 @@
+/* MQTT broker stand-in for the host tests. */
+
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "lwip/sockets.h"
+#include "sn_test.h"
+#include "sn_test_broker.h"
+
+#define MAX_PACKET      16384
+#define MAX_HELD_ACKS   64
+
+typedef struct {
+    uint16_t id;
+    int64_t due_us;
+} held_ack_t;
+
+static held_ack_t s_held[MAX_HELD_ACKS];
+static uint32_t s_held_head;
+static uint32_t s_held_tail;
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static bool send_all(int fd, const uint8_t *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool send_puback(int fd, uint16_t id)
+{
+    const uint8_t puback[4] = { 0x40, 2, id >> 8, id & 0xff };
+    return send_all(fd, puback, sizeof(puback));
+}
+
+/* Send the held PUBACKs that are due; returns the time until the next one, or -1 for none. */
+static int64_t flush_acks(sn_test_broker_t *b, int fd)
+{
+    while (s_held_tail != s_held_head) {
+        held_ack_t *ack = &s_held[s_held_tail % MAX_HELD_ACKS];
+        int64_t wait_us = ack->due_us - now_us();
+        if (wait_us > 0) {
+            return wait_us;
+        }
+        send_puback(fd, ack->id);
+        s_held_tail++;
+    }
+    return -1;
+}
+
+/* Read exactly len bytes, sending held PUBACKs and pausing while stalled. */
+static bool read_exact(sn_test_broker_t *b, int fd, uint8_t *p, size_t len)
+{
+    while (len > 0) {
+        int timeout_ms = 10;
+        if (!b->stall) {
+            int64_t wait_us = flush_acks(b, fd);
+            if (wait_us >= 0 && wait_us / 1000 < timeout_ms) {
+                timeout_ms = (int)(wait_us / 1000);
+            }
+        }
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0) {
+            return false;
+        }
+        if (ready == 0 || b->stall) {
+            continue;
+        }
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void handle_publish(sn_test_broker_t *b, int fd, uint8_t type, const uint8_t *body, uint32_t len)
+{
+    uint8_t qos = (type >> 1) & 3;
+    size_t topic_len = len >= 2 ? (body[0] << 8) | body[1] : 0;
+    size_t off = 2 + topic_len + (qos > 0 ? 2 : 0);
+
+    if (len < 2 || off > len || qos > 1) {
+        b->errors++;
+        return;
+    }
+    if (b->topic != NULL && (strlen(b->topic) != topic_len || memcmp(body + 2, b->topic, topic_len) != 0)) {
+        b->errors++;
+    }
+    bool dup = (type & 0x08) != 0;
+    b->publishes++;
+    b->dups += dup;
+    b->payload_bytes += len - off;
+    if (b->on_publish != NULL) {
+        b->on_publish(body + off, len - off, dup, b->ctx);
+    }
+    if (qos == 1) {
+        uint16_t id = (body[off - 2] << 8) | body[off - 1];
+        if (b->ack_delay_us == 0 && s_held_head == s_held_tail) {
+            send_puback(fd, id);
+        } else if (s_held_head - s_held_tail < MAX_HELD_ACKS) {
+            s_held[s_held_head++ % MAX_HELD_ACKS] = (held_ack_t) { id, now_us() + b->ack_delay_us };
+        } else {
+            b->errors++;        /* more in flight than any window the pipe allows */
+        }
+    }
+}
+
+static void serve(sn_test_broker_t *b, int fd)
+{
+    static uint8_t body[MAX_PACKET];
+    bool connected = false;
+
+    s_held_head = s_held_tail = 0;
+    for (;;) {
+        uint8_t type, byte;
+        uint32_t remaining = 0;
+        int shift = 0;
+
+        if (!read_exact(b, fd, &type, 1)) {
+            return;
+        }
+        do {
+            if (shift > 21 || !read_exact(b, fd, &byte, 1)) {
+                return;
+            }
+            remaining |= (uint32_t)(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        if (remaining > sizeof(body) || !read_exact(b, fd, body, remaining)) {
+            b->errors += remaining > sizeof(body);
+            return;
+        }
+
+        switch (type & 0xf0) {
+            case 0x10: {
+                static const uint8_t connack[4] = { 0x20, 2, 0, 0 };
+                if (remaining < 10 || memcmp(body, "\0\4MQTT\4", 7) != 0) {
+                    b->errors++;
+                    return;
+                }
+                connected = true;
+                b->connects++;
+                if (!send_all(fd, connack, sizeof(connack))) {
+                    return;
+                }
+                break;
+            }
+            case 0x30:
+                if (!connected) {
+                    b->errors++;
+                    return;
+                }
+                handle_publish(b, fd, type, body, remaining);
+                break;
+            case 0xc0: {
+                static const uint8_t pingresp[2] = { 0xd0, 0 };
+                send_all(fd, pingresp, sizeof(pingresp));
+                break;
+            }
+            case 0xe0:
+                return;
+            default:
+                b->errors++;
+                return;
+        }
+    }
+}
+
+static void *broker_thread(void *arg)
+{
+    sn_test_broker_t *b = arg;
+
+    for (;;) {
+        int fd = accept(b->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        if (b->refuse) {
+            close(fd);
+            continue;
+        }
+        b->client_fd = fd;
+        serve(b, fd);
+        b->client_fd = -1;
+        close(fd);
+    }
+    return NULL;
+}
+
+void sn_test_broker_start(sn_test_broker_t *b)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    pthread_t thread;
+
+    b->client_fd = -1;
+    b->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    SN_CHECK(bind(b->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    SN_CHECK(listen(b->listen_fd, 1) == 0);
+    getsockname(b->listen_fd, (struct sockaddr *)&addr, &len);
+    snprintf(b->port, sizeof(b->port), "%u", ntohs(addr.sin_port));
+    pthread_create(&thread, NULL, broker_thread, b);
+    pthread_detach(thread);
+}
+
+void sn_test_broker_drop(sn_test_broker_t *b)
+{
+    int fd = b->client_fd;
+
+    if (fd >= 0) {
+        shutdown(fd, SHUT_RDWR);
+    }
+}
@@ -0,0 +1,45 @@
+/* MQTT broker stand-in for the host tests.
+
+   Listens on an ephemeral loopback port and serves one client at a time
+   with the part of MQTT 3.1.1 the data pipe uses: CONNECT, QoS 0 and 1
+   PUBLISH, PINGREQ and DISCONNECT. Every PUBLISH is handed to on_publish
+   from the broker thread. PUBACKs can be held back by a fixed delay to
+   stand in for a network round trip, and a test can stall the broker
+   (stop reading, so the client's window fills), drop the connection, or
+   refuse new ones.
+*/
+
+#ifndef SN_TEST_BROKER_H
+#define SN_TEST_BROKER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    void (*on_publish)(const uint8_t *payload, size_t len, bool dup, void *ctx);
+    void *ctx;
+    const char *topic;          /* expected topic; PUBLISHes elsewhere count as errors */
+    volatile uint32_t ack_delay_us;
+    volatile bool stall;
+    volatile bool refuse;
+
+    /* written by the broker thread */
+    char port[8];
+    volatile uint32_t connects;
+    volatile uint32_t publishes;
+    volatile uint32_t dups;
+    volatile uint32_t errors;   /* malformed packets and wrong topics */
+    volatile uint64_t payload_bytes;
+
+    int listen_fd;
+    volatile int client_fd;
+} sn_test_broker_t;
+
+/* Bind and start the broker thread. */
+void sn_test_broker_start(sn_test_broker_t *broker);
+
+/* Close the current client connection, if any. */
+void sn_test_broker_drop(sn_test_broker_t *broker);
+
+#endif /* SN_TEST_BROKER_H */
@@ -0,0 +1,139 @@
+/* File-backed NOR flash for the host tests. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sn_test.h"
+#include "sn_test_flash.h"
+
+static esp_err_t flash_read(void *ctx, size_t offset, void *buf, size_t len)
+{
+    sn_test_flash_t *f = ctx;
+
+    if (offset + len > f->size || pread(f->fd, buf, len, offset) != (ssize_t)len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t flash_write(void *ctx, size_t offset, const void *buf, size_t len)
+{
+    sn_test_flash_t *f = ctx;
+    const uint8_t *src = buf;
+    uint8_t old[256];
+
+    if (offset + len > f->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    f->writes++;
+    while (len > 0) {
+        size_t n = len < sizeof(old) ? len : sizeof(old);
+        if (f->cut_after >= 0 && (int64_t)n > f->cut_after) {
+            n = (size_t)f->cut_after;
+        }
+        if (n == 0) {
+            return ESP_FAIL;    /* powered off */
+        }
+        if (pread(f->fd, old, n, offset) != (ssize_t)n) {
+            return ESP_FAIL;
+        }
+        for (size_t i = 0; i < n; i++) {
+            f->violations += __builtin_popcount(src[i] & ~old[i] & 0xff);
+            old[i] &= src[i];
+        }
+        if (pwrite(f->fd, old, n, offset) != (ssize_t)n) {
+            return ESP_FAIL;
+        }
+        if (f->cut_after >= 0) {
+            f->cut_after -= n;
+        }
+        f->bytes_written += n;
+        offset += n;
+        src += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t flash_erase(void *ctx, size_t offset, size_t len)
+{
+    sn_test_flash_t *f = ctx;
+    uint8_t *ones;
+
+    if (offset % f->sector_size != 0 || len % f->sector_size != 0 || offset + len > f->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (f->cut_after == 0) {
+        return ESP_FAIL;
+    }
+    ones = malloc(len);
+    memset(ones, 0xff, len);
+    ssize_t done = pwrite(f->fd, ones, len, offset);
+    free(ones);
+    if (done != (ssize_t)len) {
+        return ESP_FAIL;
+    }
+    for (size_t s = offset / f->sector_size; s < (offset + len) / f->sector_size; s++) {
+        f->sector_erases[s]++;
+    }
+    return ESP_OK;
+}
+
+static const sn_spill_flash_ops_t s_ops = {
+    .read = flash_read,
+    .write = flash_write,
+    .erase = flash_erase,
+};
+
+void sn_test_flash_open(sn_test_flash_t *f, size_t size, size_t sector_size)
+{
+    char path[] = "/tmp/sn_flash_XXXXXX";
+
+    memset(f, 0, sizeof(*f));
+    f->fd = mkstemp(path);
+    SN_CHECK(f->fd >= 0, "cannot create %s", path);
+    unlink(path);
+    f->size = size;
+    f->sector_size = sector_size;
+    f->sector_erases = calloc(size / sector_size, sizeof(uint32_t));
+    f->cut_after = -1;
+    f->flash = (sn_spill_flash_t) {
+        .ops = &s_ops,
+        .ctx = f,
+        .size = size,
+        .sector_size = sector_size,
+    };
+    /* a factory-fresh chip reads erased, without counting as wear */
+    uint8_t ones[4096];
+    memset(ones, 0xff, sizeof(ones));
+    for (size_t off = 0; off < size; off += sizeof(ones)) {
+        size_t n = size - off < sizeof(ones) ? size - off : sizeof(ones);
+        SN_CHECK(pwrite(f->fd, ones, n, off) == (ssize_t)n);
+    }
+}
+
+void sn_test_flash_close(sn_test_flash_t *f)
+{
+    close(f->fd);
+    free(f->sector_erases);
+    f->sector_erases = NULL;
+}
+
+void sn_test_flash_clear(sn_test_flash_t *f, size_t offset, uint8_t mask)
+{
+    uint8_t b;
+
+    SN_CHECK(pread(f->fd, &b, 1, offset) == 1);
+    b &= ~mask;
+    SN_CHECK(pwrite(f->fd, &b, 1, offset) == 1);
+}
+
+void sn_test_flash_wear(const sn_test_flash_t *f, uint32_t *min, uint32_t *max)
+{
+    *min = UINT32_MAX;
+    *max = 0;
+    for (size_t s = 0; s < f->size / f->sector_size; s++) {
+        *min = f->sector_erases[s] < *min ? f->sector_erases[s] : *min;
+        *max = f->sector_erases[s] > *max ? f->sector_erases[s] : *max;
+    }
+}
@@ -0,0 +1,40 @@
+/* File-backed NOR flash for the host tests.
+
+   Behaves like the SPI flash under a data partition: erase works on whole
+   sectors and sets every bit, and a write can only clear bits, so
+   programming a 0 back to 1 leaves the 0 in place and is counted as a
+   violation. The image lives in a file, so a test can drop the log and
+   attach a fresh one to the same bytes as a reset would. A power cut can be
+   armed to stop programming part way through a write.
+*/
+
+#ifndef SN_TEST_FLASH_H
+#define SN_TEST_FLASH_H
+
+#include <stdint.h>
+#include "sn_spill.h"
+
+typedef struct {
+    int fd;
+    size_t size;
+    size_t sector_size;
+    uint32_t *sector_erases;    /* per sector */
+    uint64_t bytes_written;
+    uint64_t writes;
+    uint64_t violations;        /* bits a write tried to set */
+    int64_t cut_after;          /* bytes still programmed before the power cut, -1 for none */
+    sn_spill_flash_t flash;     /* bound to this image */
+} sn_test_flash_t;
+
+/* Create an erased image of size bytes in a temporary file. */
+void sn_test_flash_open(sn_test_flash_t *f, size_t size, size_t sector_size);
+
+void sn_test_flash_close(sn_test_flash_t *f);
+
+/* Clear bits of the image directly, bypassing the counters. */
+void sn_test_flash_clear(sn_test_flash_t *f, size_t offset, uint8_t mask);
+
+/* Fewest and most erases of any sector. */
+void sn_test_flash_wear(const sn_test_flash_t *f, uint32_t *min, uint32_t *max);
+
+#endif /* SN_TEST_FLASH_H */
@@ -0,0 +1,85 @@
+/* NTP server stand-in for the host tests. */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "sn_test.h"
+#include "sn_test_ntp.h"
+
+#define NTP_UNIX_OFFSET 2208988800ULL
+
+int64_t sn_test_ntp_time(const sn_test_ntp_t *server, int64_t local_us)
+{
+    return server->epoch_us + server->shift_us + local_us + local_us * server->skew_ppm / 1000000;
+}
+
+static void put_timestamp(uint8_t *p, int64_t unix_us)
+{
+    uint32_t sec = (uint32_t)(unix_us / 1000000 + NTP_UNIX_OFFSET);
+    uint32_t frac = (uint32_t)(((uint64_t)(unix_us % 1000000) << 32) / 1000000);
+    for (int i = 0; i < 4; i++) {
+        p[i] = sec >> (24 - 8 * i);
+        p[4 + i] = frac >> (24 - 8 * i);
+    }
+}
+
+static void sleep_us(uint32_t us)
+{
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000L };
+    nanosleep(&ts, NULL);
+}
+
+static void *ntp_thread(void *arg)
+{
+    sn_test_ntp_t *server = arg;
+    uint8_t pkt[48];
+    struct sockaddr_in from;
+
+    for (;;) {
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(server->sock, pkt, sizeof(pkt), 0, (struct sockaddr *)&from, &from_len);
+        if (len != sizeof(pkt) || (pkt[0] & 0x07) != 3 || server->silent) {
+            continue;
+        }
+        uint32_t n = server->requests++;
+        uint32_t out_us = server->base_delay_us + sn_test_rand() % server->jitter_us;
+        uint32_t back_us = server->base_delay_us + sn_test_rand() % server->jitter_us;
+        if (server->spike_every != 0 && n % server->spike_every == server->spike_every - 1) {
+            out_us += server->spike_us;
+        }
+        if (server->fast) {
+            server->fast = false;   /* lowest delay in the filter, so the node uses it at once */
+            out_us = 0;
+            back_us = 0;
+        }
+        sleep_us(out_us);
+        int64_t t2 = sn_test_ntp_time(server, esp_timer_get_time());
+        memcpy(&pkt[24], &pkt[40], 8);
+        pkt[0] = (0 << 6) | (4 << 3) | 4;
+        pkt[1] = 1;
+        put_timestamp(&pkt[32], t2);
+        put_timestamp(&pkt[40], t2 + 20);
+        sleep_us(back_us);
+        sendto(server->sock, pkt, sizeof(pkt), 0, (struct sockaddr *)&from, from_len);
+    }
+    return NULL;
+}
+
+void sn_test_ntp_start(sn_test_ntp_t *server)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    pthread_t thread;
+
+    server->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    bind(server->sock, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(server->sock, (struct sockaddr *)&addr, &len);
+    server->port = ntohs(addr.sin_port);
+    pthread_create(&thread, NULL, ntp_thread, server);
+    pthread_detach(thread);
+}
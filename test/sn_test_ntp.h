@@ -0,0 +1,40 @@
+/* NTP server stand-in for the host tests.
+
+   Answers client mode requests on an ephemeral loopback port from its own
+   timeline, which starts at epoch_us and runs skew_ppm fast against
+   esp_timer. Each request and reply is held for base_delay_us plus up to
+   jitter_us, and every spike_every-th request additionally spike_us on the
+   way in only, so its offset is off by half the spike. A test can shift the
+   timeline, make the next reply skip the path delay, or silence the server.
+*/
+
+#ifndef SN_TEST_NTP_H
+#define SN_TEST_NTP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    int64_t epoch_us;           /* server time at esp_timer 0 */
+    int32_t skew_ppm;
+    uint32_t base_delay_us;
+    uint32_t jitter_us;         /* must be above 0 */
+    uint32_t spike_us;
+    uint32_t spike_every;       /* 0 for no spikes */
+    volatile int64_t shift_us;  /* added to the server timeline */
+    volatile bool silent;       /* drop requests */
+    volatile bool fast;         /* answer the next request without path delay */
+
+    /* written by the server thread */
+    int sock;
+    uint16_t port;
+    volatile uint32_t requests;
+} sn_test_ntp_t;
+
+/* Bind and start the server thread. */
+void sn_test_ntp_start(sn_test_ntp_t *server);
+
+/* Server time for an esp_timer reading. */
+int64_t sn_test_ntp_time(const sn_test_ntp_t *server, int64_t local_us);
+
+#endif /* SN_TEST_NTP_H */
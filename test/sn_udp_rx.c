@@ -0,0 +1,247 @@
+/* Reference receiver for the sn_udp transport. */
+
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "sn_udp.h"
+#include "sn_udp_rx.h"
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool lose(sn_udp_rx_t *rx)
+{
+    if (rx->loss <= 0) {
+        return false;
+    }
+    rx->rand ^= rx->rand << 13;
+    rx->rand ^= rx->rand >> 17;
+    rx->rand ^= rx->rand << 5;
+    return rx->rand < rx->loss * UINT32_MAX;
+}
+
+static void add_missing(sn_udp_rx_t *rx, uint32_t first, uint32_t end)
+{
+    for (uint32_t seq = first; seq != end; seq++) {
+        if (rx->missing_count == SN_UDP_RX_MAX_MISSING) {
+            rx->stats.lost++;   /* too far behind to keep track */
+            continue;
+        }
+        rx->missing[rx->missing_count++] = (sn_udp_rx_missing_t) { .seq = seq };
+    }
+}
+
+static bool remove_missing(sn_udp_rx_t *rx, uint32_t seq)
+{
+    for (uint32_t i = 0; i < rx->missing_count; i++) {
+        if (rx->missing[i].seq == seq) {
+            rx->missing_count--;
+            memmove(&rx->missing[i], &rx->missing[i + 1], (rx->missing_count - i) * sizeof(rx->missing[0]));
+            return true;
+        }
+    }
+    return false;
+}
+
+static void send_nack(sn_udp_rx_t *rx, uint32_t seq, uint16_t count)
+{
+    const uint8_t pkt[SN_UDP_NACK_LEN] = {
+        SN_UDP_VERSION, SN_UDP_TYPE_NACK, rx->node_id & 0xff, rx->node_id >> 8,
+        seq & 0xff, (seq >> 8) & 0xff, (seq >> 16) & 0xff, seq >> 24,
+        count & 0xff, count >> 8,
+    };
+
+    sendto(rx->fd, pkt, sizeof(pkt), 0, (const struct sockaddr *)&rx->node, sizeof(rx->node));
+    rx->stats.nacks++;
+}
+
+/* NACK every missing seq whose retry time has come, consecutive ones in one packet. */
+static void send_nacks(sn_udp_rx_t *rx)
+{
+    int64_t now = now_us();
+    int64_t retry_us = (rx->nack_retry_ms ? rx->nack_retry_ms : 20) * 1000LL;
+    uint8_t max_tries = rx->max_tries ? rx->max_tries : 5;
+    uint32_t first = 0;
+    uint16_t count = 0;
+
+    for (uint32_t i = 0; i < rx->missing_count; ) {
+        sn_udp_rx_missing_t *m = &rx->missing[i];
+        if (m->nacked_us != 0 && now - m->nacked_us < retry_us) {
+            i++;
+            continue;
+        }
+        if (m->tries >= max_tries) {
+            rx->stats.lost++;
+            remove_missing(rx, m->seq);
+            continue;
+        }
+        if (count > 0 && m->seq != first + count) {
+            send_nack(rx, first, count);
+            count = 0;
+        }
+        if (count++ == 0) {
+            first = m->seq;
+        }
+        m->nacked_us = now;
+        m->tries++;
+        i++;
+    }
+    if (count > 0) {
+        send_nack(rx, first, count);
+    }
+}
+
+static void deliver(sn_udp_rx_t *rx, const uint8_t *p, size_t len, uint32_t seq, bool retransmit)
+{
+    rx->stats.frames++;
+    rx->stats.bytes += len - SN_UDP_HEADER_LEN;
+    if (rx->on_frame != NULL) {
+        rx->on_frame(p + SN_UDP_HEADER_LEN, len - SN_UDP_HEADER_LEN, seq, retransmit, rx->ctx);
+    }
+}
+
+static void handle_datagram(sn_udp_rx_t *rx, const uint8_t *p, size_t len, const struct sockaddr_in *from)
+{
+    if (len < SN_UDP_HEADER_LEN || p[0] != SN_UDP_VERSION) {
+        return;
+    }
+    if (lose(rx)) {
+        rx->stats.dropped++;
+        return;
+    }
+    uint16_t node_id = p[2] | (p[3] << 8);
+    uint8_t type = p[1] & SN_UDP_TYPE_MASK;
+    bool retransmit = (p[1] & SN_UDP_FLAG_RETRANSMIT) != 0;
+    uint32_t seq = get_u32(&p[4]);
+
+    if (!rx->started) {
+        if (type != SN_UDP_TYPE_DATA && type != SN_UDP_TYPE_HEARTBEAT) {
+            return;
+        }
+        rx->started = true;
+        rx->node_id = node_id;
+        rx->expected = seq;
+    } else if (node_id != rx->node_id) {
+        return;
+    }
+    rx->node = *from;
+    rx->stats.datagrams++;
+
+    switch (type) {
+        case SN_UDP_TYPE_DATA:
+            if ((int32_t)(seq - rx->expected) >= 0) {
+                add_missing(rx, rx->expected, seq);
+                rx->expected = seq + 1;
+                deliver(rx, p, len, seq, retransmit);
+            } else if (remove_missing(rx, seq)) {
+                rx->stats.recovered++;
+                deliver(rx, p, len, seq, retransmit);
+            } else {
+                rx->stats.duplicates++;
+            }
+            break;
+        case SN_UDP_TYPE_HEARTBEAT:
+            if ((int32_t)(seq - rx->expected) > 0) {
+                add_missing(rx, rx->expected, seq);
+                rx->expected = seq;
+            }
+            break;
+        case SN_UDP_TYPE_GONE:
+            if (len >= SN_UDP_NACK_LEN) {
+                uint16_t count = p[8] | (p[9] << 8);
+                for (uint16_t i = 0; i < count; i++) {
+                    rx->stats.gone += remove_missing(rx, seq + i);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+int sn_udp_rx_open(sn_udp_rx_t *rx, uint16_t port, const char *group)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    socklen_t addr_len = sizeof(addr);
+    int one = 1;
+
+    rx->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (rx->fd < 0) {
+        return -1;
+    }
+    setsockopt(rx->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(rx->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        getsockname(rx->fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        close(rx->fd);
+        return -1;
+    }
+    if (group != NULL) {
+        struct ip_mreq mreq = { .imr_interface.s_addr = htonl(INADDR_ANY) };
+        if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1 ||
+            setsockopt(rx->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+            close(rx->fd);
+            return -1;
+        }
+    }
+    rx->port = ntohs(addr.sin_port);
+    rx->started = false;
+    rx->missing_count = 0;
+    rx->rand = 0x2545f491;
+    memset(&rx->stats, 0, sizeof(rx->stats));
+    return 0;
+}
+
+void sn_udp_rx_poll(sn_udp_rx_t *rx, uint32_t timeout_ms)
+{
+    static uint8_t buf[65536];
+    int64_t end = now_us() + timeout_ms * 1000LL;
+
+    do {
+        /* wake up in time for NACK retries */
+        int64_t wait_us = end - now_us();
+        if (rx->missing_count > 0 && wait_us > 1000) {
+            wait_us = 1000;
+        }
+        struct pollfd pfd = { .fd = rx->fd, .events = POLLIN };
+        if (poll(&pfd, 1, wait_us > 0 ? (int)((wait_us + 999) / 1000) : 0) > 0) {
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t len;
+            while ((len = recvfrom(rx->fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from,
+                                   &from_len)) >= 0) {
+                handle_datagram(rx, buf, len, &from);
+                from_len = sizeof(from);
+            }
+        }
+        if (rx->started) {
+            send_nacks(rx);
+        }
+    } while (now_us() < end);
+}
+
+uint32_t sn_udp_rx_pending(const sn_udp_rx_t *rx)
+{
+    return rx->missing_count;
+}
+
+void sn_udp_rx_close(sn_udp_rx_t *rx)
+{
+    close(rx->fd);
+    rx->fd = -1;
+}
@@ -0,0 +1,73 @@
+/* Reference receiver for the sn_udp transport, plain POSIX.
+
+   Takes DATA datagrams from one node, hands every frame to on_frame once,
+   in arrival order, and asks for the ones missing with NACK: as soon as a
+   gap shows up behind a newer seq or a HEARTBEAT, then again every
+   nack_retry_ms until the frame arrives, the node answers GONE, or
+   max_tries NACKs went unanswered and the frame counts as lost. It is what
+   the node expects on the other end and serves both the loopback test and
+   udp_rx on a real network.
+
+   loss drops that fraction of incoming datagrams before they are looked at,
+   to test recovery on a clean link.
+*/
+
+#ifndef SN_UDP_RX_H
+#define SN_UDP_RX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define SN_UDP_RX_MAX_MISSING   256
+
+typedef struct {
+    uint32_t seq;
+    int64_t nacked_us;          /* last NACK, 0 before the first */
+    uint8_t tries;
+} sn_udp_rx_missing_t;
+
+typedef struct {
+    uint32_t datagrams;         /* received, after simulated loss */
+    uint32_t dropped;           /* discarded by simulated loss */
+    uint32_t frames;            /* handed to on_frame */
+    uint32_t recovered;         /* of those, retransmissions that filled a gap */
+    uint32_t duplicates;
+    uint32_t nacks;             /* NACK packets sent */
+    uint32_t gone;              /* frames the node could no longer resend */
+    uint32_t lost;              /* frames given up after max_tries NACKs */
+    uint64_t bytes;             /* frame bytes handed to on_frame */
+} sn_udp_rx_stats_t;
+
+typedef struct {
+    void (*on_frame)(const uint8_t *frame, size_t len, uint32_t seq, bool retransmit, void *ctx);
+    void *ctx;
+    double loss;                /* 0..1 */
+    uint32_t nack_retry_ms;     /* 0 for 20 */
+    uint8_t max_tries;          /* 0 for 5 */
+
+    int fd;
+    uint16_t port;              /* bound port, useful when opened on port 0 */
+    uint16_t node_id;           /* learnt from the first datagram */
+    bool started;
+    uint32_t expected;          /* one past the highest seq seen */
+    struct sockaddr_in node;    /* where the last datagram came from, NACKs go there */
+    sn_udp_rx_missing_t missing[SN_UDP_RX_MAX_MISSING];
+    uint32_t missing_count;
+    uint32_t rand;
+    sn_udp_rx_stats_t stats;
+} sn_udp_rx_t;
+
+/* Bind port (0 for an ephemeral one) on all interfaces and join group unless it is NULL. Returns 0 or -1. */
+int sn_udp_rx_open(sn_udp_rx_t *rx, uint16_t port, const char *group);
+
+/* Handle datagrams for up to timeout_ms and send the NACKs that are due. */
+void sn_udp_rx_poll(sn_udp_rx_t *rx, uint32_t timeout_ms);
+
+/* Frames still missing and not yet given up. */
+uint32_t sn_udp_rx_pending(const sn_udp_rx_t *rx);
+
+void sn_udp_rx_close(sn_udp_rx_t *rx);
+
+#endif /* SN_UDP_RX_H */
@@ -0,0 +1,193 @@
+/* The benchmark sweep on the host.
+
+   Runs the whole pipeline as on the node: the synthetic source polled by
+   the sampler, the publisher, and the MQTT data pipe to the broker
+   stand-in, with the clock disciplined against the NTP stand-in, all on
+   the loopback interface. sn_bench then sweeps it exactly as on the target
+   and prints its SN_BENCH lines, so host runs of different releases can be
+   diffed like target runs. "make bench" runs the full sweep.
+
+   Each step must have sampled, with latency percentiles no larger than
+   the max; the lowest rate must be sustained, with no ring or pool losses
+   (ticks the host scheduler coalesced are reported but not counted), and
+   the high-water marks must cover the step alone: the first step of each
+   combination runs at the lowest rate right after the heaviest one, so its
+   ring and pool marks show whether they were restarted.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sn_bench.h"
+#include "sn_clock.h"
+#include "sn_config.h"
+#include "sn_mqtt_pipe.h"
+#include "sn_publisher.h"
+#include "sn_sampler.h"
+#include "sn_test.h"
+#include "sn_test_broker.h"
+#include "sn_test_ntp.h"
+
+#define POOL_BUFS       8
+#define WINDOW          4
+#define BUF_SIZE        (SN_MQTT_PIPE_HEADROOM + SN_PUBLISHER_MAX_FRAME_LEN)
+#define RING_SIZE       256
+#define TOPIC           "sn/bench/data"
+#define MAX_LINES       128
+#define LINE_LEN        512
+#define QUIET_RING      8       /* deepest fill expected at the lowest rate */
+
+static uint8_t s_storage[POOL_BUFS * BUF_SIZE];
+static sn_buf_t s_bufs[POOL_BUFS];
+static sn_pool_t s_pool;
+static sn_sample_set_t s_slots[RING_SIZE];
+static sn_ring_t s_ring;
+static sn_test_broker_t s_broker = { .topic = TOPIC };
+static sn_test_ntp_t s_ntp = {
+    .epoch_us = 1700000000000000LL,
+    .base_delay_us = 100,
+    .jitter_us = 20,
+};
+
+/* written by the bench task */
+static char s_lines[MAX_LINES][LINE_LEN];
+static volatile uint32_t s_line_count;
+static volatile bool s_done;
+
+static bool report(const char *line, size_t len)
+{
+    uint32_t n = s_line_count;
+
+    if (n < MAX_LINES && len < LINE_LEN) {
+        memcpy(s_lines[n], line, len + 1);
+        s_line_count = n + 1;
+    }
+    if (strstr(line, "\"done\"") != NULL) {
+        s_done = true;
+    }
+    return true;
+}
+
+/* Value of a numeric member of a report line, -1 when absent. */
+static long member(const char *line, const char *key)
+{
+    char quoted[40];
+
+    snprintf(quoted, sizeof(quoted), "\"%s\":", key);
+    const char *p = strstr(line, quoted);
+    return p != NULL ? strtol(p + strlen(quoted), NULL, 10) : -1;
+}
+
+static void start_pipeline(void)
+{
+    const sn_clock_config_t clock_config = {
+        .server = "127.0.0.1",
+        .port = s_ntp.port,
+        .poll_interval_s = 1,
+    };
+    SN_CHECK(sn_clock_start(&clock_config) == ESP_OK);
+    SN_CHECK(sn_clock_wait_synced(3000));
+
+    sn_config_t initial = {
+        .running = true,
+        .rate_hz = 100,
+        .channel_mask = 0x0001,
+        .dsp = { .ratio = 1 },
+        .pkt_len = 10,
+        .transport = sn_transport_mqtt(),
+    };
+    SN_CHECK(sn_config_init(&initial) == ESP_OK);
+    SN_CHECK(sn_pool_init(&s_pool, s_bufs, s_storage, POOL_BUFS, BUF_SIZE, SN_MQTT_PIPE_HEADROOM) == ESP_OK);
+    SN_CHECK(sn_ring_init(&s_ring, s_slots, RING_SIZE));
+    const sn_mqtt_pipe_config_t pipe_config = {
+        .host = "127.0.0.1",
+        .port = s_broker.port,
+        .client_id = "sn-bench-data",
+        .topic = TOPIC,
+        .pool = &s_pool,
+        .window = WINDOW,
+    };
+    SN_CHECK(sn_mqtt_pipe_start(&pipe_config) == ESP_OK);
+    for (int i = 0; i < 200 && !sn_mqtt_pipe_connected(); i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    SN_CHECK(sn_mqtt_pipe_connected());
+    const sn_publisher_config_t publisher_config = {
+        .ring = &s_ring,
+        .pool = &s_pool,
+        .node_id = 5,
+        .sample_bits = 12,
+        .backpressure = SN_PUBLISHER_DROP_OLDEST,
+    };
+    SN_CHECK(sn_publisher_start(&publisher_config) == ESP_OK);
+    const sn_sampler_config_t sampler_config = {
+        .source = sn_source_synth(1),
+        .initial = &initial,
+    };
+    SN_CHECK(sn_sampler_start(&sampler_config, &s_ring) == ESP_OK);
+}
+
+int main(int argc, char **argv)
+{
+    static const uint8_t check_channels[] = { 1, 16 };
+    static const uint16_t check_pkt_lens[] = { 20 };
+    static const uint8_t bench_channels[] = { 1, 4, 8, 16 };
+    static const uint16_t bench_pkt_lens[] = { 10, 50 };
+    static const uint16_t rates[] = { 100, 250, 500, 1000, 2000 };
+
+    sn_test_init(argc, argv);
+    sn_test_broker_start(&s_broker);
+    sn_test_ntp_start(&s_ntp);
+    start_pipeline();
+
+    const sn_bench_config_t config = {
+        .channels = sn_test_bench ? bench_channels : check_channels,
+        .channel_steps = sn_test_bench ? sizeof(bench_channels) : sizeof(check_channels),
+        .pkt_lens = sn_test_bench ? bench_pkt_lens : check_pkt_lens,
+        .pkt_len_steps = sn_test_bench ? sizeof(bench_pkt_lens) / sizeof(bench_pkt_lens[0]) :
+                         sizeof(check_pkt_lens) / sizeof(check_pkt_lens[0]),
+        .rates = rates,
+        .rate_steps = sizeof(rates) / sizeof(rates[0]),
+        .settle_ms = sn_test_bench ? 500 : 100,
+        .measure_ms = sn_test_bench ? 2000 : 300,
+        /* the host deschedules the sampler at will, so only ring and pool losses end a series here */
+        .max_missed_ticks = UINT16_MAX,
+        .report = report,
+    };
+    SN_CHECK(sn_bench_start(&config) == ESP_OK);
+    for (int i = 0; i < 3000 && !s_done; i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    SN_CHECK(s_done, "the sweep did not finish, %u lines", s_line_count);
+
+    uint32_t combinations = 0;
+    bool first = true;
+    for (uint32_t i = 0; i < s_line_count; i++) {
+        const char *line = s_lines[i];
+        if (strstr(line, "\"max\"") != NULL) {
+            char name[48];
+            snprintf(name, sizeof(name), "%ld ch x %ld sets: max rate", member(line, "channels"),
+                     member(line, "pkt_len"));
+            sn_test_metric("bench", name, member(line, "max_rate_hz"), "hz");
+            SN_CHECK(member(line, "max_rate_hz") >= rates[0], "%s", line);
+            combinations++;
+            first = true;
+            continue;
+        }
+        if (strstr(line, "\"step\"") == NULL) {
+            continue;
+        }
+        SN_CHECK(member(line, "sets") > 0, "%s", line);
+        SN_CHECK(member(line, "latency_us_p50") <= member(line, "latency_us_p99") &&
+                 member(line, "latency_us_p99") <= member(line, "latency_us_max"), "%s", line);
+        if (first) {
+            SN_CHECK(member(line, "sustained") == 1, "%s", line);
+            SN_CHECK(member(line, "ring_high_water") < QUIET_RING && member(line, "pool_low_water") >= POOL_BUFS - 2,
+                     "marks of an earlier step: %s", line);
+        }
+        first = false;
+    }
+    SN_CHECK(combinations == (uint32_t)config.channel_steps * config.pkt_len_steps, "%u combinations", combinations);
+    return sn_test_done("test_bench");
+}
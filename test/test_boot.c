@@ -0,0 +1,299 @@
+/* Fast boot on the host.
+
+   A previous boot is played first: the network record is cached once and
+   not rewritten when unchanged, and a clock record of that size is the only
+   one accepted. Then the node boots in the order app_main uses, after a
+   power cycle (system time back at the epoch) with the clock record two
+   seconds stale. Sampling starts before the network; the network comes up
+   after a fast reconnect's association time, and the NTP stand-in stays
+   silent for the first second and a half.
+
+   The phase report must have every phase in order, the first sample right
+   after start and the first frame acknowledged within one second, before
+   the clock syncs. Frames sent until then are flagged provisional, and
+   adding the first step to their times must line them up with the first
+   synced frame. The clock record is saved again after the sync.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "sn_boot.h"
+#include "sn_clock.h"
+#include "sn_config.h"
+#include "sn_frame.h"
+#include "sn_mqtt_pipe.h"
+#include "sn_publisher.h"
+#include "sn_sampler.h"
+#include "sn_test.h"
+#include "sn_test_broker.h"
+#include "sn_test_ntp.h"
+
+#define POOL_BUFS       8
+#define WINDOW          4
+#define BUF_SIZE        (SN_MQTT_PIPE_HEADROOM + SN_PUBLISHER_MAX_FRAME_LEN)
+#define RING_SIZE       256
+#define TOPIC           "sn/boot/data"
+#define RATE_HZ         100
+#define PKT_LEN         10
+#define STALE_US        2000000     /* the saved clock state is this far behind the server */
+#define DRIFT_PPB       5000
+#define ASSOCIATE_MS    150         /* reconnect on a known BSSID and channel without a scan */
+#define NTP_SILENT_MS   1500
+#define FIRST_FRAME_MS  1000        /* boot to first published frame */
+#define FIRST_SAMPLE_MS 100
+#define MAX_FRAMES      256
+
+static uint8_t s_storage[POOL_BUFS * BUF_SIZE];
+static sn_buf_t s_bufs[POOL_BUFS];
+static sn_pool_t s_pool;
+static sn_sample_set_t s_slots[RING_SIZE];
+static sn_ring_t s_ring;
+static sn_test_broker_t s_broker = { .topic = TOPIC };
+static sn_test_ntp_t s_ntp = {
+    .epoch_us = 1700000000000000LL,
+    .base_delay_us = 100,
+    .jitter_us = 20,
+    .silent = true,
+};
+
+/* written by the broker thread */
+static sn_frame_header_t s_frames[MAX_FRAMES];
+static volatile uint32_t s_frame_count;
+
+static void on_frame(const uint8_t *payload, size_t len, bool dup, void *ctx)
+{
+    uint32_t n = s_frame_count;
+
+    if (!dup && n < MAX_FRAMES && sn_frame_decode_header(payload, len, &s_frames[n])) {
+        s_frame_count = n + 1;
+    }
+}
+
+/* Value of a numeric member of the boot report, -1 when absent. */
+static long member(const char *report, const char *key)
+{
+    char quoted[40];
+
+    snprintf(quoted, sizeof(quoted), "\"%s\":", key);
+    const char *p = strstr(report, quoted);
+    return p != NULL ? strtol(p + strlen(quoted), NULL, 10) : -1;
+}
+
+static void boot_report(char *buf, size_t cap)
+{
+    sn_stats_writer_t writer;
+
+    sn_stats_begin(&writer, buf, cap);
+    sn_boot_add_fields(&writer);
+    sn_stats_finish(&writer);
+}
+
+/* What earlier boots left in NVS. */
+static void test_records(void)
+{
+    sn_boot_net_t net = {
+        .ssid = "sensor-net",
+        .password = "secret",
+        .bssid = { 0x24, 0x0a, 0xc4, 0x01, 0x02, 0x03 },
+        .channel = 6,
+        .static_ip = true,
+        .ip = 0x6401a8c0,
+    };
+    sn_boot_net_t loaded;
+    sn_clock_state_t clock;
+    nvs_handle handle;
+
+    SN_CHECK(sn_boot_load_net(&loaded) == ESP_ERR_NVS_NOT_FOUND);
+    SN_CHECK(sn_boot_load_clock(&clock) == ESP_ERR_NVS_NOT_FOUND);
+    SN_CHECK(sn_boot_save_net(&net) == ESP_OK);
+    uint32_t writes = sn_host_nvs_writes;
+    SN_CHECK(sn_boot_save_net(&net) == ESP_OK && sn_host_nvs_writes == writes, "unchanged network rewritten");
+    SN_CHECK(sn_boot_load_net(&loaded) == ESP_OK && memcmp(&loaded, &net, sizeof(net)) == 0);
+    net.channel = 11;
+    SN_CHECK(sn_boot_save_net(&net) == ESP_OK && sn_host_nvs_writes == writes + 1);
+
+    /* a record from a build with another layout is refused */
+    SN_CHECK(nvs_open("sn_boot", NVS_READWRITE, &handle) == ESP_OK);
+    SN_CHECK(nvs_set_blob(handle, "clock", &clock, sizeof(clock) - 4) == ESP_OK);
+    nvs_close(handle);
+    SN_CHECK(sn_boot_load_clock(&clock) == ESP_ERR_NVS_INVALID_LENGTH);
+}
+
+static void start_clock(void)
+{
+    sn_clock_state_t saved = {
+        .utc_us = sn_test_ntp_time(&s_ntp, esp_timer_get_time()) - STALE_US,
+        .drift_ppb = DRIFT_PPB,
+    };
+    sn_clock_state_t state;
+
+    sn_boot_save_clock(&saved);
+    SN_CHECK(sn_boot_load_clock(&state) == ESP_OK);
+    const sn_clock_config_t config = {
+        .server = "127.0.0.1",
+        .port = s_ntp.port,
+        .poll_interval_s = 1,
+        .restore = &state,
+        .save = sn_boot_save_clock,
+    };
+    SN_CHECK(sn_clock_start(&config) == ESP_OK);
+}
+
+static void boot(void)
+{
+    sn_boot_net_t net;
+    const struct timeval epoch = { 0 };
+
+    settimeofday(&epoch, NULL);
+    sn_boot_mark(SN_BOOT_APP_START);
+    SN_CHECK(sn_boot_load_net(&net) == ESP_OK && net.channel == 11);
+
+    sn_config_t initial = {
+        .running = true,
+        .rate_hz = RATE_HZ,
+        .channel_mask = 0x000f,
+        .dsp = { .ratio = 1 },
+        .pkt_len = PKT_LEN,
+        .transport = sn_transport_mqtt(),
+    };
+    SN_CHECK(sn_config_init(&initial) == ESP_OK);
+    start_clock();
+
+    SN_CHECK(sn_pool_init(&s_pool, s_bufs, s_storage, POOL_BUFS, BUF_SIZE, SN_MQTT_PIPE_HEADROOM) == ESP_OK);
+    SN_CHECK(sn_ring_init(&s_ring, s_slots, RING_SIZE));
+    const sn_mqtt_pipe_config_t pipe_config = {
+        .host = "127.0.0.1",
+        .port = s_broker.port,
+        .client_id = "sn-boot-data",
+        .topic = TOPIC,
+        .pool = &s_pool,
+        .window = WINDOW,
+    };
+    SN_CHECK(sn_mqtt_pipe_start(&pipe_config) == ESP_OK);
+    const sn_publisher_config_t publisher_config = {
+        .ring = &s_ring,
+        .pool = &s_pool,
+        .node_id = 7,
+        .sample_bits = 12,
+        .backpressure = SN_PUBLISHER_DROP_OLDEST,
+    };
+    SN_CHECK(sn_publisher_start(&publisher_config) == ESP_OK);
+    const sn_sampler_config_t sampler_config = {
+        .source = sn_source_synth(1),
+        .initial = &initial,
+    };
+    SN_CHECK(sn_sampler_start(&sampler_config, &s_ring) == ESP_OK);
+    sn_boot_mark(SN_BOOT_SAMPLING);
+    SN_CHECK(sn_boot_watch() == ESP_OK);
+
+    sn_clock_status_t clock;
+    sn_clock_get_status(&clock);
+    SN_CHECK(!clock.synced && clock.drift_ppb == DRIFT_PPB, "drift %d ppb before the first sync", clock.drift_ppb);
+}
+
+/* The network side as the event handler sees it. */
+static void bring_up_network(int64_t start_us)
+{
+    vTaskDelay(pdMS_TO_TICKS(ASSOCIATE_MS));
+    sn_boot_mark(SN_BOOT_WIFI_CONNECTED);
+    /* the cached address is applied as soon as the station connects, there is no DHCP exchange */
+    sn_boot_mark(SN_BOOT_GOT_IP);
+    s_broker.refuse = false;
+    sn_clock_poll_now();
+    sn_mqtt_pipe_retry_now();
+    while (!sn_mqtt_pipe_connected() && esp_timer_get_time() - start_us < 3000000) {
+        vTaskDelay(1);
+    }
+    sn_boot_mark(SN_BOOT_MQTT_CONNECTED);
+}
+
+int main(int argc, char **argv)
+{
+    /* each phase and the one it has to follow; the data pipe does not wait for the control connection */
+    static const char *const order[][2] = {
+        { "app_start", "app_start" },
+        { "sampling", "app_start" },
+        { "first_sample", "sampling" },
+        { "wifi_connected", "app_start" },
+        { "got_ip", "wifi_connected" },
+        { "mqtt_connected", "got_ip" },
+        { "first_frame", "got_ip" },
+        { "clock_synced", "first_frame" },
+    };
+    char report[512] = "";
+
+    sn_test_init(argc, argv);
+    s_broker.on_publish = on_frame;
+    s_broker.refuse = true;
+    sn_test_broker_start(&s_broker);
+    sn_test_ntp_start(&s_ntp);
+    test_records();
+
+    int64_t start_us = esp_timer_get_time();
+    boot();
+    bring_up_network(start_us);
+    while (esp_timer_get_time() - start_us < NTP_SILENT_MS * 1000LL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    s_ntp.silent = false;
+    for (int i = 0; i < 1000 && member(report, "clock_synced") < 0; i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        boot_report(report, sizeof(report));
+    }
+
+    long app_start = member(report, "app_start");
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        long ms = member(report, order[i][0]);
+        SN_CHECK(ms >= 0, "%s not reached: %s", order[i][0], report);
+        SN_CHECK(ms >= member(report, order[i][1]), "%s before %s: %s", order[i][0], order[i][1], report);
+        sn_test_metric("boot", order[i][0], ms - app_start, "ms");
+    }
+    SN_CHECK(member(report, "first_sample") - app_start < FIRST_SAMPLE_MS, "%s", report);
+    SN_CHECK(member(report, "first_frame") - app_start < FIRST_FRAME_MS, "%s", report);
+
+    /* wait for the save after the first correction, then for a synced frame */
+    sn_clock_status_t clock;
+    sn_clock_state_t saved;
+    uint32_t writes = sn_host_nvs_writes;
+    for (int i = 0; i < 500 && sn_host_nvs_writes == writes; i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    sn_clock_get_status(&clock);
+    SN_CHECK(sn_host_nvs_writes > writes && sn_boot_load_clock(&saved) == ESP_OK, "clock state not saved");
+    int64_t server_us = sn_test_ntp_time(&s_ntp, esp_timer_get_time());
+    SN_CHECK(saved.utc_us <= server_us && saved.utc_us > server_us - 5000000, "saved %lld, server at %lld",
+             (long long)saved.utc_us, (long long)server_us);
+    SN_CHECK(clock.synced && clock.first_step_us >= STALE_US && clock.first_step_us < STALE_US + 100000,
+             "first step %lld us", (long long)clock.first_step_us);
+    sn_test_metric("boot", "first step", clock.first_step_us / 1000.0, "ms");
+
+    uint32_t provisional = 0;
+    const sn_frame_header_t *last = NULL;
+    const sn_frame_header_t *synced = NULL;
+    uint32_t frames = s_frame_count;
+    for (uint32_t i = 0; i < frames; i++) {
+        if (s_frames[i].flags & SN_FRAME_FLAG_PROVISIONAL) {
+            SN_CHECK(synced == NULL, "frame %u provisional after a synced one", s_frames[i].seq);
+            provisional++;
+            last = &s_frames[i];
+        } else if (synced == NULL) {
+            synced = &s_frames[i];
+        }
+    }
+    SN_CHECK(provisional > 0 && last != NULL && synced != NULL, "%u provisional frames of %u", provisional, frames);
+    if (last != NULL && synced != NULL) {
+        /* corrected, the last provisional frame ends where the first synced one starts */
+        int64_t end_us = last->t0_us + clock.first_step_us + (int64_t)last->sample_count * last->period_us;
+        int64_t gap_us = synced->t0_us - end_us;
+        SN_CHECK(synced->seq == last->seq + 1 && gap_us > -5000 && gap_us < 5000, "frames %u and %u %lld us apart",
+                 last->seq, synced->seq, (long long)gap_us);
+        sn_test_metric("boot", "provisional frames", provisional, "");
+        sn_test_metric("boot", "gap after correction", gap_us, "us");
+    }
+    return sn_test_done("test_boot");
+}
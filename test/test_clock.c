@@ -0,0 +1,149 @@
+/* Clock discipline against an NTP stand-in on the loopback interface.
+
+   The stand-in answers client requests from its own timeline, which runs
+   SKEW_PPM fast against the host's monotonic clock, and holds each request
+   and reply for a base path delay plus jitter, with an occasional long
+   one-sided delay that the sample filter has to reject. The test checks
+   the first step, drift convergence and tracking error, then shifts the
+   server by a fraction of a millisecond and cuts it off right after the node has
+   started slewing towards the shift: the slew must stop after one poll
+   interval and leave the timebase running at the drift estimate, however
+   far that estimate was pulled by the shift.
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sn_clock.h"
+#include "sn_test.h"
+#include "sn_test_ntp.h"
+
+#define SKEW_PPM        100
+#define EPOCH_US        2000000000000000LL    /* ahead of the host clock, so the restore has to step */
+#define BASE_DELAY_US   300
+#define JITTER_US       40
+#define SPIKE_US        8000
+#define POLL_S          1
+
+static sn_test_ntp_t s_server = {
+    .epoch_us = EPOCH_US,
+    .skew_ppm = SKEW_PPM,
+    .base_delay_us = BASE_DELAY_US,
+    .jitter_us = JITTER_US,
+    .spike_us = SPIKE_US,
+    .spike_every = 4,
+};
+
+static int64_t server_time(int64_t local_us)
+{
+    return sn_test_ntp_time(&s_server, local_us);
+}
+
+/* Node time minus server time, now. */
+static double clock_error_us(void)
+{
+    int64_t local_us = esp_timer_get_time();
+    return (double)(sn_clock_from_local(local_us) - server_time(local_us));
+}
+
+/* Rate of the node's timebase against esp_timer, in ppm. */
+static double timebase_rate_ppm(void)
+{
+    int64_t local_us = esp_timer_get_time();
+    return (double)(sn_clock_from_local(local_us + 10000000) - sn_clock_from_local(local_us) - 10000000) / 10;
+}
+
+int main(int argc, char **argv)
+{
+    /* a saved drift from an earlier run, off by a third */
+    static const sn_clock_state_t restore = { .utc_us = EPOCH_US - 3600000000LL, .drift_ppb = SKEW_PPM * 1000 * 2 / 3 };
+    sn_clock_status_t status;
+
+    sn_test_init(argc, argv);
+    sn_test_ntp_start(&s_server);
+    const sn_clock_config_t config = {
+        .server = "127.0.0.1",
+        .port = s_server.port,
+        .poll_interval_s = POLL_S,
+        .restore = &restore,
+    };
+    SN_CHECK(sn_clock_start(&config) == ESP_OK);
+
+    bool provisional;
+    sn_clock_convert(esp_timer_get_time(), &provisional);
+    SN_CHECK(provisional, "restored timeline is provisional until the first sync");
+    double provisional_error_us = clock_error_us();
+    SN_CHECK(sn_clock_wait_synced(3000));
+    sn_clock_convert(esp_timer_get_time(), &provisional);
+    SN_CHECK(!provisional);
+    sn_clock_get_status(&status);
+    SN_CHECK(status.first_step_us + provisional_error_us < 2000 && status.first_step_us + provisional_error_us > -2000,
+             "first step %lld us for a provisional error of %.0f us", (long long)status.first_step_us,
+             provisional_error_us);
+
+    /* converge on the skew; the filter only lets a sample through when it has the lowest delay of the last
+       eight, so updates are a few polls apart */
+    double start = sn_test_seconds();
+    double settled = 0;
+    double worst_us = 0;
+    uint32_t worst_jitter_us = 0;
+    while (sn_test_seconds() - start < 60 && (settled == 0 || sn_test_seconds() - settled < (sn_test_bench ? 30 : 6))) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+        sn_clock_get_status(&status);
+        if (settled == 0 && status.drift_ppb > SKEW_PPM * 1000 * 8 / 10 && status.drift_ppb < SKEW_PPM * 1000 * 12 / 10) {
+            settled = sn_test_seconds();
+            sn_test_metric("clock", "time to drift within 20%", settled - start, "s");
+        }
+        if (settled != 0) {
+            double err = clock_error_us();
+            worst_us = err > worst_us ? err : (-err > worst_us ? -err : worst_us);
+            worst_jitter_us = status.jitter_us > worst_jitter_us ? status.jitter_us : worst_jitter_us;
+        }
+    }
+    sn_clock_get_status(&status);
+    SN_CHECK(settled != 0, "drift %d ppb against %d ppm after a minute", status.drift_ppb, SKEW_PPM);
+    SN_CHECK(status.drift_ppb > SKEW_PPM * 1000 * 7 / 10 && status.drift_ppb < SKEW_PPM * 1000 * 13 / 10,
+             "drift %d ppb against %d ppm", status.drift_ppb, SKEW_PPM);
+    /* a busy host delays the stand-in's threads unevenly; the node sees that as jitter and so may the bound */
+    SN_CHECK(worst_us < 500 + 2 * worst_jitter_us, "tracking error up to %.0f us, jitter up to %u us", worst_us,
+             worst_jitter_us);
+    SN_CHECK(status.delay_us < SPIKE_US, "spiked samples must lose to the quiet ones");
+    sn_test_metric("clock", "drift", status.drift_ppb / 1000.0, "ppm");
+    sn_test_metric("clock", "worst error after settling", worst_us, "us");
+    sn_test_metric("clock", "jitter", status.jitter_us, "us");
+    sn_test_metric("clock", "delay", status.delay_us, "us");
+
+    /* shift the server, let one poll see it, then go silent */
+    s_server.shift_us = 600;
+    for (int i = 0; i < 500 && status.delay_us >= BASE_DELAY_US; i++) {
+        s_server.fast = true;       /* again, in case scheduling stretched the last fast reply */
+        vTaskDelay(pdMS_TO_TICKS(10));
+        sn_clock_get_status(&status);
+    }
+    SN_CHECK(status.delay_us < BASE_DELAY_US && status.offset_us > 300, "the shifted sample was not used");
+    s_server.silent = true;
+    vTaskDelay(pdMS_TO_TICKS(50));
+    sn_clock_get_status(&status);
+    double slewing_ppm = timebase_rate_ppm();
+    SN_CHECK(slewing_ppm > status.drift_ppb / 1000.0 + 100, "slewing at %.1f ppm, drift %.1f ppm", slewing_ppm,
+             status.drift_ppb / 1000.0);
+
+    vTaskDelay(pdMS_TO_TICKS(POLL_S * 1000 + 300));
+    sn_clock_get_status(&status);
+    double quiet_ppm = timebase_rate_ppm();
+    SN_CHECK(quiet_ppm > status.drift_ppb / 1000.0 - 1 && quiet_ppm < status.drift_ppb / 1000.0 + 1,
+             "timebase at %.1f ppm after the slew, drift %.1f ppm", quiet_ppm, status.drift_ppb / 1000.0);
+    double before_us = clock_error_us();
+    vTaskDelay(pdMS_TO_TICKS(3000));
+    double after_us = clock_error_us();
+    sn_clock_get_status(&status);
+    SN_CHECK(status.failures > 0);
+    /* without a server the error grows only by the frequency estimate's own error */
+    double expected_us = (quiet_ppm - SKEW_PPM) * 3;
+    SN_CHECK(after_us - before_us < expected_us + 100 && after_us - before_us > expected_us - 100,
+             "error moved %.0f us in 3 s without a server, expected %.0f", after_us - before_us, expected_us);
+    sn_test_metric("clock", "slew rate", slewing_ppm, "ppm");
+    sn_test_metric("clock", "rate after slew", quiet_ppm, "ppm");
+    sn_test_metric("clock", "holdover drift", (after_us - before_us) / 3, "us/s");
+    return sn_test_done("test_clock");
+}
@@ -0,0 +1,296 @@
+/* Sample codec: fuzzed round trips over random channel counts, frame sizes
+   and signal shapes, the worst-case size bound, truncated and garbage
+   input, compressed frames through the frame writer, and the compression
+   ratio and encode/decode speed on typical signals.
+
+   SN_RECORDING names a file of recorded samples, little-endian uint16
+   interleaved over SN_RECORDING_CHANNELS channels (16 by default), to be
+   measured alongside the synthetic signals.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "sn_codec.h"
+#include "sn_frame.h"
+#include "sn_source.h"
+#include "sn_test.h"
+
+#define MAX_SETS        400
+#define BENCH_SETS      100     /* sets per frame, as the publisher sends at 2 kHz */
+#define RATE_HZ         2000
+
+typedef enum {
+    SIGNAL_SYNTH,               /* sn_source_synth: sine, triangle, square and ramp */
+    SIGNAL_SLOW,                /* 12-bit random walk with a few LSB of noise, as most sensors */
+    SIGNAL_NOISE12,             /* uniform 12-bit noise */
+    SIGNAL_RANDOM16,            /* uniform 16-bit, the worst case */
+    SIGNAL_EXTREMES,            /* 0 and 0xffff, to drive residuals to their limits */
+    SIGNAL_CONSTANT,
+    SIGNAL_COUNT,
+} signal_t;
+
+static const char *const s_signal_names[SIGNAL_COUNT] = {
+    "synth", "slow", "noise12", "random16", "extremes", "constant",
+};
+
+static uint16_t s_in[MAX_SETS * SN_MAX_CHANNELS];
+static uint16_t s_out[MAX_SETS * SN_MAX_CHANNELS + 1];
+static uint8_t s_buf[SN_FRAME_HEADER_LEN + MAX_SETS * SN_MAX_CHANNELS * SN_CODEC_MAX_SAMPLE_BITS / 8 + 8];
+
+/* Fill sets of channels from one signal per channel. */
+static void generate(const signal_t *signals, uint8_t channels, uint32_t sets, uint16_t *out)
+{
+    static sn_source_t *synth;
+    int32_t level[SN_MAX_CHANNELS];
+
+    if (synth == NULL) {
+        synth = sn_source_synth(10);
+        sn_source_open(synth);
+    }
+    sn_source_configure(synth, 0xffff, RATE_HZ);
+    for (uint32_t got = 0; got < sets; ) {
+        sn_sample_block_t block;
+        sn_source_read_block(synth, sets - got, &block, 0);
+        for (uint32_t k = 0; k < block.count; k++) {
+            for (uint8_t c = 0; c < channels; c++) {
+                out[(got + k) * channels + c] = block.samples[k * SN_MAX_CHANNELS + c];
+            }
+        }
+        got += block.count;
+    }
+    for (uint8_t c = 0; c < channels; c++) {
+        level[c] = 500 + sn_test_rand() % 3000;
+    }
+    for (uint32_t k = 0; k < sets; k++) {
+        for (uint8_t c = 0; c < channels; c++) {
+            uint16_t *v = &out[k * channels + c];
+            switch (signals[c]) {
+                case SIGNAL_SYNTH:
+                    break;
+                case SIGNAL_SLOW:
+                    level[c] += (int32_t)(sn_test_rand() % 5) - 2;
+                    *v = (uint16_t)(level[c] + (int32_t)(sn_test_rand() % 7) - 3);
+                    break;
+                case SIGNAL_NOISE12:
+                    *v = sn_test_rand() & 0x0fff;
+                    break;
+                case SIGNAL_RANDOM16:
+                    *v = (uint16_t)sn_test_rand();
+                    break;
+                case SIGNAL_EXTREMES:
+                    *v = (sn_test_rand() & 1) ? 0xffff : 0;
+                    break;
+                default:
+                    *v = (uint16_t)level[c];
+                    break;
+            }
+        }
+    }
+}
+
+static size_t encode(const uint16_t *in, uint8_t channels, uint32_t sets, uint8_t *out)
+{
+    sn_codec_t codec;
+    uint8_t *end = out;
+
+    sn_codec_init(&codec, channels);
+    for (uint32_t k = 0; k < sets; k++) {
+        end = sn_codec_encode_set(&codec, &in[k * channels], end);
+    }
+    return sn_codec_flush(&codec, end) - out;
+}
+
+static void test_round_trip(void)
+{
+    for (int iter = 0; iter < 3000 && sn_test_failures < 20; iter++) {
+        uint8_t channels = 1 + sn_test_rand() % SN_MAX_CHANNELS;
+        uint32_t sets = 1 + sn_test_rand() % MAX_SETS;
+        signal_t signals[SN_MAX_CHANNELS];
+        signal_t shared = sn_test_rand() % SIGNAL_COUNT;
+
+        /* most frames carry one kind of signal, some mix them per channel */
+        for (uint8_t c = 0; c < channels; c++) {
+            signals[c] = (iter % 4 == 0) ? sn_test_rand() % SIGNAL_COUNT : shared;
+        }
+        generate(signals, channels, sets, s_in);
+        if (iter % 8 == 1) {
+            /* isolated spikes break the prediction mid-frame */
+            for (int i = 0; i < 4; i++) {
+                s_in[sn_test_rand() % (sets * channels)] ^= 1 << (sn_test_rand() % 16);
+            }
+        }
+        size_t len = encode(s_in, channels, sets, s_buf);
+
+        SN_CHECK(len <= sets * sn_codec_max_set_len(channels), "%zu bytes for %u sets of %u channels", len, sets,
+                 channels);
+        memset(s_out, 0xa5, sizeof(s_out));
+        SN_CHECK(sn_codec_decode(s_buf, len, channels, sets, s_out));
+        SN_CHECK(memcmp(s_in, s_out, (size_t)sets * channels * sizeof(uint16_t)) == 0,
+                 "%s, %u channels, %u sets", s_signal_names[shared], channels, sets);
+        SN_CHECK(s_out[sets * channels] == 0xa5a5, "decoder wrote past the sets");
+        SN_CHECK(!sn_codec_decode(s_buf, len - 1, channels, sets, s_out), "truncated input decoded");
+    }
+}
+
+/* Random and corrupted input must be rejected or decoded within bounds, never read or written past them. */
+static void test_garbage(void)
+{
+    for (int iter = 0; iter < 3000; iter++) {
+        uint8_t channels = 1 + sn_test_rand() % SN_MAX_CHANNELS;
+        uint32_t sets = 1 + sn_test_rand() % 50;
+        size_t len = sn_test_rand() % (sets * sn_codec_max_set_len(channels) + 1);
+        uint8_t *in = malloc(len + 1);
+        uint16_t *out = malloc(sets * channels * sizeof(uint16_t));
+
+        if (iter % 2 == 0) {
+            for (size_t i = 0; i < len; i++) {
+                in[i] = (uint8_t)sn_test_rand();
+            }
+        } else {
+            signal_t signal = sn_test_rand() % SIGNAL_COUNT;
+            signal_t signals[SN_MAX_CHANNELS];
+            for (uint8_t c = 0; c < channels; c++) {
+                signals[c] = signal;
+            }
+            generate(signals, channels, sets, s_in);
+            size_t full = encode(s_in, channels, sets, s_buf);
+            len = len < full ? len : full;
+            memcpy(in, s_buf, len);
+            if (len > 0) {
+                in[sn_test_rand() % len] ^= 1 << (sn_test_rand() % 8);
+            }
+        }
+        sn_codec_decode(in, len, channels, sets, out);
+        free(in);
+        free(out);
+    }
+}
+
+/* Compressed frames through the writer: the cap holds however well the signal codes. */
+static void test_frames(void)
+{
+    for (int iter = 0; iter < 1000 && sn_test_failures < 20; iter++) {
+        sn_frame_header_t hdr = {
+            .flags = SN_FRAME_FLAG_COMPRESSED | ((iter & 1) ? SN_FRAME_FLAG_BACKFILL : 0),
+            .seq = iter,
+            .period_us = 1000000 / RATE_HZ,
+            .channel_mask = (uint16_t)(sn_test_rand() | 1),
+        };
+        uint8_t channels = sn_frame_channel_count(hdr.channel_mask);
+        signal_t signals[SN_MAX_CHANNELS];
+        signal_t signal = sn_test_rand() % SIGNAL_COUNT;
+        size_t cap = SN_FRAME_HEADER_LEN + 1 + sn_test_rand() % 4000;
+        sn_frame_writer_t w;
+        sn_frame_header_t got;
+        uint32_t sets = 0;
+
+        for (uint8_t c = 0; c < channels; c++) {
+            signals[c] = signal;
+        }
+        generate(signals, channels, MAX_SETS, s_in);
+        sn_frame_writer_begin(&w, s_buf, cap, &hdr);
+        while (sets < MAX_SETS && sn_frame_writer_add(&w, &s_in[sets * channels])) {
+            sets++;
+        }
+        size_t len = sn_frame_writer_finish(&w);
+
+        SN_CHECK(len <= cap, "%zu byte frame for a %zu byte cap", len, cap);
+        SN_CHECK(sn_frame_decode_header(s_buf, len, &got) && got.sample_count == sets &&
+                 got.flags == hdr.flags && got.channel_mask == hdr.channel_mask);
+        SN_CHECK(sets == 0 || sn_frame_decode_samples(s_buf, len, &got, s_out, sets * channels));
+        SN_CHECK(memcmp(s_in, s_out, (size_t)sets * channels * sizeof(uint16_t)) == 0, "%s, mask %04x, %u sets",
+                 s_signal_names[signal], hdr.channel_mask, sets);
+    }
+}
+
+/* Encode and decode frames of BENCH_SETS sets over the given samples; returns the ratio to 16-bit words. */
+static double bench(const char *name, const uint16_t *samples, uint8_t channels, uint32_t sets, bool is_12bit)
+{
+    double seconds = sn_test_bench ? 1 : 0.1;
+    double encode_s = 0;
+    double decode_s = 0;
+    uint64_t raw = 0;
+    uint64_t coded = 0;
+    uint32_t frames = sets / BENCH_SETS;
+
+    while (encode_s + decode_s < seconds) {
+        for (uint32_t f = 0; f < frames; f++) {
+            const uint16_t *in = &samples[(size_t)f * BENCH_SETS * channels];
+            double t0 = sn_test_seconds();
+            size_t len = encode(in, channels, BENCH_SETS, s_buf);
+            double t1 = sn_test_seconds();
+            bool ok = sn_codec_decode(s_buf, len, channels, BENCH_SETS, s_out);
+            double t2 = sn_test_seconds();
+            encode_s += t1 - t0;
+            decode_s += t2 - t1;
+            raw += BENCH_SETS * channels * sizeof(uint16_t);
+            coded += len;
+            SN_CHECK(ok && memcmp(in, s_out, BENCH_SETS * channels * sizeof(uint16_t)) == 0, "%s frame %u", name,
+                     f);
+        }
+    }
+    double ratio = (double)raw / coded;
+    sn_test_metric(name, "ratio to 16-bit", ratio, "");
+    if (is_12bit) {
+        sn_test_metric(name, "ratio to packed 12-bit", ratio * 12 / 16, "");
+    }
+    sn_test_metric(name, "bits per sample", 8.0 * coded / (raw / sizeof(uint16_t)), "");
+    sn_test_metric(name, "encode", raw / encode_s / 1e6, "MB/s");
+    sn_test_metric(name, "decode", raw / decode_s / 1e6, "MB/s");
+    return ratio;
+}
+
+static void bench_signal(signal_t signal, double min_ratio)
+{
+    signal_t signals[SN_MAX_CHANNELS];
+    char name[32];
+
+    for (int c = 0; c < SN_MAX_CHANNELS; c++) {
+        signals[c] = signal;
+    }
+    generate(signals, SN_MAX_CHANNELS, MAX_SETS, s_in);
+    snprintf(name, sizeof(name), "codec %s", s_signal_names[signal]);
+    double ratio = bench(name, s_in, SN_MAX_CHANNELS, MAX_SETS, signal != SIGNAL_RANDOM16);
+    SN_CHECK(ratio >= min_ratio, "%s compresses %.2f:1, expected at least %.2f:1", name, ratio, min_ratio);
+}
+
+static void bench_recording(void)
+{
+    const char *path = getenv("SN_RECORDING");
+    const char *channels_env = getenv("SN_RECORDING_CHANNELS");
+    uint8_t channels = channels_env ? atoi(channels_env) : SN_MAX_CHANNELS;
+
+    if (path == NULL) {
+        return;
+    }
+    FILE *f = fopen(path, "rb");
+    SN_CHECK(f != NULL && channels >= 1 && channels <= SN_MAX_CHANNELS, "cannot read %s", path);
+    if (f == NULL || channels < 1 || channels > SN_MAX_CHANNELS) {
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    uint32_t sets = ftell(f) / (channels * sizeof(uint16_t)) / BENCH_SETS * BENCH_SETS;
+    uint16_t *samples = malloc((size_t)sets * channels * sizeof(uint16_t) + 1);
+    fseek(f, 0, SEEK_SET);
+    SN_CHECK(fread(samples, sizeof(uint16_t) * channels, sets, f) == sets);
+    fclose(f);
+    if (sets > 0) {
+        bench("codec recording", samples, channels, sets, true);
+    }
+    free(samples);
+}
+
+int main(int argc, char **argv)
+{
+    sn_test_init(argc, argv);
+    test_round_trip();
+    test_garbage();
+    test_frames();
+    /* floors a little under the measured ratios, so a regression in prediction or Rice adaptation shows */
+    bench_signal(SIGNAL_SLOW, 2.0);
+    bench_signal(SIGNAL_SYNTH, 1.45);
+    bench_signal(SIGNAL_NOISE12, 1.15);
+    bench_signal(SIGNAL_RANDOM16, 0.9);
+    bench_recording();
+    return sn_test_done("test_codec");
+}
@@ -0,0 +1,242 @@
+/* DSP stage: CIC response, subsampled channels, calibration, configuration
+   checks, and filtering throughput.
+
+   The long full-scale runs take the integrators through many 32-bit wraps,
+   which UBSan reports if any of the filter state is signed. */
+
+#include <math.h>
+#include <string.h>
+#include "sn_dsp.h"
+#include "sn_test.h"
+
+static sn_dsp_t s_dsp;
+static uint16_t s_in[SN_DSP_BLOCK_SETS * SN_MAX_CHANNELS];
+
+/* Feed count inputs of one channel from gen and collect up to max outputs. */
+static uint32_t run(sn_dsp_t *dsp, uint32_t count, uint16_t (*gen)(uint32_t n, void *ctx), void *ctx,
+                    uint16_t *out, uint32_t max)
+{
+    uint32_t got = 0;
+
+    for (uint32_t n = 0; n < count; n += SN_DSP_BLOCK_SETS) {
+        sn_sample_block_t in = {
+            .samples = s_in,
+            .count = SN_DSP_BLOCK_SETS,
+            .timestamp_us = 1000 + (int64_t)n * 10,
+            .period_us = 10,
+        };
+        sn_sample_block_t block;
+        for (uint32_t k = 0; k < SN_DSP_BLOCK_SETS; k++) {
+            s_in[k] = gen(n + k, ctx);
+        }
+        sn_dsp_process(dsp, &in, &block);
+        for (uint32_t k = 0; k < block.count && got < max; k++) {
+            out[got++] = block.samples[k];
+        }
+    }
+    return got;
+}
+
+static uint16_t constant(uint32_t n, void *ctx)
+{
+    return *(const uint16_t *)ctx;
+}
+
+static uint16_t step(uint32_t n, void *ctx)
+{
+    return n < *(const uint32_t *)ctx ? 0 : 4095;
+}
+
+typedef struct {
+    double cycles_per_input;
+    double amplitude;
+} sine_t;
+
+static uint16_t sine(uint32_t n, void *ctx)
+{
+    const sine_t *s = ctx;
+    return (uint16_t)lrint(2048 + s->amplitude * sin(2 * M_PI * s->cycles_per_input * n));
+}
+
+static void test_dc_gain(void)
+{
+    static uint16_t out[4096];
+    static const uint16_t levels[] = { 0, 1, 2048, 4095 };
+
+    for (uint8_t ratio = 2; ratio <= SN_DSP_MAX_RATIO; ratio *= 2) {
+        const sn_dsp_config_t config = { .ratio = ratio, .filter_mask = 0x0001 };
+        for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+            uint16_t level = levels[i];
+            SN_CHECK(sn_dsp_init(&s_dsp, &config, 0x0001, 12, NULL));
+            /* enough full-scale inputs to wrap the last integrator many times over */
+            uint32_t got = run(&s_dsp, 200000, constant, &level, out, 4096);
+            SN_CHECK(got >= 200000 / ratio / 2 || got == 4096);
+            /* the first SN_DSP_CIC_STAGES outputs are the filter filling up */
+            for (uint32_t k = SN_DSP_CIC_STAGES; k < got; k++) {
+                if (out[k] != level << 4) {
+                    SN_CHECK(false, "ratio %u level %u: output %u is %u", ratio, level, k, out[k]);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void test_step_response(void)
+{
+    static uint16_t out[64];
+    const sn_dsp_config_t config = { .ratio = 16, .filter_mask = 0x0001 };
+    uint32_t at = 16 * 20;
+
+    SN_CHECK(sn_dsp_init(&s_dsp, &config, 0x0001, 12, NULL));
+    uint32_t got = run(&s_dsp, 64 * 16, step, &at, out, 64);
+    SN_CHECK(got == 64);
+    for (uint32_t k = 1; k < got; k++) {
+        SN_CHECK(out[k] >= out[k - 1], "step response dips at %u", k);
+    }
+    SN_CHECK(out[19] == 0 && out[20] > 0 && out[20] < 65520);
+    SN_CHECK(out[20 + SN_DSP_CIC_STAGES - 1] == 65520, "settles in %d outputs", SN_DSP_CIC_STAGES);
+}
+
+/* RMS gain for a sine of the given frequency, after the filter has settled. */
+static double gain(uint8_t ratio, double cycles_per_input)
+{
+    static uint16_t out[2048];
+    const sn_dsp_config_t config = { .ratio = ratio, .filter_mask = 0x0001 };
+    sine_t s = { .cycles_per_input = cycles_per_input, .amplitude = 1500 };
+    double sum = 0;
+    double sum_sq = 0;
+
+    sn_dsp_init(&s_dsp, &config, 0x0001, 12, NULL);
+    uint32_t got = run(&s_dsp, 2048 * ratio, sine, &s, out, 2048);
+    for (uint32_t k = 16; k < got; k++) {
+        sum += out[k] / 16.0;
+        sum_sq += (out[k] / 16.0) * (out[k] / 16.0);
+    }
+    double n = got - 16;
+    double var = sum_sq / n - (sum / n) * (sum / n);
+    return sqrt(2 * var) / s.amplitude;
+}
+
+/* |H(f)| of an N stage CIC decimating by ratio, f in cycles per input. */
+static double cic_gain(uint8_t ratio, double f)
+{
+    return pow(fabs(sin(M_PI * f * ratio) / (ratio * sin(M_PI * f))), SN_DSP_CIC_STAGES);
+}
+
+static void test_frequency_response(void)
+{
+    const uint8_t ratio = 8;
+
+    for (double fout = 0.02; fout < 0.5; fout += 0.06) {
+        double measured = gain(ratio, fout / ratio);
+        double expected = cic_gain(ratio, fout / ratio);
+        SN_CHECK(fabs(measured - expected) < 0.01, "gain %.4f at %.2f of the output rate, expected %.4f",
+                 measured, fout, expected);
+    }
+    double null = gain(ratio, 1.0 / ratio);
+    double alias = gain(ratio, 1.02 / ratio);
+    SN_CHECK(null < 0.002, "gain %.4f at the output rate", null);
+    SN_CHECK(alias < 0.01, "gain %.4f just above the output rate", alias);
+    sn_test_metric("cic x8", "gain at fout/4", 20 * log10(gain(ratio, 0.25 / ratio)), "dB");
+    sn_test_metric("cic x8", "rejection at 1.02 fout", 20 * log10(alias > 1e-6 ? alias : 1e-6), "dB");
+}
+
+static void test_mask_and_timing(void)
+{
+    const sn_dsp_config_t config = { .ratio = 4, .filter_mask = 0x0004 };
+    sn_sample_block_t in = { .samples = s_in, .count = 8, .timestamp_us = 5000, .period_us = 250 };
+    sn_sample_block_t out;
+
+    /* channels 0 and 2 enabled, only channel 2 filtered */
+    SN_CHECK(sn_dsp_init(&s_dsp, &config, 0x0005, 12, NULL));
+    for (uint32_t k = 0; k < 8; k++) {
+        s_in[k * 2] = (uint16_t)(100 + k);
+        s_in[k * 2 + 1] = 700;
+    }
+    sn_dsp_process(&s_dsp, &in, &out);
+    SN_CHECK(out.count == 2 && out.period_us == 1000 && out.timestamp_us == 5000);
+    SN_CHECK(out.format == SN_SAMPLE_FORMAT_SCALED16);
+    SN_CHECK(out.samples[0] == 103 << 4 && out.samples[2] == 107 << 4, "subsampled channel takes the last input");
+
+    /* a window split across blocks keeps the timestamp of its first input */
+    in.count = 2;
+    in.timestamp_us = 7000;
+    sn_dsp_process(&s_dsp, &in, &out);
+    SN_CHECK(out.count == 0);
+    in.timestamp_us = 7500;
+    sn_dsp_process(&s_dsp, &in, &out);
+    SN_CHECK(out.count == 1 && out.timestamp_us == 7000);
+}
+
+static void test_calibration(void)
+{
+    static uint32_t lut[SN_DSP_LUT_SIZE];
+    static uint16_t out[64];
+    const sn_dsp_config_t config = { .ratio = 4, .filter_mask = 0x0001, .calibrate = true };
+    const uint16_t level = 1000;
+
+    for (int i = 0; i < SN_DSP_LUT_SIZE; i++) {
+        lut[i] = i * 800;
+    }
+    SN_CHECK(sn_dsp_init(&s_dsp, &config, 0x0001, 12, lut));
+    SN_CHECK(run(&s_dsp, 256, constant, (void *)&level, out, 64) == 64);
+    SN_CHECK(out[63] == level * 800 / 100, "calibrated %u", out[63]);
+}
+
+static void test_check(void)
+{
+    static uint32_t lut[SN_DSP_LUT_SIZE];
+    const sn_dsp_config_t bad_ratio = { .ratio = 3 };
+    const sn_dsp_config_t too_big = { .ratio = 128 };
+    const sn_dsp_config_t x64 = { .ratio = 64 };
+    const sn_dsp_config_t cal = { .ratio = 1, .calibrate = true };
+
+    SN_CHECK(!sn_dsp_check(&bad_ratio, 12, NULL));
+    SN_CHECK(!sn_dsp_check(&too_big, 12, NULL));
+    SN_CHECK(sn_dsp_check(&x64, 12, NULL));
+    SN_CHECK(!sn_dsp_check(&x64, 16, NULL), "16 + 18 bits of gain do not fit");
+    SN_CHECK(!sn_dsp_check(&cal, 12, NULL));
+    SN_CHECK(!sn_dsp_check(&cal, 16, lut));
+    SN_CHECK(sn_dsp_check(&cal, 12, lut) && sn_dsp_active(&cal));
+    SN_CHECK(!sn_dsp_active(&(sn_dsp_config_t) { .ratio = 1 }));
+}
+
+static void test_throughput(void)
+{
+    const sn_dsp_config_t config = { .ratio = 16, .filter_mask = 0xffff };
+    sn_sample_block_t in = { .samples = s_in, .count = SN_DSP_BLOCK_SETS, .period_us = 31 };
+    sn_sample_block_t out;
+    double seconds = sn_test_bench ? 2 : 0.3;
+    uint64_t sets = 0;
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < SN_DSP_BLOCK_SETS * SN_MAX_CHANNELS; i++) {
+        s_in[i] = (uint16_t)(sn_test_rand() & 0xfff);
+    }
+    SN_CHECK(sn_dsp_init(&s_dsp, &config, 0xffff, 12, NULL));
+    double start = sn_test_seconds();
+    while (sn_test_seconds() - start < seconds) {
+        for (int i = 0; i < 100; i++) {
+            sn_dsp_process(&s_dsp, &in, &out);
+            sum += out.samples[0];
+            sets += SN_DSP_BLOCK_SETS;
+        }
+    }
+    double elapsed = sn_test_seconds() - start;
+    SN_CHECK(sum != 0);
+    sn_test_metric("cic x16 16ch", "input samples", sets * 16 / elapsed / 1e6, "M/s per core");
+}
+
+int main(int argc, char **argv)
+{
+    sn_test_init(argc, argv);
+    test_check();
+    test_dc_gain();
+    test_step_response();
+    test_frequency_response();
+    test_mask_and_timing();
+    test_calibration();
+    test_throughput();
+    return sn_test_done("test_dsp");
+}
@@ -0,0 +1,180 @@
+/* Frame encoder and decoder: header fields, 16-bit and packed 12-bit round
+   trips over many channel masks and frame sizes, capacity limits, rejection
+   of bad input, and encode/decode throughput. */
+
+#include <string.h>
+#include "sn_frame.h"
+#include "sn_test.h"
+
+#define MAX_SETS    2000
+
+static uint8_t s_buf[SN_FRAME_HEADER_LEN + MAX_SETS * SN_MAX_CHANNELS * 2];
+static uint16_t s_in[MAX_SETS * SN_MAX_CHANNELS];
+static uint16_t s_out[MAX_SETS * SN_MAX_CHANNELS];
+
+static uint16_t random_mask(void)
+{
+    uint16_t mask;
+    do {
+        mask = (uint16_t)sn_test_rand();
+        if (sn_test_rand() & 1) {
+            mask &= (uint16_t)sn_test_rand();    /* sparser masks too */
+        }
+    } while (mask == 0);
+    return mask;
+}
+
+/* Fill a frame until the writer refuses a set; returns the sets written. */
+static uint32_t fill(sn_frame_writer_t *w, size_t cap, const sn_frame_header_t *hdr, uint16_t value_mask)
+{
+    uint8_t channels = sn_frame_channel_count(hdr->channel_mask);
+    uint32_t sets = 0;
+
+    sn_frame_writer_begin(w, s_buf, cap, hdr);
+    for (;;) {
+        uint16_t *set = &s_in[sets * channels];
+        for (uint8_t c = 0; c < channels; c++) {
+            set[c] = (uint16_t)sn_test_rand() & value_mask;
+        }
+        if (sets == MAX_SETS || !sn_frame_writer_add(w, set)) {
+            return sets;
+        }
+        sets++;
+    }
+}
+
+static void test_round_trip(void)
+{
+    static const uint8_t flag_sets[] = {
+        0,
+        SN_FRAME_FLAG_PACKED12,
+        SN_FRAME_FLAG_SCALED16,
+        SN_FRAME_FLAG_CAL_100UV | SN_FRAME_FLAG_PROVISIONAL,
+        SN_FRAME_FLAG_PACKED12 | SN_FRAME_FLAG_BACKFILL,
+    };
+
+    for (int iter = 0; iter < 2000; iter++) {
+        uint8_t flags = flag_sets[iter % sizeof(flag_sets)];
+        sn_frame_header_t hdr = {
+            .flags = flags,
+            .node_id = (uint16_t)sn_test_rand(),
+            .seq = sn_test_rand(),
+            .t0_us = (int64_t)(((uint64_t)sn_test_rand() << 32) | sn_test_rand()),
+            .period_us = sn_test_rand() % 1000000,
+            .channel_mask = random_mask(),
+            .sample_count = 12345,  /* ignored by the writer */
+        };
+        uint8_t channels = sn_frame_channel_count(hdr.channel_mask);
+        size_t cap = SN_FRAME_HEADER_LEN + 1 + sn_test_rand() % (sizeof(s_buf) - SN_FRAME_HEADER_LEN);
+        sn_frame_writer_t w;
+        uint32_t sets = fill(&w, cap, &hdr, (flags & SN_FRAME_FLAG_PACKED12) ? 0x0fff : 0xffff);
+        size_t len = sn_frame_writer_finish(&w);
+
+        SN_CHECK(len == sn_frame_len(hdr.channel_mask, sets, flags), "len %zu for %u sets", len, sets);
+        SN_CHECK(len <= cap);
+        if (sets < MAX_SETS) {
+            SN_CHECK(sn_frame_len(hdr.channel_mask, sets + 1, flags) > cap, "set %u would have fit", sets + 1);
+        }
+
+        sn_frame_header_t got;
+        SN_CHECK(sn_frame_decode_header(s_buf, len, &got));
+        SN_CHECK(got.version == SN_FRAME_VERSION && got.flags == flags && got.node_id == hdr.node_id);
+        SN_CHECK(got.seq == hdr.seq && got.t0_us == hdr.t0_us && got.period_us == hdr.period_us);
+        SN_CHECK(got.channel_mask == hdr.channel_mask && got.sample_count == sets);
+        SN_CHECK(sn_frame_decode_samples(s_buf, len, &got, s_out, sets * channels));
+        SN_CHECK(memcmp(s_in, s_out, (size_t)sets * channels * sizeof(uint16_t)) == 0,
+                 "mask %04x flags %02x sets %u", hdr.channel_mask, flags, sets);
+        if (sets > 0) {
+            SN_CHECK(!sn_frame_decode_samples(s_buf, len - 1, &got, s_out, sets * channels), "truncated frame");
+            SN_CHECK(!sn_frame_decode_samples(s_buf, len, &got, s_out, sets * channels - 1), "short output");
+        }
+        if (sn_test_failures > 20) {
+            return;
+        }
+    }
+}
+
+static void test_layout(void)
+{
+    sn_frame_header_t hdr = {
+        .flags = SN_FRAME_FLAG_PACKED12,
+        .node_id = 0x1234,
+        .seq = 0x89abcdef,
+        .t0_us = -2,
+        .period_us = 500,
+        .channel_mask = 0x0005,
+    };
+    const uint16_t set[2] = { 0x0abc, 0x0123 };
+    sn_frame_writer_t w;
+
+    sn_frame_writer_begin(&w, s_buf, sizeof(s_buf), &hdr);
+    SN_CHECK(sn_frame_writer_add(&w, set));
+    size_t len = sn_frame_writer_finish(&w);
+    static const uint8_t expected[] = {
+        SN_FRAME_VERSION, SN_FRAME_FLAG_PACKED12, 0x34, 0x12, 0xef, 0xcd, 0xab, 0x89,
+        0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf4, 0x01, 0x00, 0x00, 0x05, 0x00, 0x01, 0x00,
+        0xbc, 0x3a, 0x12,
+    };
+    SN_CHECK(len == sizeof(expected));
+    SN_CHECK(memcmp(s_buf, expected, sizeof(expected)) == 0, "wire layout changed");
+
+    sn_frame_header_t got;
+    SN_CHECK(!sn_frame_decode_header(s_buf, SN_FRAME_HEADER_LEN - 1, &got));
+    s_buf[0] = SN_FRAME_VERSION + 1;
+    SN_CHECK(!sn_frame_decode_header(s_buf, len, &got));
+    SN_CHECK(sn_frame_len(0xffff, 3, SN_FRAME_FLAG_PACKED12) == SN_FRAME_HEADER_LEN + 72);
+    SN_CHECK(sn_frame_len(0x0001, 3, SN_FRAME_FLAG_PACKED12) == SN_FRAME_HEADER_LEN + 5);
+}
+
+static void test_throughput(uint8_t flags, const char *name)
+{
+    const uint16_t mask = 0xffff;
+    const uint32_t sets_per_frame = 100;
+    double seconds = sn_test_bench ? 2 : 0.3;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    double encode_s = 0;
+    double decode_s = 0;
+
+    for (uint32_t i = 0; i < sets_per_frame * SN_MAX_CHANNELS; i++) {
+        s_in[i] = (uint16_t)(2048 + (sn_test_rand() & 0x3ff) - 512);
+    }
+    while (encode_s + decode_s < seconds) {
+        sn_frame_header_t hdr = { .flags = flags, .period_us = 500, .channel_mask = mask, .seq = (uint32_t)frames };
+        sn_frame_writer_t w;
+        sn_frame_header_t got;
+
+        double t0 = sn_test_seconds();
+        for (int k = 0; k < 100; k++) {
+            sn_frame_writer_begin(&w, s_buf, sizeof(s_buf), &hdr);
+            for (uint32_t s = 0; s < sets_per_frame; s++) {
+                sn_frame_writer_add(&w, &s_in[s * SN_MAX_CHANNELS]);
+            }
+            bytes += sn_frame_writer_finish(&w);
+        }
+        double t1 = sn_test_seconds();
+        for (int k = 0; k < 100; k++) {
+            sn_frame_decode_header(s_buf, w.len, &got);
+            sn_frame_decode_samples(s_buf, w.len, &got, s_out, sets_per_frame * SN_MAX_CHANNELS);
+        }
+        double t2 = sn_test_seconds();
+        encode_s += t1 - t0;
+        decode_s += t2 - t1;
+        frames += 100;
+    }
+    SN_CHECK(memcmp(s_in, s_out, sets_per_frame * SN_MAX_CHANNELS * sizeof(uint16_t)) == 0);
+    double samples = (double)frames * sets_per_frame * SN_MAX_CHANNELS;
+    sn_test_metric(name, "encode", samples / encode_s / 1e6, "Msamples/s");
+    sn_test_metric(name, "decode", samples / decode_s / 1e6, "Msamples/s");
+    sn_test_metric(name, "encoded", bytes / encode_s / 1e6, "MB/s");
+}
+
+int main(int argc, char **argv)
+{
+    sn_test_init(argc, argv);
+    test_layout();
+    test_round_trip();
+    test_throughput(0, "frame16");
+    test_throughput(SN_FRAME_FLAG_PACKED12, "frame12");
+    return sn_test_done("test_frame");
+}
@@ -0,0 +1,239 @@
+/* Health report on the host.
+
+   The reporter runs its own task at a one second interval next to three
+   tasks sharing a name and a spinner that burns CPU for the first two
+   intervals. Every report must be valid JSON with no repeated key in any
+   object and fit in SN_HEALTH_MAX_REPORT. The application fields are then
+   padded so the per-task section no longer fits, and later so they do not
+   fit themselves: each time the report still goes out, without that
+   section and with "truncated" set. The report after the one that left the
+   tasks out must cover both intervals, so the spinner's share shows up in
+   it instead of being lost with the skipped section.
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sn_health.h"
+#include "sn_test.h"
+
+#define REPORTS         4
+#define MAX_KEYS        64
+#define MAX_DEPTH       8
+
+static char s_reports[REPORTS][SN_HEALTH_MAX_REPORT + 1];
+static size_t s_lens[REPORTS];
+static volatile int s_published;
+static char s_pad[2 * SN_HEALTH_MAX_REPORT];
+
+/* Minimal JSON checker: objects, arrays, strings without escapes and plain numbers. */
+typedef struct {
+    const char *p;
+    int depth;
+    bool ok;
+} json_t;
+
+static void json_value(json_t *j);
+
+static size_t json_string(json_t *j, const char **start)
+{
+    if (*j->p != '"') {
+        j->ok = false;
+        return 0;
+    }
+    *start = ++j->p;
+    while (*j->p != '\0' && *j->p != '"' && *j->p != '\\') {
+        j->p++;
+    }
+    if (*j->p != '"') {
+        j->ok = false;
+        return 0;
+    }
+    return (size_t)(j->p++ - *start);
+}
+
+static void json_object(json_t *j)
+{
+    const char *keys[MAX_KEYS];
+    size_t lens[MAX_KEYS];
+    int count = 0;
+
+    j->p++;
+    if (++j->depth > MAX_DEPTH) {
+        j->ok = false;
+        return;
+    }
+    while (j->ok && *j->p != '}') {
+        if (count > 0 && *j->p++ != ',') {
+            j->ok = false;
+            return;
+        }
+        const char *key;
+        size_t len = json_string(j, &key);
+        for (int i = 0; i < count && j->ok; i++) {
+            if (lens[i] == len && memcmp(keys[i], key, len) == 0) {
+                SN_CHECK(false, "key \"%.*s\" repeated", (int)len, key);
+                j->ok = false;
+            }
+        }
+        if (!j->ok || count == MAX_KEYS || *j->p++ != ':') {
+            j->ok = false;
+            return;
+        }
+        keys[count] = key;
+        lens[count++] = len;
+        json_value(j);
+    }
+    j->p++;
+    j->depth--;
+}
+
+static void json_value(json_t *j)
+{
+    const char *s;
+
+    if (*j->p == '{') {
+        json_object(j);
+    } else if (*j->p == '"') {
+        json_string(j, &s);
+    } else if (*j->p == '[') {
+        j->p++;
+        while (j->ok && *j->p != ']') {
+            json_value(j);
+            if (*j->p == ',') {
+                j->p++;
+            } else if (*j->p != ']') {
+                j->ok = false;
+            }
+        }
+        j->p++;
+    } else if (*j->p == '-' || (*j->p >= '0' && *j->p <= '9')) {
+        j->p++;
+        while (*j->p >= '0' && *j->p <= '9') {
+            j->p++;
+        }
+    } else {
+        j->ok = false;
+    }
+}
+
+static bool json_valid(const char *text)
+{
+    json_t j = { .p = text, .ok = *text == '{' };
+
+    if (j.ok) {
+        json_object(&j);
+    }
+    return j.ok && *j.p == '\0';
+}
+
+/* Value of a member anywhere in the report, -1 when absent. */
+static long member(const char *report, const char *key)
+{
+    char quoted[40];
+
+    snprintf(quoted, sizeof(quoted), "\"%s\":", key);
+    const char *p = strstr(report, quoted);
+    return p != NULL ? strtol(p + strlen(quoted), NULL, 10) : -1;
+}
+
+/* Length of the per-task section with its leading comma, 0 when absent. */
+static size_t tasks_len(const char *report)
+{
+    const char *p = strstr(report, ",\"cpu_permille\":{");
+    const char *end = p != NULL ? strchr(p, '}') : NULL;
+
+    return end != NULL ? (size_t)(end + 1 - p) : 0;
+}
+
+static void add_fields(sn_stats_writer_t *w)
+{
+    sn_stats_str(w, "pad", s_pad);
+}
+
+/* Runs on the health task, so the padding for the next report is in place before it is built. */
+static bool publish(const char *payload, size_t len)
+{
+    int n = s_published;
+
+    if (n >= REPORTS) {
+        return true;
+    }
+    SN_CHECK(len == strlen(payload) && len < SN_HEALTH_MAX_REPORT, "report %d is %zu bytes", n, len);
+    memcpy(s_reports[n], payload, len);
+    s_lens[n] = len;
+    if (n == 0) {
+        /* leave less room than the tasks need: fields fit, the per-task section does not */
+        size_t room = SN_HEALTH_MAX_REPORT - 80 - (len - tasks_len(payload));
+        memset(s_pad, 'x', room);
+    } else if (n == 1) {
+        s_pad[0] = '\0';
+    } else if (n == 2) {
+        memset(s_pad, 'x', sizeof(s_pad) - 1);
+    }
+    __atomic_store_n(&s_published, n + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void worker(void *arg)
+{
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+static void spinner(void *arg)
+{
+    volatile uint32_t spins = 0;
+
+    while (__atomic_load_n(&s_published, __ATOMIC_ACQUIRE) < 2) {
+        spins++;
+    }
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    sn_test_init(argc, argv);
+    for (int i = 0; i < 3; i++) {
+        SN_CHECK(xTaskCreate(worker, "worker", 2048, NULL, 1, NULL) == pdPASS);
+    }
+    SN_CHECK(xTaskCreate(spinner, "spinner", 2048, NULL, 1, NULL) == pdPASS);
+    const sn_health_config_t config = {
+        .node_id = 0x1234,
+        .interval_s = 1,
+        .publish = publish,
+        .add_fields = add_fields,
+    };
+    SN_CHECK(sn_health_start(&config) == ESP_OK);
+    for (int i = 0; i < 600 && __atomic_load_n(&s_published, __ATOMIC_ACQUIRE) < REPORTS; i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    SN_CHECK(s_published == REPORTS, "%d reports", s_published);
+
+    for (int n = 0; n < s_published; n++) {
+        SN_CHECK(json_valid(s_reports[n]), "report %d: %s", n, s_reports[n]);
+    }
+    const char *full = s_reports[0];
+    SN_CHECK(member(full, "truncated") < 0 && tasks_len(full) > 0 && member(full, "interval_max_us") >= 0);
+    SN_CHECK(member(full, "IDLE0") >= 0 && member(full, "IDLE1") >= 0 && member(full, "worker") >= 0 &&
+             member(full, "worker#1") >= 0 && member(full, "worker#2") >= 0, "%s", full);
+
+    const char *no_tasks = s_reports[1];
+    SN_CHECK(member(no_tasks, "truncated") == 1 && tasks_len(no_tasks) == 0 && strstr(no_tasks, "\"pad\"") != NULL,
+             "%s", no_tasks);
+
+    /* the spinner ran through the first half of the two intervals this one covers */
+    const char *after = s_reports[2];
+    SN_CHECK(member(after, "truncated") < 0 && member(after, "spinner") > 200, "spinner at %ld permille",
+             member(after, "spinner"));
+
+    const char *no_fields = s_reports[3];
+    SN_CHECK(member(no_fields, "truncated") == 1 && strstr(no_fields, "\"pad\"") == NULL &&
+             tasks_len(no_fields) > 0, "%s", no_fields);
+
+    sn_test_metric("health", "report", s_lens[0], "bytes");
+    return sn_test_done("test_health");
+}
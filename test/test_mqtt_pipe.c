@@ -0,0 +1,369 @@
+/* MQTT data pipe against a broker stand-in on the loopback interface.
+
+   Measures frames and bytes per second through the pipe with PUBACKs sent
+   at once and held back by a simulated round trip, where the window has to
+   keep several frames in flight. Then checks that frames taken back from
+   the queue keep their length and contents, that frames in flight when the
+   connection drops are sent again with DUP set, and finally runs the
+   publisher over the pipe with the spill log on a flash image through a
+   stall, an outage and the backfill after it: every sample set must reach
+   the broker, including those in frames that were queued on the pipe when
+   it went offline.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sn_config.h"
+#include "sn_frame.h"
+#include "sn_mqtt_pipe.h"
+#include "sn_publisher.h"
+#include "sn_spill.h"
+#include "sn_test.h"
+#include "sn_test_broker.h"
+#include "sn_test_flash.h"
+
+#define POOL_BUFS       8
+#define WINDOW          4
+#define BUF_SIZE        (SN_MQTT_PIPE_HEADROOM + SN_PUBLISHER_MAX_FRAME_LEN)
+#define TOPIC           "sn/test/data"
+#define RING_SIZE       1024
+#define PERIOD_US       500
+#define MAX_SETS        200000
+
+static uint8_t s_storage[POOL_BUFS * BUF_SIZE];
+static sn_buf_t s_bufs[POOL_BUFS];
+static sn_pool_t s_pool;
+static sn_test_broker_t s_broker;
+
+/* raw frames: a sequence number, then a pattern derived from it */
+static uint32_t s_next_seq;             /* next sequence number to send */
+static volatile uint32_t s_expected;    /* next one the broker should see */
+static volatile uint32_t s_out_of_order;
+
+/* publisher frames: which sample sets arrived */
+static uint8_t *s_set_seen;
+static volatile uint32_t s_bad_sets;
+static volatile uint32_t s_backfill_frames;
+
+static void fill(sn_buf_t *buf, uint32_t seq, size_t len)
+{
+    memcpy(buf->data, &seq, sizeof(seq));
+    for (size_t i = sizeof(seq); i < len; i++) {
+        buf->data[i] = (uint8_t)(seq + i);
+    }
+    buf->len = len;
+}
+
+static bool filled(const uint8_t *data, size_t len, uint32_t seq)
+{
+    uint32_t got;
+
+    memcpy(&got, data, sizeof(got));
+    if (got != seq) {
+        return false;
+    }
+    for (size_t i = sizeof(seq); i < len; i++) {
+        if (data[i] != (uint8_t)(seq + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void on_raw(const uint8_t *payload, size_t len, bool dup, void *ctx)
+{
+    uint32_t seq;
+
+    memcpy(&seq, payload, sizeof(seq));
+    if (dup && seq < s_expected) {
+        return;                 /* a resend of a frame the broker already had */
+    }
+    if (seq != s_expected || !filled(payload, len, seq)) {
+        s_out_of_order++;
+    }
+    s_expected = seq + 1;
+}
+
+static void on_frame(const uint8_t *payload, size_t len, bool dup, void *ctx)
+{
+    static uint16_t samples[SN_PUBLISHER_MAX_FRAME_LEN];
+    sn_frame_header_t hdr;
+
+    if (!sn_frame_decode_header(payload, len, &hdr) ||
+        !sn_frame_decode_samples(payload, len, &hdr, samples, sizeof(samples) / sizeof(samples[0]))) {
+        s_bad_sets++;
+        return;
+    }
+    s_backfill_frames += (hdr.flags & SN_FRAME_FLAG_BACKFILL) != 0;
+    for (uint32_t k = 0; k < hdr.sample_count; k++) {
+        uint32_t index = (uint32_t)(hdr.t0_us / PERIOD_US) + k;
+        if (index >= MAX_SETS || samples[k * SN_MAX_CHANNELS + 15] != ((index * SN_MAX_CHANNELS + 15) & 0xfff)) {
+            s_bad_sets++;
+            continue;
+        }
+        s_set_seen[index] = 1;
+    }
+}
+
+static void send_raw(size_t len)
+{
+    sn_buf_t *buf = sn_pool_acquire(&s_pool, pdMS_TO_TICKS(2000));
+
+    SN_CHECK(buf != NULL, "no buffer came back from the pipe");
+    if (buf != NULL) {
+        fill(buf, s_next_seq++, len);
+        buf->queued_us = esp_timer_get_time();
+        SN_CHECK(sn_mqtt_pipe_send(buf) == ESP_OK);
+    }
+}
+
+/* Wait until the pipe has handed every buffer back. */
+static bool wait_idle(uint32_t timeout_ms)
+{
+    for (uint32_t waited = 0; waited < timeout_ms; waited += 10) {
+        if (sn_pool_available(&s_pool) == POOL_BUFS) {
+            return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return false;
+}
+
+static void test_throughput(size_t len, uint32_t rtt_us, const char *name)
+{
+    double seconds = sn_test_bench ? 3 : 0.5;
+    sn_mqtt_pipe_stats_t before, after;
+    sn_hist_t latency;
+
+    s_broker.ack_delay_us = rtt_us;
+    uint32_t first = s_next_seq;
+    uint64_t bytes = s_broker.payload_bytes;
+    sn_mqtt_pipe_get_stats(&before);
+    double start = sn_test_seconds();
+    while (sn_test_seconds() - start < seconds) {
+        send_raw(len);
+    }
+    SN_CHECK(wait_idle(2000));
+    double elapsed = sn_test_seconds() - start;
+    sn_mqtt_pipe_get_stats(&after);
+    sn_hist_delta(&latency, &after.ack_latency_us, &before.ack_latency_us);
+
+    uint32_t frames = s_next_seq - first;
+    SN_CHECK(s_expected == s_next_seq && s_out_of_order == 0, "%u of %u frames in order", s_expected - first,
+             frames);
+    SN_CHECK(after.acked - before.acked == frames && after.resent == before.resent);
+    if (rtt_us > 0) {
+        /* one frame per round trip is what a publish that waits for its PUBACK would manage */
+        SN_CHECK(frames / elapsed > 2.0 * 1000000 / rtt_us, "%.0f frames/s over a %u us round trip",
+                 frames / elapsed, rtt_us);
+    }
+    sn_test_metric(name, "frames", frames / elapsed, "/s");
+    sn_test_metric(name, "payload", (s_broker.payload_bytes - bytes) / elapsed / 1e6, "MB/s");
+    sn_test_metric(name, "ack latency p50", sn_hist_percentile(&latency, 50), "us");
+    sn_test_metric(name, "ack latency p99", sn_hist_percentile(&latency, 99), "us");
+    s_broker.ack_delay_us = 0;
+}
+
+/* Stall the broker so the window fills and the rest of the pool waits in the pipe's queue. */
+static void fill_pipe(size_t *lens)
+{
+    s_broker.stall = true;
+    for (int i = 0; i < POOL_BUFS; i++) {
+        send_raw(lens[i]);
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+}
+
+static void test_reclaim(void)
+{
+    size_t lens[POOL_BUFS];
+    sn_buf_t *taken[POOL_BUFS];
+    uint32_t first = s_next_seq;
+    int n = 0;
+
+    for (int i = 0; i < POOL_BUFS; i++) {
+        lens[i] = 100 + 37 * i;
+    }
+    fill_pipe(lens);
+    SN_CHECK(sn_pool_available(&s_pool) == 0);
+    while (n < POOL_BUFS && (taken[n] = sn_mqtt_pipe_reclaim()) != NULL) {
+        n++;
+    }
+    SN_CHECK(n == POOL_BUFS - WINDOW, "%d frames taken back", n);
+    for (int i = 0; i < n; i++) {
+        uint32_t seq = first + WINDOW + i;
+        SN_CHECK(taken[i]->len == lens[WINDOW + i], "frame %u came back with length %zu, sent with %zu", seq,
+                 taken[i]->len, lens[WINDOW + i]);
+        SN_CHECK(taken[i]->packet == NULL && filled(taken[i]->data, taken[i]->len, seq));
+    }
+    /* hand them over again, still oldest first */
+    for (int i = 0; i < n; i++) {
+        SN_CHECK(sn_mqtt_pipe_send(taken[i]) == ESP_OK);
+    }
+    s_broker.stall = false;
+    SN_CHECK(wait_idle(2000));
+    SN_CHECK(s_expected == s_next_seq && s_out_of_order == 0);
+}
+
+static void test_reconnect(void)
+{
+    size_t lens[POOL_BUFS];
+    sn_mqtt_pipe_stats_t before, after;
+    uint32_t connects = s_broker.connects;
+    uint32_t dups = s_broker.dups;
+
+    for (int i = 0; i < POOL_BUFS; i++) {
+        lens[i] = 600;
+    }
+    sn_mqtt_pipe_get_stats(&before);
+    fill_pipe(lens);
+    sn_test_broker_drop(&s_broker);
+    s_broker.stall = false;
+    SN_CHECK(wait_idle(3000));
+    sn_mqtt_pipe_get_stats(&after);
+    SN_CHECK(s_broker.connects == connects + 1 && after.reconnects == before.reconnects + 1);
+    SN_CHECK(after.resent - before.resent == WINDOW && s_broker.dups - dups == WINDOW,
+             "%u resent, broker saw %u DUPs", after.resent - before.resent, s_broker.dups - dups);
+    SN_CHECK(s_expected == s_next_seq && s_out_of_order == 0, "frames lost over the reconnect");
+}
+
+/* Push sets into the ring at PERIOD_US, as the sampler would, for the given time. */
+static uint32_t produce(sn_ring_t *ring, uint32_t index, double seconds)
+{
+    double start = sn_test_seconds();
+
+    while (sn_test_seconds() - start < seconds) {
+        uint32_t due = index + 20;
+        for (; index < due; index++) {
+            sn_sample_set_t *set;
+            while ((set = sn_ring_claim(ring)) == NULL) {
+                vTaskDelay(1);  /* a blocked publisher holds the producer up rather than losing sets */
+            }
+            set->index = index;
+            set->timestamp_us = (int64_t)index * PERIOD_US;
+            set->period_us = PERIOD_US;
+            set->channel_mask = 0xffff;
+            set->channel_count = SN_MAX_CHANNELS;
+            set->format = SN_SAMPLE_FORMAT_RAW;
+            set->config_version = 1;
+            set->provisional = 0;
+            for (int c = 0; c < SN_MAX_CHANNELS; c++) {
+                set->samples[c] = (uint16_t)((index * SN_MAX_CHANNELS + c) & 0xfff);
+            }
+            sn_ring_commit(ring);
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return index;
+}
+
+static void test_offline_spill(void)
+{
+    static sn_sample_set_t slots[RING_SIZE];
+    static sn_ring_t ring;
+    static sn_test_flash_t flash;
+    sn_mqtt_pipe_stats_t pipe_before, pipe_after;
+    sn_publisher_stats_t stats;
+    sn_spill_stats_t spill;
+
+    s_set_seen = calloc(MAX_SETS, 1);
+    s_broker.on_publish = on_frame;
+    sn_test_flash_open(&flash, 256 * 1024, 4096);
+    SN_CHECK(sn_spill_init(&flash.flash) == ESP_OK);
+    SN_CHECK(sn_ring_init(&ring, slots, RING_SIZE));
+    const sn_config_t initial = {
+        .running = true,
+        .rate_hz = 1000000 / PERIOD_US,
+        .channel_mask = 0xffff,
+        .dsp = { .ratio = 1 },
+        .pkt_len = 20,
+        .transport = sn_transport_mqtt(),
+    };
+    SN_CHECK(sn_config_init(&initial) == ESP_OK);
+    const sn_publisher_config_t config = {
+        .ring = &ring,
+        .pool = &s_pool,
+        .node_id = 7,
+        .sample_bits = 12,
+        .backfill_bytes_per_s = 256 * 1024,
+        .backpressure = SN_PUBLISHER_BLOCK,
+    };
+    SN_CHECK(sn_publisher_start(&config) == ESP_OK);
+    sn_mqtt_pipe_get_stats(&pipe_before);
+
+    uint32_t index = produce(&ring, 0, 0.5);
+    s_broker.stall = true;              /* the window and then the pool fill up */
+    index = produce(&ring, index, 0.3);
+    s_broker.refuse = true;             /* outage: queued frames go to the spill log */
+    sn_test_broker_drop(&s_broker);
+    s_broker.stall = false;
+    index = produce(&ring, index, 1.0);
+    s_broker.refuse = false;
+    sn_mqtt_pipe_retry_now();
+    index = produce(&ring, index, 1.0);
+
+    for (int i = 0; i < 1000; i++) {
+        sn_spill_get_stats(&spill);
+        if (spill.records_pending == 0 && sn_ring_count(&ring) == 0 && sn_pool_available(&s_pool) == POOL_BUFS) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    vTaskDelay(pdMS_TO_TICKS(50));
+    sn_publisher_get_stats(SN_STATS_READER_HEALTH, &stats);
+    sn_spill_get_stats(&spill);
+    sn_mqtt_pipe_get_stats(&pipe_after);
+
+    uint32_t missing = 0;
+    uint32_t first_missing = UINT32_MAX;
+    for (uint32_t i = 0; i < index; i++) {
+        if (!s_set_seen[i]) {
+            first_missing = missing++ == 0 ? i : first_missing;
+        }
+    }
+    SN_CHECK(missing == 0, "%u of %u sample sets never reached the broker, first %u", missing, index, first_missing);
+    SN_CHECK(s_bad_sets == 0 && s_broker.errors == 0);
+    SN_CHECK(pipe_after.reclaimed > pipe_before.reclaimed, "no queued frame was taken back when the pipe went down");
+    SN_CHECK(stats.frames_spilled > 0 && stats.frames_backfilled == stats.frames_spilled,
+             "%u spilled, %u backfilled", stats.frames_spilled, stats.frames_backfilled);
+    SN_CHECK(spill.records_pending == 0 && stats.frames_dropped == 0);
+    SN_CHECK(s_backfill_frames >= stats.frames_backfilled);
+    sn_test_metric("publisher", "frames spilled", stats.frames_spilled, "");
+    sn_test_metric("publisher", "queued frames spilled", pipe_after.reclaimed - pipe_before.reclaimed, "");
+    sn_test_metric("publisher", "sample sets delivered", index - missing, "");
+    sn_test_flash_close(&flash);
+    free(s_set_seen);
+}
+
+int main(int argc, char **argv)
+{
+    sn_test_init(argc, argv);
+    s_broker.on_publish = on_raw;
+    s_broker.topic = TOPIC;
+    sn_test_broker_start(&s_broker);
+    SN_CHECK(sn_pool_init(&s_pool, s_bufs, s_storage, POOL_BUFS, BUF_SIZE, SN_MQTT_PIPE_HEADROOM) == ESP_OK);
+    const sn_mqtt_pipe_config_t config = {
+        .host = "127.0.0.1",
+        .port = s_broker.port,
+        .client_id = "sn-test-data",
+        .topic = TOPIC,
+        .pool = &s_pool,
+        .window = WINDOW,
+    };
+    SN_CHECK(sn_mqtt_pipe_start(&config) == ESP_OK);
+    for (int i = 0; i < 200 && !sn_mqtt_pipe_connected(); i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    SN_CHECK(sn_mqtt_pipe_connected());
+
+    test_throughput(664, 0, "pipe 664 B");
+    test_throughput(4096, 0, "pipe 4 KB");
+    test_throughput(664, 2000, "pipe 664 B, 2 ms rtt");
+    test_reclaim();
+    test_reconnect();
+    test_offline_spill();
+    return sn_test_done("test_mqtt_pipe");
+}
@@ -0,0 +1,274 @@
+/* Reconfiguration under load: two committer threads, standing in for the
+   command handler and the benchmark sweep, change the configuration about
+   every 3 ms between them while a producer plays the sampler, adopting each
+   version between bursts and stamping it into the sets it pushes, and the
+   publisher frames them.
+
+   Every version selects its own capture transport, packet length and
+   compression, so each frame shows the settings it went out under and,
+   through the version written into its samples, the configuration its sets
+   were taken under. No frame may mix sets of two versions or go out under
+   settings newer than its sets; a frame may only lag behind when the
+   publisher skipped a version it never saw. Every set must arrive once and
+   in order, and every commit must get a version of its own, also when the
+   two commit back to back as fast as they can.
+*/
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sn_config.h"
+#include "sn_frame.h"
+#include "sn_publisher.h"
+#include "sn_test.h"
+
+#define POOL_BUFS       8
+#define BUF_SIZE        SN_PUBLISHER_MAX_FRAME_LEN
+#define RING_SIZE       1024
+#define TRANSPORTS      32      /* version v sends through transport v % TRANSPORTS */
+#define CHANNEL_MASK    0x0007
+
+static uint8_t s_storage[POOL_BUFS * BUF_SIZE];
+static sn_buf_t s_bufs[POOL_BUFS];
+static sn_pool_t s_pool;
+static sn_sample_set_t s_slots[RING_SIZE];
+static sn_ring_t s_ring;
+static sn_transport_t s_transports[TRANSPORTS];
+
+static volatile bool s_stop;
+
+/* written by the publisher task through the capture transports */
+static uint32_t s_frames;
+static uint32_t s_settings;     /* version of the settings the last frame went out under */
+static uint32_t s_sets;
+static uint32_t s_next_index;
+static uint32_t s_mixed;        /* sets of two versions in one frame */
+static uint32_t s_ahead;        /* settings newer than the sets, or older than the last frame's */
+static uint32_t s_behind;       /* settings of an older version, the publisher skipped the sets' one */
+static uint32_t s_wrong;        /* compression or length not those of the version it went out under */
+static uint32_t s_lost;
+static uint32_t s_bad;
+
+static uint16_t pkt_len_of(uint32_t version)
+{
+    return 1 + version % 23;
+}
+
+static bool compress_of(uint32_t version)
+{
+    return (version / 3) & 1;
+}
+
+static bool capture_connected(void)
+{
+    return true;
+}
+
+/* Decode and check the frame right away, so nothing stays queued when the transport changes. */
+static esp_err_t capture(uint32_t transport, sn_buf_t *buf)
+{
+    static uint16_t samples[SN_PUBLISHER_MAX_FRAME_LEN];
+    sn_frame_header_t hdr;
+
+    if (!sn_frame_decode_header(buf->data, buf->len, &hdr) || hdr.channel_mask != CHANNEL_MASK ||
+        !sn_frame_decode_samples(buf->data, buf->len, &hdr, samples, sizeof(samples) / sizeof(samples[0]))) {
+        s_bad++;
+        sn_pool_release(&s_pool, buf);
+        return ESP_OK;
+    }
+    /* samples are the version, then the index in two halves */
+    uint16_t version = samples[0];
+    for (uint32_t k = 0; k < hdr.sample_count; k++) {
+        const uint16_t *set = &samples[k * 3];
+        uint32_t index = set[1] | ((uint32_t)set[2] << 16);
+        s_mixed += set[0] != version;
+        s_lost += index != s_next_index;
+        s_next_index = index + 1;
+    }
+    /* the newest version up to the sets' own that used this transport; an older one than the previous
+       frame's means the settings were really ahead of the sets */
+    uint32_t settings = version - (version - transport) % TRANSPORTS;
+    if (settings < s_settings) {
+        s_ahead++;
+        settings += TRANSPORTS;
+    } else {
+        s_behind += settings < version;
+        s_settings = settings;
+    }
+    if ((hdr.flags & SN_FRAME_FLAG_COMPRESSED) != (compress_of(settings) ? SN_FRAME_FLAG_COMPRESSED : 0) ||
+        hdr.sample_count > pkt_len_of(settings)) {
+        s_wrong++;
+    }
+    s_frames++;
+    s_sets += hdr.sample_count;
+    sn_pool_release(&s_pool, buf);
+    return ESP_OK;
+}
+
+static sn_buf_t *capture_reclaim(void)
+{
+    return NULL;
+}
+
+#define CAPTURE(n) static esp_err_t capture_##n(sn_buf_t *buf) { return capture(n, buf); }
+CAPTURE(0) CAPTURE(1) CAPTURE(2) CAPTURE(3) CAPTURE(4) CAPTURE(5) CAPTURE(6) CAPTURE(7)
+CAPTURE(8) CAPTURE(9) CAPTURE(10) CAPTURE(11) CAPTURE(12) CAPTURE(13) CAPTURE(14) CAPTURE(15)
+CAPTURE(16) CAPTURE(17) CAPTURE(18) CAPTURE(19) CAPTURE(20) CAPTURE(21) CAPTURE(22) CAPTURE(23)
+CAPTURE(24) CAPTURE(25) CAPTURE(26) CAPTURE(27) CAPTURE(28) CAPTURE(29) CAPTURE(30) CAPTURE(31)
+
+static esp_err_t (*const s_captures[TRANSPORTS])(sn_buf_t *) = {
+    capture_0, capture_1, capture_2, capture_3, capture_4, capture_5, capture_6, capture_7,
+    capture_8, capture_9, capture_10, capture_11, capture_12, capture_13, capture_14, capture_15,
+    capture_16, capture_17, capture_18, capture_19, capture_20, capture_21, capture_22, capture_23,
+    capture_24, capture_25, capture_26, capture_27, capture_28, capture_29, capture_30, capture_31,
+};
+
+static void settings_for(sn_config_t *config, uint32_t version)
+{
+    config->pkt_len = pkt_len_of(version);
+    config->compress = compress_of(version);
+    config->transport = &s_transports[version % TRANSPORTS];
+}
+
+/* A command path: commit a new version every 0 to 12 ms. */
+static void *committer(void *arg)
+{
+    uint32_t *commits = arg;
+
+    while (!s_stop) {
+        sn_config_t config;
+        sn_config_edit(&config);
+        settings_for(&config, config.version + 1);
+        sn_config_commit(&config);
+        (*commits)++;
+        usleep(sn_test_rand() % 12000);
+    }
+    return NULL;
+}
+
+/* Both committers without pauses, to catch edits that overlap. */
+static void *storm(void *arg)
+{
+    for (uint32_t i = 0; i < *(uint32_t *)arg; i++) {
+        sn_config_t config;
+        sn_config_edit(&config);
+        settings_for(&config, config.version + 1);
+        sn_config_commit(&config);
+    }
+    return NULL;
+}
+
+/* The sampler: adopt between bursts, stamp the version and push the burst. */
+static uint32_t produce(double seconds)
+{
+    uint16_t version = 1;
+    uint32_t index = 0;
+    double start = sn_test_seconds();
+
+    while (sn_test_seconds() - start < seconds) {
+        const sn_config_t *config = sn_config_adopt(SN_CONFIG_SAMPLER);
+        if (config != NULL) {
+            version = (uint16_t)config->version;
+        }
+        uint32_t burst = 1 + sn_test_rand() % 30;
+        for (uint32_t k = 0; k < burst; k++, index++) {
+            sn_sample_set_t *set;
+            while ((set = sn_ring_claim(&s_ring)) == NULL) {
+                vTaskDelay(1);
+            }
+            set->index = index;
+            set->timestamp_us = (int64_t)index * 500;
+            set->period_us = 500;
+            set->channel_mask = CHANNEL_MASK;
+            set->channel_count = 3;
+            set->format = SN_SAMPLE_FORMAT_RAW;
+            set->config_version = version;
+            set->provisional = 0;
+            set->samples[0] = version;
+            set->samples[1] = index & 0xffff;
+            set->samples[2] = index >> 16;
+            sn_ring_commit(&s_ring);
+        }
+        usleep(sn_test_rand() % 2000);
+    }
+    return index;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds;
+    uint32_t commits[2] = { 0 };
+    pthread_t threads[2];
+
+    sn_test_init(argc, argv);
+    seconds = sn_test_bench ? 10 : 2;
+    for (int i = 0; i < TRANSPORTS; i++) {
+        s_transports[i] = (sn_transport_t) {
+            .name = "capture",
+            .max_frame = SN_PUBLISHER_MAX_FRAME_LEN,
+            .connected = capture_connected,
+            .send = s_captures[i],
+            .reclaim = capture_reclaim,
+        };
+    }
+    SN_CHECK(sn_pool_init(&s_pool, s_bufs, s_storage, POOL_BUFS, BUF_SIZE, 0) == ESP_OK);
+    SN_CHECK(sn_ring_init(&s_ring, s_slots, RING_SIZE));
+    sn_config_t initial = {
+        .running = true,
+        .rate_hz = 2000,
+        .channel_mask = CHANNEL_MASK,
+        .dsp = { .ratio = 1 },
+    };
+    settings_for(&initial, 1);
+    SN_CHECK(sn_config_init(&initial) == ESP_OK);
+    const sn_publisher_config_t config = {
+        .ring = &s_ring,
+        .pool = &s_pool,
+        .node_id = 1,
+        .sample_bits = 16,
+        .backpressure = SN_PUBLISHER_BLOCK,
+    };
+    SN_CHECK(sn_publisher_start(&config) == ESP_OK);
+
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&threads[i], NULL, committer, &commits[i]);
+    }
+    uint32_t produced = produce(seconds);
+    s_stop = true;
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    sn_config_t latest;
+    sn_config_get(&latest);
+    for (int i = 0; i < 200 && sn_ring_count(&s_ring) > 0; i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    /* the last frame stays open until it is full or a configuration is staged */
+
+    SN_CHECK(s_bad == 0 && s_lost == 0, "%u bad frames, %u sets out of order", s_bad, s_lost);
+    SN_CHECK(s_mixed == 0, "%u sets in a frame with another version", s_mixed);
+    SN_CHECK(s_ahead == 0, "%u of %u frames went out under a configuration newer than their sets", s_ahead,
+             s_frames);
+    SN_CHECK(s_wrong == 0, "%u frames did not follow the settings they went out under", s_wrong);
+    SN_CHECK(s_sets <= produced && produced - s_sets < pkt_len_of(22), "%u of %u sets framed", s_sets, produced);
+    SN_CHECK(latest.version == 1 + commits[0] + commits[1], "version %u after %u commits", latest.version,
+             commits[0] + commits[1]);
+    sn_test_metric("reconfig", "commits", (commits[0] + commits[1]) / seconds, "/s");
+
+    uint32_t storm_commits = sn_test_bench ? 1000000 : 200000;
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&threads[i], NULL, storm, &storm_commits);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    sn_config_t stormed;
+    sn_config_get(&stormed);
+    SN_CHECK(stormed.version == latest.version + 2 * storm_commits, "version %u after %u more commits",
+             stormed.version, 2 * storm_commits);
+    sn_test_metric("reconfig", "frames", s_frames / seconds, "/s");
+    sn_test_metric("reconfig", "frames under an older configuration", 100.0 * s_behind / s_frames, "%");
+    return sn_test_done("test_reconfig");
+}
@@ -0,0 +1,380 @@
+/* Ring and sampler on the host.
+
+   Drop and high-water accounting are checked on a ring filled past its
+   size; then a producer thread pushes sets as fast as the ring takes them
+   while this thread drains it, so ordering and slot contents are checked
+   under real concurrency. The sampler runs its own task against a polled stub ADC at
+   the stretch goal of 16 channels at 2 kHz and is drained like the
+   publisher would; every set must arrive, in order, with the stub's values
+   and evenly spaced timestamps. Meanwhile a second reader polls the stats
+   from another thread: every copy must be consistent, and its short
+   interval windows must not cut into the health reader's. Last, new
+   versions are committed to the running sampler: only a change of rate or
+   channels may reconfigure the stub, and one the stub rejects must leave the
+   previous version sampling, or sampling stopped if that fails as well.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sn_ring.h"
+#include "sn_sampler.h"
+#include "sn_test.h"
+
+#define RING_SIZE       256
+#define SAMPLER_RATE_HZ 2000
+#define SAMPLER_MASK    0xffff
+
+static sn_sample_set_t s_slots[RING_SIZE];
+static sn_ring_t s_ring;
+
+static uint32_t s_total;
+
+/* Producer that waits for room instead of dropping, so every index must arrive. */
+static void *producer(void *arg)
+{
+    for (uint32_t i = 0; i < s_total; i++) {
+        sn_sample_set_t *set;
+        while ((set = sn_ring_claim(&s_ring)) == NULL) {
+            sched_yield();
+        }
+        set->index = i;
+        set->timestamp_us = i * 500;
+        set->samples[0] = (uint16_t)i;
+        set->samples[SN_MAX_CHANNELS - 1] = (uint16_t)~i;
+        sn_ring_commit(&s_ring);
+    }
+    return NULL;
+}
+
+static void test_ring_overrun(void)
+{
+    SN_CHECK(!sn_ring_init(&s_ring, s_slots, 100), "size must be a power of two");
+    SN_CHECK(sn_ring_init(&s_ring, s_slots, RING_SIZE));
+    SN_CHECK(sn_ring_front(&s_ring) == NULL);
+    for (uint32_t i = 0; i < RING_SIZE; i++) {
+        sn_sample_set_t *set = sn_ring_claim(&s_ring);
+        SN_CHECK(set != NULL);
+        set->index = i;
+        sn_ring_commit(&s_ring);
+    }
+    SN_CHECK(sn_ring_claim(&s_ring) == NULL);
+    SN_CHECK(sn_ring_claim(&s_ring) == NULL);
+    SN_CHECK(sn_ring_dropped(&s_ring) == 2);
+    SN_CHECK(sn_ring_count(&s_ring) == RING_SIZE && s_ring.high_water == RING_SIZE);
+    SN_CHECK(sn_ring_front(&s_ring)->index == 0);
+    sn_ring_pop(&s_ring);
+    SN_CHECK(sn_ring_claim(&s_ring) != NULL, "a pop frees one slot");
+}
+
+static void test_ring_concurrent(void)
+{
+    pthread_t thread;
+    uint32_t received = 0;
+
+    SN_CHECK(sn_ring_init(&s_ring, s_slots, RING_SIZE));
+    s_total = sn_test_bench ? 20000000 : 2000000;
+
+    double start = sn_test_seconds();
+    pthread_create(&thread, NULL, producer, NULL);
+    while (received < s_total) {
+        const sn_sample_set_t *set = sn_ring_front(&s_ring);
+        if (set == NULL) {
+            sched_yield();
+            continue;
+        }
+        if (set->index != received || set->samples[0] != (uint16_t)received ||
+            set->samples[SN_MAX_CHANNELS - 1] != (uint16_t)~received || set->timestamp_us != received * 500) {
+            SN_CHECK(false, "set %u arrived as index %u", received, set->index);
+            break;
+        }
+        received++;
+        sn_ring_pop(&s_ring);
+    }
+    pthread_join(thread, NULL);
+    double elapsed = sn_test_seconds() - start;
+
+    SN_CHECK(received == s_total);
+    SN_CHECK(sn_ring_count(&s_ring) == 0);
+    SN_CHECK(s_ring.high_water <= RING_SIZE);
+    sn_test_metric("ring", "sets", s_total / elapsed, "/s");
+}
+
+/* Polled stub ADC: channel c of scan n reads (n * 16 + c) & 0xfff. */
+static uint32_t s_stub_scans;
+static uint16_t s_stub_samples[SN_MAX_CHANNELS];
+static uint32_t s_stub_configures;
+static uint16_t s_stub_reject;          /* channel masks refused with any of these bits */
+
+static esp_err_t stub_configure(sn_source_t *src, uint16_t channel_mask, uint32_t rate_hz)
+{
+    s_stub_configures++;
+    if (channel_mask & s_stub_reject) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    src->channel_mask = channel_mask;
+    src->rate_hz = rate_hz;
+    return ESP_OK;
+}
+
+static esp_err_t stub_read_block(sn_source_t *src, uint32_t max_sets, sn_sample_block_t *block, uint32_t timeout_ms)
+{
+    uint8_t count = __builtin_popcount(src->channel_mask);
+
+    for (uint8_t c = 0; c < count; c++) {
+        s_stub_samples[c] = (uint16_t)((s_stub_scans * SN_MAX_CHANNELS + c) & 0xfff);
+    }
+    s_stub_scans++;
+    *block = (sn_sample_block_t) {
+        .samples = s_stub_samples,
+        .count = 1,
+        .period_us = 1000000 / src->rate_hz,
+        .format = SN_SAMPLE_FORMAT_RAW,
+    };
+    return ESP_OK;
+}
+
+static const sn_source_ops_t s_stub_ops = {
+    .name = "stub",
+    .configure = stub_configure,
+    .read_block = stub_read_block,
+};
+
+static sn_source_t s_stub = {
+    .ops = &s_stub_ops,
+    .sample_bits = 12,
+    .supported_mask = 0xffff,
+};
+
+/* The bench reader, polling the sampler's stats as fast as it can sleep. */
+static volatile bool s_reader_stop;
+static uint32_t s_reader_copies;
+static uint32_t s_reader_torn;
+static uint32_t s_reader_min_us = UINT32_MAX;
+static uint32_t s_reader_max_us;
+
+static uint32_t hist_total(const sn_hist_t *hist)
+{
+    uint32_t total = 0;
+
+    for (int i = 0; i < SN_HIST_BUCKETS; i++) {
+        total += hist->buckets[i];
+    }
+    return total;
+}
+
+static void *stats_reader(void *arg)
+{
+    sn_sampler_stats_t stats;
+    uint32_t last_sets = 0;
+
+    /* the first window began before the health reader's */
+    sn_sampler_get_stats(SN_STATS_READER_BENCH, &stats);
+    while (!s_reader_stop) {
+        usleep(200);
+        sn_sampler_get_stats(SN_STATS_READER_BENCH, &stats);
+        /* every scan adds an interval, then a read */
+        s_reader_torn += hist_total(&stats.jitter_ns) != stats.jitter_ns.count ||
+                         hist_total(&stats.read_ns) != stats.read_ns.count ||
+                         stats.jitter_ns.count > stats.read_ns.count ||
+                         stats.read_ns.count > stats.jitter_ns.count + 1 || stats.sample_sets < last_sets;
+        last_sets = stats.sample_sets;
+        if (stats.max_interval_us > 0) {
+            if (stats.min_interval_us < s_reader_min_us) {
+                s_reader_min_us = stats.min_interval_us;
+            }
+            if (stats.max_interval_us > s_reader_max_us) {
+                s_reader_max_us = stats.max_interval_us;
+            }
+        }
+        s_reader_copies++;
+    }
+    return NULL;
+}
+
+static bool stub_connected(void)
+{
+    return true;
+}
+
+static const sn_transport_t s_no_transport = {
+    .name = "none",
+    .connected = stub_connected,
+};
+
+static void test_sampler(void)
+{
+    sn_config_t initial = {
+        .running = true,
+        .rate_hz = SAMPLER_RATE_HZ,
+        .channel_mask = SAMPLER_MASK,
+        .dsp = { .ratio = 1 },
+        .pkt_len = 20,
+        .transport = &s_no_transport,
+    };
+    const sn_sampler_config_t config = {
+        .source = &s_stub,
+        .initial = &initial,
+    };
+    double seconds = sn_test_bench ? 20 : 3;
+    uint32_t received = 0;
+    uint32_t expected_index = 0;
+    int64_t last_us = 0;
+    size_t spacing_cap = (size_t)(seconds * SAMPLER_RATE_HZ * 2);
+    double *spacing = calloc(spacing_cap, sizeof(double));
+    size_t spacing_count = 0;
+
+    SN_CHECK(sn_ring_init(&s_ring, s_slots, RING_SIZE));
+    SN_CHECK(sn_config_init(&initial) == ESP_OK);
+    SN_CHECK(sn_sampler_start(&config, &s_ring) == ESP_OK);
+    sn_sampler_stats_t stats;
+    pthread_t reader;
+    sn_sampler_get_stats(SN_STATS_READER_HEALTH, &stats);
+    pthread_create(&reader, NULL, stats_reader, NULL);
+
+    double start = sn_test_seconds();
+    while (sn_test_seconds() - start < seconds) {
+        const sn_sample_set_t *set;
+        while ((set = sn_ring_front(&s_ring)) != NULL) {
+            SN_CHECK(set->index == expected_index, "index %u, expected %u", set->index, expected_index);
+            SN_CHECK(set->channel_count == 16 && set->channel_mask == SAMPLER_MASK);
+            SN_CHECK(set->period_us == 1000000 / SAMPLER_RATE_HZ);
+            SN_CHECK(set->samples[15] == ((set->index * SN_MAX_CHANNELS + 15) & 0xfff),
+                     "set %u channel 15 reads %u", set->index, set->samples[15]);
+            if (received > 0 && spacing_count < spacing_cap) {
+                spacing[spacing_count++] = (double)(set->timestamp_us - last_us);
+            }
+            last_us = set->timestamp_us;
+            expected_index = set->index + 1;
+            received++;
+            sn_ring_pop(&s_ring);
+        }
+        vTaskDelay(1);
+    }
+    double elapsed = sn_test_seconds() - start;
+    s_reader_stop = true;
+    pthread_join(reader, NULL);
+
+    sn_sampler_get_stats(SN_STATS_READER_HEALTH, &stats);
+    SN_CHECK(stats.ring_drops == 0, "%u ring drops", stats.ring_drops);
+    SN_CHECK(stats.read_errors == 0);
+    /* a loaded single-core host coalesces some timer ticks; the target must not */
+    SN_CHECK(received > 0.8 * seconds * SAMPLER_RATE_HZ, "%u sets in %.1f s", received, elapsed);
+    SN_CHECK(stats.sample_sets >= received);
+    SN_CHECK(s_reader_copies > 0 && s_reader_torn == 0, "%u of %u copies inconsistent", s_reader_torn,
+             s_reader_copies);
+    SN_CHECK(stats.min_interval_us <= s_reader_min_us && stats.max_interval_us >= s_reader_max_us,
+             "health window %u..%u us misses the bench reader's %u..%u us", stats.min_interval_us,
+             stats.max_interval_us, s_reader_min_us, s_reader_max_us);
+
+    double rate = received / elapsed;
+    double p50 = sn_test_percentile(spacing, spacing_count, 50);
+    double p99 = sn_test_percentile(spacing, spacing_count, 99);
+    SN_CHECK(p50 > 450 && p50 < 550, "median spacing %.0f us", p50);
+    sn_test_metric("sampler", "sets", rate, "/s");
+    sn_test_metric("sampler", "samples", rate * 16, "/s");
+    sn_test_metric("sampler", "missed ticks", stats.missed_ticks, "");
+    sn_test_metric("sampler", "spacing p50", p50, "us");
+    sn_test_metric("sampler", "spacing p99", p99, "us");
+    sn_test_metric("sampler", "interval max", stats.max_interval_us, "us");
+    sn_test_metric("sampler", "jitter mean", stats.jitter_ns.count ? stats.jitter_ns.sum / stats.jitter_ns.count / 1e3 : 0,
+                   "us");
+    sn_test_metric("sampler", "ring high water", stats.ring_high_water, "sets");
+    free(spacing);
+}
+
+/* Commit a new rate and channel mask with pkt_len, wait for the ack and drain the ring. */
+static sn_config_ack_t reconfigure(uint16_t rate_hz, uint16_t channel_mask, uint16_t pkt_len, uint32_t *version)
+{
+    sn_config_t config;
+    sn_config_ack_t ack = { 0 };
+
+    sn_config_edit(&config);
+    config.rate_hz = rate_hz;
+    config.channel_mask = channel_mask;
+    config.pkt_len = pkt_len;
+    sn_config_commit(&config);
+    *version = config.version;
+    SN_CHECK(sn_config_wait_ack(&ack, pdMS_TO_TICKS(1000)) && ack.version == config.version, "no ack for %u",
+             config.version);
+    vTaskDelay(pdMS_TO_TICKS(20));
+    while (sn_ring_front(&s_ring) != NULL) {
+        sn_ring_pop(&s_ring);
+    }
+    return ack;
+}
+
+/* Newest set the sampler pushes from now on. */
+static sn_sample_set_t next_set(void)
+{
+    sn_sample_set_t last = { 0 };
+    int64_t start_us = esp_timer_get_time();
+
+    while (esp_timer_get_time() - start_us < 50000) {
+        const sn_sample_set_t *set;
+        while ((set = sn_ring_front(&s_ring)) != NULL) {
+            last = *set;
+            sn_ring_pop(&s_ring);
+        }
+        vTaskDelay(1);
+    }
+    return last;
+}
+
+static void test_reconfigure(void)
+{
+    uint32_t configures = s_stub_configures;
+    uint32_t version, kept;
+    sn_config_ack_t ack;
+    sn_sample_set_t set;
+
+    while (sn_config_wait_ack(&ack, 0)) {
+        /* the initial version's */
+    }
+    ack = reconfigure(SAMPLER_RATE_HZ, SAMPLER_MASK, 40, &version);
+    set = next_set();
+    SN_CHECK(ack.result == ESP_OK && ack.applied == version && ack.running);
+    SN_CHECK(s_stub_configures == configures, "a packet length change reconfigured the source");
+    SN_CHECK(set.config_version == (uint16_t)version && set.channel_mask == SAMPLER_MASK, "set under version %u",
+             set.config_version);
+
+    ack = reconfigure(1000, 0x00ff, 40, &kept);
+    set = next_set();
+    SN_CHECK(ack.result == ESP_OK && ack.applied == kept && ack.running);
+    SN_CHECK(s_stub_configures == configures + 1);
+    SN_CHECK(set.config_version == (uint16_t)kept && set.channel_mask == 0x00ff && set.period_us == 1000);
+
+    /* rejected: the previous version carries on */
+    s_stub_reject = 0x0f00;
+    configures = s_stub_configures;
+    ack = reconfigure(1000, 0x0fff, 40, &version);
+    set = next_set();
+    SN_CHECK(ack.result == ESP_ERR_NOT_SUPPORTED && ack.applied == kept && ack.running, "result %d, version %u",
+             ack.result, ack.applied);
+    SN_CHECK(s_stub_configures == configures + 2);
+    SN_CHECK(set.config_version == (uint16_t)kept && set.channel_mask == 0x00ff, "set under version %u, mask 0x%04x",
+             set.config_version, set.channel_mask);
+
+    /* the previous one cannot be restored either: sampling stops */
+    s_stub_reject = 0xffff;
+    ack = reconfigure(1000, 0x0003, 40, &version);
+    set = next_set();
+    SN_CHECK(ack.result == ESP_ERR_NOT_SUPPORTED && ack.applied == kept && !ack.running);
+    SN_CHECK(set.channel_count == 0, "set %u pushed while stopped", set.index);
+    s_stub_reject = 0;
+}
+
+int main(int argc, char **argv)
+{
+    sn_test_init(argc, argv);
+    test_ring_overrun();
+    test_ring_concurrent();
+    test_sampler();
+    test_reconfigure();
+    return sn_test_done("test_sampler");
+}
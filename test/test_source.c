@@ -0,0 +1,202 @@
+/* Synthetic source: shapes, frequencies, range and determinism, plus the
+   cost of generating 16-channel sets.
+
+   I2S ADC source over the I2S stand-in, which swaps the halves of every
+   32-bit DMA word: with an odd channel count a swapped pair straddles two
+   scans, and every set must still hold the conversions of one scan, in
+   order, whatever the block sizes. Sets are stamped from the start of
+   the stream, however late the reads return. After words are dropped the
+   source must count the broken set as missed and resume at the next whole
+   scan, with stamps that still only move forward.
+*/
+
+#include <string.h>
+#include "esp_timer.h"
+#include "driver/i2s.h"
+#include "sn_source_hw.h"
+#include "sn_test.h"
+
+#define RATE_HZ     1000
+#define BASE_HZ     10
+#define START_US    1000000000
+#define LATE_US     5000000     /* reads return this long after the start, as with DMA buffers queued */
+
+/* Upward crossings of the midpoint over count sets of one channel. */
+static uint32_t crossings(const uint16_t *samples, uint32_t count, uint8_t stride)
+{
+    uint32_t n = 0;
+
+    for (uint32_t k = 1; k < count; k++) {
+        n += samples[(k - 1) * stride] < 2048 && samples[k * stride] >= 2048;
+    }
+    return n;
+}
+
+static void test_waveforms(sn_source_t *src)
+{
+    static uint16_t first[RATE_HZ * 4];
+    sn_sample_block_t block;
+    uint32_t got = 0;
+
+    SN_CHECK(sn_source_configure(src, 0x000f, RATE_HZ) == ESP_OK);
+    SN_CHECK(src->channel_mask == 0x000f && src->rate_hz == RATE_HZ && !src->self_paced);
+    while (got < RATE_HZ) {
+        SN_CHECK(sn_source_read_block(src, RATE_HZ - got, &block, 0) == ESP_OK);
+        SN_CHECK(block.count > 0 && block.count <= RATE_HZ - got);
+        SN_CHECK(block.period_us == 1000000 / RATE_HZ && block.timestamp_us == 0);
+        SN_CHECK(block.format == SN_SAMPLE_FORMAT_RAW);
+        memcpy(&first[got * 4], block.samples, block.count * 4 * sizeof(uint16_t));
+        got += block.count;
+    }
+
+    /* one second: channel n completes (n + 1) * BASE_HZ cycles */
+    for (uint8_t ch = 0; ch < 4; ch++) {
+        uint32_t n = crossings(&first[ch], RATE_HZ, 4);
+        SN_CHECK(n >= (ch + 1) * BASE_HZ - 1 && n <= (ch + 1) * BASE_HZ, "channel %u crosses %u times", ch, n);
+    }
+    for (uint32_t i = 0; i < RATE_HZ * 4; i++) {
+        SN_CHECK(first[i] >= 48 && first[i] <= 4048, "sample %u is %u", i, first[i]);
+    }
+    /* channel 2 is a square wave of two levels */
+    for (uint32_t k = 0; k < RATE_HZ; k++) {
+        uint16_t v = first[k * 4 + 2];
+        SN_CHECK(v == 48 || v == 4048, "square reads %u", v);
+    }
+
+    /* reconfiguring restarts the same stream */
+    SN_CHECK(sn_source_configure(src, 0x000f, RATE_HZ) == ESP_OK);
+    SN_CHECK(sn_source_read_block(src, 64, &block, 0) == ESP_OK);
+    SN_CHECK(memcmp(block.samples, first, block.count * 4 * sizeof(uint16_t)) == 0);
+
+    /* a sparse mask keeps each channel's own frequency */
+    SN_CHECK(sn_source_configure(src, 0x8001, RATE_HZ) == ESP_OK);
+    got = 0;
+    while (got < RATE_HZ) {
+        SN_CHECK(sn_source_read_block(src, RATE_HZ - got, &block, 0) == ESP_OK);
+        memcpy(&first[got * 2], block.samples, block.count * 2 * sizeof(uint16_t));
+        got += block.count;
+    }
+    SN_CHECK(crossings(&first[0], RATE_HZ, 2) >= BASE_HZ - 1);
+    SN_CHECK(crossings(&first[1], RATE_HZ, 2) >= 16 * BASE_HZ - 1, "channel 15 is a ramp at 160 hz");
+
+    SN_CHECK(sn_source_configure(src, 0, RATE_HZ) == ESP_ERR_INVALID_ARG);
+    SN_CHECK(sn_source_configure(src, 0x0001, 0) == ESP_ERR_INVALID_ARG);
+}
+
+static void test_throughput(sn_source_t *src)
+{
+    sn_sample_block_t block;
+    uint64_t sets = 0;
+    uint32_t sum = 0;
+    double seconds = sn_test_bench ? 2 : 0.3;
+
+    SN_CHECK(sn_source_configure(src, 0xffff, 2000) == ESP_OK);
+    double start = sn_test_seconds();
+    while (sn_test_seconds() - start < seconds) {
+        for (int i = 0; i < 100; i++) {
+            sn_source_read_block(src, 64, &block, 0);
+            sum += block.samples[block.count * 16 - 1];
+            sets += block.count;
+        }
+    }
+    double elapsed = sn_test_seconds() - start;
+    SN_CHECK(sum != 0);
+    sn_test_metric("synth", "16-channel sets", sets / elapsed, "/s");
+}
+
+/* Read sets sets from the I2S source in blocks of varying size. scan is the scan the next set must come from; after
+   a drop the sets may skip the few scans that were dropped, wherever the drop fell among the words read ahead. */
+static void read_scans(sn_source_t *src, const uint8_t *sequence, uint8_t channels, uint32_t sets, uint32_t *scan,
+                       bool dropped)
+{
+    static const uint32_t block_sets[] = { 1, 2, 5, 32, 3, 64, 7 };
+    sn_sample_block_t block;
+    uint32_t got = 0;
+    uint32_t skip = dropped ? 4 : 0;
+    uint32_t missed = src->missed;
+    int64_t last_us = 0;
+
+    for (int i = 0; got < sets; i++) {
+        uint32_t want = block_sets[i % (sizeof(block_sets) / sizeof(block_sets[0]))];
+        esp_err_t err = sn_source_read_block(src, want, &block, 0);
+        if (err == ESP_ERR_TIMEOUT && skip > 0) {
+            continue;   /* the words left of a broken scan make no set */
+        }
+        SN_CHECK(err == ESP_OK && block.count > 0 && block.count <= want, "%u sets for %u: %s", block.count, want,
+                 esp_err_to_name(err));
+        for (uint32_t n = 0; n < block.count; n++, got++) {
+            const uint16_t *set = block.samples + n * channels;
+            while (skip > 0 && set[0] != sn_host_i2s_conversion(*scan, sequence[0])) {
+                (*scan)++;
+                skip--;
+            }
+            for (uint8_t c = 0; c < channels; c++) {
+                uint16_t expected = sn_host_i2s_conversion(*scan, sequence[c]);
+                SN_CHECK(set[c] == expected, "mask 0x%02x set %u channel %u reads %u, scan %u has %u",
+                         src->channel_mask, got, sequence[c], set[c], *scan, expected);
+            }
+            int64_t stamp_us = block.timestamp_us + (int64_t)n * block.period_us;
+            if (!dropped) {
+                SN_CHECK(stamp_us == START_US + (int64_t)*scan * block.period_us, "scan %u stamped %lld", *scan,
+                         (long long)(stamp_us - START_US));
+            } else if (last_us != 0 && n == 0 && src->missed != missed) {
+                SN_CHECK(stamp_us > last_us && stamp_us <= START_US + LATE_US, "scan %u stamped %lld after %lld",
+                         *scan, (long long)(stamp_us - START_US), (long long)(last_us - START_US));
+            } else if (last_us != 0) {
+                SN_CHECK(stamp_us == last_us + block.period_us, "scan %u stamped %lld after %lld", *scan,
+                         (long long)(stamp_us - START_US), (long long)(last_us - START_US));
+            }
+            last_us = stamp_us;
+            (*scan)++;
+        }
+        missed = src->missed;
+    }
+}
+
+static void test_i2s(void)
+{
+    static const struct {
+        uint16_t mask;
+        uint8_t sequence[8];
+    } masks[] = {
+        { 0x0b, { 0, 1, 3 } },
+        { 0x01, { 0 } },
+        { 0xe0, { 5, 6, 7 } },
+        { 0x1f, { 0, 1, 2, 3, 4 } },
+        { 0xff, { 0, 1, 2, 3, 4, 5, 6, 7 } },
+    };
+    sn_source_t *src = sn_source_i2s_adc(ADC_ATTEN_DB_11);
+
+    SN_CHECK(src->self_paced && src->supported_mask == 0xff && src->sample_bits == 12);
+    for (size_t m = 0; m < sizeof(masks) / sizeof(masks[0]); m++) {
+        uint8_t channels = __builtin_popcount(masks[m].mask);
+        uint32_t scan = 0;
+
+        SN_CHECK(sn_source_configure(src, masks[m].mask, 1000) == ESP_OK);
+        sn_host_timer_now_us = START_US;
+        SN_CHECK(sn_source_start(src) == ESP_OK);
+        sn_host_timer_now_us = START_US + LATE_US;
+        src->missed = 0;
+        read_scans(src, masks[m].sequence, channels, 500, &scan, false);
+        SN_CHECK(src->missed == 0, "mask 0x%02x: %u missed", masks[m].mask, src->missed);
+
+        /* a dropped DMA buffer that does not end on a scan */
+        sn_host_i2s_drop = 2 * channels + 2;
+        read_scans(src, masks[m].sequence, channels, 500, &scan, true);
+        SN_CHECK(channels == 1 || src->missed == 1, "mask 0x%02x: %u missed after a drop", masks[m].mask,
+                 src->missed);
+        SN_CHECK(sn_source_stop(src) == ESP_OK);
+    }
+    sn_host_timer_now_us = 0;
+}
+
+int main(int argc, char **argv)
+{
+    sn_test_init(argc, argv);
+    sn_source_t *src = sn_source_synth(BASE_HZ);
+    SN_CHECK(sn_source_open(src) == ESP_OK);
+    test_waveforms(src);
+    test_throughput(src);
+    test_i2s();
+    return sn_test_done("test_source");
+}
@@ -0,0 +1,317 @@
+/* SPI ADC source over the mock bus on the host.
+
+   The ADS7953 is read on the timer: every set must decode the scripted
+   conversions in order through the two-frame pipeline, its frames must
+   take the bus time sclk_hz allows, and decoding must keep far ahead of
+   the sample rate. The AD7606 is read at data-ready edges raised at
+   explicit times, some late, early or bunched: every edge must yield its
+   set, every set must be stamped at most half a period before its edge
+   and never after it, and stamps must keep increasing.
+
+   Bus errors must come back as they are: a wait that fails is returned by
+   the read, the rest of the set is collected, and the following sets stay
+   in step, even when the bus gives a transfer back only on the next set.
+   An error after some sets of a block comes back with the next read.
+*/
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "sn_source_spi.h"
+#include "sn_test.h"
+
+#define SCRIPT_SETS     64
+#define SCLK_HZ         20000000
+#define RATE_HZ         2000
+#define EDGE_RATE_HZ    1000
+#define DRDY_GPIO       4
+#define CONVST_GPIO     5
+#define TIMEOUT_MS      50
+
+static uint16_t s_script[SCRIPT_SETS * SN_MAX_CHANNELS];
+static sn_spi_mock_t s_mock;
+
+static uint16_t script_sample(const sn_spi_adc_chip_t *chip, uint32_t row, uint8_t ch)
+{
+    return s_script[(row % SCRIPT_SETS) * chip->channels + ch];
+}
+
+static sn_source_t *spi_source(const sn_spi_adc_chip_t *chip, int drdy_gpio, int convst_gpio)
+{
+    sn_spi_adc_config_t config = {
+        .chip = chip,
+        .drdy_gpio = drdy_gpio,
+        .convst_gpio = convst_gpio,
+    };
+    uint16_t mask = (uint16_t)((1u << chip->sample_bits) - 1);
+
+    for (uint32_t i = 0; i < SCRIPT_SETS * chip->channels; i++) {
+        s_script[i] = (uint16_t)((i * 2654435761u) >> 16) & mask;
+    }
+    sn_spi_mock_init(&s_mock, chip, s_script, SCRIPT_SETS, SCLK_HZ, &config.bus);
+    return sn_source_spi_adc(&config);
+}
+
+/* Conversion of channel ch that set k of a sequenced chip reads: the flush frames at the end of each set
+   select the first pipeline channels again, so those are converted twice per set after the first. */
+static uint32_t sequenced_row(const sn_spi_adc_chip_t *chip, uint16_t mask, uint32_t k, uint8_t ch)
+{
+    uint8_t before = __builtin_popcount(mask & ((1u << ch) - 1));
+
+    return before < chip->pipeline ? 2 * k : k;
+}
+
+/* Read count sets one at a time, checking each against the script; false at the first mismatch. */
+static bool read_sequenced(sn_source_t *src, uint16_t mask, uint32_t *k, uint32_t count)
+{
+    const sn_spi_adc_chip_t *chip = sn_spi_adc_ads7953();
+    sn_sample_block_t block;
+
+    for (uint32_t n = 0; n < count; n++, (*k)++) {
+        esp_err_t err = sn_source_read_block(src, 1, &block, TIMEOUT_MS);
+        if (err != ESP_OK || block.count != 1) {
+            SN_CHECK(false, "set %u: %s", *k, esp_err_to_name(err));
+            return false;
+        }
+        uint8_t i = 0;
+        for (uint8_t ch = 0; ch < chip->channels; ch++) {
+            if ((mask & (1 << ch)) == 0) {
+                continue;
+            }
+            uint16_t expected = script_sample(chip, sequenced_row(chip, mask, *k, ch), ch);
+            if (block.samples[i] != expected) {
+                SN_CHECK(false, "set %u channel %u reads %u, expected %u", *k, ch, block.samples[i], expected);
+                return false;
+            }
+            i++;
+        }
+    }
+    return true;
+}
+
+static void test_sequenced(void)
+{
+    const sn_spi_adc_chip_t *chip = sn_spi_adc_ads7953();
+    sn_source_t *src = spi_source(chip, -1, -1);
+    uint32_t sets = sn_test_bench ? 2000000 : 200000;
+    uint32_t k = 0;
+
+    SN_CHECK(!src->self_paced && src->supported_mask == 0xffff && src->sample_bits == 12);
+    SN_CHECK(sn_source_open(src) == ESP_OK);
+    SN_CHECK(sn_source_configure(src, 0xffff, 60000) == ESP_ERR_INVALID_ARG, "18 frames at 60 khz is too fast");
+    SN_CHECK(sn_source_configure(src, 0xffff, RATE_HZ) == ESP_OK);
+    SN_CHECK(sn_source_start(src) == ESP_OK);
+
+    double start = sn_test_seconds();
+    int64_t bus_start_us = s_mock.clock_us;
+    read_sequenced(src, 0xffff, &k, sets);
+    double elapsed = sn_test_seconds() - start;
+
+    /* 16 result frames plus 2 flushing the pipeline, each 16 bits at 20 MHz rounded up to 1 us */
+    uint32_t frames_per_set = chip->channels + chip->pipeline;
+    double bus_us = (double)(s_mock.clock_us - bus_start_us) / sets;
+    SN_CHECK(s_mock.frames == sets * frames_per_set, "%u frames for %u sets", s_mock.frames, sets);
+    SN_CHECK(bus_us == frames_per_set, "%.1f us of bus time per set", bus_us);
+    SN_CHECK(sets / elapsed > 10 * RATE_HZ, "%.0f sets/s decoded", sets / elapsed);
+    sn_test_metric("spi", "bus time per 16-channel set", bus_us, "us");
+    sn_test_metric("spi", "bus load at 2 khz", bus_us * RATE_HZ / 1e4, "%");
+    sn_test_metric("spi", "sets", sets / elapsed, "/s");
+    sn_test_metric("spi", "samples", sets * chip->channels / elapsed, "/s");
+
+    /* a sparse mask flushes with its own first channels */
+    src = spi_source(chip, -1, -1);
+    SN_CHECK(sn_source_configure(src, 0x00a5, RATE_HZ) == ESP_OK);
+    k = 0;
+    read_sequenced(src, 0x00a5, &k, 1000);
+    SN_CHECK(s_mock.frames == 1000 * (4 + chip->pipeline));
+    SN_CHECK(sn_source_stop(src) == ESP_OK);
+}
+
+static void test_bus_errors(void)
+{
+    const sn_spi_adc_chip_t *chip = sn_spi_adc_ads7953();
+    sn_source_t *src = spi_source(chip, -1, -1);
+    sn_sample_block_t block;
+    uint32_t k = 0;
+
+    SN_CHECK(sn_source_configure(src, 0x000f, RATE_HZ) == ESP_OK);
+    SN_CHECK(sn_source_start(src) == ESP_OK);
+    read_sequenced(src, 0x000f, &k, 3);
+
+    /* the third frame times out once: the read says so and the rest of the set is collected */
+    s_mock.fail_after = 2;
+    s_mock.fail_count = 1;
+    s_mock.fail_err = ESP_ERR_TIMEOUT;
+    SN_CHECK(sn_source_read_block(src, 1, &block, TIMEOUT_MS) == ESP_ERR_TIMEOUT);
+    SN_CHECK(s_mock.done_count == 0, "%u transfers left queued", s_mock.done_count);
+    k++;
+    read_sequenced(src, 0x000f, &k, 20);
+
+    /* collecting the rest fails too: the transfers left are collected before the next set is queued */
+    s_mock.fail_after = 2;
+    s_mock.fail_count = 2;
+    SN_CHECK(sn_source_read_block(src, 1, &block, TIMEOUT_MS) == ESP_ERR_TIMEOUT);
+    SN_CHECK(s_mock.done_count == 4, "%u transfers left queued", s_mock.done_count);
+    k++;
+    read_sequenced(src, 0x000f, &k, 20);
+
+    /* a bus that keeps failing: every read returns its error, then the source recovers */
+    s_mock.fail_after = 0;
+    s_mock.fail_count = 100;
+    s_mock.fail_err = ESP_ERR_INVALID_STATE;
+    for (int i = 0; i < 3; i++) {
+        SN_CHECK(sn_source_read_block(src, 1, &block, TIMEOUT_MS) == ESP_ERR_INVALID_STATE);
+    }
+    SN_CHECK(sn_source_configure(src, 0x000f, RATE_HZ) == ESP_ERR_INVALID_STATE,
+             "the transfers must be collected before they are rebuilt");
+    s_mock.fail_count = 0;
+    SN_CHECK(sn_source_configure(src, 0x000f, RATE_HZ) == ESP_OK);
+    SN_CHECK(s_mock.done_count == 0);
+    /* the one set whose queueing reached the mock was converted */
+    k++;
+    read_sequenced(src, 0x000f, &k, 20);
+    SN_CHECK(sn_source_stop(src) == ESP_OK);
+}
+
+/* Data-ready edges at explicit times, from their own thread. Each edge is raised once the set of the one before
+   has been transferred, so none is missed and the test does not depend on how the threads are scheduled. The gaps
+   between edges cycle through on-period, jittered, late, early, bunched and drifting ones. */
+#define EDGE_PERIOD_US  (1000000 / EDGE_RATE_HZ)
+#define MAX_EDGES       (10 * EDGE_RATE_HZ)
+
+static const uint32_t s_gaps_us[] = {
+    1000, 1000, 1000, 990, 1010, 1000, 1400, 1000, 2500, 1000, 1000, 300, 1000, 1000,
+    600, 600, 600, 1000, 1000, 1450, 550, 1000, 1000, 1000,
+};
+static int64_t s_edge_us[MAX_EDGES];
+static uint32_t s_edge_count;
+
+static void *edge_thread(void *arg)
+{
+    uint32_t frames = __atomic_load_n(&s_mock.frames, __ATOMIC_ACQUIRE);
+
+    for (uint32_t i = 0; i < s_edge_count; i++) {
+        while (__atomic_load_n(&s_mock.frames, __ATOMIC_ACQUIRE) < frames + i) {
+            usleep(20);
+        }
+        sn_host_gpio_edge_at(DRDY_GPIO, s_edge_us[i]);
+    }
+    return NULL;
+}
+
+static void start_edges(uint32_t count)
+{
+    pthread_t thread;
+
+    s_edge_us[0] = 1000000;
+    for (uint32_t i = 1; i < count; i++) {
+        s_edge_us[i] = s_edge_us[i - 1] + s_gaps_us[i % (sizeof(s_gaps_us) / sizeof(s_gaps_us[0]))];
+    }
+    s_edge_count = count;
+    pthread_create(&thread, NULL, edge_thread, NULL);
+    pthread_detach(thread);
+}
+
+static void test_simultaneous(void)
+{
+    const sn_spi_adc_chip_t *chip = sn_spi_adc_ad7606();
+    sn_source_t *src = spi_source(chip, DRDY_GPIO, CONVST_GPIO);
+    uint32_t edges = sn_test_bench ? MAX_EDGES : EDGE_RATE_HZ;
+    sn_sample_block_t block;
+    uint32_t sets = 0;
+    uint32_t blocks = 0;
+    int64_t last_us = 0;
+    double deadline = sn_test_seconds() + 10;
+
+    SN_CHECK(src->self_paced && src->supported_mask == 0x00ff && src->sample_bits == 16);
+    SN_CHECK(sn_source_open(src) == ESP_OK);
+    SN_CHECK(sn_source_configure(src, 0x00ff, EDGE_RATE_HZ) == ESP_OK);
+    SN_CHECK(sn_host_ledc_freq_hz == EDGE_RATE_HZ && !sn_host_ledc_running);
+    SN_CHECK(sn_source_start(src) == ESP_OK);
+    SN_CHECK(sn_host_ledc_running, "CONVST runs once started");
+
+    src->missed = 0;
+    start_edges(edges);
+    while (sets < edges && sn_test_seconds() < deadline) {
+        esp_err_t err = sn_source_read_block(src, 32, &block, TIMEOUT_MS);
+        if (err == ESP_ERR_TIMEOUT) {
+            continue;
+        }
+        if (err != ESP_OK) {
+            SN_CHECK(false, "read: %s", esp_err_to_name(err));
+            break;
+        }
+        SN_CHECK(block.period_us == EDGE_PERIOD_US && block.count > 0 && sets + block.count <= edges);
+        for (uint32_t n = 0; n < block.count && sets < edges; n++, sets++) {
+            int64_t stamp_us = block.timestamp_us + (int64_t)n * block.period_us;
+            int64_t late_us = s_edge_us[sets] - stamp_us;
+            SN_CHECK(stamp_us > last_us, "set %u stamped %lld after %lld", sets, (long long)stamp_us,
+                     (long long)last_us);
+            SN_CHECK(late_us >= 0 && late_us <= EDGE_PERIOD_US / 2, "set %u taken %lld us after its stamp", sets,
+                     (long long)late_us);
+            for (uint8_t ch = 0; ch < chip->channels; ch++) {
+                uint16_t sample = block.samples[n * chip->channels + ch];
+                SN_CHECK(sample == script_sample(chip, sets, ch), "set %u channel %u reads %u", sets, ch, sample);
+            }
+            last_us = stamp_us;
+        }
+        blocks++;
+    }
+    SN_CHECK(sets == edges && src->missed == 0, "%u sets and %u missed of %u edges", sets, src->missed, edges);
+    SN_CHECK(sn_source_stop(src) == ESP_OK && !sn_host_ledc_running);
+    sn_test_metric("spi", "sets per block", blocks ? (double)sets / blocks : 0, "");
+}
+
+static void test_block_errors(void)
+{
+    const sn_spi_adc_chip_t *chip = sn_spi_adc_ad7606();
+    sn_source_t *src = spi_source(chip, DRDY_GPIO, CONVST_GPIO);
+    sn_sample_block_t block;
+    uint32_t before = 0;
+    uint32_t after = 0;
+    int errors = 0;
+    double deadline = sn_test_seconds() + 5;
+
+    SN_CHECK(sn_source_configure(src, 0x00ff, EDGE_RATE_HZ) == ESP_OK);
+    SN_CHECK(sn_source_start(src) == ESP_OK);
+    s_mock.fail_after = 2;
+    s_mock.fail_count = 1;
+    s_mock.fail_err = ESP_FAIL;
+
+    /* the first two sets go through, the third set's transfer fails */
+    src->missed = 0;
+    start_edges(20);
+    while (before + after + errors < 20 && sn_test_seconds() < deadline) {
+        esp_err_t err = sn_source_read_block(src, 32, &block, TIMEOUT_MS);
+        if (err == ESP_ERR_TIMEOUT) {
+            continue;
+        }
+        if (err != ESP_OK) {
+            SN_CHECK(err == ESP_FAIL, "read: %s", esp_err_to_name(err));
+            errors++;
+            continue;
+        }
+        if (errors == 0) {
+            before += block.count;
+        } else {
+            after += block.count;
+        }
+    }
+    SN_CHECK(errors == 1 && before == 2 && after == 17 && src->missed == 0, "%u sets, %d errors, %u sets, %u missed",
+             before, errors, after, src->missed);
+    SN_CHECK(sn_source_stop(src) == ESP_OK);
+}
+
+int main(int argc, char **argv)
+{
+    sn_test_init(argc, argv);
+    /* the source is a singleton that sets up its data-ready interrupt on the first open */
+    test_simultaneous();
+    test_block_errors();
+    test_sequenced();
+    test_bus_errors();
+    return sn_test_done("test_spi");
+}
@@ -0,0 +1,330 @@
+/* Spill log on a file-backed NOR flash image the size of the spill partition.
+
+   Checks in-order draining with writes interleaved, how much of the
+   partition holds frames and how many bytes are programmed per frame byte,
+   that erases stay even across sectors when the log wraps, recovery after a
+   reset and after a power cut part way through a record, and that a corrupt
+   record is counted out of the pending total exactly once, whether its
+   sector is later dropped by a wrap or rescanned after a reset.
+*/
+
+#include <string.h>
+#include "esp_log.h"
+#include "sn_spill.h"
+#include "sn_test.h"
+#include "sn_test_flash.h"
+
+#define PARTITION_SIZE  0xF0000     /* partitions.csv */
+#define SECTOR_SIZE     4096
+#define FRAME_LEN       664         /* 16 channels x 20 sets of 16 bits plus the header */
+
+static sn_test_flash_t s_flash;
+static uint8_t s_buf[SECTOR_SIZE];
+
+/* Record seq: its length follows from seq, then seq and a byte pattern seeded by it. */
+static size_t record_len(uint32_t seq, size_t fixed)
+{
+    return fixed != 0 ? fixed : 8 + (seq * 2654435761u >> 16) % 900;
+}
+
+static size_t make_record(uint32_t seq, size_t fixed, uint8_t *buf)
+{
+    size_t len = record_len(seq, fixed);
+    uint32_t x = seq | 1;
+
+    memcpy(buf, &seq, sizeof(seq));
+    for (size_t i = sizeof(seq); i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buf[i] = (uint8_t)x;
+    }
+    return len;
+}
+
+/* Seq of the record in buf, or UINT32_MAX if its contents do not match. */
+static uint32_t record_seq(const uint8_t *buf, size_t len, size_t fixed)
+{
+    static uint8_t expected[SECTOR_SIZE];
+    uint32_t seq;
+
+    if (len < sizeof(seq)) {
+        return UINT32_MAX;
+    }
+    memcpy(&seq, buf, sizeof(seq));
+    if (len != record_len(seq, fixed) || make_record(seq, fixed, expected) != len || memcmp(buf, expected, len) != 0) {
+        return UINT32_MAX;
+    }
+    return seq;
+}
+
+static void reset_flash(size_t size)
+{
+    if (s_flash.sector_erases != NULL) {
+        sn_test_flash_close(&s_flash);
+    }
+    sn_test_flash_open(&s_flash, size, SECTOR_SIZE);
+    SN_CHECK(sn_spill_init(&s_flash.flash) == ESP_OK);
+}
+
+/* Drain everything; checks records come out as first, first + 1, ... and returns how many did. */
+static uint32_t drain_all(uint32_t first, size_t fixed)
+{
+    uint32_t n = 0;
+    size_t len;
+
+    while ((len = sn_spill_peek(s_buf, sizeof(s_buf))) > 0) {
+        uint32_t seq = record_seq(s_buf, len, fixed);
+        if (seq != first + n) {
+            SN_CHECK(false, "drained record %u, expected %u", seq, first + n);
+            return n;
+        }
+        SN_CHECK(sn_spill_consume() == ESP_OK);
+        n++;
+    }
+    return n;
+}
+
+/* Stats restart at sn_spill_init(), which found recovered records pending. */
+static void check_accounting(uint32_t recovered)
+{
+    sn_spill_stats_t stats;
+
+    sn_spill_get_stats(&stats);
+    SN_CHECK(stats.records_pending == recovered + stats.records_written - stats.records_drained -
+             stats.records_dropped - stats.records_corrupt,
+             "%u pending of %u recovered, %u written, %u drained, %u dropped, %u corrupt", stats.records_pending,
+             recovered, stats.records_written, stats.records_drained, stats.records_dropped, stats.records_corrupt);
+}
+
+static void test_interleaved(void)
+{
+    uint32_t written = 0;
+    uint32_t drained = 0;
+    sn_spill_stats_t stats;
+
+    reset_flash(16 * SECTOR_SIZE);
+    SN_CHECK(sn_spill_peek(s_buf, sizeof(s_buf)) == 0);
+    SN_CHECK(sn_spill_consume() == ESP_ERR_INVALID_STATE);
+    for (int i = 0; i < 20000; i++) {
+        /* writes outpace drains until 40 are pending, then drains catch up */
+        if (written - drained < 40 && (sn_test_rand() % 3 != 0 || written == drained)) {
+            size_t len = make_record(written, 0, s_buf);
+            SN_CHECK(sn_spill_write(s_buf, len) == ESP_OK);
+            written++;
+        } else {
+            size_t len = sn_spill_peek(s_buf, sizeof(s_buf));
+            SN_CHECK(record_seq(s_buf, len, 0) == drained, "peeked %u, expected %u", record_seq(s_buf, len, 0),
+                     drained);
+            SN_CHECK(sn_spill_peek(s_buf, sizeof(s_buf)) == len, "peek again returns the same record");
+            SN_CHECK(sn_spill_consume() == ESP_OK);
+            drained++;
+        }
+        if (sn_test_failures > 10) {
+            return;
+        }
+    }
+    drained += drain_all(drained, 0);
+    sn_spill_get_stats(&stats);
+    SN_CHECK(drained == written && stats.records_pending == 0 && stats.records_dropped == 0);
+    SN_CHECK(stats.records_written == written && stats.records_drained == drained);
+    SN_CHECK(s_flash.violations == 0, "%llu bits programmed from 0 to 1", (unsigned long long)s_flash.violations);
+    SN_CHECK(sn_spill_write(s_buf, 0) == ESP_ERR_INVALID_SIZE);
+    SN_CHECK(sn_spill_write(s_buf, sn_spill_max_record() + 1) == ESP_ERR_INVALID_SIZE);
+}
+
+/* Fill the partition with frames until the log has wrapped it four times over. */
+static void test_capacity_and_wear(void)
+{
+    uint32_t written = 0;
+    uint32_t first_dropped_at = 0;
+    sn_spill_stats_t stats;
+
+    reset_flash(PARTITION_SIZE);
+    int log_level = sn_host_log_level;
+    sn_host_log_level = ESP_LOG_ERROR;      /* one warning per wrap */
+    for (;;) {
+        size_t len = make_record(written, FRAME_LEN, s_buf);
+        SN_CHECK(sn_spill_write(s_buf, len) == ESP_OK);
+        written++;
+        sn_spill_get_stats(&stats);
+        if (first_dropped_at == 0 && stats.records_dropped > 0) {
+            first_dropped_at = written;
+        }
+        if (stats.sector_erases >= 4 * PARTITION_SIZE / SECTOR_SIZE) {
+            break;
+        }
+    }
+    sn_host_log_level = log_level;
+    sn_spill_get_stats(&stats);
+    check_accounting(0);
+    SN_CHECK(stats.flash_bytes == s_flash.bytes_written);
+    SN_CHECK(s_flash.violations == 0);
+
+    /* the full partition less the sector being reused */
+    uint32_t per_sector = (SECTOR_SIZE - 8) / (8 + FRAME_LEN);
+    uint32_t capacity = (PARTITION_SIZE / SECTOR_SIZE - 1) * per_sector;
+    SN_CHECK(stats.records_pending >= capacity && stats.records_pending <= capacity + per_sector,
+             "%u frames held, expected %u", stats.records_pending, capacity);
+    SN_CHECK(first_dropped_at >= capacity + per_sector, "dropped from frame %u", first_dropped_at);
+
+    uint32_t min, max;
+    sn_test_flash_wear(&s_flash, &min, &max);
+    SN_CHECK(max - min <= 1, "sector erases range from %u to %u", min, max);
+
+    double amplification = (double)stats.flash_bytes / stats.payload_bytes;
+    SN_CHECK(amplification < 1.03, "%.3f bytes programmed per frame byte", amplification);
+    sn_test_metric("spill", "frames held", stats.records_pending, "");
+    sn_test_metric("spill", "partition holding frames", 100.0 * stats.records_pending * FRAME_LEN / PARTITION_SIZE, "%");
+    sn_test_metric("spill", "offline time at 2 kHz x 16 ch", stats.records_pending * 20 / 2000.0, "s");
+    sn_test_metric("spill", "write amplification", amplification, "");
+    sn_test_metric("spill", "erases per sector", max, "");
+
+    uint32_t pending = stats.records_pending;
+    SN_CHECK(drain_all(written - pending, FRAME_LEN) == pending, "the newest frames survive, in order");
+    check_accounting(0);
+}
+
+static void test_reset_recovery(void)
+{
+    sn_spill_stats_t stats;
+
+    reset_flash(16 * SECTOR_SIZE);
+    for (uint32_t seq = 0; seq < 60; seq++) {
+        size_t len = make_record(seq, 0, s_buf);
+        SN_CHECK(sn_spill_write(s_buf, len) == ESP_OK);
+    }
+    for (uint32_t seq = 0; seq < 25; seq++) {
+        SN_CHECK(record_seq(s_buf, sn_spill_peek(s_buf, sizeof(s_buf)), 0) == seq);
+        SN_CHECK(sn_spill_consume() == ESP_OK);
+    }
+    sn_spill_peek(s_buf, sizeof(s_buf));    /* peeked but not consumed: stays pending */
+
+    SN_CHECK(sn_spill_init(&s_flash.flash) == ESP_OK);
+    sn_spill_get_stats(&stats);
+    SN_CHECK(stats.records_pending == 35, "%u pending after reset", stats.records_pending);
+    for (uint32_t seq = 60; seq < 70; seq++) {
+        size_t len = make_record(seq, 0, s_buf);
+        SN_CHECK(sn_spill_write(s_buf, len) == ESP_OK);
+    }
+    SN_CHECK(drain_all(25, 0) == 45);
+    SN_CHECK(s_flash.violations == 0);
+}
+
+/* Cut the power after the given number of bytes of a record's header and payload. */
+static void test_power_cut(int64_t cut)
+{
+    sn_spill_stats_t stats;
+    uint32_t seq = 0;
+
+    reset_flash(8 * SECTOR_SIZE);
+    for (; seq < 10; seq++) {
+        size_t len = make_record(seq, 0, s_buf);
+        SN_CHECK(sn_spill_write(s_buf, len) == ESP_OK);
+    }
+    s_flash.cut_after = cut;
+    size_t len = make_record(seq++, 0, s_buf);
+    SN_CHECK(sn_spill_write(s_buf, len) != ESP_OK, "cut after %lld bytes", (long long)cut);
+    s_flash.cut_after = -1;
+
+    SN_CHECK(sn_spill_init(&s_flash.flash) == ESP_OK);
+    for (; seq < 20; seq++) {
+        len = make_record(seq, 0, s_buf);
+        SN_CHECK(sn_spill_write(s_buf, len) == ESP_OK);
+    }
+    /* the cut record is lost; everything before and after it drains in order */
+    uint32_t expected = 0;
+    while ((len = sn_spill_peek(s_buf, sizeof(s_buf))) > 0) {
+        uint32_t got = record_seq(s_buf, len, 0);
+        SN_CHECK(got == expected, "drained %u, expected %u, cut at %lld", got, expected, (long long)cut);
+        sn_spill_consume();
+        expected = got == 9 ? 11 : got + 1;
+    }
+    sn_spill_get_stats(&stats);
+    SN_CHECK(expected == 20, "drain stopped before %u, cut at %lld", expected, (long long)cut);
+    SN_CHECK(stats.records_pending == 0 && stats.records_corrupt <= 1, "%u pending, %u corrupt",
+             stats.records_pending, stats.records_corrupt);
+    SN_CHECK(s_flash.violations == 0);
+}
+
+/* A corrupt record the reader has skipped must not be counted again when a wrap drops its sector. */
+static void test_corrupt_then_wrap(bool reset)
+{
+    sn_spill_stats_t stats;
+    uint32_t seq = 0;
+
+    reset_flash(8 * SECTOR_SIZE);
+    for (; seq < 20; seq++) {
+        size_t len = make_record(seq, 0, s_buf);
+        SN_CHECK(sn_spill_write(s_buf, len) == ESP_OK);
+    }
+    /* the first record sits right after the header of sector 0; zero its check */
+    sn_test_flash_clear(&s_flash, 8 + 2, 0xff);
+    sn_test_flash_clear(&s_flash, 8 + 3, 0xff);
+    SN_CHECK(record_seq(s_buf, sn_spill_peek(s_buf, sizeof(s_buf)), 0) == 1, "the corrupt record is skipped");
+    sn_spill_get_stats(&stats);
+    SN_CHECK(stats.records_corrupt == 1 && stats.records_pending == 19);
+    if (reset) {
+        SN_CHECK(sn_spill_init(&s_flash.flash) == ESP_OK);
+        sn_spill_get_stats(&stats);
+        SN_CHECK(stats.records_pending == 19, "%u pending after reset", stats.records_pending);
+        SN_CHECK(record_seq(s_buf, sn_spill_peek(s_buf, sizeof(s_buf)), 0) == 1);
+    }
+
+    /* write until the wrap drops sector 0 */
+    do {
+        size_t len = make_record(seq++, 0, s_buf);
+        SN_CHECK(sn_spill_write(s_buf, len) == ESP_OK);
+        sn_spill_get_stats(&stats);
+    } while (stats.records_dropped == 0);
+    check_accounting(reset ? 19 : 0);
+    uint32_t pending = stats.records_pending;
+    uint32_t first;
+    size_t len = sn_spill_peek(s_buf, sizeof(s_buf));
+    first = record_seq(s_buf, len, 0);
+    SN_CHECK(drain_all(first, 0) == pending && first + pending == seq, "%u pending, drained from %u to %u", pending,
+             first, seq);
+    sn_spill_get_stats(&stats);
+    SN_CHECK(stats.records_pending == 0, "%u still pending", stats.records_pending);
+}
+
+static void test_throughput(void)
+{
+    double seconds = sn_test_bench ? 2 : 0.3;
+    uint64_t bytes = 0;
+    uint32_t seq = 0;
+    uint32_t drained = 0;
+
+    reset_flash(PARTITION_SIZE);
+    double start = sn_test_seconds();
+    while (sn_test_seconds() - start < seconds) {
+        size_t len = make_record(seq++, FRAME_LEN, s_buf);
+        sn_spill_write(s_buf, len);
+        bytes += len;
+    }
+    double write_s = sn_test_seconds() - start;
+    start = sn_test_seconds();
+    while (sn_spill_peek(s_buf, sizeof(s_buf)) > 0) {
+        sn_spill_consume();
+        drained++;
+    }
+    double drain_s = sn_test_seconds() - start;
+    sn_test_metric("spill", "append (file image)", bytes / write_s / 1e6, "MB/s");
+    sn_test_metric("spill", "drain (file image)", drained * FRAME_LEN / drain_s / 1e6, "MB/s");
+}
+
+int main(int argc, char **argv)
+{
+    sn_test_init(argc, argv);
+    test_interleaved();
+    test_capacity_and_wear();
+    test_reset_recovery();
+    for (int64_t cut = 0; cut < 8 + 40; cut += 3) {
+        test_power_cut(cut);
+    }
+    test_corrupt_then_wrap(false);
+    test_corrupt_then_wrap(true);
+    test_throughput();
+    sn_test_flash_close(&s_flash);
+    return sn_test_done("test_spill");
+}
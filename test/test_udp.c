@@ -0,0 +1,252 @@
+/* UDP transport against the reference receiver on the loopback interface.
+
+   Streams numbered frames from the node to sn_udp_rx with no loss as fast
+   as the pool allows, then paced at about 1000 frames/s while the receiver
+   drops 1%, 5% and 20% of what reaches it. Each run reports throughput and
+   the handoff-to-delivery latency of frames that arrived the first time and
+   of those that needed a NACK, and checks that no frame is delivered twice
+   or damaged, that every frame is accounted for as delivered, GONE or lost,
+   and that at moderate loss nearly all of them are recovered. Last, frames
+   lost just before the transport is switched away go back to the pool at
+   once and are answered with GONE after the next heartbeat.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "sn_transport.h"
+#include "sn_udp.h"
+#include "sn_test.h"
+#include "sn_udp_rx.h"
+
+#define POOL_BUFS       8
+#define HISTORY         6
+#define BUF_SIZE        (SN_UDP_HEADER_LEN + SN_UDP_MAX_DATAGRAM)
+#define FRAME_LEN       1000
+#define MAX_FRAMES      400000
+
+typedef struct {
+    uint32_t id;
+    int64_t queued_us;
+} stamp_t;
+
+static uint8_t s_storage[POOL_BUFS * BUF_SIZE];
+static sn_buf_t s_bufs[POOL_BUFS];
+static sn_pool_t s_pool;
+static sn_udp_rx_t s_rx;
+static pthread_mutex_t s_rx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* per frame id, written by the receiver thread */
+static uint8_t *s_seen;
+static double *s_first_us;
+static double *s_resent_us;
+static uint32_t s_first_count;
+static uint32_t s_resent_count;
+static uint32_t s_repeated;
+static uint32_t s_damaged;
+static uint32_t s_next_id;
+
+static void on_frame(const uint8_t *frame, size_t len, uint32_t seq, bool retransmit, void *ctx)
+{
+    double latency_us = esp_timer_get_time();
+    stamp_t stamp;
+
+    if (len != FRAME_LEN) {
+        s_damaged++;
+        return;
+    }
+    memcpy(&stamp, frame, sizeof(stamp));
+    for (size_t i = sizeof(stamp); i < len; i++) {
+        if (frame[i] != (uint8_t)(stamp.id + i)) {
+            s_damaged++;
+            return;
+        }
+    }
+    if (stamp.id >= MAX_FRAMES || s_seen[stamp.id]) {
+        s_repeated++;
+        return;
+    }
+    s_seen[stamp.id] = 1;
+    latency_us -= stamp.queued_us;
+    if (retransmit) {
+        s_resent_us[s_resent_count++] = latency_us;
+    } else {
+        s_first_us[s_first_count++] = latency_us;
+    }
+}
+
+static void *rx_thread(void *arg)
+{
+    for (;;) {
+        pthread_mutex_lock(&s_rx_lock);
+        sn_udp_rx_poll(&s_rx, 2);
+        pthread_mutex_unlock(&s_rx_lock);
+    }
+    return NULL;
+}
+
+static void send_frame(void)
+{
+    sn_buf_t *buf = sn_pool_acquire(&s_pool, pdMS_TO_TICKS(2000));
+    stamp_t stamp = { .id = s_next_id++ };
+
+    SN_CHECK(buf != NULL, "no buffer came back from the transport");
+    if (buf == NULL) {
+        return;
+    }
+    for (size_t i = sizeof(stamp); i < FRAME_LEN; i++) {
+        buf->data[i] = (uint8_t)(stamp.id + i);
+    }
+    buf->len = FRAME_LEN;
+    stamp.queued_us = buf->queued_us = esp_timer_get_time();
+    memcpy(buf->data, &stamp, sizeof(stamp));
+    SN_CHECK(sn_transport_udp()->send(buf) == ESP_OK);
+}
+
+static void run(double loss, uint32_t rate, const char *name)
+{
+    double seconds = sn_test_bench ? 5 : 1;
+    sn_udp_stats_t node_before, node_after;
+    sn_udp_rx_stats_t before, after;
+
+    pthread_mutex_lock(&s_rx_lock);
+    s_rx.loss = loss;
+    before = after = s_rx.stats;
+    s_first_count = s_resent_count = 0;
+    pthread_mutex_unlock(&s_rx_lock);
+    sn_udp_get_stats(&node_before);
+
+    uint32_t first = s_next_id;
+    double start = sn_test_seconds();
+    while (sn_test_seconds() - start < seconds) {
+        send_frame();
+        if (rate > 0) {
+            usleep(1000000 / rate);
+        }
+    }
+    double elapsed = sn_test_seconds() - start;
+    uint32_t sent = s_next_id - first;
+
+    /* frames lost at the end of the run only show up with the next heartbeat */
+    uint32_t settled = 0;
+    for (int i = 0; i < 500 && settled < sent; i++) {
+        usleep(10000);
+        pthread_mutex_lock(&s_rx_lock);
+        after = s_rx.stats;
+        settled = after.frames - before.frames + after.gone - before.gone + after.lost - before.lost;
+        settled = sn_udp_rx_pending(&s_rx) > 0 ? 0 : settled;
+        pthread_mutex_unlock(&s_rx_lock);
+    }
+    sn_udp_get_stats(&node_after);
+
+    uint32_t delivered = 0;
+    for (uint32_t id = first; id < s_next_id; id++) {
+        delivered += s_seen[id];
+    }
+    uint32_t recovered = after.recovered - before.recovered;
+    uint32_t missed = sent - (delivered - recovered);
+    SN_CHECK(s_repeated == 0 && s_damaged == 0 && after.duplicates == before.duplicates,
+             "%u repeated, %u damaged, %u duplicate datagrams", s_repeated, s_damaged,
+             after.duplicates - before.duplicates);
+    SN_CHECK(settled == sent && delivered == after.frames - before.frames,
+             "%u sent, %u delivered, %u gone, %u lost", sent, delivered, after.gone - before.gone,
+             after.lost - before.lost);
+    if (loss == 0) {
+        SN_CHECK(delivered == sent && node_after.retransmitted == node_before.retransmitted);
+    } else {
+        SN_CHECK(node_after.retransmitted > node_before.retransmitted && recovered > 0);
+    }
+    if (loss <= 0.05) {
+        SN_CHECK(delivered >= sent - sent / 50, "%u of %u frames delivered at %.0f%% loss", delivered, sent,
+                 loss * 100);
+    }
+    sn_test_metric(name, "frames", sent / elapsed, "/s");
+    sn_test_metric(name, "payload", (double)sent * FRAME_LEN / elapsed / 1e6, "MB/s");
+    sn_test_metric(name, "delivered", 100.0 * delivered / sent, "%");
+    sn_test_metric(name, "recovered", missed ? 100.0 * recovered / missed : 100, "% of missed");
+    sn_test_metric(name, "latency p50", sn_test_percentile(s_first_us, s_first_count, 50), "us");
+    sn_test_metric(name, "latency p99", sn_test_percentile(s_first_us, s_first_count, 99), "us");
+    if (s_resent_count > 0) {
+        sn_test_metric(name, "recovered latency p50", sn_test_percentile(s_resent_us, s_resent_count, 50), "us");
+        sn_test_metric(name, "recovered latency p99", sn_test_percentile(s_resent_us, s_resent_count, 99), "us");
+    }
+}
+
+static void test_detach(void)
+{
+    sn_udp_stats_t node;
+    sn_udp_rx_stats_t before, after;
+
+    pthread_mutex_lock(&s_rx_lock);
+    s_rx.loss = 1;
+    before = after = s_rx.stats;
+    pthread_mutex_unlock(&s_rx_lock);
+    sn_udp_get_stats(&node);
+    uint32_t sent = node.sent;
+    send_frame();
+    send_frame();
+    for (int i = 0; i < 100 && node.sent - sent < 2; i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        sn_udp_get_stats(&node);
+    }
+    SN_CHECK(node.sent - sent == 2 && sn_pool_available(&s_pool) == POOL_BUFS - HISTORY);
+
+    sn_transport_udp()->detach();
+    for (int i = 0; i < 100 && sn_pool_available(&s_pool) < POOL_BUFS; i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    SN_CHECK(sn_pool_available(&s_pool) == POOL_BUFS, "%u of %u buffers back after detach",
+             sn_pool_available(&s_pool), POOL_BUFS);
+
+    pthread_mutex_lock(&s_rx_lock);
+    s_rx.loss = 0;
+    pthread_mutex_unlock(&s_rx_lock);
+    for (int i = 0; i < 300 && after.gone - before.gone < 2; i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        pthread_mutex_lock(&s_rx_lock);
+        after = s_rx.stats;
+        pthread_mutex_unlock(&s_rx_lock);
+    }
+    SN_CHECK(after.gone - before.gone == 2 && after.frames == before.frames, "%u gone, %u delivered",
+             after.gone - before.gone, after.frames - before.frames);
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t thread;
+    char port[8];
+
+    sn_test_init(argc, argv);
+    s_seen = calloc(MAX_FRAMES, 1);
+    s_first_us = calloc(MAX_FRAMES, sizeof(double));
+    s_resent_us = calloc(MAX_FRAMES, sizeof(double));
+    s_rx.on_frame = on_frame;
+    SN_CHECK(sn_udp_rx_open(&s_rx, 0, NULL) == 0);
+    snprintf(port, sizeof(port), "%u", s_rx.port);
+    pthread_create(&thread, NULL, rx_thread, NULL);
+    pthread_detach(thread);
+
+    SN_CHECK(sn_pool_init(&s_pool, s_bufs, s_storage, POOL_BUFS, BUF_SIZE, SN_UDP_HEADER_LEN) == ESP_OK);
+    const sn_udp_config_t config = {
+        .host = "127.0.0.1",
+        .port = port,
+        .node_id = 3,
+        .pool = &s_pool,
+        .history = HISTORY,
+    };
+    SN_CHECK(sn_udp_start(&config) == ESP_OK);
+    for (int i = 0; i < 200 && !sn_transport_udp()->connected(); i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    run(0, 0, "udp max rate");
+    run(0.01, 1000, "udp 1% loss");
+    run(0.05, 1000, "udp 5% loss");
+    run(0.20, 1000, "udp 20% loss");
+    test_detach();
+    return sn_test_done("test_udp");
+}